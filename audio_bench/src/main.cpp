@@ -0,0 +1,862 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "real_fft.h"
+#include "audio_features.h"
+#include "audio_stream.h"
+#include "goertzel_bank.h"
+#include "octave_bands.h"
+
+#define BENCH_SAMPLE_RATE 16000.0
+#define BENCH_LOW_FREQUENCY 20.0
+#define BENCH_HIGH_FREQUENCY 4000.0
+#define BENCH_MAX_ERROR 1e-4 // Largest magnitude error relative to the strongest bin that still passes.
+#define BENCH_MAX_DB_ERROR 0.01
+
+typedef struct
+{
+  const char *name;
+  std::vector<int16_t> samples;
+} signal_t;
+
+typedef struct
+{
+  double peakFrequency;
+  double averageDb;
+} reference_features_t;
+
+static int16_t clip(double value)
+{
+  return (int16_t)fmax(-32768.0, fmin(32767.0, round(value)));
+}
+
+static std::vector<signal_t> makeSignals(uint16_t size, uint32_t seed)
+{
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  std::vector<signal_t> signals;
+  auto add = [&](const char *name, auto generator)
+  {
+    signal_t signal = {name, std::vector<int16_t>(size)};
+    for (uint16_t i = 0; i < size; i++)
+    {
+      signal.samples[i] = clip(generator(i / BENCH_SAMPLE_RATE));
+    }
+    signals.push_back(signal);
+  };
+  add("tone 440 Hz", [&](double t)
+      { return 8000 * sin(2 * M_PI * 440 * t); });
+  add("tone 1000 Hz + noise", [&](double t)
+      { return 4000 * sin(2 * M_PI * 1000 * t) + 500 * noise(random); });
+  add("quiet tone 3150 Hz", [&](double t)
+      { return 40 * sin(2 * M_PI * 3150 * t) + 2 * noise(random); });
+  add("two tones + DC", [&](double t)
+      { return 300 + 6000 * sin(2 * M_PI * 250 * t) + 9000 * sin(2 * M_PI * 2500 * t); });
+  add("clipped square 200 Hz", [&](double t)
+      { return sin(2 * M_PI * 200 * t) >= 0 ? 40000 : -40000; });
+  add("chirp 100-6000 Hz", [&](double t)
+      { return 10000 * sin(2 * M_PI * (100 * t + 0.5 * (5900 / (size / BENCH_SAMPLE_RATE)) * t * t)); });
+  add("white noise", [&](double)
+      { return 3000 * noise(random); });
+  return signals;
+}
+
+// The former node path: arduinoFFT<double> with a Hamming window, a complex FFT with a zeroed imaginary part
+static void referenceMagnitude(const int16_t *samples, uint16_t size, double *real)
+{
+  std::vector<double> imag(size, 0.0);
+  for (uint16_t i = 0; i < size; i++)
+  {
+    real[i] = samples[i];
+  }
+  for (uint16_t i = 0; i < size / 2; i++)
+  {
+    double weight = 0.54 - 0.46 * cos(2 * M_PI * i / (size - 1.0));
+    real[i] *= weight;
+    real[size - 1 - i] *= weight;
+  }
+  for (uint16_t i = 1, j = 0; i < size; i++)
+  {
+    uint16_t bit = size >> 1;
+    for (; j & bit; bit >>= 1)
+    {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j)
+    {
+      std::swap(real[i], real[j]);
+      std::swap(imag[i], imag[j]);
+    }
+  }
+  for (uint16_t length = 2; length <= size; length <<= 1)
+  {
+    for (uint16_t j = 0; j < length / 2; j++)
+    {
+      double c = cos(2 * M_PI * j / length);
+      double s = sin(2 * M_PI * j / length);
+      for (uint16_t i = j; i < size; i += length)
+      {
+        uint16_t k = i + length / 2;
+        double re = c * real[k] + s * imag[k];
+        double im = c * imag[k] - s * real[k];
+        real[k] = real[i] - re;
+        imag[k] = imag[i] - im;
+        real[i] += re;
+        imag[i] += im;
+      }
+    }
+  }
+  for (uint16_t i = 0; i < size; i++)
+  {
+    real[i] = sqrt(real[i] * real[i] + imag[i] * imag[i]);
+  }
+}
+
+static reference_features_t referenceFeatures(const double *magnitude, uint16_t size)
+{
+  reference_features_t features = {0, 0};
+  double maxMagnitude = 0;
+  double total = 0;
+  for (uint16_t i = 1; i < size / 2; i++)
+  {
+    double frequency = (i * BENCH_SAMPLE_RATE) / size;
+    if (frequency >= BENCH_LOW_FREQUENCY && frequency <= BENCH_HIGH_FREQUENCY && magnitude[i] > maxMagnitude)
+    {
+      maxMagnitude = magnitude[i];
+      features.peakFrequency = frequency;
+    }
+    total += magnitude[i];
+  }
+  features.averageDb = 20.0 * log10(total / (size / 2 - 1));
+  return features;
+}
+
+template <typename F>
+static double microsPerFrame(uint32_t iterations, F run)
+{
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++)
+  {
+    run();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+
+// The float path against the double reference, frame by frame
+static bool benchSpectrum(uint16_t size, uint32_t iterations, uint32_t seed)
+{
+  RealFFT fft;
+  if (!fft.init(size))
+  {
+    printf("invalid frame size %u\n", size);
+    return false;
+  }
+  std::vector<double> reference(size);
+  std::vector<float> frame(size);
+  bool pass = true;
+
+  printf("%-24s %12s %12s %10s %10s %10s\n", "signal", "max error", "peak Hz", "float Hz", "dB", "dB error");
+  for (const signal_t &signal : makeSignals(size, seed))
+  {
+    referenceMagnitude(signal.samples.data(), size, reference.data());
+    reference_features_t expected = referenceFeatures(reference.data(), size);
+
+    fft.window(signal.samples.data(), frame.data());
+    fft.forward(frame.data());
+    fft.magnitude(frame.data());
+    audio_spectrum_features_t actual = audioSpectrumFeatures(frame.data(), size / 2, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY);
+
+    double strongest = 0;
+    double error = 0;
+    for (uint16_t i = 0; i < size / 2; i++)
+    {
+      strongest = fmax(strongest, reference[i]);
+      error = fmax(error, fabs(reference[i] - frame[i]));
+    }
+    error /= strongest;
+    double dbError = fabs(expected.averageDb - actual.averageDb);
+    bool ok = error <= BENCH_MAX_ERROR && dbError <= BENCH_MAX_DB_ERROR && fabs(expected.peakFrequency - actual.peakFrequency) < 1e-3;
+    pass = pass && ok;
+    printf("%-24s %12.2e %12.1f %10.1f %10.2f %10.2e%s\n", signal.name, error, expected.peakFrequency, actual.peakFrequency, expected.averageDb, dbError, ok ? "" : "  <- FAIL");
+  }
+
+  // Timing covers window, transform and magnitudes, the part the node repeats per analysis
+  const std::vector<int16_t> &samples = makeSignals(size, seed)[1].samples;
+  volatile float sink = 0;
+  double referenceMicros = microsPerFrame(iterations, [&]()
+                                          { referenceMagnitude(samples.data(), size, reference.data());
+                                            sink = sink + (float)reference[1]; });
+  double floatMicros = microsPerFrame(iterations, [&]()
+                                      { fft.window(samples.data(), frame.data());
+                                        fft.forward(frame.data());
+                                        fft.magnitude(frame.data());
+                                        sink = sink + frame[1]; });
+  printf("\ndouble complex FFT %8.1f us/frame\nfloat real FFT     %8.1f us/frame (%.1fx)\n", referenceMicros, floatMicros, referenceMicros / floatMicros);
+  printf("memory: %u bytes tables + %u bytes frame (was %u bytes)\n", (unsigned)((size / 4 + 1) * sizeof(float) + size / 2 * sizeof(uint16_t)), (unsigned)(size * sizeof(float)), (unsigned)(2 * size * sizeof(double)));
+
+  return pass;
+}
+
+typedef struct
+{
+  uint32_t start;     // First sample.
+  uint32_t length;    // Samples.
+  float frequency;    // Tone frequency (in Hz).
+  bool detected;      // A window over it showed the tone.
+  bool detectedOld;   // A window of the former read-and-sleep loop showed the tone.
+} burst_t;
+
+typedef struct
+{
+  std::vector<burst_t> *bursts;
+  std::vector<audio_report_t> *reports;
+  std::vector<std::vector<float>> *shown; // Burst frequencies shown by the windows of each report.
+  const int16_t *audio;
+  const RealFFT *fft;
+  const OctaveBands *bands;
+  float *frame;
+  uint32_t mismatches; // Windows whose features or bands differ from analysing the same samples in one piece.
+  uint16_t size;
+  uint16_t hop;
+  uint32_t windows;
+  float thresholdDb;
+} stream_state_t;
+
+static bool showsBurst(const audio_spectrum_features_t *features, const burst_t &burst, uint16_t size, float thresholdDb)
+{
+  return features->averageDb >= thresholdDb && fabs(features->peakFrequency - burst.frequency) <= 2 * BENCH_SAMPLE_RATE / size;
+}
+
+static void onWindow(const audio_spectrum_features_t *features, const audio_time_features_t *time, const audio_bands_t *bands, void *arg)
+{
+  stream_state_t *state = (stream_state_t *)arg;
+  uint32_t start = state->windows++ * state->hop;
+  uint32_t end = start + state->size;
+  state->fft->window(state->audio + start, state->frame);
+  state->fft->forward(state->frame);
+  state->fft->magnitude(state->frame);
+  audio_spectrum_features_t direct = audioSpectrumFeatures(state->frame, state->size / 2, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY);
+  audio_bands_t directBands = {};
+  state->bands->measure(state->frame, &directBands);
+  if (memcmp(&direct, features, sizeof(direct)) != 0 || bands == NULL || memcmp(directBands.meanSquare, bands->meanSquare, sizeof(directBands.meanSquare)) != 0)
+  {
+    ++state->mismatches;
+  }
+  // A window counts for the second in which it completes, like a report taken by the sensor task
+  uint32_t second = (uint32_t)(end / BENCH_SAMPLE_RATE);
+  if (second >= state->reports->size())
+  {
+    state->reports->resize(second + 1, audio_report_t{});
+    state->shown->resize(second + 1);
+  }
+  audioReportAdd(&(*state->reports)[second], features, time, bands);
+  for (burst_t &burst : *state->bursts)
+  {
+    if (burst.start < end && burst.start + burst.length > start && showsBurst(features, burst, state->size, state->thresholdDb))
+    {
+      burst.detected = true;
+      (*state->shown)[second].push_back(burst.frequency);
+    }
+  }
+}
+
+// Tone bursts in noise, streamed like the I2S reads of the node, against the former read-and-sleep loop
+static bool benchStream(uint16_t size, uint32_t seconds, uint32_t seed)
+{
+  const uint16_t hop = size / 2;
+  const uint32_t oldSleep = (uint32_t)(0.2 * BENCH_SAMPLE_RATE);
+  const uint32_t burstLength = (uint32_t)(0.04 * BENCH_SAMPLE_RATE);
+  const float frequencies[] = {500, 1000, 2000, 3150};
+
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, 50.0);
+  std::vector<int16_t> audio(seconds * (uint32_t)BENCH_SAMPLE_RATE);
+  for (int16_t &sample : audio)
+  {
+    sample = clip(noise(random));
+  }
+  // One burst per second at a random offset
+  std::vector<burst_t> bursts;
+  for (uint32_t second = 0; second < seconds; second++)
+  {
+    burst_t burst = {
+        .start = second * (uint32_t)BENCH_SAMPLE_RATE + (uint32_t)(random() % (uint32_t)(BENCH_SAMPLE_RATE - burstLength)),
+        .length = burstLength,
+        .frequency = frequencies[second % 4],
+        .detected = false,
+        .detectedOld = false};
+    for (uint32_t i = 0; i < burst.length; i++)
+    {
+      audio[burst.start + i] = clip(audio[burst.start + i] + 6000 * sin(2 * M_PI * burst.frequency * i / BENCH_SAMPLE_RATE));
+    }
+    bursts.push_back(burst);
+  }
+
+  RealFFT fft;
+  std::vector<float> frame(size);
+  fft.init(size);
+  // Level of plain noise, a burst has to show 6 dB above it
+  std::vector<int16_t> quiet(size);
+  for (int16_t &sample : quiet)
+  {
+    sample = clip(noise(random));
+  }
+  fft.window(quiet.data(), frame.data());
+  fft.forward(frame.data());
+  fft.magnitude(frame.data());
+  float thresholdDb = audioSpectrumFeatures(frame.data(), size / 2, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY).averageDb + 6;
+
+  // Former loop: one window, then 200 ms of audio were never read
+  uint32_t oldWindows = 0;
+  uint64_t oldCovered = 0;
+  for (uint32_t start = 0; start + size <= audio.size(); start += size + oldSleep)
+  {
+    fft.window(audio.data() + start, frame.data());
+    fft.forward(frame.data());
+    fft.magnitude(frame.data());
+    audio_spectrum_features_t features = audioSpectrumFeatures(frame.data(), size / 2, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY);
+    for (burst_t &burst : bursts)
+    {
+      if (burst.start < start + size && burst.start + burst.length > start && showsBurst(&features, burst, size, thresholdDb))
+      {
+        burst.detectedOld = true;
+      }
+    }
+    ++oldWindows;
+    oldCovered += size;
+  }
+
+  AudioStream stream;
+  if (!stream.init(size, hop, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY) || !stream.initBands(3, true))
+  {
+    printf("invalid frame size %u\n", size);
+    return false;
+  }
+  std::vector<audio_report_t> reports;
+  std::vector<std::vector<float>> shown;
+  stream_state_t state = {
+      .bursts = &bursts,
+      .reports = &reports,
+      .shown = &shown,
+      .audio = audio.data(),
+      .fft = &fft,
+      .bands = &stream.bands(),
+      .frame = frame.data(),
+      .mismatches = 0,
+      .size = size,
+      .hop = hop,
+      .windows = 0,
+      .thresholdDb = thresholdDb};
+  // Read straight into the window buffer like the node, a hop per read
+  for (size_t offset = 0; offset < audio.size();)
+  {
+    size_t space = 0;
+    int16_t *tail = stream.reserve(&space);
+    size_t count = std::min(space, audio.size() - offset);
+    memcpy(tail, audio.data() + offset, count * sizeof(int16_t));
+    stream.commit(count, onWindow, &state);
+    offset += count;
+  }
+  // Timed again without the checks in the callback
+  AudioStream timed;
+  timed.init(size, hop, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY);
+  timed.initBands(3, true);
+  auto begin = std::chrono::steady_clock::now();
+  timed.push(audio.data(), audio.size(), NULL, NULL);
+  double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+
+  uint32_t detected = 0;
+  uint32_t detectedOld = 0;
+  for (const burst_t &burst : bursts)
+  {
+    detected += burst.detected;
+    detectedOld += burst.detectedOld;
+  }
+  // Only the loudest window of a report decides its peak, so a report whose windows showed bursts has to report one of them
+  uint32_t reportsWithBurst = 0;
+  uint32_t reportsShowingBurst = 0;
+  for (size_t i = 0; i < reports.size(); i++)
+  {
+    if (shown[i].empty())
+    {
+      continue;
+    }
+    ++reportsWithBurst;
+    if (reports[i].bands.blocks != reports[i].windows)
+    {
+      continue;
+    }
+    for (float frequency : shown[i])
+    {
+      if (fabs(reports[i].peakFrequency - frequency) <= 2 * BENCH_SAMPLE_RATE / size)
+      {
+        ++reportsShowingBurst;
+        break;
+      }
+    }
+  }
+  double coverage = (double)((stream.windows() - 1) * hop + size) / audio.size();
+  double oldCoverage = (double)oldCovered / audio.size();
+  double windowMicros = micros / timed.windows();
+  bool pass = detected == bursts.size() && reportsShowingBurst == reportsWithBurst && state.mismatches == 0;
+
+  printf("%-24s %10s %10s %10s\n", "stream", "windows", "coverage", "bursts");
+  printf("%-24s %10u %9.1f%% %6u/%-3u\n", "read and sleep 200 ms", oldWindows, 100 * oldCoverage, detectedOld, (unsigned)bursts.size());
+  printf("%-24s %10u %9.1f%% %6u/%-3u\n", "50 % overlap", stream.windows(), 100 * coverage, detected, (unsigned)bursts.size());
+  printf("1 s reports with their burst as peak: %u/%u\n", reportsShowingBurst, reportsWithBurst);
+  printf("windows differing from a one piece analysis: %u\n", state.mismatches);
+  printf("%.1f us per window, %.2f %% of the %.0f ms between two windows (host)\n", windowMicros, 100 * windowMicros / (hop / BENCH_SAMPLE_RATE * 1e6), hop / BENCH_SAMPLE_RATE * 1e3);
+  return pass;
+}
+
+typedef struct
+{
+  const char *name;
+  std::vector<int16_t> samples;
+  double amplitude; // Of the sine, 0 if the signal has no analytic level.
+  double frequency; // Of the sine (in Hz).
+  double offset;    // DC offset.
+} time_signal_t;
+
+// The three loops a straightforward implementation would use, in double
+static void referenceTime(const std::vector<int16_t> &samples, int16_t centre, audio_time_features_t *features)
+{
+  double sum = 0;
+  double energy = 0;
+  for (int16_t sample : samples)
+  {
+    sum += sample;
+    energy += (double)sample * sample;
+  }
+  uint16_t peak = 0;
+  for (int16_t sample : samples)
+  {
+    peak = std::max(peak, (uint16_t)abs(sample));
+  }
+  uint32_t crossings = 0;
+  for (size_t i = 1; i < samples.size(); i++)
+  {
+    crossings += (samples[i - 1] >= centre) != (samples[i] >= centre);
+  }
+  *features = {};
+  features->count = samples.size();
+  features->sum = (int64_t)sum;
+  features->energy = (uint64_t)energy;
+  features->zeroCrossings = crossings;
+  features->peak = peak;
+}
+
+// The fused kernel against the three loops, and against the analytic values of sines
+static bool benchTime(uint32_t iterations, uint32_t seed)
+{
+  const uint32_t length = (uint32_t)BENCH_SAMPLE_RATE;
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  std::vector<time_signal_t> signals;
+  auto add = [&](const char *name, double amplitude, double frequency, double offset, double noiseLevel)
+  {
+    time_signal_t signal = {name, std::vector<int16_t>(length), amplitude, frequency, offset};
+    for (uint32_t i = 0; i < length; i++)
+    {
+      signal.samples[i] = clip(offset + amplitude * sin(2 * M_PI * frequency * i / BENCH_SAMPLE_RATE + 0.1) + noiseLevel * noise(random));
+    }
+    signals.push_back(signal);
+  };
+  add("sine 1000 Hz", 10000, 1000, 0, 0);
+  add("sine 440 Hz + DC", 3000, 440, 500, 0);
+  add("quiet sine 3150 Hz + DC", 20, 3150, -200, 0);
+  add("full scale sine 50 Hz", 32767, 50, 0, 0);
+  add("noise + DC", 0, 0, 1000, 2000);
+  add("silence", 0, 0, 0, 0);
+
+  bool pass = true;
+  printf("%-24s %10s %10s %10s %8s %8s %s\n", "time domain", "level dB", "expected", "crossings", "peak", "DC", "");
+  for (const time_signal_t &signal : signals)
+  {
+    int16_t centre = (int16_t)lround(signal.offset);
+    audio_time_features_t expected;
+    referenceTime(signal.samples, centre, &expected);
+
+    audio_time_features_t whole = {};
+    audioTimeFeatures(signal.samples.data(), signal.samples.size(), centre, &whole);
+
+    // Ragged chunks with clears in between, merged into a report, must give the same totals
+    audio_time_features_t chunk = {};
+    audio_time_features_t merged = {};
+    for (size_t offset = 0; offset < signal.samples.size();)
+    {
+      size_t count = std::min((size_t)(1 + random() % 700), signal.samples.size() - offset);
+      audioTimeFeatures(signal.samples.data() + offset, count, centre, &chunk);
+      audioTimeMerge(&merged, &chunk);
+      audioTimeClear(&chunk);
+      offset += count;
+    }
+
+    bool exact = whole.count == expected.count && whole.sum == expected.sum && whole.energy == expected.energy &&
+                 whole.zeroCrossings == expected.zeroCrossings && whole.peak == expected.peak &&
+                 merged.sum == whole.sum && merged.energy == whole.energy && merged.zeroCrossings == whole.zeroCrossings && merged.peak == whole.peak;
+    double level = audioTimeLevelDb(&whole);
+    double analytic = signal.amplitude > 0 ? 20 * log10(signal.amplitude / sqrt(2.0)) : NAN;
+    bool ok = exact;
+    if (signal.amplitude > 0)
+    {
+      // Rounding to int16_t adds about 1/12 LSB^2 of noise, which only shows on the quiet sine
+      ok = ok && fabs(level - analytic) < (signal.amplitude < 100 ? 0.1 : 0.01);
+      ok = ok && fabs(audioTimeCrossingRate(&whole, BENCH_SAMPLE_RATE) - 2 * signal.frequency) <= 2;
+      ok = ok && fabs(audioTimeDcOffset(&whole) - signal.offset) < 1;
+    }
+    pass = pass && ok;
+    char expectedLevel[16] = "-";
+    if (signal.amplitude > 0)
+    {
+      snprintf(expectedLevel, sizeof(expectedLevel), "%.2f", analytic);
+    }
+    printf("%-24s %10.2f %10s %10u %8u %8.1f%s\n", signal.name, level, expectedLevel, whole.zeroCrossings, whole.peak, audioTimeDcOffset(&whole), ok ? "" : "  <- FAIL");
+  }
+
+  const std::vector<int16_t> &samples = signals[4].samples;
+  volatile uint32_t sink = 0;
+  double referenceMicros = microsPerFrame(iterations, [&]()
+                                          { audio_time_features_t features;
+                                            referenceTime(samples, 1000, &features);
+                                            sink = sink + features.zeroCrossings; });
+  double fusedMicros = microsPerFrame(iterations, [&]()
+                                      { audio_time_features_t features = {};
+                                        audioTimeFeatures(samples.data(), samples.size(), 1000, &features);
+                                        sink = sink + features.zeroCrossings; });
+  printf("\nthree loops        %8.1f us/s of audio\nfused kernel       %8.1f us/s of audio (%.1fx)\n", referenceMicros, fusedMicros, referenceMicros / fusedMicros);
+  return pass;
+}
+
+static void onBlock(const float *meanSquare, uint8_t bands, void *arg)
+{
+  audioBandsAdd((audio_bands_t *)arg, meanSquare, bands);
+}
+
+// The Goertzel mode of the node: band levels of sines against their analytic values, and its cost against AudioStream
+static bool benchGoertzel(uint16_t size, uint32_t iterations, uint32_t seed)
+{
+  const float frequencies[] = {500, 1000, 3150};
+  const uint8_t bands = sizeof(frequencies) / sizeof(frequencies[0]);
+  const uint16_t blockSize = 512; // As in Microphone.cpp
+  const uint32_t length = (uint32_t)BENCH_SAMPLE_RATE;
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+
+  bool pass = true;
+  printf("%-24s", "goertzel dB");
+  for (float frequency : frequencies)
+  {
+    printf(" %8.0f Hz", frequency);
+  }
+  printf(" %10s\n", "expected");
+  const struct
+  {
+    const char *name;
+    double frequency; // Of the sine, none of the bands if not in frequencies.
+    double amplitude;
+  } tones[] = {{"sine 500 Hz", 500, 10000}, {"sine 1000 Hz + noise", 1000, 3000}, {"quiet sine 3150 Hz", 3150, 30}, {"sine 2000 Hz (off band)", 2000, 10000}};
+  std::vector<int16_t> samples(length);
+  for (const auto &tone : tones)
+  {
+    double noiseLevel = strstr(tone.name, "noise") != NULL ? 100 : 0;
+    for (uint32_t i = 0; i < length; i++)
+    {
+      samples[i] = clip(tone.amplitude * sin(2 * M_PI * tone.frequency * i / BENCH_SAMPLE_RATE + 0.3) + noiseLevel * noise(random));
+    }
+    GoertzelBank bank;
+    if (!bank.init(frequencies, bands, BENCH_SAMPLE_RATE, blockSize))
+    {
+      printf("GoertzelBank::init failed\n");
+      return false;
+    }
+    audio_bands_t whole = {};
+    bank.process(samples.data(), samples.size(), onBlock, &whole);
+
+    // Ragged chunks must continue the blocks exactly
+    audio_bands_t ragged = {};
+    bank.deinit();
+    bank.init(frequencies, bands, BENCH_SAMPLE_RATE, blockSize);
+    for (size_t offset = 0; offset < samples.size();)
+    {
+      size_t count = std::min((size_t)(1 + random() % 700), samples.size() - offset);
+      bank.process(samples.data() + offset, count, onBlock, &ragged);
+      offset += count;
+    }
+
+    uint8_t levels[AUDIO_MAX_BANDS];
+    bool ok = whole.blocks == length / blockSize && audioBandsQuantise(&whole, levels, AUDIO_MAX_BANDS) == bands &&
+              memcmp(whole.meanSquare, ragged.meanSquare, sizeof(whole.meanSquare)) == 0 && ragged.blocks == whole.blocks;
+    double analytic = 20 * log10(tone.amplitude / sqrt(2.0));
+    printf("%-24s", tone.name);
+    for (uint8_t i = 0; i < bands; i++)
+    {
+      double level = 10 * log10(std::max(whole.meanSquare[i] / whole.blocks, 1e-3f));
+      if (frequencies[i] == tone.frequency)
+      {
+        // The quantised level must agree too, it is what goes on air
+        ok = ok && fabs(level - analytic) < 0.1 && abs(levels[i] - (int)lround(2 * analytic)) <= 1;
+      }
+      else
+      {
+        ok = ok && level < analytic - 40; // Sidelobes of the Hann window and the noise floor
+      }
+      printf(" %11.2f", level);
+    }
+    printf(" %10.2f%s\n", analytic, ok ? "" : "  <- FAIL");
+    pass = pass && ok;
+  }
+
+  GoertzelBank bank;
+  AudioStream stream;
+  if (!bank.init(frequencies, bands, BENCH_SAMPLE_RATE, blockSize) || !stream.init(size, size / 2, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY))
+  {
+    printf("init failed\n");
+    return false;
+  }
+  volatile uint32_t sink = 0;
+  double streamMicros = microsPerFrame(iterations / 10 + 1, [&]()
+                                       { sink = sink + stream.push(samples.data(), samples.size(), NULL, NULL); });
+  double goertzelMicros = microsPerFrame(iterations / 10 + 1, [&]()
+                                         { audio_time_features_t features = {};
+                                           sink = sink + bank.process(samples.data(), samples.size(), NULL, NULL);
+                                           audioTimeFeatures(samples.data(), samples.size(), 0, &features); });
+  printf("\nAudioStream %-6u %8.1f us/s of audio\nGoertzel %u bands  %8.1f us/s of audio (%.1fx)\n", size, streamMicros, bands, goertzelMicros, streamMicros / goertzelMicros);
+  return pass;
+}
+
+static void onReport(const audio_spectrum_features_t *spectrum, const audio_time_features_t *time, const audio_bands_t *bands, void *arg)
+{
+  audioReportAdd((audio_report_t *)arg, spectrum, time, bands);
+}
+
+// A-weighting at the usual table frequencies of IEC 61672
+static double tableAWeighting(double frequency)
+{
+  const double table[][2] = {{63, -26.2}, {100, -19.1}, {1000, 0.0}, {3150, 1.2}};
+  for (const auto &entry : table)
+  {
+    if (fabs(frequency / entry[0] - 1) < 0.03)
+    {
+      return entry[1];
+    }
+  }
+  return NAN;
+}
+
+// A-weighting of IEC 61672 from its analytic form, for the bands the table does not list
+static double formulaAWeighting(double frequency)
+{
+  double f2 = frequency * frequency;
+  double ra = 12194.0 * 12194.0 * f2 * f2 /
+              ((f2 + 20.6 * 20.6) * sqrt((f2 + 107.7 * 107.7) * (f2 + 737.9 * 737.9)) * (f2 + 12194.0 * 12194.0));
+  return 20 * log10(ra) + 2.0;
+}
+
+// Octave band levels of one second of AudioStream windows against the analytic levels of sines and white noise
+static bool benchOctave(uint16_t size, uint32_t iterations, uint32_t seed)
+{
+  const uint32_t length = (uint32_t)BENCH_SAMPLE_RATE;
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  const struct
+  {
+    const char *name;
+    double frequency; // Of the sine, 0 for noise.
+    double amplitude; // Of the sine, standard deviation of the noise.
+  } signals[] = {{"sine 1000 Hz", 1000, 10000}, {"sine 100 Hz", 100, 10000}, {"quiet sine 3150 Hz", 3150, 30}, {"white noise", 0, 1000}};
+  const struct
+  {
+    const char *name;
+    uint8_t fraction;
+    bool aWeighting;
+  } configs[] = {{"1/1 octave", 1, false}, {"1/3 octave", 3, false}, {"1/3 octave A", 3, true}};
+
+  bool pass = true;
+  printf("%-20s %-14s %8s %10s %10s %10s\n", "octave bands", "", "band Hz", "level dB", "expected", "others dB");
+  std::vector<int16_t> samples(length);
+  for (const auto &signal : signals)
+  {
+    for (uint32_t i = 0; i < length; i++)
+    {
+      samples[i] = clip(signal.frequency > 0 ? signal.amplitude * sin(2 * M_PI * signal.frequency * i / BENCH_SAMPLE_RATE + 0.7) : signal.amplitude * noise(random));
+    }
+    for (const auto &config : configs)
+    {
+      AudioStream stream;
+      if (!stream.init(size, size / 2, BENCH_SAMPLE_RATE, BENCH_LOW_FREQUENCY, BENCH_HIGH_FREQUENCY) || !stream.initBands(config.fraction, config.aWeighting))
+      {
+        printf("invalid frame size %u\n", size);
+        return false;
+      }
+      audio_report_t report = {};
+      stream.push(samples.data(), samples.size(), onReport, &report);
+      const OctaveBands &bands = stream.bands();
+      uint8_t levels[AUDIO_MAX_BANDS];
+      uint8_t count = audioBandsQuantise(&report.bands, levels, AUDIO_MAX_BANDS);
+      // At 16 kHz: 63 Hz to 4 kHz octaves, 50 Hz to 6.3 kHz third octaves
+      bool ok = report.bands.blocks == report.windows && count == bands.bands() && count == (config.fraction == 1 ? 7 : 22);
+
+      std::vector<double> level(count);
+      for (uint8_t i = 0; i < count; i++)
+      {
+        level[i] = 10 * log10(std::max(report.bands.meanSquare[i] / report.bands.blocks, 1e-3f));
+      }
+      const double halfBand = pow(10.0, 3.0 / config.fraction / 20.0);
+      int band = -1;
+      double expected = NAN;
+      double measured = NAN;
+      double others = -INFINITY;
+      if (signal.frequency > 0)
+      {
+        for (uint8_t i = 0; i < count; i++)
+        {
+          double centre = bands.frequency(i);
+          if (signal.frequency >= centre / halfBand && signal.frequency < centre * halfBand)
+          {
+            band = i;
+          }
+        }
+        if (band < 0)
+        {
+          printf("%s outside the bands\n", signal.name);
+          return false;
+        }
+        expected = 20 * log10(signal.amplitude / sqrt(2.0)) + (config.aWeighting ? tableAWeighting(bands.frequency(band)) : 0);
+        measured = level[band];
+        for (uint8_t i = 0; i < count; i++)
+        {
+          others = i == band ? others : std::max(others, level[i] - measured);
+        }
+        // The table rounds to 0.1 dB. The Hamming main lobe reaches 2 bins to either side, a sine closer to a band
+        // edge spills into the neighbour, then only the sum of all bands has to keep its power.
+        double centre = bands.frequency(band);
+        double edgeBins = std::min(signal.frequency - centre / halfBand, centre * halfBand - signal.frequency) / (BENCH_SAMPLE_RATE / size);
+        if (edgeBins >= 2)
+        {
+          ok = ok && fabs(measured - expected) < 0.2 && abs(levels[band] - (int)lround(2 * expected)) <= 1 && others < -20;
+        }
+        else if (!config.aWeighting)
+        {
+          double total = 0;
+          for (uint8_t i = 0; i < count; i++)
+          {
+            total += report.bands.meanSquare[i] / report.bands.blocks;
+          }
+          ok = ok && fabs(10 * log10(total) - expected) < 0.2;
+        }
+      }
+      else
+      {
+        // White noise spreads its variance evenly up to the Nyquist frequency, each band gets its share of it
+        // weighted at its centre frequency
+        double total = 0;
+        double power = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+          total += report.bands.meanSquare[i] / report.bands.blocks;
+          double centre = bands.frequency(i);
+          double share = (centre * halfBand - centre / halfBand) / (BENCH_SAMPLE_RATE / 2);
+          power += signal.amplitude * signal.amplitude * share * (config.aWeighting ? pow(10.0, formulaAWeighting(centre) / 10) : 1);
+        }
+        measured = 10 * log10(total);
+        expected = 10 * log10(power);
+        ok = ok && fabs(measured - expected) < 0.15; // Tighter than the 0.34 dB the A-weighting adds to white noise here.
+      }
+      pass = pass && ok;
+      char bandName[16] = "all";
+      char othersLevel[16] = "-";
+      if (band >= 0)
+      {
+        snprintf(bandName, sizeof(bandName), "%.0f", bands.frequency(band));
+        snprintf(othersLevel, sizeof(othersLevel), "%.1f", others);
+      }
+      printf("%-20s %-14s %8s %10.2f %10.2f %10s%s\n", signal.name, config.name, bandName, measured, expected, othersLevel, ok ? "" : "  <- FAIL");
+    }
+  }
+
+  RealFFT fft;
+  OctaveBands bands;
+  fft.init(size);
+  bands.init(3, size, BENCH_SAMPLE_RATE, true);
+  std::vector<float> frame(size);
+  volatile float sink = 0;
+  double fftMicros = microsPerFrame(iterations, [&]()
+                                    { fft.window(samples.data(), frame.data());
+                                      fft.forward(frame.data());
+                                      fft.magnitude(frame.data());
+                                      sink = sink + frame[1]; });
+  double bandsMicros = microsPerFrame(iterations, [&]()
+                                      { audio_bands_t result;
+                                        bands.measure(frame.data(), &result);
+                                        sink = sink + result.meanSquare[0]; });
+  printf("\nRealFFT %-6u       %8.1f us/frame\n1/3 octave bands     %8.1f us/frame (%.1f %%)\n", size, fftMicros, bandsMicros, 100 * bandsMicros / fftMicros);
+  return pass;
+}
+
+static void usage(const char *name)
+{
+  printf("Usage: %s [options]\n"
+         "  --size N          samples per frame, power of two (2048)\n"
+         "  --iterations N    frames per timing run (500)\n"
+         "  --seconds N       length of the streamed signal (30)\n"
+         "  --seed N          noise seed (1)\n",
+         name);
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t size = 2048;
+  uint32_t iterations = 500;
+  uint32_t seconds = 30;
+  uint32_t seed = 1;
+
+  static const struct option options[] = {
+      {"size", required_argument, NULL, 'n'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"seconds", required_argument, NULL, 'S'},
+      {"seed", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      size = (uint16_t)atoi(optarg);
+      break;
+    case 'i':
+      iterations = (uint32_t)atoi(optarg);
+      break;
+    case 'S':
+      seconds = (uint32_t)atoi(optarg);
+      break;
+    case 's':
+      seed = (uint32_t)atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return option == 'h' ? 0 : 2;
+    }
+  }
+
+  bool pass = benchSpectrum(size, iterations, seed);
+  printf("\n");
+  pass = benchTime(iterations, seed) && pass;
+  printf("\n");
+  pass = benchStream(size, seconds, seed) && pass;
+  printf("\n");
+  pass = benchGoertzel(size, iterations, seed) && pass;
+  printf("\n");
+  pass = benchOctave(size, iterations, seed) && pass;
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
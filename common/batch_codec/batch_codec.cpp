@@ -0,0 +1,278 @@
+#include "batch_codec.h"
+#include "string.h"
+#include "math.h"
+
+static inline size_t _put_varint(uint8_t *out, uint64_t value)
+{
+  size_t size = 0;
+  while (value >= 0x80)
+  {
+    out[size++] = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  out[size++] = (uint8_t)value;
+  return size;
+}
+
+static inline size_t _put_signed(uint8_t *out, int64_t value)
+{
+  return _put_varint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static inline size_t _get_varint(const uint8_t *in, size_t length, uint64_t &value)
+{
+  value = 0;
+  for (size_t i = 0; i < length && i < 10; ++i)
+  {
+    value |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+    if ((in[i] & 0x80) == 0)
+    {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+static inline size_t _get_signed(const uint8_t *in, size_t length, int64_t &value)
+{
+  uint64_t raw;
+  size_t size = _get_varint(in, length, raw);
+  value = (int64_t)(raw >> 1) ^ -(int64_t)(raw & 1);
+  return size;
+}
+
+static inline int32_t _quantise(float angle)
+{
+  float scaled = angle * BATCH_CODEC_ANGLE_SCALE;
+  if (scaled != scaled)
+  {
+    return 0;
+  }
+  if (scaled > 2e9f)
+  {
+    scaled = 2e9f;
+  }
+  else if (scaled < -2e9f)
+  {
+    scaled = -2e9f;
+  }
+  return (int32_t)lrintf(scaled);
+}
+
+void batchCodecFromMessage(const uint8_t *message, batch_codec_record_t &record)
+{
+  uint32_t type;
+  memcpy(&type, message + BATCH_CODEC_OFFSET_TYPE, sizeof(type));
+  record = {};
+  record.type = (uint8_t)type;
+  record.id = message[BATCH_CODEC_OFFSET_ID];
+  memcpy(&record.timestamp, message + BATCH_CODEC_OFFSET_TIMESTAMP, sizeof(record.timestamp));
+  memcpy(&record.timestamp_us, message + BATCH_CODEC_OFFSET_TIMESTAMP + 4, sizeof(record.timestamp_us));
+  if (type != BATCH_CODEC_TYPE_DATA)
+  {
+    return;
+  }
+  memcpy(&record.avg_db, message + BATCH_CODEC_OFFSET_MICROPHONE, sizeof(record.avg_db));
+  memcpy(&record.peak_frequency, message + BATCH_CODEC_OFFSET_MICROPHONE + 2, sizeof(record.peak_frequency));
+  memcpy(&record.zero_crossings, message + BATCH_CODEC_OFFSET_MICROPHONE + 4, sizeof(record.zero_crossings));
+  memcpy(&record.roll, message + BATCH_CODEC_OFFSET_ANGLES, sizeof(record.roll));
+  memcpy(&record.pitch, message + BATCH_CODEC_OFFSET_ANGLES + 4, sizeof(record.pitch));
+  memcpy(&record.yaw, message + BATCH_CODEC_OFFSET_ANGLES + 8, sizeof(record.yaw));
+  record.ble_count = BATCH_CODEC_MAX_BLE;
+  memcpy(record.ble, message + BATCH_CODEC_OFFSET_BLE, sizeof(record.ble));
+  record.band_mode = message[BATCH_CODEC_OFFSET_BANDS];
+  record.band_count = message[BATCH_CODEC_OFFSET_BANDS + 1];
+  memcpy(record.bands, message + BATCH_CODEC_OFFSET_BANDS + 2, sizeof(record.bands));
+}
+
+void BatchCodecState::begin()
+{
+  _first = true;
+  _time = 0;
+  _nodes_count = 0;
+}
+
+batch_codec_node_t *BatchCodecState::_node(uint8_t id)
+{
+  for (uint8_t i = 0; i < _nodes_count; ++i)
+  {
+    if (_nodes[i].id == id)
+    {
+      return &_nodes[i];
+    }
+  }
+  if (_nodes_count == BATCH_CODEC_MAX_NODES)
+  {
+    return NULL;
+  }
+  batch_codec_node_t *node = &_nodes[_nodes_count++];
+  memset(node, 0, sizeof(*node));
+  node->id = id;
+  return node;
+}
+
+size_t BatchEncoder::encode(const batch_codec_record_t &record, uint8_t *out, size_t capacity)
+{
+  if (capacity < BATCH_CODEC_MAX_RECORD_SIZE)
+  {
+    return 0;
+  }
+  size_t size = _put_varint(out, record.type);
+  out[size++] = record.id;
+  uint64_t time = (uint64_t)record.timestamp * 1000000 + record.timestamp_us;
+  if (_first)
+  {
+    size += _put_varint(out + size, record.timestamp);
+    size += _put_varint(out + size, record.timestamp_us);
+    _first = false;
+  }
+  else
+  {
+    size += _put_signed(out + size, (int64_t)(time - _time));
+  }
+  _time = time;
+  if (record.type != BATCH_CODEC_TYPE_DATA)
+  {
+    return size;
+  }
+  batch_codec_node_t absolute = {};
+  batch_codec_node_t *node = _node(record.id);
+  if (node == NULL)
+  {
+    node = &absolute;
+  }
+  const uint16_t microphone[3] = {record.avg_db, record.peak_frequency, record.zero_crossings};
+  for (uint8_t i = 0; i < 3; ++i)
+  {
+    size += _put_signed(out + size, (int32_t)microphone[i] - node->microphone[i]);
+    node->microphone[i] = microphone[i];
+  }
+  const int32_t angles[3] = {_quantise(record.roll), _quantise(record.pitch), _quantise(record.yaw)};
+  for (uint8_t i = 0; i < 3; ++i)
+  {
+    size += _put_signed(out + size, (int64_t)angles[i] - node->angles[i]);
+    node->angles[i] = angles[i];
+  }
+  uint8_t count = record.ble_count > BATCH_CODEC_MAX_BLE ? BATCH_CODEC_MAX_BLE : record.ble_count;
+  while (count > 0 && record.ble[count - 1].device_name == 0 && record.ble[count - 1].rssi == 0)
+  {
+    --count;
+  }
+  out[size++] = count;
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    out[size++] = record.ble[i].device_name;
+    out[size++] = record.ble[i].rssi;
+  }
+  out[size++] = record.band_mode;
+  if (record.band_mode == 0)
+  {
+    return size;
+  }
+  count = record.band_count > BATCH_CODEC_MAX_BANDS ? BATCH_CODEC_MAX_BANDS : record.band_count;
+  out[size++] = count;
+  memcpy(out + size, record.bands, count);
+  return size + count;
+}
+
+size_t BatchDecoder::decode(const uint8_t *in, size_t length, batch_codec_record_t &record)
+{
+  memset(&record, 0, sizeof(record));
+  uint64_t value;
+  int64_t delta;
+  size_t used;
+  size_t size = _get_varint(in, length, value);
+  if (size == 0 || size >= length || value > UINT8_MAX)
+  {
+    return 0;
+  }
+  record.type = (uint8_t)value;
+  record.id = in[size++];
+  if (_first)
+  {
+    uint64_t microseconds;
+    if ((used = _get_varint(in + size, length - size, value)) == 0)
+    {
+      return 0;
+    }
+    size += used;
+    if ((used = _get_varint(in + size, length - size, microseconds)) == 0)
+    {
+      return 0;
+    }
+    size += used;
+    _time = value * 1000000 + microseconds;
+    _first = false;
+  }
+  else
+  {
+    if ((used = _get_signed(in + size, length - size, delta)) == 0)
+    {
+      return 0;
+    }
+    size += used;
+    _time += delta;
+  }
+  record.timestamp = (uint32_t)(_time / 1000000);
+  record.timestamp_us = (uint32_t)(_time % 1000000);
+  if (record.type != BATCH_CODEC_TYPE_DATA)
+  {
+    return size;
+  }
+  batch_codec_node_t absolute = {};
+  batch_codec_node_t *node = _node(record.id);
+  if (node == NULL)
+  {
+    node = &absolute;
+  }
+  for (uint8_t i = 0; i < 3; ++i)
+  {
+    if ((used = _get_signed(in + size, length - size, delta)) == 0)
+    {
+      return 0;
+    }
+    size += used;
+    node->microphone[i] = (uint16_t)(node->microphone[i] + delta);
+  }
+  for (uint8_t i = 0; i < 3; ++i)
+  {
+    if ((used = _get_signed(in + size, length - size, delta)) == 0)
+    {
+      return 0;
+    }
+    size += used;
+    node->angles[i] = (int32_t)(node->angles[i] + delta);
+  }
+  record.avg_db = node->microphone[0];
+  record.peak_frequency = node->microphone[1];
+  record.zero_crossings = node->microphone[2];
+  record.roll = (float)node->angles[0] / BATCH_CODEC_ANGLE_SCALE;
+  record.pitch = (float)node->angles[1] / BATCH_CODEC_ANGLE_SCALE;
+  record.yaw = (float)node->angles[2] / BATCH_CODEC_ANGLE_SCALE;
+  if (size >= length || in[size] > BATCH_CODEC_MAX_BLE || size + 1 + 2 * in[size] > length)
+  {
+    return 0;
+  }
+  record.ble_count = in[size++];
+  for (uint8_t i = 0; i < record.ble_count; ++i)
+  {
+    record.ble[i].device_name = in[size++];
+    record.ble[i].rssi = in[size++];
+  }
+  if (size >= length)
+  {
+    return 0;
+  }
+  record.band_mode = in[size++];
+  if (record.band_mode == 0)
+  {
+    return size;
+  }
+  if (size >= length || in[size] > BATCH_CODEC_MAX_BANDS || size + 1 + in[size] > length)
+  {
+    return 0;
+  }
+  record.band_count = in[size++];
+  memcpy(record.bands, in + size, record.band_count);
+  return size + record.band_count;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define BATCH_CODEC_MAX_BLE 10         // Entries of OutputData::bleData.
+#define BATCH_CODEC_MAX_NODES 16       // Nodes per batch whose fields are delta coded, further nodes are coded absolute.
+#define BATCH_CODEC_ANGLE_SCALE 100    // Angles are quantised to 1/BATCH_CODEC_ANGLE_SCALE degree.
+#define BATCH_CODEC_MAX_BANDS 22       // Entries of AudioBands::level.
+#define BATCH_CODEC_MAX_RECORD_SIZE 96 // Upper bound of a single encoded record.
+#define BATCH_CODEC_MIN_RECORD_SIZE 3  // Smallest encoded record (type, id and a one byte time delta), bounds count by length.
+#define BATCH_CODEC_TYPE_DATA 5        // message_type_t DATA, the only type that carries OutputData.
+#define BATCH_CODEC_MESSAGE_SIZE 80    // sizeof(message_t) on the ESP32, the input of batchCodecFromMessage().
+
+// Offsets of the fields batchCodecFromMessage() reads from a message_t (data_packaging.h), little endian
+#define BATCH_CODEC_OFFSET_TYPE 0        // uint32_t message_type_t.
+#define BATCH_CODEC_OFFSET_ID 4          // uint8_t.
+#define BATCH_CODEC_OFFSET_TIMESTAMP 8   // uint32_t seconds, then uint32_t microseconds.
+#define BATCH_CODEC_OFFSET_MICROPHONE 16 // 3x uint16_t avg dB, peak frequency, zero crossings.
+#define BATCH_CODEC_OFFSET_ANGLES 24     // 3x float roll, pitch, yaw.
+#define BATCH_CODEC_OFFSET_BLE 36        // BATCH_CODEC_MAX_BLE x (device name, rssi).
+#define BATCH_CODEC_OFFSET_BANDS 56      // Mode, count, BATCH_CODEC_MAX_BANDS levels.
+
+// Encoded record, all varints are LEB128 and signed deltas are zigzag coded:
+//   type      varint
+//   id        byte
+//   time      first record: varint seconds, varint microseconds
+//             following records: signed varint delta in microseconds to the previous record of the batch
+// DATA only:
+//   microphone 3x signed varint delta to the previous record of the same node (avg dB, peak frequency, zero crossings)
+//   angles     3x signed varint delta of the quantised angle to the previous record of the same node (roll, pitch, yaw)
+//   ble        byte count, then count x (device name, rssi). Trailing empty entries are not sent.
+//   bands      byte mode, if not 0: byte count, then count x level byte
+// A batch starts with no previous record, so every frame decodes on its own.
+// Nodes send id 0 (sensorTask.cpp), the root replaces it with the source's SequenceTracker slot before queueing
+// (enqueueReceived()), so every node of the mesh has its own delta base. The batch_codec suite of lib_bench
+// measures about 17 to 19 bytes per message for 4 to 20 interleaved nodes without band levels (0.22 of a raw
+// frame) and 41 with 1/3 octave bands (0.51). A single shared id costs about 4 bytes more.
+
+typedef struct // Decoded message. Mirrors the fields of message_t that reach the host.
+{
+  uint8_t type;
+  uint8_t id;
+  uint32_t timestamp;
+  uint32_t timestamp_us;
+  uint16_t avg_db;
+  uint16_t peak_frequency;
+  uint16_t zero_crossings;
+  float roll;  // In degrees.
+  float pitch; // In degrees.
+  float yaw;   // In degrees.
+  uint8_t ble_count; // Valid entries of ble.
+  struct
+  {
+    uint8_t device_name;
+    uint8_t rssi;
+  } ble[BATCH_CODEC_MAX_BLE];
+  uint8_t band_mode;  // AUDIO_BANDS_* of data_packaging.h.
+  uint8_t band_count; // Valid entries of bands.
+  uint8_t bands[BATCH_CODEC_MAX_BANDS];
+} batch_codec_record_t;
+
+typedef struct // Per-node delta base, identical on both sides.
+{
+  uint8_t id;
+  uint16_t microphone[3];
+  int32_t angles[3];
+} batch_codec_node_t;
+
+/**
+ * @brief Fill a record from a message_t as the ESP32 lays it out, the one conversion every sender uses.
+ *
+ * @param[in] message BATCH_CODEC_MESSAGE_SIZE bytes. The OutputData fields are only read for DATA messages.
+ */
+void batchCodecFromMessage(const uint8_t *message, batch_codec_record_t &record);
+
+class BatchCodecState
+{
+public:
+  void begin();
+
+protected:
+  batch_codec_node_t *_node(uint8_t id);
+
+  bool _first = true;
+  uint64_t _time = 0; // Microseconds of the previous record.
+  uint8_t _nodes_count = 0;
+  batch_codec_node_t _nodes[BATCH_CODEC_MAX_NODES];
+};
+
+class BatchEncoder : public BatchCodecState
+{
+public:
+  /**
+   * @brief Append a record to the batch started by begin().
+   *
+   * @return Number of bytes written, 0 if fewer than BATCH_CODEC_MAX_RECORD_SIZE bytes are left.
+   */
+  size_t encode(const batch_codec_record_t &record, uint8_t *out, size_t capacity);
+};
+
+/**
+ * @brief Reference decoder, the host implementation has to produce the same records.
+ */
+class BatchDecoder : public BatchCodecState
+{
+public:
+  /**
+   * @brief Decode the next record of the batch started by begin().
+   *
+   * @return Number of bytes consumed, 0 if the input is truncated or malformed.
+   */
+  size_t decode(const uint8_t *in, size_t length, batch_codec_record_t &record);
+};
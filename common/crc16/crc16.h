@@ -0,0 +1,51 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define CRC16_CCITT_INIT 0xFFFF       // Initial register value used on the serial link.
+#define CRC16_CCITT_POLYNOMIAL 0x1021 // x^16 + x^12 + x^5 + 1, processed MSB first without final XOR.
+
+/**
+ * @brief Reference implementation, one bit per iteration. Used to cross-check the table driven variants.
+ */
+uint16_t crc16_ccitt_update_bitwise(uint16_t crc, const uint8_t *data, size_t length);
+
+/**
+ * @brief 256-entry table, one lookup per byte.
+ */
+uint16_t crc16_ccitt_update_table(uint16_t crc, const uint8_t *data, size_t length);
+
+/**
+ * @brief Slicing-by-4, four independent lookups per four bytes. Needs 2 KB of tables instead of 512 bytes.
+ */
+uint16_t crc16_ccitt_update_slice4(uint16_t crc, const uint8_t *data, size_t length);
+
+/**
+ * @brief Continue a CRC-16-CCITT over more data.
+ *
+ * @note Start with CRC16_CCITT_INIT and feed the data in any number of chunks, the result is the same as a
+ * single call over the concatenated data. Build with CRC16_SLICING_BY_4 to use the slicing-by-4 kernel.
+ *
+ * @param[in] crc Value returned by the previous call or CRC16_CCITT_INIT.
+ * @param[in] data Pointer to the next chunk.
+ * @param[in] length Length of the chunk.
+ *
+ * @return Updated CRC.
+ */
+static inline uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *data, size_t length)
+{
+#ifdef CRC16_SLICING_BY_4
+  return crc16_ccitt_update_slice4(crc, data, length);
+#else
+  return crc16_ccitt_update_table(crc, data, length);
+#endif
+}
+
+/**
+ * @brief CRC-16-CCITT of a complete buffer.
+ */
+static inline uint16_t crc16_ccitt(const uint8_t *data, size_t length)
+{
+  return crc16_ccitt_update(CRC16_CCITT_INIT, data, length);
+}
@@ -0,0 +1,95 @@
+#include "latency_histogram.h"
+#include "string.h"
+
+uint16_t LatencyHistogram::bucket(uint32_t value)
+{
+  if (value < LATENCY_HISTOGRAM_SUB_BUCKETS)
+  {
+    return value;
+  }
+  uint8_t shift = (31 - __builtin_clz(value)) - LATENCY_HISTOGRAM_SUB_BITS;
+  uint32_t sub = (value >> shift) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+  return LATENCY_HISTOGRAM_SUB_BUCKETS * (shift + 1) + sub;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(uint16_t bucket)
+{
+  if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS)
+  {
+    return bucket;
+  }
+  uint8_t shift = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+  uint64_t lower = (uint64_t)(LATENCY_HISTOGRAM_SUB_BUCKETS + bucket % LATENCY_HISTOGRAM_SUB_BUCKETS) << shift;
+  uint64_t upper = lower + ((uint64_t)1 << shift) - 1;
+  return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+}
+
+void LatencyHistogram::record(uint32_t value)
+{
+  _buckets[bucket(value)]++;
+  _count++;
+  _sum += value;
+  if (value < _min)
+  {
+    _min = value;
+  }
+  if (value > _max)
+  {
+    _max = value;
+  }
+}
+
+void LatencyHistogram::reset()
+{
+  memset(_buckets, 0, sizeof(_buckets));
+  _count = 0;
+  _min = UINT32_MAX;
+  _max = 0;
+  _sum = 0;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+  for (uint16_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i)
+  {
+    _buckets[i] += other._buckets[i];
+  }
+  _count += other._count;
+  _sum += other._sum;
+  if (other._count > 0 && other._min < _min)
+  {
+    _min = other._min;
+  }
+  if (other._max > _max)
+  {
+    _max = other._max;
+  }
+}
+
+uint32_t LatencyHistogram::percentile(float percentile) const
+{
+  if (_count == 0)
+  {
+    return 0;
+  }
+  if (percentile >= 100.0f)
+  {
+    return _max;
+  }
+  uint64_t rank = (uint64_t)(percentile / 100.0f * _count + 0.5f);
+  if (rank == 0)
+  {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (uint16_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i)
+  {
+    seen += _buckets[i];
+    if (seen >= rank)
+    {
+      uint32_t upper = bucketUpperBound(i);
+      return upper > _max ? _max : upper;
+    }
+  }
+  return _max;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define LATENCY_HISTOGRAM_SUB_BITS 4                                  // 16 linear sub-buckets per power of two, at most 6.25 % relative error.
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BITS)
+#define LATENCY_HISTOGRAM_BUCKETS (LATENCY_HISTOGRAM_SUB_BUCKETS * (32 - LATENCY_HISTOGRAM_SUB_BITS + 1)) // Covers the whole uint32_t range.
+
+/**
+ * @brief Log-linear (HDR style) histogram of uint32_t samples, e.g. latencies in microseconds.
+ *
+ * @note Values below LATENCY_HISTOGRAM_SUB_BUCKETS are counted exactly, larger values in buckets whose width
+ * is 1/16 of their power of two. Recording is a few shifts and an increment, no floating point and no
+ * allocation. Not synchronised, record from one task and read when that task is idle or accept torn reads.
+ */
+class LatencyHistogram
+{
+public:
+  void record(uint32_t value);
+  void reset();
+  void merge(const LatencyHistogram &other);
+
+  uint32_t count() const { return _count; }
+  uint32_t min() const { return _count == 0 ? 0 : _min; }
+  uint32_t max() const { return _max; }
+  uint32_t mean() const { return _count == 0 ? 0 : (uint32_t)(_sum / _count); }
+
+  /**
+   * @brief Value below which the given fraction of samples lies.
+   *
+   * @param[in] percentile Percentile between 0 and 100, e.g. 99.9.
+   *
+   * @return Upper bound of the bucket holding that sample, clamped to max(). 0 if nothing was recorded.
+   */
+  uint32_t percentile(float percentile) const;
+
+  static uint16_t bucket(uint32_t value);
+  static uint32_t bucketUpperBound(uint16_t bucket);
+
+private:
+  uint32_t _buckets[LATENCY_HISTOGRAM_BUCKETS] = {};
+  uint32_t _count = 0;
+  uint32_t _min = UINT32_MAX;
+  uint32_t _max = 0;
+  uint64_t _sum = 0;
+};
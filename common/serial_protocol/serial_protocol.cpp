@@ -0,0 +1,316 @@
+#include "serial_protocol.h"
+#include "crc16.h"
+#include "stdlib.h"
+#include "string.h"
+
+bool SerialCommandParser::feed(uint8_t byte, uint32_t now, serial_command_t &command)
+{
+  if (_command != 0 && now - _started > SERIAL_COMMAND_TIMEOUT)
+  {
+    _command = 0;
+  }
+  if (_command == 0)
+  {
+    switch (byte)
+    {
+    case SERIAL_CMD_POLL:
+      command.type = SERIAL_COMMAND_POLL;
+      return true;
+    case SERIAL_CMD_ACK:
+      command.type = SERIAL_COMMAND_ACK;
+      return true;
+    case SERIAL_CMD_RESEND:
+      command.type = SERIAL_COMMAND_RESEND;
+      return true;
+    case SERIAL_CMD_STREAM_STOP:
+      command.type = SERIAL_COMMAND_STREAM_STOP;
+      return true;
+    case SERIAL_CMD_TIME_SET:
+      _expected = 8;
+      break;
+    case SERIAL_CMD_STREAM_START:
+      _expected = 1;
+      break;
+    case SERIAL_CMD_STREAM_ACK:
+    case SERIAL_CMD_STREAM_NACK:
+      _expected = 2;
+      break;
+    default:
+      return false; // Unknown byte, skip it.
+    }
+    _command = byte;
+    _received = 0;
+    _started = now;
+    return false;
+  }
+  _args[_received++] = byte;
+  if (_received < _expected)
+  {
+    return false;
+  }
+  switch (_command)
+  {
+  case SERIAL_CMD_TIME_SET:
+    command.type = SERIAL_COMMAND_TIME_SET;
+    command.seconds = _args[0] | (_args[1] << 8) | (_args[2] << 16) | ((uint32_t)_args[3] << 24);
+    command.microseconds = _args[4] | (_args[5] << 8) | (_args[6] << 16) | ((uint32_t)_args[7] << 24);
+    break;
+  case SERIAL_CMD_STREAM_START:
+    command.type = SERIAL_COMMAND_STREAM_START;
+    command.window = _args[0] & SERIAL_STREAM_WINDOW_MASK;
+    command.compact = (_args[0] & SERIAL_STREAM_FLAG_COMPACT) != 0;
+    break;
+  case SERIAL_CMD_STREAM_ACK:
+    command.type = SERIAL_COMMAND_STREAM_ACK;
+    command.seq = _args[0] | (_args[1] << 8);
+    break;
+  default:
+    command.type = SERIAL_COMMAND_STREAM_NACK;
+    command.seq = _args[0] | (_args[1] << 8);
+    break;
+  }
+  _command = 0;
+  return true;
+}
+
+SerialStreamSender::~SerialStreamSender()
+{
+  free(_frames);
+  free(_sent_at);
+  free(_message);
+}
+
+bool SerialStreamSender::init(const serial_stream_config_t &config)
+{
+  if (_frames != NULL || config.write == NULL || config.millis == NULL || config.dequeue == NULL || config.message_size == 0 || config.batch_size == 0 || config.window == 0 ||
+      (config.encode != NULL && config.max_encoded_size == 0))
+  {
+    return false;
+  }
+  _config = config;
+  uint8_t window = 1;
+  while (window * 2 <= _config.window && window * 2 <= SERIAL_STREAM_MAX_WINDOW)
+  {
+    window *= 2;
+  }
+  _config.window = window; // Power of two so that seq % window stays continuous when seq wraps.
+  _frame_capacity = SERIAL_FRAME_HEADER_SIZE + (size_t)_config.batch_size * _config.message_size + SERIAL_FRAME_TRAILER_SIZE;
+  if (_frame_capacity - SERIAL_FRAME_HEADER_SIZE - SERIAL_FRAME_TRAILER_SIZE > UINT16_MAX ||
+      (_config.encode != NULL && _frame_capacity - SERIAL_FRAME_HEADER_SIZE - SERIAL_FRAME_TRAILER_SIZE < _config.max_encoded_size))
+  {
+    return false;
+  }
+  _frames = (uint8_t *)malloc(_frame_capacity * _config.window);
+  _sent_at = (uint32_t *)malloc(sizeof(uint32_t) * _config.window);
+  _message = _config.encode != NULL ? (uint8_t *)malloc(_config.message_size) : NULL;
+  if (_frames == NULL || _sent_at == NULL || (_config.encode != NULL && _message == NULL))
+  {
+    free(_frames);
+    free(_sent_at);
+    free(_message);
+    _frames = NULL;
+    _sent_at = NULL;
+    _message = NULL;
+    return false;
+  }
+  _window = _config.window;
+  memset(&_stats, 0, sizeof(_stats));
+  return true;
+}
+
+void SerialStreamSender::start(uint8_t window, bool compact)
+{
+  if (_frames == NULL)
+  {
+    return;
+  }
+  _window = (window == 0 || window > _config.window) ? _config.window : window;
+  _compact = compact && _config.encode != NULL; // Frames already built keep their type, the host decodes by frame type.
+  _send_next = _base;
+  _last_progress = _config.millis();
+  _active = true;
+}
+
+void SerialStreamSender::stop()
+{
+  _active = false;
+}
+
+void SerialStreamSender::onAck(uint16_t seq)
+{
+  if (!_inFlight(seq))
+  {
+    return; // Duplicate or stale ack.
+  }
+  _release(seq + 1);
+}
+
+void SerialStreamSender::onNack(uint16_t seq)
+{
+  if (seq != _next && !_inFlight(seq))
+  {
+    return;
+  }
+  _release(seq);
+  _stats.nacks++;
+  // The host NACKs every frame that arrives behind a gap. Only the first NACK of a gap rewinds, the others
+  // would restart a resend that is already on its way. A lost resend is covered by the retransmit timeout.
+  uint32_t now = _config.millis();
+  if (_rewound && seq == _rewind_seq && now - _rewind_at < _config.retransmit_timeout)
+  {
+    return;
+  }
+  _rewound = true;
+  _rewind_seq = seq;
+  _rewind_at = now;
+  _send_next = _base;
+}
+
+void SerialStreamSender::pump()
+{
+  if (!_active)
+  {
+    return;
+  }
+  uint32_t now = _config.millis();
+  if (_base != _next && now - _last_progress > _config.retransmit_timeout)
+  {
+    _send_next = _base;
+    _last_progress = now;
+    _stats.timeouts++;
+  }
+  while (_send_next != _next)
+  {
+    _transmit(_send_next);
+    _stats.frames_resent++;
+    _send_next++;
+  }
+  while ((uint16_t)(_next - _base) < _window)
+  {
+    if (!_build(_next))
+    {
+      break;
+    }
+    _sent_at[_next % _config.window] = now;
+    if (_base == _next)
+    {
+      _last_progress = now;
+    }
+    _transmit(_next);
+    _stats.frames_sent++;
+    _next++;
+    _send_next = _next;
+  }
+}
+
+void SerialStreamSender::sendText(const char *text)
+{
+  if (_frames == NULL || text == NULL)
+  {
+    return;
+  }
+  uint8_t frame[SERIAL_FRAME_HEADER_SIZE + SERIAL_FRAME_MAX_TEXT + SERIAL_FRAME_TRAILER_SIZE];
+  size_t length = strnlen(text, SERIAL_FRAME_MAX_TEXT);
+  frame[0] = SERIAL_FRAME_SYNC0;
+  frame[1] = SERIAL_FRAME_SYNC1;
+  frame[2] = SERIAL_FRAME_TEXT;
+  frame[3] = 0;
+  frame[4] = 0;
+  frame[5] = 0;
+  frame[6] = (uint8_t)length;
+  frame[7] = (uint8_t)(length >> 8);
+  memcpy(frame + SERIAL_FRAME_HEADER_SIZE, text, length);
+  uint16_t crc = crc16_ccitt(frame + 2, SERIAL_FRAME_HEADER_SIZE - 2 + length);
+  frame[SERIAL_FRAME_HEADER_SIZE + length] = (uint8_t)crc;
+  frame[SERIAL_FRAME_HEADER_SIZE + length + 1] = (uint8_t)(crc >> 8);
+  _config.write(frame, SERIAL_FRAME_HEADER_SIZE + length + SERIAL_FRAME_TRAILER_SIZE);
+}
+
+uint8_t *SerialStreamSender::_slot(uint16_t seq) const
+{
+  return _frames + (size_t)(seq % _config.window) * _frame_capacity;
+}
+
+bool SerialStreamSender::_inFlight(uint16_t seq) const
+{
+  return (uint16_t)(seq - _base) < (uint16_t)(_next - _base);
+}
+
+void SerialStreamSender::_release(uint16_t upto)
+{
+  uint32_t now = _config.millis();
+  if (_base == upto)
+  {
+    return; // No progress, must not hold off the retransmit timeout.
+  }
+  while (_base != upto)
+  {
+    uint8_t *frame = _slot(_base);
+    _stats.frames_acked++;
+    _stats.messages_acked += frame[3];
+    _stats.last_ack_latency = now - _sent_at[_base % _config.window];
+    if (_config.acked != NULL)
+    {
+      _config.acked(frame[3], _stats.last_ack_latency);
+    }
+    _base++;
+  }
+  if ((uint16_t)(_send_next - _base) > (uint16_t)(_next - _base))
+  {
+    _send_next = _base;
+  }
+  _last_progress = now;
+}
+
+bool SerialStreamSender::_build(uint16_t seq)
+{
+  uint8_t *frame = _slot(seq);
+  uint8_t *payload = frame + SERIAL_FRAME_HEADER_SIZE;
+  uint8_t count = 0;
+  uint16_t length = 0;
+  if (_compact)
+  {
+    // Fill the raw payload capacity, compact frames carry more messages in the same number of bytes.
+    size_t capacity = _frame_capacity - SERIAL_FRAME_HEADER_SIZE - SERIAL_FRAME_TRAILER_SIZE;
+    while (count < UINT8_MAX && capacity - length >= _config.max_encoded_size && _config.dequeue(_message))
+    {
+      length += _config.encode(_message, count == 0, payload + length, capacity - length);
+      count++;
+    }
+  }
+  else
+  {
+    while (count < _config.batch_size && _config.dequeue(payload + (size_t)count * _config.message_size))
+    {
+      count++;
+    }
+    length = count * _config.message_size;
+  }
+  if (count == 0)
+  {
+    return false;
+  }
+  frame[0] = SERIAL_FRAME_SYNC0;
+  frame[1] = SERIAL_FRAME_SYNC1;
+  frame[2] = _compact ? SERIAL_FRAME_DATA_COMPACT : SERIAL_FRAME_DATA;
+  frame[3] = count;
+  frame[4] = (uint8_t)seq;
+  frame[5] = (uint8_t)(seq >> 8);
+  frame[6] = (uint8_t)length;
+  frame[7] = (uint8_t)(length >> 8);
+  uint16_t crc = crc16_ccitt_update(CRC16_CCITT_INIT, frame + 2, SERIAL_FRAME_HEADER_SIZE - 2);
+  crc = crc16_ccitt_update(crc, payload, length);
+  payload[length] = (uint8_t)crc;
+  payload[length + 1] = (uint8_t)(crc >> 8);
+  _stats.messages_sent += count;
+  return true;
+}
+
+void SerialStreamSender::_transmit(uint16_t seq)
+{
+  uint8_t *frame = _slot(seq);
+  uint16_t length = frame[6] | (frame[7] << 8);
+  size_t size = SERIAL_FRAME_HEADER_SIZE + length + SERIAL_FRAME_TRAILER_SIZE;
+  _config.write(frame, size);
+  _stats.bytes_sent += size;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+// Host -> root command bytes.
+#define SERIAL_CMD_ACK 0x07          // v1: Batch received.
+#define SERIAL_CMD_TIME_SET 0x11     // Followed by uint32_t seconds and uint32_t microseconds (little endian).
+#define SERIAL_CMD_RESEND 0x19       // v1: Batch checksum mismatch.
+#define SERIAL_CMD_POLL 0x25         // v1: Request a single batch.
+#define SERIAL_CMD_STREAM_START 0x26 // v2: Followed by uint8_t window, optionally or'ed with SERIAL_STREAM_FLAG_COMPACT. The root starts pushing frames.
+#define SERIAL_CMD_STREAM_ACK 0x27   // v2: Followed by uint16_t seq. Cumulative, every frame up to and including seq was received.
+#define SERIAL_CMD_STREAM_NACK 0x28  // v2: Followed by uint16_t seq. First missing frame, everything before it was received.
+#define SERIAL_CMD_STREAM_STOP 0x29  // v2: Stop pushing frames and fall back to the v1 poll protocol.
+
+// Root -> host v2 frame: sync[2] type count seq[2] length[2] payload[length] crc[2].
+// All fields are little endian, the CRC-16-CCITT (see crc16.h) covers type up to the end of the payload.
+#define SERIAL_FRAME_SYNC0 0xA5
+#define SERIAL_FRAME_SYNC1 0x5A
+#define SERIAL_FRAME_HEADER_SIZE 8
+#define SERIAL_FRAME_TRAILER_SIZE 2
+#define SERIAL_FRAME_DATA 0x01         // Payload is count raw messages of equal size.
+#define SERIAL_FRAME_DATA_COMPACT 0x02 // Payload is count messages coded with the sender's encode callback (see batch_codec.h).
+#define SERIAL_FRAME_TEXT 0x03         // Payload is a status line for the host log. Not sequenced and not acknowledged, count and seq are 0.
+#define SERIAL_FRAME_MAX_TEXT 200
+
+#define SERIAL_STREAM_FLAG_COMPACT 0x80 // Host asks for SERIAL_FRAME_DATA_COMPACT frames if the root supports them.
+#define SERIAL_STREAM_WINDOW_MASK 0x3F
+
+#define SERIAL_STREAM_MAX_WINDOW 32 // Upper bound for the window a host can request.
+#define SERIAL_COMMAND_TIMEOUT 100  // A command whose argument bytes do not arrive within this time is dropped (in milliseconds).
+
+typedef struct // Link and queue bindings of the v2 sender. Keeps the protocol independent of the UART implementation.
+{
+  size_t (*write)(const uint8_t *data, size_t length); // Write bytes to the host link. @note Must accept the whole buffer.
+  uint32_t (*millis)(void);                            // Monotonic millisecond clock.
+  bool (*dequeue)(uint8_t *message);                   // Move the oldest queued message (message_size bytes) into message. Returns false if the queue is empty.
+  uint16_t message_size;                               // Size of a single message in bytes.
+  uint8_t batch_size;                                  // Maximum number of messages per frame.
+  uint8_t window;                                      // Maximum number of unacknowledged frames. @note Rounded down to a power of two, at most SERIAL_STREAM_MAX_WINDOW.
+  uint16_t retransmit_timeout;                         // Time without ack progress after which every unacknowledged frame is resent (in milliseconds).
+  size_t (*encode)(const uint8_t *message, bool first, uint8_t *out, size_t capacity); // Optional. Code a dequeued message for a compact frame, first starts a new frame. Returns the bytes written.
+  uint16_t max_encoded_size;                           // Upper bound of a single encode() result. Compact frames use the same payload capacity as batch_size raw messages.
+  void (*acked)(uint8_t count, uint32_t latency);      // Optional. Called for every acknowledged frame with its message count and the time since its first transmission (in milliseconds).
+} serial_stream_config_t;
+
+typedef struct // Counters of the v2 sender since init().
+{
+  uint32_t frames_sent;       // New frames sent.
+  uint32_t frames_resent;     // Frames sent again after a NACK or a timeout.
+  uint32_t frames_acked;      // Frames released by cumulative acks.
+  uint32_t messages_sent;     // Messages in new frames.
+  uint32_t messages_acked;    // Messages in acknowledged frames.
+  uint32_t nacks;             // NACKs received.
+  uint32_t timeouts;          // Retransmit timeouts.
+  uint32_t bytes_sent;        // Bytes written to the link including retransmissions.
+  uint32_t last_ack_latency;  // Time between first transmission and ack of the newest acknowledged frame (in milliseconds).
+} serial_stream_stats_t;
+
+typedef enum // Complete host commands reported by SerialCommandParser.
+{
+  SERIAL_COMMAND_POLL,         // v1 batch request.
+  SERIAL_COMMAND_ACK,          // v1 batch received.
+  SERIAL_COMMAND_RESEND,       // v1 batch checksum mismatch.
+  SERIAL_COMMAND_TIME_SET,     // seconds and microseconds are set.
+  SERIAL_COMMAND_STREAM_START, // window and compact are set.
+  SERIAL_COMMAND_STREAM_ACK,   // seq is set.
+  SERIAL_COMMAND_STREAM_NACK,  // seq is set.
+  SERIAL_COMMAND_STREAM_STOP
+} serial_command_type_t;
+
+typedef struct
+{
+  serial_command_type_t type;
+  uint8_t window;
+  bool compact;
+  uint16_t seq;
+  uint32_t seconds;
+  uint32_t microseconds;
+} serial_command_t;
+
+/**
+ * @brief Byte-level parser for host commands.
+ *
+ * @note Bytes can be fed in any chunking, e.g. straight from a UART event. Unknown bytes are skipped and a
+ * command whose arguments stall for longer than SERIAL_COMMAND_TIMEOUT is dropped, so the parser never waits.
+ */
+class SerialCommandParser
+{
+public:
+  /**
+   * @brief Feed one received byte.
+   *
+   * @param[in] byte Received byte.
+   * @param[in] now Current time in milliseconds.
+   * @param[out] command Filled when a command is complete.
+   *
+   * @return
+   *              - true if command holds a complete command
+   *              - false if more bytes are needed
+   */
+  bool feed(uint8_t byte, uint32_t now, serial_command_t &command);
+  void reset() { _command = 0; }
+
+private:
+  uint8_t _command = 0;   // Command byte waiting for arguments, 0 if idle.
+  uint8_t _expected = 0;  // Number of argument bytes of _command.
+  uint8_t _received = 0;  // Argument bytes received so far.
+  uint8_t _args[8] = {};
+  uint32_t _started = 0;
+};
+
+/**
+ * @brief Sender side of the v2 streaming protocol.
+ *
+ * @note Frames are numbered with a 16-bit sequence number and kept until the host acknowledges them
+ * cumulatively. Up to window frames are in flight, on a NACK or a retransmit timeout the sender goes back
+ * to the first unacknowledged frame and resends from there.
+ */
+class SerialStreamSender
+{
+public:
+  ~SerialStreamSender();
+
+  bool init(const serial_stream_config_t &config);
+  void start(uint8_t window, bool compact = false); // Host sent SERIAL_CMD_STREAM_START. Unacknowledged frames are resent.
+  void stop();                 // Host sent SERIAL_CMD_STREAM_STOP. Unacknowledged frames are kept for the next start().
+  bool isActive() const { return _active; }
+  void onAck(uint16_t seq);
+  void onNack(uint16_t seq);
+  void pump();                 // Retransmit if needed and send new frames while the window allows.
+  void sendText(const char *text); // Send a SERIAL_FRAME_TEXT frame, text is cut at SERIAL_FRAME_MAX_TEXT bytes. @note Call from the task that calls pump().
+  uint16_t inFlight() const { return (uint16_t)(_next - _base); }
+  const serial_stream_stats_t &stats() const { return _stats; }
+
+private:
+  uint8_t *_slot(uint16_t seq) const;
+  bool _inFlight(uint16_t seq) const;
+  void _release(uint16_t upto);
+  bool _build(uint16_t seq);
+  void _transmit(uint16_t seq);
+
+  serial_stream_config_t _config = {};
+  serial_stream_stats_t _stats = {};
+  uint8_t *_frames = NULL;     // window slots of SERIAL_FRAME_HEADER_SIZE + batch_size * message_size + SERIAL_FRAME_TRAILER_SIZE bytes.
+  uint32_t *_sent_at = NULL;   // Time of the first transmission per slot.
+  size_t _frame_capacity = 0;
+  uint8_t _window = 0;
+  bool _active = false;
+  bool _compact = false;       // New frames are SERIAL_FRAME_DATA_COMPACT.
+  uint8_t *_message = NULL;    // Dequeued message waiting for encode, message_size bytes.
+  uint16_t _base = 0;          // Oldest unacknowledged frame.
+  uint16_t _send_next = 0;     // Next frame to (re)transmit, between _base and _next.
+  uint16_t _next = 0;          // Sequence number of the next new frame.
+  uint32_t _last_progress = 0;
+  bool _rewound = false;       // A NACK for _rewind_seq already restarted transmission from _base.
+  uint16_t _rewind_seq = 0;
+  uint32_t _rewind_at = 0;
+};
@@ -0,0 +1,149 @@
+package main
+
+import "log/slog"
+
+// Compact frame payload, see common/batch_codec/batch_codec.h on the node side
+const (
+	codecMaxNodes   = 16
+	codecAngleScale = 100
+	codecMaxBle     = 10
+	codecMaxBands   = 22
+	codecTypeData   = 5
+)
+
+type codecNode struct {
+	id         uint8
+	microphone [3]uint16
+	angles     [3]int32
+}
+
+type compactDecoder struct {
+	data  []byte
+	pos   int
+	err   bool
+	first bool
+	time  uint64
+	nodes []codecNode
+}
+
+func (d *compactDecoder) varint() uint64 {
+	var value uint64
+	for i := 0; i < 10; i++ {
+		if d.pos >= len(d.data) {
+			break
+		}
+		b := d.data[d.pos]
+		d.pos++
+		value |= uint64(b&0x7F) << (7 * i)
+		if b&0x80 == 0 {
+			return value
+		}
+	}
+	d.err = true
+	return 0
+}
+
+func (d *compactDecoder) signed() int64 {
+	raw := d.varint()
+	return int64(raw>>1) ^ -int64(raw&1)
+}
+
+func (d *compactDecoder) byte() byte {
+	if d.pos >= len(d.data) {
+		d.err = true
+		return 0
+	}
+	b := d.data[d.pos]
+	d.pos++
+	return b
+}
+
+// node returns the delta base of a node, nil once the table is full (further nodes are coded absolute)
+func (d *compactDecoder) node(id uint8) *codecNode {
+	for i := range d.nodes {
+		if d.nodes[i].id == id {
+			return &d.nodes[i]
+		}
+	}
+	if len(d.nodes) == codecMaxNodes {
+		return nil
+	}
+	d.nodes = append(d.nodes, codecNode{id: id})
+	return &d.nodes[len(d.nodes)-1]
+}
+
+func (d *compactDecoder) record() Message {
+	var message Message
+	message.MessageHeader.Type = uint32(d.varint())
+	message.MessageHeader.ID = d.byte()
+	if d.first {
+		seconds := d.varint()
+		d.time = seconds*1000000 + d.varint()
+		d.first = false
+	} else {
+		d.time += uint64(d.signed())
+	}
+	message.MessageHeader.Timestamp = uint32(d.time / 1000000)
+	message.MessageHeader.TimestampUs = uint32(d.time % 1000000)
+	if message.MessageHeader.Type != codecTypeData {
+		return message
+	}
+
+	node := d.node(message.MessageHeader.ID)
+	if node == nil {
+		node = &codecNode{}
+	}
+	for i := range node.microphone {
+		node.microphone[i] = uint16(int64(node.microphone[i]) + d.signed())
+	}
+	for i := range node.angles {
+		node.angles[i] = int32(int64(node.angles[i]) + d.signed())
+	}
+	data := &OutputData{}
+	data.MicrophoneData.AvgDb = node.microphone[0]
+	data.MicrophoneData.PeakFrequency = node.microphone[1]
+	data.MicrophoneData.ZeroCrossingCount = node.microphone[2]
+	data.AccelerometerData.Roll = float32(node.angles[0]) / codecAngleScale
+	data.AccelerometerData.Pitch = float32(node.angles[1]) / codecAngleScale
+	data.AccelerometerData.Yaw = float32(node.angles[2]) / codecAngleScale
+	count := int(d.byte())
+	if count > codecMaxBle {
+		d.err = true
+		return message
+	}
+	for i := 0; i < count; i++ {
+		data.BleData[i].DeviceName = d.byte()
+		data.BleData[i].Rssi = d.byte()
+	}
+	data.AudioBands.Mode = d.byte()
+	if data.AudioBands.Mode != 0 {
+		data.AudioBands.Count = d.byte()
+		if data.AudioBands.Count > codecMaxBands {
+			d.err = true
+			return message
+		}
+		for i := 0; i < int(data.AudioBands.Count); i++ {
+			data.AudioBands.Level[i] = d.byte()
+		}
+	}
+	message.Data = data
+	return message
+}
+
+// decodeCompactBatch decodes the payload of a compact frame holding count messages
+func decodeCompactBatch(payload []byte, count int) []Message {
+	d := &compactDecoder{data: payload, first: true}
+	messages := make([]Message, 0, count)
+	for i := 0; i < count; i++ {
+		message := d.record()
+		if d.err {
+			slog.Error("Malformed compact frame", "message", i, "count", count)
+			break
+		}
+		if message.Data == nil || message.MessageHeader.Timestamp < 1000 {
+			continue
+		}
+		messages = append(messages, message)
+	}
+	return messages
+}
@@ -20,6 +20,10 @@ type Config struct {
 	Serial struct {
 		BaudRate   int    `yaml:"baud_rate"`
 		Port       string `yaml:"port"`
+		Protocol   string `yaml:"protocol"` // "v1" (poll, default) or "v2" (streaming)
+		Window     int    `yaml:"window"`   // v2: unacknowledged frames the node may send ahead
+		Compact    bool   `yaml:"compact"`  // v2: ask for delta/varint coded frames
+		BatchSize  int    `yaml:"batch_size"` // v2: SERIAL_STREAM_BATCH_SIZE of the root, bounds the frame headers that are accepted
 	}
 	Log struct {
 		Level  string `yaml:"level"`
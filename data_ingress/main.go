@@ -11,17 +11,17 @@ import (
 	"log/slog"
 
 	influxdb2 "github.com/influxdata/influxdb-client-go/v2"
+	"github.com/influxdata/influxdb-client-go/v2/api"
 	"github.com/tarm/serial"
 )
 
-const POLYNOMIAL uint32 = 0x1021
-
-func checksumCalculator(data []byte, length int) uint16 {
-	var crc uint32 = 0xFFFF
-
-	for i := 0; i < length; i++ {
-		crc ^= uint32(data[i]) << 8
+const POLYNOMIAL uint16 = 0x1021
 
+// crcTable holds the CRC-16-CCITT register contribution of every byte value, same as common/crc16 on the node
+var crcTable = func() [256]uint16 {
+	var table [256]uint16
+	for i := range table {
+		crc := uint16(i) << 8
 		for bit := 0; bit < 8; bit++ {
 			if (crc & 0x8000) != 0 {
 				crc = (crc << 1) ^ POLYNOMIAL
@@ -29,9 +29,19 @@ func checksumCalculator(data []byte, length int) uint16 {
 				crc <<= 1
 			}
 		}
+		table[i] = crc
+	}
+	return table
+}()
+
+func checksumCalculator(data []byte, length int) uint16 {
+	var crc uint16 = 0xFFFF
+
+	for i := 0; i < length; i++ {
+		crc = (crc << 8) ^ crcTable[byte(crc>>8)^data[i]]
 	}
 
-	return uint16(crc & 0xFFFF)
+	return crc
 }
 
 func readSerialData(s *serial.Port) ([]byte, error) {
@@ -54,6 +64,137 @@ func readSerialData(s *serial.Port) ([]byte, error) {
 	}
 }
 
+// messageSize is sizeof(message_t) on the node: 16 byte header and 64 byte OutputData
+const messageSize = 80
+
+// decodeBatch splits a checksummed batch into messages of messageSize bytes
+func decodeBatch(data []byte) []Message {
+	messages := make([]Message, 0, len(data)/messageSize)
+	for i := 0; i+messageSize <= len(data); i += messageSize {
+		var outputData OutputData
+		headerSize := binary.Size(MessageHeader{})
+		outputDataSize := binary.Size(OutputData{})
+		slog.Debug("Received data of length %d", headerSize+outputDataSize)
+		if len(data[i:]) >= headerSize+outputDataSize {
+			headerBytes := data[i : i+headerSize]
+			outputDataBytes := data[i+headerSize : i+headerSize+outputDataSize]
+
+			var messageHeader MessageHeader
+			err := binary.Read(bytes.NewReader(headerBytes), binary.LittleEndian, &messageHeader)
+			if err != nil {
+				slog.Error("Failed to decode message header: %v", err)
+			} else {
+				slog.Info("Decoded message header: %+v", messageHeader)
+				err = binary.Read(bytes.NewReader(outputDataBytes), binary.LittleEndian, &outputData)
+				if err != nil {
+					slog.Error("Failed to decode output data: %v", err)
+				} else {
+					slog.Info("Decoded Output Data: %+v", outputData)
+
+					message := Message{
+						MessageHeader: messageHeader,
+						Data:          &outputData,
+					}
+					if messageHeader.Timestamp < 1000 {
+						slog.Error("Timestamp is less than 1000")
+						continue
+					}
+
+					messages = append(messages, message)
+				}
+			}
+		}
+	}
+	return messages
+}
+
+const (
+	audioBandsGoertzel    = 1
+	audioBandsOctave      = 2
+	audioBandsThirdOctave = 3
+	audioBandsAWeighted   = 0x80
+)
+
+// Nominal centres of the third octaves a node at 16 kHz reports, octaves are every third entry from 63 Hz
+var thirdOctaveCentres = [...]string{"50", "63", "80", "100", "125", "160", "200", "250", "315", "400", "500",
+	"630", "800", "1000", "1250", "1600", "2000", "2500", "3150", "4000", "5000", "6300"}
+
+// bandTags names band i of a message, Goertzel bands are only numbered as their frequencies are set at build time
+func bandTags(id uint8, bands AudioBands, i int) map[string]string {
+	tags := map[string]string{"id": fmt.Sprintf("%d", id+1), "band": fmt.Sprintf("%d", i), "weighting": "Z"}
+	if bands.Mode&audioBandsAWeighted != 0 {
+		tags["weighting"] = "A"
+	}
+	switch bands.Mode &^ audioBandsAWeighted {
+	case audioBandsGoertzel:
+		tags["mode"] = "goertzel"
+	case audioBandsOctave:
+		tags["mode"] = "octave"
+		if 1+3*i < len(thirdOctaveCentres) {
+			tags["frequency"] = thirdOctaveCentres[1+3*i]
+		}
+	case audioBandsThirdOctave:
+		tags["mode"] = "thirdOctave"
+		if i < len(thirdOctaveCentres) {
+			tags["frequency"] = thirdOctaveCentres[i]
+		}
+	default:
+		tags["mode"] = fmt.Sprintf("%d", bands.Mode)
+	}
+	return tags
+}
+
+// writeMessages writes decoded messages to InfluxDB
+func writeMessages(writeAPI api.WriteAPIBlocking, queue []Message) {
+	for _, msg := range queue {
+		p := influxdb2.NewPoint(
+			"measurement",
+			map[string]string{"id": fmt.Sprintf("%d", msg.MessageHeader.ID+1)},
+			map[string]interface{}{
+				"avgDb":              msg.Data.MicrophoneData.AvgDb,
+				"peakFrequency":      msg.Data.MicrophoneData.PeakFrequency,
+				"zeroCrossingsCount": msg.Data.MicrophoneData.ZeroCrossingCount,
+				"roll":               msg.Data.AccelerometerData.Roll,
+				"pitch":              msg.Data.AccelerometerData.Pitch,
+				"yaw":                msg.Data.AccelerometerData.Yaw,
+			},
+			time.Unix(int64(msg.MessageHeader.Timestamp), int64(msg.MessageHeader.TimestampUs)*int64(time.Microsecond)),
+		)
+		if err := writeAPI.WritePoint(context.Background(), p); err != nil {
+			fmt.Printf("Error writing point to InfluxDB: %v\n", err)
+		}
+		for _, ble := range msg.Data.BleData {
+			if ble.DeviceName != 0 {
+				p := influxdb2.NewPoint(
+					"BLEData",
+					map[string]string{"id": fmt.Sprintf("%d", msg.MessageHeader.ID+1), "device": fmt.Sprintf("%d", ble.DeviceName+1)},
+					map[string]interface{}{
+						"rssi": ble.Rssi,
+					},
+					time.Unix(int64(msg.MessageHeader.Timestamp), int64(msg.MessageHeader.TimestampUs)*int64(time.Microsecond)),
+				)
+				if err := writeAPI.WritePoint(context.Background(), p); err != nil {
+					fmt.Printf("Error writing point to InfluxDB: %v\n", err)
+				}
+			}
+		}
+		bands := msg.Data.AudioBands
+		for i := 0; bands.Mode != 0 && i < int(bands.Count) && i < len(bands.Level); i++ {
+			p := influxdb2.NewPoint(
+				"audioBands",
+				bandTags(msg.MessageHeader.ID, bands, i),
+				map[string]interface{}{
+					"level": float64(bands.Level[i]) / 2,
+				},
+				time.Unix(int64(msg.MessageHeader.Timestamp), int64(msg.MessageHeader.TimestampUs)*int64(time.Microsecond)),
+			)
+			if err := writeAPI.WritePoint(context.Background(), p); err != nil {
+				fmt.Printf("Error writing point to InfluxDB: %v\n", err)
+			}
+		}
+	}
+}
+
 func main() {
 	config, err := readConfig()
 
@@ -75,6 +216,11 @@ func main() {
 	}
 	defer s.Close()
 
+	if config.Serial.Protocol == "v2" {
+		runStream(s, config, writeAPI)
+		return
+	}
+
 	messageQueue := make([]Message, 0)
 
 	for {
@@ -121,42 +267,8 @@ func main() {
 						}
 					} else {
 						// Store valid data in the queue
-						for i := 0; i+56 <= len(data); i += 56 {
-							var outputData OutputData
-							headerSize := binary.Size(MessageHeader{})
-							outputDataSize := binary.Size(OutputData{})
-							slog.Debug("Received data of length %d", headerSize+outputDataSize)
-							if len(data[i:]) >= headerSize+outputDataSize {
-								headerBytes := data[i : i+headerSize]
-								outputDataBytes := data[i+headerSize : i+headerSize+outputDataSize]
-
-								var messageHeader MessageHeader
-								err := binary.Read(bytes.NewReader(headerBytes), binary.LittleEndian, &messageHeader)
-								if err != nil {
-									slog.Error("Failed to decode message header: %v", err)
-								} else {
-									slog.Info("Decoded message header: %+v", messageHeader)
-									err = binary.Read(bytes.NewReader(outputDataBytes), binary.LittleEndian, &outputData)
-									if err != nil {
-										slog.Error("Failed to decode output data: %v", err)
-									} else {
-										slog.Info("Decoded Output Data: %+v", outputData)
-
-										message := Message{
-											MessageHeader: messageHeader,
-											Data:          &outputData,
-										}
-                    if(messageHeader.Timestamp < 1000) {
-											slog.Error("Timestamp is less than 1000")
-                      continue
-                    }
-
-										messageQueue = append(messageQueue, message)
-									}
-								}
-							}
-						}
-						
+						messageQueue = append(messageQueue, decodeBatch(data)...)
+
 						// Acknowledge with byte 0x07
 						slog.Debug("Checksum matches, sending ACK byte 0x07")
 						_, err = s.Write([]byte{0x07})
@@ -176,42 +288,7 @@ func main() {
 
 		// If message queue is large enough, send batch data
 		if len(messageQueue) >= 2 {
-			go func(queue []Message) {
-				// Write data to InfluxDB
-				for _, msg := range queue {
-					p := influxdb2.NewPoint(
-						"measurement",
-						map[string]string{"id": fmt.Sprintf("%d", msg.MessageHeader.ID+1)},
-						map[string]interface{}{
-							"avgDb":               msg.Data.MicrophoneData.AvgDb,
-							"peakFrequency":       msg.Data.MicrophoneData.PeakFrequency,
-							"zeroCrossingsCount":  msg.Data.MicrophoneData.ZeroCrossingCount,
-							"roll":                msg.Data.AccelerometerData.Roll,
-							"pitch":               msg.Data.AccelerometerData.Pitch,
-							"yaw":                 msg.Data.AccelerometerData.Yaw,
-						},
-						time.Unix(int64(msg.MessageHeader.Timestamp), int64(msg.MessageHeader.TimestampUs)*int64(time.Microsecond)),
-					)
-					if err := writeAPI.WritePoint(context.Background(), p); err != nil {
-						fmt.Printf("Error writing point to InfluxDB: %v\n", err)
-					}
-					for _, ble := range msg.Data.BleData {
-						if ble.DeviceName != 0 {
-							p := influxdb2.NewPoint(
-								"BLEData",
-								map[string]string{"id": fmt.Sprintf("%d", msg.MessageHeader.ID+1), "device": fmt.Sprintf("%d", ble.DeviceName+1)},
-								map[string]interface{}{
-									"rssi": ble.Rssi,
-								},
-								time.Unix(int64(msg.MessageHeader.Timestamp), int64(msg.MessageHeader.TimestampUs)*int64(time.Microsecond)),
-							)
-							if err := writeAPI.WritePoint(context.Background(), p); err != nil {
-								fmt.Printf("Error writing point to InfluxDB: %v\n", err)
-							}
-						}
-					}
-				}
-			}(messageQueue)
+			go writeMessages(writeAPI, messageQueue)
 			messageQueue = messageQueue[:0]
 		}
 	}
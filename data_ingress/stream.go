@@ -0,0 +1,214 @@
+package main
+
+import (
+	"log/slog"
+	"time"
+
+	"github.com/influxdata/influxdb-client-go/v2/api"
+	"github.com/tarm/serial"
+)
+
+// v2 streaming protocol, see common/serial_protocol/serial_protocol.h on the node side
+const (
+	cmdStreamStart = 0x26
+	cmdStreamAck   = 0x27
+	cmdStreamNack  = 0x28
+
+	frameSync0       = 0xA5
+	frameSync1       = 0x5A
+	frameHeaderSize  = 8
+	frameTrailerSize = 2
+	frameTypeData    = 0x01
+	frameTypeCompact = 0x02
+	frameTypeText    = 0x03
+	frameMaxText     = 200 // SERIAL_FRAME_MAX_TEXT
+	codecMinRecord   = 3   // BATCH_CODEC_MIN_RECORD_SIZE
+
+	streamFlagCompact = 0x80
+	streamMaxWindow   = 32
+	streamBatchSize   = 16 // SERIAL_STREAM_BATCH_SIZE of the root, unless serial.batch_size says otherwise
+
+	streamIdleTimeout = 2 * time.Second       // Restart the stream when nothing arrives for this long
+	streamNackHoldoff = 50 * time.Millisecond // Minimum time between two NACKs for the same gap
+)
+
+type streamReceiver struct {
+	port      *serial.Port
+	window    byte
+	compact   bool
+	batchSize int
+	buffer    []byte
+	expected  uint16
+	synced    bool // False until the first frame after a start, its seq becomes the expected one
+	lastFrame time.Time
+	lastNack  time.Time
+
+	frames   uint64
+	messages uint64
+	gaps     uint64
+	crcErrs  uint64
+	bytes    uint64
+}
+
+func (r *streamReceiver) send(command byte, seq uint16) {
+	if _, err := r.port.Write([]byte{command, byte(seq), byte(seq >> 8)}); err != nil {
+		slog.Error("Failed to write to serial port", "err", err)
+	}
+}
+
+func (r *streamReceiver) start() {
+	slog.Info("Starting v2 stream", "window", r.window, "compact", r.compact)
+	argument := r.window
+	if r.compact {
+		argument |= streamFlagCompact
+	}
+	if _, err := r.port.Write([]byte{cmdStreamStart, argument}); err != nil {
+		slog.Error("Failed to send stream start", "err", err)
+	}
+	r.synced = false
+	r.lastFrame = time.Now()
+}
+
+func (r *streamReceiver) nack() {
+	if time.Since(r.lastNack) < streamNackHoldoff {
+		return
+	}
+	r.lastNack = time.Now()
+	r.send(cmdStreamNack, r.expected)
+}
+
+// plausible rejects a header no root can send. It has no check of its own, so a flipped bit in length would
+// otherwise hold the parser for up to 64 kB before the CRC fails
+func (r *streamReceiver) plausible(header []byte) bool {
+	count := int(header[3])
+	length := int(header[6]) | int(header[7])<<8
+	switch header[2] {
+	case frameTypeData:
+		return count > 0 && count <= r.batchSize && length == count*messageSize
+	case frameTypeCompact:
+		// Compact frames fill the payload of a raw one with as many records as fit, count is not bounded by the batch size
+		return count > 0 && length <= r.batchSize*messageSize && length >= count*codecMinRecord
+	case frameTypeText:
+		return count == 0 && length <= frameMaxText
+	}
+	return false
+}
+
+// parse consumes complete frames from the buffer and returns the decoded messages of in-order frames
+func (r *streamReceiver) parse() []Message {
+	var messages []Message
+	for {
+		// Resynchronise on the frame marker, anything in between (debug output, v1 ack bytes) is dropped
+		start := 0
+		for start+1 < len(r.buffer) && !(r.buffer[start] == frameSync0 && r.buffer[start+1] == frameSync1) {
+			start++
+		}
+		r.buffer = r.buffer[start:]
+		if len(r.buffer) < frameHeaderSize {
+			return messages
+		}
+		if !r.plausible(r.buffer[:frameHeaderSize]) {
+			r.buffer = r.buffer[1:]
+			continue
+		}
+		length := int(r.buffer[6]) | int(r.buffer[7])<<8
+		size := frameHeaderSize + length + frameTrailerSize
+		if len(r.buffer) < size {
+			return messages
+		}
+		frame := r.buffer[:size]
+		expectedChecksum := uint16(frame[size-2]) | uint16(frame[size-1])<<8
+		if checksumCalculator(frame[2:size-2], size-4) != expectedChecksum {
+			// Could also be a false sync marker inside a frame, skip one byte and look again. The node is still
+			// sending, a restart now would take a frame that was already on its way as the new start of the sequence
+			r.crcErrs++
+			r.lastFrame = time.Now()
+			r.buffer = r.buffer[1:]
+			r.nack()
+			continue
+		}
+		r.buffer = r.buffer[size:]
+		r.lastFrame = time.Now()
+
+		if frame[2] == frameTypeText {
+			// Status line from the node, outside the sequence space
+			slog.Info("Node report", "text", string(frame[frameHeaderSize:size-frameTrailerSize]))
+			continue
+		}
+
+		seq := uint16(frame[4]) | uint16(frame[5])<<8
+		if !r.synced {
+			r.expected = seq
+			r.synced = true
+		}
+		switch {
+		case seq == r.expected:
+			switch frame[2] {
+			case frameTypeData:
+				batch := decodeBatch(frame[frameHeaderSize : size-frameTrailerSize])
+				messages = append(messages, batch...)
+				r.messages += uint64(frame[3])
+			case frameTypeCompact:
+				batch := decodeCompactBatch(frame[frameHeaderSize:size-frameTrailerSize], int(frame[3]))
+				messages = append(messages, batch...)
+				r.messages += uint64(frame[3])
+			}
+			r.bytes += uint64(size)
+			r.frames++
+			r.expected++
+			r.send(cmdStreamAck, seq)
+		case int16(seq-r.expected) > 0:
+			// Gap, everything after it is dropped until the node goes back to the missing frame
+			r.gaps++
+			r.nack()
+		default:
+			// Retransmission of a frame we already have, the ack was probably lost
+			r.send(cmdStreamAck, r.expected-1)
+		}
+	}
+}
+
+func runStream(s *serial.Port, config *Config, writeAPI api.WriteAPIBlocking) {
+	window := config.Serial.Window
+	if window <= 0 || window > streamMaxWindow {
+		window = 8
+	}
+	batchSize := config.Serial.BatchSize
+	if batchSize <= 0 || batchSize > 255 {
+		batchSize = streamBatchSize
+	}
+	r := &streamReceiver{port: s, window: byte(window), compact: config.Serial.Compact, batchSize: batchSize}
+	r.start()
+
+	messageQueue := make([]Message, 0)
+	response := make([]byte, 4096)
+	lastReport := time.Now()
+	for {
+		n, err := s.Read(response)
+		if err != nil && n == 0 {
+			slog.Debug("Serial read returned no data", "err", err)
+		}
+		r.buffer = append(r.buffer, response[:n]...)
+		messageQueue = append(messageQueue, r.parse()...)
+
+		if time.Since(r.lastFrame) > streamIdleTimeout {
+			r.start()
+		}
+
+		if len(messageQueue) >= 2 {
+			go writeMessages(writeAPI, messageQueue)
+			messageQueue = make([]Message, 0)
+		}
+
+		if time.Since(lastReport) > 10*time.Second {
+			elapsed := time.Since(lastReport).Seconds()
+			bytesPerMessage := 0.0
+			if r.messages > 0 {
+				bytesPerMessage = float64(r.bytes) / float64(r.messages)
+			}
+			slog.Info("Stream statistics", "frames", r.frames, "messages", r.messages, "messagesPerSecond", float64(r.messages)/elapsed, "bytesPerMessage", bytesPerMessage, "gaps", r.gaps, "crcErrors", r.crcErrs)
+			r.frames, r.messages, r.gaps, r.crcErrs, r.bytes = 0, 0, 0, 0, 0
+			lastReport = time.Now()
+		}
+	}
+}
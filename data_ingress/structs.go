@@ -3,8 +3,8 @@ package main
 type MessageHeader struct {
 	Type        uint32  // message_type_t type
 	ID          uint8  // uint8_t id
-  Buffer      uint16  // uint8_t id
-  Buffer2     uint8  // uint8_t id
+  Buffer      uint8  // padding
+  Seq         uint16 // uint16_t seq
 	Timestamp   uint32 // unsigned long timestamp
 	TimestampUs uint32 // unsigned long timestamp_us
 }
@@ -39,10 +39,18 @@ type DeviceRSSI struct {
 	Rssi       uint8
 }
 
+// AudioBands mirrors AudioBands in node/lib/globals/data_packaging.h
+type AudioBands struct {
+	Mode  uint8     // 0 none, 1 Goertzel filters, 2 octaves, 3 third octaves, bit 7 set if A-weighted
+	Count uint8     // Valid entries of Level
+	Level [22]uint8 // 0.5 dB steps relative to one LSB
+}
+
 type OutputData struct {
 	MicrophoneData   MicrophoneData
 	AccelerometerData AccelerometerData
 	BleData          [10]DeviceRSSI
+	AudioBands       AudioBands
 }
 
 type Message struct {
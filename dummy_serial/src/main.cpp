@@ -1,8 +1,50 @@
 #include <Arduino.h>
+#include "serial_protocol.h"
+#include "crc16.h"
+#include "batch_codec.h"
+#include "latency_histogram.h"
+#include "spsc_ring.h"
+#include "esp_timer.h"
 
 #define MESSAGE_LENGTH sizeof(message_t)
-#define QUEUE_SIZE 150 // Increased queue size to handle more messages
+#define QUEUE_SIZE 128 // Messages between the load generator and loop(), a power of two so SpscRing uses all of it
 #define BATCH_SIZE 50  // Further reduced batch size for reliability
+#define STREAM_BATCH_SIZE 16
+#define STREAM_WINDOW 8
+#define STREAM_RETRANSMIT_TIMEOUT 500
+
+// Load generator, every setting can be overridden from build_flags
+#define LOAD_CONSTANT 0
+#define LOAD_RAMP 1
+#define LOAD_BURST 2
+#ifndef LOAD_PROFILE
+#define LOAD_PROFILE LOAD_CONSTANT
+#endif
+#ifndef LOAD_RATE
+#define LOAD_RATE 500 // Messages per second. Start of a ramp, rate between bursts
+#endif
+#ifndef LOAD_RAMP_RATE
+#define LOAD_RAMP_RATE 4000 // Rate at the end of a ramp
+#endif
+#ifndef LOAD_RAMP_PERIOD
+#define LOAD_RAMP_PERIOD 60 // Seconds from LOAD_RATE to LOAD_RAMP_RATE, then the ramp starts over
+#endif
+#ifndef LOAD_BURST_RATE
+#define LOAD_BURST_RATE 5000 // Rate during a burst
+#endif
+#ifndef LOAD_BURST_LENGTH
+#define LOAD_BURST_LENGTH 200 // Milliseconds
+#endif
+#ifndef LOAD_BURST_PERIOD
+#define LOAD_BURST_PERIOD 2000 // Milliseconds from the start of one burst to the next
+#endif
+#ifndef LOAD_NODES
+#define LOAD_NODES 8 // Simulated node ids 1..LOAD_NODES, messages are sent round robin
+#endif
+#ifndef LOAD_REPORT_INTERVAL
+#define LOAD_REPORT_INTERVAL 5000 // Milliseconds between two reports (v2 text frames)
+#endif
+#define LOAD_EPOCH 1700000000 // Timestamps start here, the host drops messages with timestamps below 1000
 struct MicrophoneData
 {
   uint16_t avgDb;
@@ -21,9 +63,24 @@ struct DeviceRSSI
   uint8_t deviceName; // Last three digits of the device name
   uint8_t rssi;       // RSSI value
 };
+#define AUDIO_BANDS_MAX 22
+#define AUDIO_BANDS_NONE 0
+#define AUDIO_BANDS_GOERTZEL 1
+#define AUDIO_BANDS_THIRD_OCTAVE 3
+#define AUDIO_BANDS_A_WEIGHTED 0x80
+struct AudioBands
+{
+  uint8_t mode;
+  uint8_t count;
+  uint8_t level[AUDIO_BANDS_MAX]; // 0.5 dB steps
+};
 
-unsigned long missed = 0;
-unsigned long total = 0;
+// Written by the generator task, read by loop()
+volatile uint32_t offered = 0;
+volatile uint32_t offeredRate = 0;
+// Written and read by loop()
+uint32_t delivered = 0;
+LatencyHistogram ackLatency;
 
 // Struct to hold BLE data (top 10 devices and their RSSI)
 // struct BLEData
@@ -37,6 +94,7 @@ struct OutputData
   MicrophoneData microphoneData;
   AccelerometerData accelerometerData;
   DeviceRSSI bleData[10];
+  AudioBands audioBands;
 };
 typedef enum // Enumeration of possible status of sent ESP-NOW message.
 {
@@ -51,6 +109,7 @@ typedef struct
 {
   message_type_t type;
   uint8_t id;
+  uint16_t seq;
   unsigned long timestamp;
   unsigned long timestamp_us;
 } message_header_t;
@@ -69,89 +128,245 @@ typedef struct
 
 message_t message;
 
-message_t messageQueue[QUEUE_SIZE];
-uint8_t queueHead = 0;
-uint8_t queueTail = 0;
+// Filled by the load generator task, drained by loop(). Counts the messages it had to drop
+SpscRing<message_t> messageQueue;
+
+bool enqueueMessage(const message_t &message)
+{
+  return messageQueue.push(message);
+}
 
-bool isQueueFull()
+bool dequeueMessage(message_t &message)
 {
-  return ((queueHead + 1) % QUEUE_SIZE) == queueTail;
+  return messageQueue.pop(message);
 }
 
-bool isQueueEmpty()
+SerialStreamSender streamSender;
+BatchEncoder batchEncoder;
+
+size_t streamWrite(const uint8_t *data, size_t length)
 {
-  return queueHead == queueTail;
+  return Serial.write(data, length);
 }
 
-bool enqueueMessage(const message_t &message)
+uint32_t streamMillis()
 {
-  if (isQueueFull())
+  return millis();
+}
+
+bool streamDequeue(uint8_t *data)
+{
+  message_t next;
+  if (!dequeueMessage(next))
   {
     return false;
   }
-  messageQueue[queueHead] = message;
-  queueHead = (queueHead + 1) % QUEUE_SIZE;
+  memcpy(data, &next, MESSAGE_LENGTH);
   return true;
 }
 
-bool dequeueMessage(message_t &message)
+size_t streamEncode(const uint8_t *data, bool first, uint8_t *out, size_t capacity)
 {
-  if (isQueueEmpty())
+  batch_codec_record_t record;
+  batchCodecFromMessage(data, record);
+  if (first)
   {
-    return false;
+    batchEncoder.begin();
   }
-  message = messageQueue[queueTail];
-  queueTail = (queueTail + 1) % QUEUE_SIZE;
-  return true;
+  return batchEncoder.encode(record, out, capacity);
 }
 
-uint16_t checksumCalculator(uint8_t *data, uint16_t length)
+void streamAcked(uint8_t count, uint32_t latency)
 {
-  uint16_t crc = 0xFFFF;        // Initial value
-  uint16_t polynomial = 0x1021; // Polynomial used in CRC-16-CCITT
+  delivered += count;
+  ackLatency.record(latency);
+}
 
-  for (uint16_t i = 0; i < length; i++)
+// v2: handle acks and commands that arrived since the last call, then push frames while the window allows
+void processStream()
+{
+  while (Serial.available() > 0)
   {
-    crc ^= (data[i] << 8); // XOR the highest byte with the data byte
-
-    for (uint8_t bit = 0; bit < 8; bit++)
+    uint8_t command = Serial.read();
+    switch (command)
     {
-      if (crc & 0x8000)
+    case SERIAL_CMD_STREAM_ACK:
+    case SERIAL_CMD_STREAM_NACK:
+    {
+      uint8_t buffer[2];
+      if (Serial.readBytes(buffer, 2) != 2)
+      {
+        break;
+      }
+      uint16_t seq = buffer[0] | (buffer[1] << 8);
+      if (command == SERIAL_CMD_STREAM_ACK)
       {
-        crc = (crc << 1) ^ polynomial;
+        streamSender.onAck(seq);
       }
       else
       {
-        crc <<= 1;
+        streamSender.onNack(seq);
       }
+      break;
+    }
+    case SERIAL_CMD_STREAM_START:
+    {
+      uint8_t window = 0;
+      Serial.readBytes(&window, 1);
+      streamSender.start(window & SERIAL_STREAM_WINDOW_MASK, window & SERIAL_STREAM_FLAG_COMPACT);
+      break;
+    }
+    case SERIAL_CMD_STREAM_STOP:
+    {
+      streamSender.stop();
+      return;
+    }
+    case SERIAL_CMD_TIME_SET:
+    {
+      uint8_t buffer[8];
+      Serial.readBytes(buffer, 8);
+      Serial.write(SERIAL_CMD_ACK);
+      break;
     }
+    default:
+      break;
+    }
+  }
+  streamSender.pump();
+}
+
+typedef struct // Random walk state of a simulated node
+{
+  uint8_t id;
+  uint16_t seq;
+  float db;
+  float frequency;
+  float roll;
+  float pitch;
+  float yaw;
+  uint8_t devices;
+} simulated_node_t;
+
+float noise(float amplitude)
+{
+  return amplitude * random(-1000, 1001) / 1000.0f;
+}
+
+void simulateMessage(simulated_node_t &node, message_t &message)
+{
+  node.db = constrain(node.db + noise(1.5f), 35.0f, 95.0f);
+  node.frequency = constrain(node.frequency + noise(60.0f), 80.0f, 4000.0f);
+  node.roll = constrain(node.roll + noise(0.5f), -30.0f, 30.0f);
+  node.pitch = constrain(node.pitch + noise(0.5f), -30.0f, 30.0f);
+  node.yaw += noise(0.2f);
+  if (random(100) == 0)
+  {
+    node.devices = constrain(node.devices + random(-1, 2), 0, 5);
+  }
+
+  uint64_t now = esp_timer_get_time();
+  memset(&message, 0, sizeof(message));
+  message.message_header.type = DATA;
+  message.message_header.id = node.id;
+  message.message_header.seq = node.seq++;
+  message.message_header.timestamp = LOAD_EPOCH + now / 1000000;
+  message.message_header.timestamp_us = now % 1000000;
+  message.data.microphoneData.avgDb = node.db;
+  message.data.microphoneData.peakFrequency = node.frequency;
+  message.data.microphoneData.zeroCrossingsCount = node.frequency * 2 * 1024 / 16000; // One 1024 sample window at 16 kHz
+  message.data.accelerometerData.roll = node.roll;
+  message.data.accelerometerData.pitch = node.pitch;
+  message.data.accelerometerData.yaw = node.yaw;
+  for (uint8_t i = 0; i < node.devices; i++)
+  {
+    message.data.bleData[i].deviceName = 100 + node.id * 10 + i;
+    message.data.bleData[i].rssi = 50 + random(40);
   }
+  // Odd nodes act as if built with three Goertzel bands, even nodes with A-weighted third octaves
+  bool goertzel = node.id % 2 == 1;
+  message.data.audioBands.mode = goertzel ? AUDIO_BANDS_GOERTZEL : AUDIO_BANDS_THIRD_OCTAVE | AUDIO_BANDS_A_WEIGHTED;
+  message.data.audioBands.count = goertzel ? 3 : AUDIO_BANDS_MAX;
+  for (uint8_t i = 0; i < message.data.audioBands.count; i++)
+  {
+    message.data.audioBands.level[i] = constrain(2 * (node.db - 6 * abs(i - 13) / 3.0f + noise(3.0f)), 0.0f, 255.0f);
+  }
+}
 
-  return crc;
+uint32_t loadRate(uint32_t elapsed)
+{
+#if LOAD_PROFILE == LOAD_RAMP
+  uint32_t phase = elapsed % (LOAD_RAMP_PERIOD * 1000UL);
+  return LOAD_RATE + (int64_t)(LOAD_RAMP_RATE - LOAD_RATE) * phase / (LOAD_RAMP_PERIOD * 1000UL);
+#elif LOAD_PROFILE == LOAD_BURST
+  return elapsed % LOAD_BURST_PERIOD < LOAD_BURST_LENGTH ? LOAD_BURST_RATE : LOAD_RATE;
+#else
+  (void)elapsed;
+  return LOAD_RATE;
+#endif
 }
 
-void createDummyData(void *pv)
+void loadGenerator(void *pv)
 {
+  simulated_node_t nodes[LOAD_NODES];
+  for (uint8_t i = 0; i < LOAD_NODES; i++)
+  {
+    nodes[i] = {.id = (uint8_t)(i + 1), .seq = (uint16_t)random(65536), .db = 55.0f + noise(10.0f), .frequency = 1000.0f + noise(500.0f), .roll = 0, .pitch = 0, .yaw = noise(180.0f), .devices = (uint8_t)random(4)};
+  }
   message_t message;
-  message.message_header.type = DATA;
+  uint8_t next = 0;
+  uint32_t credit = 0; // Thousandths of a message, carries fractional rates over to the next tick
+  uint32_t start = millis();
+  TickType_t wake = xTaskGetTickCount();
 
   while (true)
   {
-    message.message_header.timestamp = missed;
-    message.message_header.timestamp_us = total;
-    total++;
-    if (!enqueueMessage(message))
-    {
-      missed++;
-      delay(2);
-    }
-    else
+    // Fixed 1 ms tick, vTaskDelayUntil catches up after a late wake-up so the average rate holds
+    vTaskDelayUntil(&wake, 1);
+    offeredRate = loadRate(millis() - start);
+    credit += offeredRate;
+    while (credit >= 1000)
     {
-      delay(2);
+      credit -= 1000;
+      simulateMessage(nodes[next], message);
+      next = (next + 1) % LOAD_NODES;
+      offered++;
+      enqueueMessage(message);
     }
   }
 }
 
+// v2 only, a text line would corrupt the v1 batch stream
+void report()
+{
+  static uint32_t last = 0;
+  static uint32_t lastOffered = 0;
+  static uint32_t lastDropped = 0;
+  static uint32_t lastDelivered = 0;
+  uint32_t now = millis();
+  if (now - last < LOAD_REPORT_INTERVAL)
+  {
+    return;
+  }
+  float seconds = (now - last) / 1000.0f;
+  uint32_t currentOffered = offered;
+  uint32_t currentDropped = messageQueue.dropped();
+  uint32_t newOffered = currentOffered - lastOffered;
+  uint32_t newDropped = currentDropped - lastDropped;
+  char line[SERIAL_FRAME_MAX_TEXT];
+  snprintf(line, sizeof(line),
+           "load rate=%lu/s offered=%.0f/s delivered=%.0f/s drop=%.2f%% queued=%u ack_ms p50=%lu p90=%lu p99=%lu max=%lu",
+           (unsigned long)offeredRate, newOffered / seconds, (delivered - lastDelivered) / seconds,
+           newOffered == 0 ? 0.0f : 100.0f * newDropped / newOffered, (unsigned)messageQueue.size(),
+           (unsigned long)ackLatency.percentile(50), (unsigned long)ackLatency.percentile(90),
+           (unsigned long)ackLatency.percentile(99), (unsigned long)ackLatency.max());
+  streamSender.sendText(line);
+  ackLatency.reset();
+  last = now;
+  lastOffered = currentOffered;
+  lastDropped = currentDropped;
+  lastDelivered = delivered;
+}
+
 void setup()
 {
   Serial.begin(115200);
@@ -162,12 +377,34 @@ void setup()
     Serial.read();
   }
 
+  if (!messageQueue.init(QUEUE_SIZE))
+  {
+    Serial.println("Failed to allocate the message queue");
+    while (1)
+    {
+      delay(10);
+    }
+  }
+
   // Send ready byte to indicate ESP32 is ready for communication
   Serial.write(0x01); // Ready byte
 
+  serial_stream_config_t config = {
+      .write = streamWrite,
+      .millis = streamMillis,
+      .dequeue = streamDequeue,
+      .message_size = MESSAGE_LENGTH,
+      .batch_size = STREAM_BATCH_SIZE,
+      .window = STREAM_WINDOW,
+      .retransmit_timeout = STREAM_RETRANSMIT_TIMEOUT,
+      .encode = streamEncode,
+      .max_encoded_size = BATCH_CODEC_MAX_RECORD_SIZE,
+      .acked = streamAcked};
+  streamSender.init(config);
+
   xTaskCreatePinnedToCore(
-      createDummyData,   /* Task */
-      "createDummyData", /* Name of the task */
+      loadGenerator,     /* Task */
+      "loadGenerator",   /* Name of the task */
       10000,             /* Stack size */
       NULL,              /* Parameter of the task */
       1,                 /* Priority of the task */
@@ -177,6 +414,14 @@ void setup()
 
 void loop()
 {
+  if (streamSender.isActive())
+  {
+    processStream();
+    report();
+    delay(1);
+    return;
+  }
+
   static uint8_t resendCount = 0;
   uint8_t messages[MESSAGE_LENGTH * BATCH_SIZE];
   bool send = false;
@@ -206,6 +451,14 @@ void loop()
           Serial.write(0x07);
           delay(10);
         }
+        else if (command == SERIAL_CMD_STREAM_START)
+        {
+          uint8_t window = 0;
+          Serial.readBytes(&window, 1);
+          streamSender.start(window & SERIAL_STREAM_WINDOW_MASK, window & SERIAL_STREAM_FLAG_COMPACT);
+          processStream();
+          return;
+        }
       }
     }
 
@@ -236,7 +489,7 @@ void loop()
 
   if (batchCount > 0)
   {
-    uint16_t crc = checksumCalculator(messages, length);
+    uint16_t crc = crc16_ccitt(messages, length);
     // Serial.write((uint8_t)length);
     Serial.write((uint8_t *)&length, 2);
     Serial.write((uint8_t *)&crc, 2);
@@ -254,6 +507,8 @@ void loop()
         {
           ackReceived = true;
           resendCount = 0;
+          delivered += batchCount;
+          ackLatency.record(millis() - startTime);
           // Serial.write(0x06);
           // delay(1);
           break;
@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "imu_fusion.h"
+
+#define BENCH_GRAVITY 9.80665                 // m/s^2, as used by Mpu6050Fifo::accelScale().
+#define BENCH_ACCEL_LSB (BENCH_GRAVITY / 4096) // MPU6050_RANGE_8_G, as set by setupAccelerometer().
+#define BENCH_GYRO_LSB (M_PI / 180 / 65.5)     // MPU6050_RANGE_500_DEG.
+#define BENCH_ACCEL_NOISE 0.04                 // m/s^2 RMS, 400 ug/sqrt(Hz) at the 21 Hz low pass.
+#define BENCH_GYRO_NOISE 0.002                 // rad/s RMS.
+#define BENCH_SETTLE 2.0                       // Seconds after the start that are not scored.
+#define BENCH_MAX_INV_SQRT_ERROR 5e-6          // Relative.
+#define BENCH_MAX_ATAN2_ERROR 2e-5             // rad.
+#define BENCH_MAX_BIAS_ERROR 0.1               // Relative error of the filter's gyroscope bias estimate at the end of a trace.
+
+typedef struct // Body orientation (in degrees) and linear acceleration in the world frame (in m/s^2) at time t.
+{
+  double roll, pitch, yaw;
+  double accel[3];
+} motion_t;
+
+typedef struct
+{
+  const char *name;
+  double seconds;
+  double bias[3];      // Gyroscope bias left after calibration (in rad/s).
+  double maxTiltError; // Largest roll and pitch RMS error of the filter that passes (in degrees).
+  double maxYawError;  // Same for yaw.
+  motion_t (*motion)(double t);
+} scenario_t;
+
+typedef struct // One sample as the node hands it to processSample(), in m/s^2 and rad/s.
+{
+  float accel[3];
+  float gyro[3];
+  imu_euler_t truth;
+} bench_sample_t;
+
+typedef struct
+{
+  double roll, pitch, yaw; // RMS error (in degrees).
+} bench_error_t;
+
+typedef struct
+{
+  double w, x, y, z;
+} quat_t;
+
+static quat_t multiply(const quat_t &a, const quat_t &b)
+{
+  return {a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+          a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+          a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+          a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w};
+}
+
+static quat_t negate(const quat_t &q)
+{
+  return {-q.w, -q.x, -q.y, -q.z};
+}
+
+// Body to world rotation of yaw, pitch, roll applied in this order
+static quat_t fromEuler(double rollDeg, double pitchDeg, double yawDeg)
+{
+  double r = rollDeg * M_PI / 360, p = pitchDeg * M_PI / 360, y = yawDeg * M_PI / 360;
+  return {cos(r) * cos(p) * cos(y) + sin(r) * sin(p) * sin(y),
+          sin(r) * cos(p) * cos(y) - cos(r) * sin(p) * sin(y),
+          cos(r) * sin(p) * cos(y) + sin(r) * cos(p) * sin(y),
+          cos(r) * cos(p) * sin(y) - sin(r) * sin(p) * cos(y)};
+}
+
+// v in the body frame of a world vector
+static void toBody(const quat_t &q, const double *world, double *body)
+{
+  quat_t v = {0, world[0], world[1], world[2]};
+  quat_t conj = {q.w, -q.x, -q.y, -q.z};
+  quat_t r = multiply(multiply(conj, v), q);
+  body[0] = r.x;
+  body[1] = r.y;
+  body[2] = r.z;
+}
+
+static quat_t orientation(const motion_t &m)
+{
+  return fromEuler(m.roll, m.pitch, m.yaw);
+}
+
+static motion_t stillTilted(double)
+{
+  return {30, -20, 0, {0, 0, 0}};
+}
+
+static motion_t yawLevel(double t)
+{
+  return {0, 0, remainder(90 * t, 360), {0, 0, 0}};
+}
+
+// The body z axis is not vertical, so gz alone is not the yaw rate
+static motion_t yawTilted(double t)
+{
+  return {30, 10, remainder(90 * t, 360), {0, 0, 0}};
+}
+
+// Handling on a bench: slow swings on all axes, a 4 Hz vibration shakes the accelerometer
+static motion_t swing(double t)
+{
+  return {25 * sin(2 * M_PI * 0.5 * t), 15 * sin(2 * M_PI * 0.3 * t), 40 * sin(2 * M_PI * 0.2 * t),
+          {2 * sin(2 * M_PI * 4 * t), 1.5 * sin(2 * M_PI * 4 * t + 1), 0}};
+}
+
+static motion_t stillLevel(double)
+{
+  return {0, 0, 0, {0, 0, 0}};
+}
+
+static const scenario_t scenarios[] = {
+    {"still, tilted", 20, {0, 0, 0}, 0.3, 0.5, stillTilted},
+    {"yaw 90 deg/s, level", 8, {0, 0, 0}, 0.3, 0.5, yawLevel},
+    {"yaw 90 deg/s, tilted", 8, {0, 0, 0}, 0.5, 1.0, yawTilted},
+    {"swing and vibration", 20, {0, 0, 0}, 1.0, 1.0, swing},
+    {"gyroscope bias 1 deg/s", 60, {0.0175, -0.0175, 0}, 0.5, 0.5, stillLevel},
+};
+
+static double wrap(double degrees)
+{
+  return remainder(degrees, 360);
+}
+
+// Sample a motion the way the FIFO delivers it: rate from the change of orientation, specific force from
+// gravity plus linear acceleration, both with noise and bias and rounded to the chip's LSB
+static std::vector<bench_sample_t> makeTrace(const scenario_t &scenario, double rate, uint32_t seed)
+{
+  std::mt19937 random(seed);
+  std::normal_distribution<double> unit(0, 1);
+  std::vector<bench_sample_t> trace((size_t)(scenario.seconds * rate));
+  for (size_t i = 0; i < trace.size(); i++)
+  {
+    double t = i / rate;
+    motion_t m = scenario.motion(t);
+    quat_t q = orientation(m);
+    // The chip low pass filters the rate, so a sample holds the constant rate that turns the previous
+    // orientation into this one
+    quat_t previous = orientation(scenario.motion(t - 1 / rate));
+    quat_t delta = multiply({previous.w, -previous.x, -previous.y, -previous.z}, q);
+    delta = delta.w < 0 ? negate(delta) : delta;
+    double sine = sqrt(delta.x * delta.x + delta.y * delta.y + delta.z * delta.z);
+    double scale = sine > 0 ? 2 * atan2(sine, delta.w) / sine * rate : 2 * rate;
+
+    double world[3] = {m.accel[0], m.accel[1], m.accel[2] + BENCH_GRAVITY};
+    double force[3];
+    toBody(q, world, force);
+    bench_sample_t &sample = trace[i];
+    double rates[3] = {scale * delta.x, scale * delta.y, scale * delta.z};
+    for (int axis = 0; axis < 3; axis++)
+    {
+      double accel = force[axis] + BENCH_ACCEL_NOISE * unit(random);
+      double gyro = rates[axis] + scenario.bias[axis] + BENCH_GYRO_NOISE * unit(random);
+      sample.accel[axis] = (float)(round(accel / BENCH_ACCEL_LSB) * BENCH_ACCEL_LSB);
+      sample.gyro[axis] = (float)(round(gyro / BENCH_GYRO_LSB) * BENCH_GYRO_LSB);
+    }
+    sample.truth = {(float)m.roll, (float)m.pitch, (float)wrap(m.yaw)};
+  }
+  return trace;
+}
+
+// The former accelerometerTask: roll and pitch from each accelerometer sample, yaw from gz alone
+static imu_euler_t formerUpdate(imu_euler_t angles, const bench_sample_t &sample, float dt)
+{
+  float ax = sample.accel[0], ay = sample.accel[1], az = sample.accel[2];
+  angles.roll = atan2(ay, az) * 180 / M_PI;
+  angles.pitch = atan2(-ax, sqrt(ay * ay + az * az)) * 180 / M_PI;
+  angles.yaw = wrap(angles.yaw + sample.gyro[2] * dt * 180 / M_PI);
+  return angles;
+}
+
+static void addError(bench_error_t &error, const imu_euler_t &angles, const imu_euler_t &truth)
+{
+  double roll = wrap(angles.roll - truth.roll);
+  double pitch = angles.pitch - truth.pitch;
+  double yaw = wrap(angles.yaw - truth.yaw);
+  error.roll += roll * roll;
+  error.pitch += pitch * pitch;
+  error.yaw += yaw * yaw;
+}
+
+static void finishError(bench_error_t &error, size_t count)
+{
+  error.roll = count > 0 ? sqrt(error.roll / count) : 0;
+  error.pitch = count > 0 ? sqrt(error.pitch / count) : 0;
+  error.yaw = count > 0 ? sqrt(error.yaw / count) : 0;
+}
+
+// Run both methods over a trace like accelerometerTask does: align on the first sample, one update per sample
+static void runTrace(const std::vector<bench_sample_t> &trace, double rate, size_t settle, bench_error_t &fusionError, bench_error_t &formerError, imu_euler_t *last, float *bias)
+{
+  MahonyFilter filter;
+  filter.init(rate);
+  if (!trace.empty())
+  {
+    filter.align(trace[0].accel[0], trace[0].accel[1], trace[0].accel[2]);
+  }
+  imu_euler_t former = {0, 0, trace.empty() ? 0 : trace[0].truth.yaw};
+  fusionError = formerError = {};
+  size_t scored = 0;
+  // The first sample only aligns, every later one advances by one interval to its own time
+  for (size_t i = 1; i < trace.size(); i++)
+  {
+    const bench_sample_t &sample = trace[i];
+    filter.update(sample.gyro[0], sample.gyro[1], sample.gyro[2], sample.accel[0], sample.accel[1], sample.accel[2]);
+    former = formerUpdate(former, sample, 1 / rate);
+    if (i >= settle)
+    {
+      addError(fusionError, filter.euler(), sample.truth);
+      addError(formerError, former, sample.truth);
+      scored++;
+    }
+  }
+  finishError(fusionError, scored);
+  finishError(formerError, scored);
+  if (last != NULL)
+  {
+    *last = filter.euler();
+  }
+  if (bias != NULL)
+  {
+    filter.bias(bias);
+  }
+}
+
+static bool benchScenarios(double rate, uint32_t seed)
+{
+  bool pass = true;
+  printf("%-24s %-8s %8s %8s %8s\n", "RMS error (deg)", "method", "roll", "pitch", "yaw");
+  for (const scenario_t &scenario : scenarios)
+  {
+    std::vector<bench_sample_t> trace = makeTrace(scenario, rate, seed);
+    bench_error_t fusion, former;
+    float bias[3];
+    runTrace(trace, rate, (size_t)(BENCH_SETTLE * rate), fusion, former, NULL, bias);
+    bool ok = fusion.roll <= scenario.maxTiltError && fusion.pitch <= scenario.maxTiltError && fusion.yaw <= scenario.maxYawError;
+    pass = pass && ok;
+    printf("%-24s %-8s %8.3f %8.3f %8.3f%s\n", scenario.name, "mahony", fusion.roll, fusion.pitch, fusion.yaw, ok ? "" : "  <- FAIL");
+    printf("%-24s %-8s %8.3f %8.3f %8.3f\n", "", "former", former.roll, former.pitch, former.yaw);
+    // The node moves this estimate into its gyroscope offsets, the horizontal axes must have found the bias
+    if (scenario.bias[0] != 0 || scenario.bias[1] != 0)
+    {
+      bool found = fabs(bias[0] - scenario.bias[0]) <= BENCH_MAX_BIAS_ERROR * fabs(scenario.bias[0]) &&
+                   fabs(bias[1] - scenario.bias[1]) <= BENCH_MAX_BIAS_ERROR * fabs(scenario.bias[1]);
+      pass = pass && found;
+      printf("%-24s %-8s %8.4f %8.4f %8.4f%s\n", "", "bias", bias[0], bias[1], bias[2], found ? "" : "  <- FAIL");
+    }
+  }
+  return pass;
+}
+
+static bool benchFastMath()
+{
+  double invSqrtError = 0;
+  for (double x = 1e-6; x < 1e6; x *= 1.0007)
+  {
+    double error = fabs(imuInvSqrt((float)x) * sqrt((float)x) - 1);
+    invSqrtError = fmax(invSqrtError, error);
+  }
+  double atan2Error = 0;
+  const int steps = 2000;
+  for (int i = 0; i <= steps; i++)
+  {
+    double angle = -M_PI + 2 * M_PI * i / steps;
+    for (double radius : {1e-3, 1.0, 1e3})
+    {
+      float y = (float)(radius * sin(angle)), x = (float)(radius * cos(angle));
+      double error = fabs(remainder(imuAtan2(y, x) - atan2((double)y, (double)x), 2 * M_PI));
+      atan2Error = fmax(atan2Error, error);
+    }
+  }
+  bool ok = invSqrtError <= BENCH_MAX_INV_SQRT_ERROR && atan2Error <= BENCH_MAX_ATAN2_ERROR;
+  printf("imuInvSqrt relative error %.2e, imuAtan2 error %.2e rad%s\n", invSqrtError, atan2Error, ok ? "" : "  <- FAIL");
+  return ok;
+}
+
+template <typename F>
+static double nanosPerCall(uint32_t calls, F run)
+{
+  auto begin = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < calls; i++)
+  {
+    run(i);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+static void benchTiming(double rate, uint32_t iterations, uint32_t seed)
+{
+  std::vector<bench_sample_t> trace = makeTrace(scenarios[3], rate, seed);
+  const uint32_t calls = iterations * (uint32_t)trace.size();
+  MahonyFilter filter;
+  filter.init(rate);
+  volatile float sink = 0;
+  double update = nanosPerCall(calls, [&](uint32_t i)
+                               {
+                                 const bench_sample_t &s = trace[i % trace.size()];
+                                 filter.update(s.gyro[0], s.gyro[1], s.gyro[2], s.accel[0], s.accel[1], s.accel[2]);
+                                 sink = sink + filter.quaternion().w; });
+  double withEuler = nanosPerCall(calls, [&](uint32_t i)
+                                  {
+                                    const bench_sample_t &s = trace[i % trace.size()];
+                                    filter.update(s.gyro[0], s.gyro[1], s.gyro[2], s.accel[0], s.accel[1], s.accel[2]);
+                                    sink = sink + filter.euler().yaw; });
+  imu_euler_t former = {};
+  double formerUpdate_ = nanosPerCall(calls, [&](uint32_t i)
+                                      {
+                                        former = formerUpdate(former, trace[i % trace.size()], 1 / rate);
+                                        sink = sink + former.yaw; });
+  printf("\nMahonyFilter::update() %8.1f ns/sample\n", update);
+  printf("update() and euler()   %8.1f ns/sample (euler() runs once per FIFO read)\n", withEuler);
+  printf("former atan2 update    %8.1f ns/sample\n", formerUpdate_);
+  printf("Host time at %.0f Hz    %8.4f %% of one core\n", rate, 100 * update * rate / 1e9);
+}
+
+// CSV rows of t,ax,ay,az,gx,gy,gz in s, m/s^2 and rad/s, optionally followed by roll,pitch,yaw in degrees
+static bool benchRecorded(const char *path, double rate)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    printf("Cannot open %s\n", path);
+    return false;
+  }
+  std::vector<bench_sample_t> trace;
+  bool hasTruth = true;
+  double first = NAN, previous = NAN, intervals = 0;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != NULL)
+  {
+    double v[10];
+    int fields = sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]);
+    if (fields < 7)
+    {
+      continue; // Header or comment
+    }
+    hasTruth = hasTruth && fields == 10;
+    bench_sample_t sample = {{(float)v[1], (float)v[2], (float)v[3]}, {(float)v[4], (float)v[5], (float)v[6]}, {}};
+    if (fields == 10)
+    {
+      sample.truth = {(float)v[7], (float)v[8], (float)v[9]};
+    }
+    trace.push_back(sample);
+    first = isnan(first) ? v[0] : first;
+    intervals += isnan(previous) ? 0 : 1;
+    previous = v[0];
+  }
+  fclose(file);
+  if (trace.empty())
+  {
+    printf("No samples in %s\n", path);
+    return false;
+  }
+  // The FIFO has a fixed interval, a recorded trace brings its own
+  double traceRate = intervals > 0 && previous > first ? intervals / (previous - first) : rate;
+  bench_error_t fusion, former;
+  imu_euler_t last;
+  runTrace(trace, traceRate, (size_t)(BENCH_SETTLE * traceRate), fusion, former, &last, NULL);
+  printf("\n%s: %u samples at %.1f Hz, final roll %.2f pitch %.2f yaw %.2f\n", path, (unsigned)trace.size(), traceRate, last.roll, last.pitch, last.yaw);
+  bool ok = isfinite(last.roll) && isfinite(last.pitch) && isfinite(last.yaw);
+  if (hasTruth)
+  {
+    printf("%-24s %-8s %8.3f %8.3f %8.3f\n", "RMS error (deg)", "mahony", fusion.roll, fusion.pitch, fusion.yaw);
+    printf("%-24s %-8s %8.3f %8.3f %8.3f\n", "", "former", former.roll, former.pitch, former.yaw);
+  }
+  return ok;
+}
+
+static void usage(const char *name)
+{
+  printf("Usage: %s [options]\n"
+         "  --rate N          samples per second, ACCELEROMETER_SAMPLE_RATE (200)\n"
+         "  --iterations N    passes over a 20 s trace per timing run (20)\n"
+         "  --seed N          noise seed (1)\n"
+         "  --trace FILE      also run a recorded CSV trace: t,ax,ay,az,gx,gy,gz[,roll,pitch,yaw]\n",
+         name);
+}
+
+int main(int argc, char **argv)
+{
+  double rate = 200;
+  uint32_t iterations = 20;
+  uint32_t seed = 1;
+  const char *tracePath = NULL;
+
+  static const struct option options[] = {
+      {"rate", required_argument, NULL, 'r'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"seed", required_argument, NULL, 's'},
+      {"trace", required_argument, NULL, 't'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'i':
+      iterations = (uint32_t)atoi(optarg);
+      break;
+    case 's':
+      seed = (uint32_t)atoi(optarg);
+      break;
+    case 't':
+      tracePath = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return option == 'h' ? 0 : 2;
+    }
+  }
+  if (rate <= 0 || iterations == 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  bool pass = benchFastMath();
+  printf("\n");
+  pass = benchScenarios(rate, seed) && pass;
+  if (tracePath != NULL)
+  {
+    pass = benchRecorded(tracePath, rate) && pass;
+  }
+  benchTiming(rate, iterations, seed);
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+// Host stand-in for the parts of Arduino.h the libraries under test use. String keeps its characters in one
+// heap block like the Arduino WString, so it allocates as often as the real one.
+
+#include "stdint.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+class String
+{
+public:
+  String(const char *text = "") { _assign(text, strlen(text)); }
+  String(const String &other) { _assign(other._buffer, other._length); }
+  ~String() { free(_buffer); }
+
+  String &operator=(const String &other)
+  {
+    if (this != &other)
+    {
+      free(_buffer);
+      _assign(other._buffer, other._length);
+    }
+    return *this;
+  }
+
+  const char *c_str() const { return _buffer != NULL ? _buffer : ""; }
+  unsigned int length() const { return _length; }
+
+  void toCharArray(char *buf, unsigned int size) const
+  {
+    if (size == 0)
+    {
+      return;
+    }
+    unsigned int n = _length < size - 1 ? _length : size - 1;
+    memcpy(buf, c_str(), n);
+    buf[n] = '\0';
+  }
+
+private:
+  void _assign(const char *text, unsigned int length)
+  {
+    _length = length;
+    _buffer = NULL;
+    if (length > 0)
+    {
+      _buffer = (char *)malloc(length + 1);
+      memcpy(_buffer, text, length + 1);
+    }
+  }
+
+  char *_buffer = NULL;
+  unsigned int _length = 0;
+};
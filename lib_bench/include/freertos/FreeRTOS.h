@@ -0,0 +1,26 @@
+#pragma once
+
+// Host stand-in for the parts of FreeRTOS.h the libraries under test use. A critical section is a spin lock,
+// so a library shared between two threads stays correct.
+
+#include "stdint.h"
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFF
+
+typedef struct
+{
+  volatile int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+#define taskENTER_CRITICAL(mux)                                   \
+  while (__atomic_exchange_n(&(mux)->locked, 1, __ATOMIC_ACQUIRE)) \
+  {                                                               \
+  }
+#define taskEXIT_CRITICAL(mux) __atomic_store_n(&(mux)->locked, 0, __ATOMIC_RELEASE)
@@ -0,0 +1,25 @@
+#pragma once
+
+// Host stand-in for the FreeRTOS mutex API, backed by std::mutex.
+
+#include <mutex>
+#include "freertos/FreeRTOS.h"
+
+typedef std::mutex *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new std::mutex();
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t)
+{
+  mutex->lock();
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+  mutex->unlock();
+  return pdTRUE;
+}
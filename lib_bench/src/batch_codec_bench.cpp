@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "bench.h"
+#include "batch_codec.h"
+
+#define CODEC_MESSAGE_SIZE 80                                           // sizeof(message_t), what a raw DATA frame carries per message.
+#define CODEC_FRAME_OVERHEAD 10                                         // SERIAL_FRAME_HEADER_SIZE + SERIAL_FRAME_TRAILER_SIZE.
+#define CODEC_BATCH_SIZE 16                                             // SERIAL_STREAM_BATCH_SIZE of the root.
+#define CODEC_PAYLOAD_CAPACITY (CODEC_BATCH_SIZE * CODEC_MESSAGE_SIZE) // A compact frame fills what a raw one carries.
+#define CODEC_MESSAGES 8000                                             // Messages per configuration.
+#define CODEC_THIRD_OCTAVE_A 0x83                                       // AUDIO_BANDS_THIRD_OCTAVE | AUDIO_BANDS_A_WEIGHTED.
+
+typedef struct // Random walk of one node, as simulateMessage() of dummy_serial.
+{
+  double db;
+  double frequency;
+  double roll, pitch, yaw;
+  uint8_t devices;
+  uint32_t phase_us; // Offset of its once per second report.
+} codec_source_t;
+
+typedef struct
+{
+  uint8_t sources;
+  bool distinctIds; // Slots 0..sources-1 as the root stamps them into header.id, otherwise 0 as sensorTask sends.
+  uint8_t bandMode;
+} codec_config_t;
+
+static volatile size_t codecSink; // Keeps the timed results alive
+
+static std::vector<batch_codec_record_t> generate(const codec_config_t &config, uint32_t seed)
+{
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0, 1);
+  std::vector<codec_source_t> sources(config.sources);
+  for (codec_source_t &source : sources)
+  {
+    source = {.db = 55 + 5 * noise(random), .frequency = 1000 + 300 * noise(random), .roll = 0, .pitch = 0,
+              .yaw = 90 * noise(random), .devices = (uint8_t)(random() % 4), .phase_us = (uint32_t)(random() % 1000000)};
+  }
+  std::vector<batch_codec_record_t> records;
+  uint32_t second = 1700000000;
+  while (records.size() < CODEC_MESSAGES)
+  {
+    for (uint8_t i = 0; i < config.sources; ++i)
+    {
+      codec_source_t &source = sources[i];
+      source.db = fmin(fmax(source.db + 1.5 * noise(random), 35), 95);
+      source.frequency = fmin(fmax(source.frequency + 60 * noise(random), 80), 4000);
+      source.roll = fmin(fmax(source.roll + 0.5 * noise(random), -30), 30);
+      source.pitch = fmin(fmax(source.pitch + 0.5 * noise(random), -30), 30);
+      source.yaw += 0.2 * noise(random);
+
+      batch_codec_record_t record = {};
+      record.type = BATCH_CODEC_TYPE_DATA;
+      record.id = config.distinctIds ? i : 0;
+      record.timestamp = second;
+      record.timestamp_us = (source.phase_us + (uint32_t)(random() % 2000)) % 1000000;
+      record.avg_db = (uint16_t)source.db;
+      record.peak_frequency = (uint16_t)source.frequency;
+      record.zero_crossings = (uint16_t)(source.frequency * 2 * 1024 / 16000);
+      record.roll = (float)source.roll;
+      record.pitch = (float)source.pitch;
+      record.yaw = (float)source.yaw;
+      record.ble_count = BATCH_CODEC_MAX_BLE;
+      for (uint8_t d = 0; d < source.devices; ++d)
+      {
+        record.ble[d].device_name = 100 + i * 10 + d;
+        record.ble[d].rssi = 50 + random() % 40;
+      }
+      record.band_mode = config.bandMode;
+      record.band_count = config.bandMode == 0 ? 0 : BATCH_CODEC_MAX_BANDS;
+      for (uint8_t b = 0; b < record.band_count; ++b)
+      {
+        record.bands[b] = (uint8_t)fmin(fmax(2 * (source.db - 6 * abs(b - 13) / 3.0 + 3 * noise(random)), 0), 255);
+      }
+      records.push_back(record);
+    }
+    ++second;
+  }
+  records.resize(CODEC_MESSAGES);
+  return records;
+}
+
+static bool sameRecord(const batch_codec_record_t &sent, const batch_codec_record_t &got)
+{
+  const float step = 1.0f / BATCH_CODEC_ANGLE_SCALE;
+  uint8_t bleCount = 0;
+  for (uint8_t d = 0; d < BATCH_CODEC_MAX_BLE; ++d)
+  {
+    bleCount = sent.ble[d].device_name != 0 || sent.ble[d].rssi != 0 ? d + 1 : bleCount;
+  }
+  return sent.type == got.type && sent.id == got.id && sent.timestamp == got.timestamp &&
+         sent.timestamp_us == got.timestamp_us && sent.avg_db == got.avg_db &&
+         sent.peak_frequency == got.peak_frequency && sent.zero_crossings == got.zero_crossings &&
+         fabsf(sent.roll - got.roll) <= step / 2 + 1e-4f && fabsf(sent.pitch - got.pitch) <= step / 2 + 1e-4f &&
+         fabsf(sent.yaw - got.yaw) <= step / 2 + 1e-4f && got.ble_count == bleCount &&
+         memcmp(sent.ble, got.ble, sizeof(sent.ble)) == 0 && sent.band_mode == got.band_mode &&
+         sent.band_count == got.band_count && memcmp(sent.bands, got.bands, sent.band_count) == 0;
+}
+
+typedef struct
+{
+  size_t offset;  // Into the encoded stream.
+  size_t length;  // Payload bytes.
+  uint32_t first; // Index of the first record.
+  uint8_t count;
+} codec_frame_t;
+
+// Fill a frame the way SerialStreamSender does: records until less than BATCH_CODEC_MAX_RECORD_SIZE is left
+static codec_frame_t encodeFrame(BatchEncoder &encoder, const std::vector<batch_codec_record_t> &records, uint32_t first,
+                                 uint8_t *payload)
+{
+  codec_frame_t frame = {.offset = 0, .length = 0, .first = first, .count = 0};
+  while (frame.count < UINT8_MAX && CODEC_PAYLOAD_CAPACITY - frame.length >= BATCH_CODEC_MAX_RECORD_SIZE &&
+         first + frame.count < records.size())
+  {
+    if (frame.count == 0)
+    {
+      encoder.begin();
+    }
+    frame.length += encoder.encode(records[first + frame.count], payload + frame.length,
+                                   CODEC_PAYLOAD_CAPACITY - frame.length);
+    ++frame.count;
+  }
+  return frame;
+}
+
+static bool runConfig(const codec_config_t &config, uint32_t seed, uint32_t repeats)
+{
+  std::vector<batch_codec_record_t> records = generate(config, seed);
+  std::vector<uint8_t> stream;
+  std::vector<codec_frame_t> frames;
+  BatchEncoder encoder;
+  BatchDecoder decoder;
+
+  // Encode everything once for the sizes, then decode it with the reference decoder
+  uint8_t payload[CODEC_PAYLOAD_CAPACITY];
+  for (uint32_t next = 0; next < records.size();)
+  {
+    codec_frame_t frame = encodeFrame(encoder, records, next, payload);
+    frame.offset = stream.size();
+    stream.insert(stream.end(), payload, payload + frame.length);
+    frames.push_back(frame);
+    next += frame.count;
+  }
+  uint32_t mismatches = 0;
+  for (const codec_frame_t &frame : frames)
+  {
+    decoder.begin();
+    size_t used = 0;
+    for (uint8_t i = 0; i < frame.count; ++i)
+    {
+      batch_codec_record_t got;
+      size_t n = decoder.decode(stream.data() + frame.offset + used, frame.length - used, got);
+      mismatches += n == 0 || !sameRecord(records[frame.first + i], got);
+      used += n == 0 ? frame.length - used : n;
+    }
+    mismatches += used != frame.length;
+  }
+
+  // Timed passes over all frames
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < repeats; ++r)
+  {
+    for (const codec_frame_t &frame : frames)
+    {
+      codecSink = encodeFrame(encoder, records, frame.first, payload).length;
+    }
+  }
+  double encodeNs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / ((double)repeats * frames.size());
+  start = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < repeats; ++r)
+  {
+    for (const codec_frame_t &frame : frames)
+    {
+      batch_codec_record_t got;
+      size_t used = 0;
+      decoder.begin();
+      for (uint8_t i = 0; i < frame.count; ++i)
+      {
+        used += decoder.decode(stream.data() + frame.offset + used, frame.length - used, got);
+      }
+      codecSink = used + got.avg_db;
+    }
+  }
+  double decodeNs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / ((double)repeats * frames.size());
+
+  double perFrame = (double)records.size() / frames.size();
+  double raw = CODEC_MESSAGE_SIZE + (double)CODEC_FRAME_OVERHEAD / CODEC_BATCH_SIZE;
+  double compact = (double)(stream.size() + frames.size() * CODEC_FRAME_OVERHEAD) / records.size();
+  char ids[8];
+  snprintf(ids, sizeof(ids), config.distinctIds ? "0..%u" : "0", config.sources - 1);
+  printf("  %7u %-6s %-10s %9.1f %6.2f %10.1f %9.0f %6.0f %9.0f\n", config.sources, ids,
+         config.bandMode == 0 ? "none" : "1/3 oct A", compact, compact / raw, perFrame, encodeNs, encodeNs / perFrame,
+         decodeNs);
+  return benchExpect(mismatches == 0, "reference decoder returns the encoded records");
+}
+
+bool benchBatchCodec(const bench_options_t &options)
+{
+  static const codec_config_t configs[] = {
+      {1, false, 0},
+      {4, true, 0},
+      {4, false, 0},
+      {8, true, 0},
+      {8, false, 0},
+      {8, true, CODEC_THIRD_OCTAVE_A},
+      {8, false, CODEC_THIRD_OCTAVE_A},
+      {20, true, 0},
+      {20, false, 0},
+  };
+  uint32_t repeats = options.iterations / 10000;
+  repeats = repeats == 0 ? 1 : repeats;
+  printf("  %7s %-6s %-10s %9s %6s %10s %9s %6s %9s\n", "sources", "ids", "bands", "bytes/msg", "ratio", "msgs/frame",
+         "encode ns", "ns/msg", "decode ns");
+  bool ok = true;
+  for (const codec_config_t &config : configs)
+  {
+    ok = runConfig(config, options.seed, repeats) && ok;
+  }
+  printf("  (bytes/msg include the frame header and CRC, ratio is to raw frames of %u x %u bytes, ns per frame)\n",
+         CODEC_BATCH_SIZE, CODEC_MESSAGE_SIZE);
+  return ok;
+}
@@ -0,0 +1,27 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "stdint.h"
+
+typedef struct
+{
+  uint32_t iterations; // Repetitions of every timed loop.
+  uint32_t seed;       // Seed of the random inputs.
+} bench_options_t;
+
+/**
+ * @brief Print what failed if condition is false.
+ *
+ * @return condition
+ */
+bool benchExpect(bool condition, const char *what);
+
+bool benchSequenceTracker(const bench_options_t &options);
+bool benchSpscRing(const bench_options_t &options);
+bool benchCrc16(const bench_options_t &options);
+bool benchEsp32Time(const bench_options_t &options);
+bool benchBatchCodec(const bench_options_t &options);
+bool checkFlashSpool(const bench_options_t &options);
+bool checkI2cBurst(const bench_options_t &options);
+
+#endif
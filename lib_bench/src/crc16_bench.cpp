@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "bench.h"
+#include "crc16.h"
+
+#define BENCH_CRC16_CHECK 0x29B1 // CRC-16/CCITT-FALSE of "123456789".
+
+static volatile uint16_t crcSink; // Keeps the timed results alive
+
+typedef uint16_t (*crc16_kernel_t)(uint16_t crc, const uint8_t *data, size_t length);
+
+typedef struct
+{
+  const char *name;
+  crc16_kernel_t kernel;
+} crc16_variant_t;
+
+static const crc16_variant_t variants[] = {
+    {"bitwise", crc16_ccitt_update_bitwise},
+    {"table", crc16_ccitt_update_table},
+    {"slice4", crc16_ccitt_update_slice4},
+};
+
+static bool checkValue()
+{
+  const uint8_t check[] = "123456789";
+  bool ok = true;
+  for (const crc16_variant_t &variant : variants)
+  {
+    uint16_t crc = variant.kernel(CRC16_CCITT_INIT, check, 9);
+    if (crc != BENCH_CRC16_CHECK)
+    {
+      printf("  %s: check value 0x%04X, expected 0x%04X\n", variant.name, crc, BENCH_CRC16_CHECK);
+      ok = false;
+    }
+  }
+  ok = benchExpect(crc16_ccitt(check, 9) == BENCH_CRC16_CHECK, "crc16_ccitt() check value") && ok;
+  ok = benchExpect(crc16_ccitt(check, 0) == CRC16_CCITT_INIT, "empty input leaves the initial value") && ok;
+  return ok;
+}
+
+// Random lengths at every alignment, whole and split into random chunks
+static bool checkRandom(uint32_t seed)
+{
+  std::mt19937 random(seed);
+  std::vector<uint8_t> buffer(4096 + 3);
+  for (uint8_t &byte : buffer)
+  {
+    byte = (uint8_t)random();
+  }
+  uint32_t mismatches = 0;
+  for (uint32_t round = 0; round < 2000; ++round)
+  {
+    size_t offset = round % 4;
+    size_t length = round < 300 ? round : random() % 4096;
+    const uint8_t *data = buffer.data() + offset;
+    uint16_t start = round % 2 ? CRC16_CCITT_INIT : (uint16_t)random();
+    uint16_t reference = crc16_ccitt_update_bitwise(start, data, length);
+    for (const crc16_variant_t &variant : variants)
+    {
+      mismatches += variant.kernel(start, data, length) != reference;
+      uint16_t crc = start;
+      size_t done = 0;
+      while (done < length)
+      {
+        size_t chunk = 1 + random() % 40;
+        chunk = chunk < length - done ? chunk : length - done;
+        crc = variant.kernel(crc, data + done, chunk);
+        done += chunk;
+      }
+      mismatches += crc != reference;
+    }
+    // The incremental API the serial code streams through
+    uint16_t crc = start;
+    for (size_t done = 0; done < length; ++done)
+    {
+      crc = crc16_ccitt_update(crc, data + done, 1);
+    }
+    mismatches += crc != reference;
+  }
+  return benchExpect(mismatches == 0, "every variant and chunking equals the bitwise CRC");
+}
+
+static void benchTiming(uint32_t iterations)
+{
+  static const size_t sizes[] = {80, 1600, 16384}; // One message_t, a batch of 20, a large compact batch.
+  std::vector<uint8_t> buffer(16384, 0x5A);
+  printf("  %-8s", "bytes");
+  for (const crc16_variant_t &variant : variants)
+  {
+    printf(" %10s", variant.name);
+  }
+  printf("   ns/byte\n");
+  for (size_t size : sizes)
+  {
+    uint32_t rounds = iterations * 80 / size;
+    rounds = rounds == 0 ? 1 : rounds;
+    printf("  %-8zu", size);
+    for (const crc16_variant_t &variant : variants)
+    {
+      auto start = std::chrono::steady_clock::now();
+      uint16_t sink = 0;
+      for (uint32_t i = 0; i < rounds; ++i)
+      {
+        buffer[i % size] = (uint8_t)i; // Keeps the compiler from hoisting the call
+        sink ^= variant.kernel(CRC16_CCITT_INIT, buffer.data(), size);
+      }
+      crcSink = sink;
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      printf(" %10.3f", seconds * 1e9 / ((double)rounds * size));
+    }
+    printf("\n");
+  }
+}
+
+bool benchCrc16(const bench_options_t &options)
+{
+  bool ok = checkValue();
+  ok = checkRandom(options.seed) && ok;
+  benchTiming(options.iterations);
+  return ok;
+}
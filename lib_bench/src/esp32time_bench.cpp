@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "bench.h"
+#include "ESP32Time.h"
+
+#ifdef __GLIBC__
+// Every heap allocation of the process goes through here, including those inside the C library
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static std::atomic<uint32_t> allocations{0};
+
+extern "C" void *malloc(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+#define ALLOCATIONS() allocations.load(std::memory_order_relaxed)
+#else
+#define ALLOCATIONS() 0
+#endif
+
+static volatile size_t textSink; // Keeps the timed results alive
+
+typedef struct
+{
+  double ns;          // Per call.
+  double allocations; // Per call.
+} time_path_t;
+
+template <typename F>
+static time_path_t measure(uint32_t iterations, F call)
+{
+  uint32_t before = ALLOCATIONS();
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    call();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return {seconds * 1e9 / iterations, (double)(ALLOCATIONS() - before) / iterations};
+}
+
+// The former getTimeStruct(): two conversions per call and the shared buffer of localtime()
+static tm formerTimeStruct(long offset)
+{
+  struct tm timeinfo;
+  time_t now;
+  time(&now);
+  localtime_r(&now, &timeinfo);
+  time_t tt = mktime(&timeinfo);
+  tt += offset;
+  return *localtime(&tt);
+}
+
+static bool comparePaths(const ESP32Time &rtc, uint32_t iterations)
+{
+  char buffer[64];
+  bool same = false;
+  // The same second on both sides, retried if it ticked in between
+  for (uint8_t attempt = 0; attempt < 3 && !same; ++attempt)
+  {
+    String text = rtc.getDateTime(true);
+    rtc.getDateTime(buffer, sizeof(buffer), true);
+    same = strcmp(text.c_str(), buffer) == 0;
+  }
+  bool ok = benchExpect(same, "getDateTime(buf) writes the same text as getDateTime()");
+  ok = benchExpect(strcmp(rtc.getAmPm().c_str(), rtc.getAmPmStr()) == 0, "getAmPmStr() matches getAmPm()") && ok;
+  ok = benchExpect(rtc.getTime(buffer, 4, "%Y-%m-%d") == 0 && buffer[0] == '\0', "too small a buffer stays a valid empty string") && ok;
+
+  typedef struct
+  {
+    const char *name;
+    time_path_t string;
+    time_path_t buffer;
+  } time_row_t;
+  const time_row_t rows[] = {
+      {"getDateTime()",
+       measure(iterations, [&]()
+               { textSink = rtc.getDateTime().length(); }),
+       measure(iterations, [&]()
+               { textSink = rtc.getDateTime(buffer, sizeof(buffer)); })},
+      {"getTime(format)",
+       measure(iterations, [&]()
+               { textSink = rtc.getTime(String("%d.%m.%Y %H:%M")).length(); }),
+       measure(iterations, [&]()
+               { textSink = rtc.getTime(buffer, sizeof(buffer), "%d.%m.%Y %H:%M"); })},
+      {"getAmPm()",
+       measure(iterations, [&]()
+               { textSink = rtc.getAmPm().length(); }),
+       measure(iterations, [&]()
+               { textSink = strlen(rtc.getAmPmStr()); })},
+      {"getTimeStruct()",
+       measure(iterations, [&]()
+               { textSink = formerTimeStruct(rtc.offset).tm_sec; }),
+       measure(iterations, [&]()
+               { textSink = rtc.getTimeStruct().tm_sec; })},
+  };
+  printf("  %-18s %14s %14s %14s %14s\n", "", "String ns", "allocs/call", "buffer ns", "allocs/call");
+  for (const time_row_t &row : rows)
+  {
+    printf("  %-18s %14.1f %14.2f %14.1f %14.2f\n", row.name, row.string.ns, row.string.allocations, row.buffer.ns,
+           row.buffer.allocations);
+    ok = benchExpect(row.buffer.allocations == 0, "buffer path does not allocate") && ok;
+  }
+  printf("  (getTimeStruct() row: former conversion per call vs the cached one)\n");
+#ifndef __GLIBC__
+  printf("  allocations are only counted with glibc\n");
+#endif
+  return ok;
+}
+
+// Hit rate in a tight loop and at the pace of a 100 Hz sensor task
+static bool checkCache(const ESP32Time &rtc, uint32_t iterations)
+{
+  uint32_t hits0, misses0, hits1, misses1, hits2, misses2;
+  tm t;
+  rtc.getCacheStats(hits0, misses0);
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    rtc.getTimeStruct(t);
+  }
+  rtc.getCacheStats(hits1, misses1);
+  for (uint32_t i = 0; i < 150; ++i)
+  {
+    rtc.getTimeStruct(t);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  rtc.getCacheStats(hits2, misses2);
+  double tight = 100.0 * (hits1 - hits0) / (hits1 - hits0 + misses1 - misses0);
+  double paced = 100.0 * (hits2 - hits1) / (hits2 - hits1 + misses2 - misses1);
+  printf("  cache hit rate: %.4f %% tight loop (%u misses), %.1f %% at 100 Hz (%u misses)\n", tight,
+         misses1 - misses0, paced, misses2 - misses1);
+  bool ok = benchExpect(tight > 99, "tight loop hit rate above 99 %");
+  ok = benchExpect(paced > 95, "100 Hz hit rate above 95 %") && ok;
+  return ok;
+}
+
+bool benchEsp32Time(const bench_options_t &options)
+{
+  ESP32Time rtc(3600);
+  bool ok = comparePaths(rtc, options.iterations);
+  ok = checkCache(rtc, options.iterations) && ok;
+  return ok;
+}
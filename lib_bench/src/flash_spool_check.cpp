@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <random>
+#include <vector>
+#include "bench.h"
+#include "flash_spool.h"
+
+#define SPOOL_SECTORS 8
+#define SPOOL_LABEL "spool"
+
+// NOR flash image behind the esp_partition stand-in: a write can only clear bits, an erase sets a whole sector
+// to 0xFF. A power cut programs only part of the next write and fails everything after it until the next boot.
+typedef struct
+{
+  std::vector<uint8_t> bytes;
+  std::vector<uint32_t> erases; // Per sector.
+  int32_t cutAfter;             // Bytes the next writes still program before the power fails, -1 for never.
+  bool powerLost;
+  bool failErase; // The next erase fails and leaves the sector as it was.
+} spool_flash_t;
+
+static spool_flash_t flash;
+static esp_partition_t partition = {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, 0, 0, SPOOL_LABEL};
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t, const char *label)
+{
+  return type == ESP_PARTITION_TYPE_DATA && strcmp(label, partition.label) == 0 ? &partition : NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t src_offset, void *dst, size_t size)
+{
+  if (flash.powerLost || src_offset + size > part->size)
+  {
+    return ESP_FAIL;
+  }
+  memcpy(dst, flash.bytes.data() + src_offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *part, size_t dst_offset, const void *src, size_t size)
+{
+  if (flash.powerLost || dst_offset + size > part->size)
+  {
+    return ESP_FAIL;
+  }
+  const uint8_t *data = (const uint8_t *)src;
+  for (size_t i = 0; i < size; ++i)
+  {
+    if (flash.cutAfter == 0)
+    {
+      flash.powerLost = true;
+      return ESP_FAIL;
+    }
+    flash.cutAfter -= flash.cutAfter > 0;
+    flash.bytes[dst_offset + i] &= data[i];
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *part, size_t offset, size_t size)
+{
+  if (flash.powerLost || offset % FLASH_SPOOL_SECTOR_SIZE != 0 || offset + size > part->size)
+  {
+    return ESP_FAIL;
+  }
+  if (flash.cutAfter == 0)
+  {
+    flash.powerLost = true;
+    return ESP_FAIL;
+  }
+  if (flash.failErase)
+  {
+    flash.failErase = false;
+    return ESP_FAIL;
+  }
+  memset(flash.bytes.data() + offset, 0xFF, size);
+  ++flash.erases[offset / FLASH_SPOOL_SECTOR_SIZE];
+  return ESP_OK;
+}
+
+static void blankFlash(uint32_t sectors)
+{
+  partition.size = sectors * FLASH_SPOOL_SECTOR_SIZE;
+  flash.bytes.assign(partition.size, 0xFF);
+  flash.erases.assign(sectors, 0);
+  flash.cutAfter = -1;
+  flash.powerLost = false;
+  flash.failErase = false;
+}
+
+// Record n carries its number and a length derived from it. No payload byte is 0xFF and there is no padding, so
+// a record torn anywhere fails its CRC.
+static uint16_t recordLength(uint32_t n)
+{
+  return 4 + 4 * ((n * 37) % (FLASH_SPOOL_MAX_RECORD / 4));
+}
+
+static void makeRecord(uint32_t n, uint8_t *data)
+{
+  uint16_t length = recordLength(n);
+  for (uint16_t i = 0; i < length; ++i)
+  {
+    data[i] = (uint8_t)((n * 7 + i) % 0xFF);
+  }
+  if (length >= sizeof(n))
+  {
+    memcpy(data, &n, sizeof(n));
+    for (uint8_t i = 0; i < sizeof(n); ++i)
+    {
+      data[i] = data[i] == 0xFF ? 0xFE : data[i];
+    }
+  }
+}
+
+static bool isRecord(uint32_t n, const uint8_t *data, uint16_t length)
+{
+  uint8_t expected[FLASH_SPOOL_MAX_RECORD];
+  makeRecord(n, expected);
+  return length == recordLength(n) && memcmp(data, expected, length) == 0;
+}
+
+static esp_err_t appendRecord(FlashSpool &spool, uint32_t n)
+{
+  uint8_t data[FLASH_SPOOL_MAX_RECORD];
+  makeRecord(n, data);
+  return spool.append(data, recordLength(n));
+}
+
+// Pop the records first..last in order, then expect the spool to be empty
+static bool popRange(FlashSpool &spool, uint32_t first, uint32_t last)
+{
+  uint8_t data[FLASH_SPOOL_MAX_RECORD];
+  uint16_t length;
+  for (uint32_t n = first; n < last; ++n)
+  {
+    if (spool.pop(data, sizeof(data), &length) != ESP_OK || !isRecord(n, data, length))
+    {
+      printf("  record %u missing or wrong\n", n);
+      return false;
+    }
+  }
+  return spool.pop(data, sizeof(data), &length) == ESP_ERR_NOT_FOUND;
+}
+
+// A reboot: a new object recovers everything from what is in flash
+static bool reboot(FlashSpool *&spool)
+{
+  delete spool;
+  flash.cutAfter = -1;
+  flash.powerLost = false;
+  spool = new FlashSpool();
+  return spool->init(SPOOL_LABEL) == ESP_OK;
+}
+
+static bool checkBasics()
+{
+  blankFlash(SPOOL_SECTORS);
+  FlashSpool *spool = NULL;
+  bool ok = benchExpect(reboot(spool) && spool->empty() && spool->pending() == 0 && spool->sectors() == SPOOL_SECTORS,
+                        "a blank partition opens empty");
+  FlashSpool missing;
+  ok = benchExpect(missing.init("other") == ESP_ERR_NOT_FOUND, "an unknown label is not found") && ok;
+  ok = benchExpect(spool->append("x", 0) == ESP_ERR_INVALID_ARG && spool->append(NULL, 1) == ESP_ERR_INVALID_ARG,
+                   "empty records are rejected") && ok;
+
+  // Across several sectors, then read back in two halves with a reboot in between
+  for (uint32_t n = 0; n < 60; ++n)
+  {
+    ok = benchExpect(appendRecord(*spool, n) == ESP_OK, "append") && ok;
+  }
+  ok = benchExpect(spool->pending() == 60 && !spool->empty(), "appended records are pending") && ok;
+  uint8_t data[FLASH_SPOOL_MAX_RECORD];
+  uint16_t length;
+  for (uint32_t n = 0; n < 25; ++n)
+  {
+    ok = benchExpect(spool->pop(data, sizeof(data), &length) == ESP_OK && isRecord(n, data, length), "pop in order") && ok;
+  }
+  ok = benchExpect(reboot(spool) && spool->pending() == 35, "pending records are found again after a reboot") && ok;
+  ok = benchExpect(popRange(*spool, 25, 60) && spool->empty() && spool->pending() == 0,
+                   "the reader resumes after the last consumed record") && ok;
+  ok = benchExpect(reboot(spool) && popRange(*spool, 0, 0), "consumed records stay consumed after a reboot") && ok;
+
+  // A record larger than the reader's buffer is discarded instead of blocking the spool
+  ok = benchExpect(appendRecord(*spool, 100) == ESP_OK && appendRecord(*spool, 101) == ESP_OK, "append") && ok;
+  ok = benchExpect(spool->pop(data, 1, &length) == ESP_ERR_INVALID_SIZE && length == recordLength(100),
+                   "a record too large for the buffer is reported") && ok;
+  ok = benchExpect(popRange(*spool, 101, 102), "the spool continues after it") && ok;
+  delete spool;
+  return ok;
+}
+
+static uint32_t recordSize(uint32_t n)
+{
+  return 8 + ((recordLength(n) + 3) & ~3); // Record header and padded payload as laid out in flash.
+}
+
+static bool checkFull()
+{
+  blankFlash(SPOOL_SECTORS);
+  FlashSpool *spool = NULL;
+  bool ok = reboot(spool);
+  uint32_t capacity = 0;
+  uint32_t bytes = 0;
+  while (appendRecord(*spool, capacity) == ESP_OK)
+  {
+    bytes += recordSize(capacity);
+    ++capacity;
+  }
+  ok = benchExpect(appendRecord(*spool, capacity) == ESP_ERR_NO_MEM && spool->stats().dropped == 2,
+                   "a full spool rejects records and counts them") && ok;
+  ok = benchExpect(bytes > (SPOOL_SECTORS - 1) * FLASH_SPOOL_SECTOR_SIZE, "every sector holds records") && ok;
+  ok = benchExpect(reboot(spool) && spool->pending() == capacity, "a full spool is recovered") && ok;
+
+  // Draining the first sector makes room for another sector of records
+  uint8_t data[FLASH_SPOOL_MAX_RECORD];
+  uint16_t length;
+  uint32_t popped = 0;
+  while (spool->stats().erases == 0 && spool->pop(data, sizeof(data), &length) == ESP_OK)
+  {
+    ++popped;
+  }
+  uint32_t appended = capacity;
+  while (appendRecord(*spool, appended) == ESP_OK)
+  {
+    ++appended;
+  }
+  ok = benchExpect(spool->stats().erases == 1 && appended > capacity, "an erased sector takes new records") && ok;
+  ok = benchExpect(reboot(spool) && popRange(*spool, popped, appended), "the wrapped ring is recovered in order") && ok;
+  delete spool;
+  return ok;
+}
+
+// A power cut after every possible number of bytes of the next append, once inside the open sector and once
+// when the append has to open the next sector, then a reboot
+static bool checkTorn()
+{
+  bool ok = true;
+  for (uint8_t opening = 0; opening < 2; ++opening)
+  {
+    uint32_t count = opening ? 0 : 3;
+    uint32_t used = 0;
+    if (opening)
+    {
+      while (used + recordSize(count) <= FLASH_SPOOL_SECTOR_SIZE - 16)
+      {
+        used += recordSize(count++);
+      }
+    }
+    uint32_t cuts = (opening ? 16 : 0) + 8 + recordLength(count);
+    uint32_t delivered = 0, corrupt = 0;
+    for (uint32_t cut = 0; cut < cuts; ++cut)
+    {
+      blankFlash(SPOOL_SECTORS);
+      FlashSpool *spool = NULL;
+      ok = reboot(spool) && ok;
+      for (uint32_t n = 0; n < count; ++n)
+      {
+        ok = appendRecord(*spool, n) == ESP_OK && ok;
+      }
+      flash.cutAfter = cut;
+      ok = appendRecord(*spool, count) == ESP_FAIL && ok;
+      ok = reboot(spool) && ok;
+      delivered += popRange(*spool, 0, count);
+      corrupt += spool->stats().corrupt;
+      ok = appendRecord(*spool, count + 1) == ESP_OK && popRange(*spool, count + 1, count + 2) && ok;
+      delete spool;
+    }
+    printf("  power cut at each of %u bytes while %s: %u recovered, %u torn records skipped\n", cuts,
+           opening ? "opening a sector" : "appending", delivered, corrupt);
+    ok = benchExpect(delivered == cuts, "records before the cut survive and the torn one is never delivered") && ok;
+  }
+  return benchExpect(ok, "the spool takes records again after a torn append");
+}
+
+// Random appends, pops, failed erases, reboots and power cuts against a model queue, over many laps of the ring
+static bool checkRandom(uint32_t seed, uint32_t operations)
+{
+  std::mt19937 random(seed);
+  blankFlash(SPOOL_SECTORS);
+  FlashSpool *spool = NULL;
+  bool ok = reboot(spool);
+  std::deque<uint32_t> model;
+  uint32_t next = 0;
+  uint32_t torn = 0;    // Appends cut by a power loss, their records may be pending until skipped as corrupt.
+  uint32_t corrupt = 0; // Torn records skipped by earlier spool objects.
+  uint32_t wrong = 0, badPending = 0, reboots = 0, cuts = 0, failedErases = 0;
+  uint8_t data[FLASH_SPOOL_MAX_RECORD];
+  uint16_t length;
+  for (uint32_t i = 0; i < operations; ++i)
+  {
+    uint32_t r = random() % 1000;
+    if (r < 520)
+    {
+      bool failErase = flash.failErase;
+      esp_err_t err = appendRecord(*spool, next++);
+      if (err == ESP_OK)
+      {
+        model.push_back(next - 1);
+      }
+      // Opening a sector whose earlier erase failed erases it first, and that may fail again
+      wrong += err != ESP_OK && err != ESP_ERR_NO_MEM && !(err == ESP_FAIL && failErase && !flash.failErase);
+    }
+    else if (r < 960)
+    {
+      esp_err_t err = spool->pop(data, sizeof(data), &length);
+      if (model.empty())
+      {
+        wrong += err != ESP_ERR_NOT_FOUND;
+        continue;
+      }
+      wrong += err != ESP_OK || !isRecord(model.front(), data, length);
+      model.pop_front();
+    }
+    else if (r < 970)
+    {
+      flash.failErase = true;
+      ++failedErases;
+    }
+    else
+    {
+      if (r >= 985)
+      {
+        // Power cut inside the next append or pop, whatever it writes or erases at the time
+        flash.cutAfter = random() % (16 + 8 + recordLength(next));
+        if (r % 2 == 0)
+        {
+          esp_err_t err = appendRecord(*spool, next++);
+          if (flash.powerLost)
+          {
+            ++torn;
+          }
+          else if (err == ESP_OK)
+          {
+            model.push_back(next - 1);
+          }
+        }
+        else
+        {
+          // A record whose consumed mark was cut is popped again after the reboot
+          esp_err_t err = spool->pop(data, sizeof(data), &length);
+          if (!flash.powerLost && !model.empty())
+          {
+            wrong += err != ESP_OK || !isRecord(model.front(), data, length);
+            model.pop_front();
+          }
+        }
+        cuts += flash.powerLost;
+      }
+      corrupt += spool->stats().corrupt;
+      wrong += !reboot(spool);
+      uint32_t pending = spool->pending();
+      badPending += pending < model.size() || pending > model.size() + torn - corrupt;
+      ++reboots;
+    }
+  }
+  for (uint32_t n : model)
+  {
+    wrong += spool->pop(data, sizeof(data), &length) != ESP_OK || !isRecord(n, data, length);
+  }
+  wrong += spool->pop(data, sizeof(data), &length) != ESP_ERR_NOT_FOUND;
+  ok = benchExpect(wrong == 0, "every record comes back once and in order") && ok;
+  ok = benchExpect(badPending == 0, "pending() after a reboot counts the recovered records") && ok;
+  uint32_t least = flash.erases[0], most = flash.erases[0];
+  for (uint32_t count : flash.erases)
+  {
+    least = count < least ? count : least;
+    most = count > most ? count : most;
+  }
+  printf("  %u operations, %u reboots, %u power cuts, %u failed erases, %u..%u erases per sector\n", operations,
+         reboots, cuts, failedErases, least, most);
+  ok = benchExpect(most > 10 && most - least <= most / 5 + 2, "sectors wear evenly") && ok;
+  delete spool;
+  return ok;
+}
+
+bool checkFlashSpool(const bench_options_t &options)
+{
+  bool ok = checkBasics();
+  ok = checkFull() && ok;
+  ok = checkTorn() && ok;
+  ok = checkRandom(options.seed, options.iterations / 4) && ok;
+  return ok;
+}
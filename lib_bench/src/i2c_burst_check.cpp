@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <random>
+#include "bench.h"
+#include "i2c_burst.h"
+#include "mpu6050_fifo.h"
+
+#define BURST_MAX_LENGTH 128 // I2C_BUS_MAX_LENGTH, the Arduino Wire buffer
+#define MPU_COUNTH 0x72
+#define MPU_FIFO 0x74
+#define MPU_USER_CTRL 0x6A
+
+static bool expectBurst(const i2c_burst_read_t *reads, uint8_t count, uint8_t lead, uint8_t reg, uint16_t length,
+                        uint8_t members, const char *what)
+{
+  uint8_t batch[16];
+  i2c_burst_t burst = i2cBurstPlan(reads, count, lead, BURST_MAX_LENGTH, batch);
+  bool ok = burst.reg == reg && burst.length == length && burst.members == members && batch[0] == lead;
+  if (!ok)
+  {
+    printf("  %s: reg 0x%02X length %u members %u, expected 0x%02X %u %u\n", what, burst.reg, burst.length,
+           burst.members, reg, length, members);
+  }
+  return ok;
+}
+
+static bool checkPlans()
+{
+  bool ok = true;
+  {
+    i2c_burst_read_t reads[] = {{0x68, 0x3B, 6, I2C_BURST_NONE}, {0x68, 0x41, 2, I2C_BURST_INCREMENT}};
+    ok = expectBurst(reads, 2, 0, 0x3B, 6, 1, "lead that may not be merged") && ok;
+    ok = expectBurst(reads, 2, 1, 0x41, 2, 1, "neighbour that may not be merged") && ok;
+  }
+  {
+    // Listed out of order, the burst grows until nothing borders it
+    i2c_burst_read_t reads[] = {
+        {0x68, 0x43, 6, I2C_BURST_INCREMENT},
+        {0x69, 0x41, 2, I2C_BURST_INCREMENT},
+        {0x68, 0x3B, 6, I2C_BURST_INCREMENT},
+        {0x68, 0x41, 2, I2C_BURST_INCREMENT},
+        {0x68, 0x35, 6, I2C_BURST_INCREMENT},
+        {0x68, 0x3D, 2, I2C_BURST_INCREMENT}};
+    ok = expectBurst(reads, 6, 3, 0x35, 20, 4, "chain both ways, other device and overlap left out") && ok;
+  }
+  {
+    i2c_burst_read_t reads[] = {{0x68, 0x00, 100, I2C_BURST_INCREMENT}, {0x68, 0x64, 40, I2C_BURST_INCREMENT}};
+    ok = expectBurst(reads, 2, 0, 0x00, 100, 1, "burst longer than the Wire buffer") && ok;
+  }
+  {
+    i2c_burst_read_t reads[] = {
+        {0x68, 0xF0, 16, I2C_BURST_INCREMENT},
+        {0x68, 0xE8, 8, I2C_BURST_INCREMENT},
+        {0x68, 0xF8, 16, I2C_BURST_INCREMENT}};
+    ok = expectBurst(reads, 3, 0, 0xE8, 24, 2, "up to register 0xFF") && ok;
+    ok = expectBurst(reads, 3, 2, 0xF8, 16, 1, "past register 0xFF") && ok;
+  }
+  {
+    // FIFO count, then the FIFO port: nothing may follow the port, its address does not advance
+    i2c_burst_read_t reads[] = {
+        {0x68, MPU_COUNTH, 2, I2C_BURST_INCREMENT},
+        {0x68, MPU_FIFO, 120, I2C_BURST_PORT},
+        {0x68, MPU_FIFO + 120, 2, I2C_BURST_INCREMENT},
+        {0x68, 0x70, 2, I2C_BURST_INCREMENT}};
+    ok = expectBurst(reads, 4, 0, 0x70, 124, 3, "count and port") && ok;
+    ok = expectBurst(reads, 4, 1, 0x70, 124, 3, "port as lead") && ok;
+    ok = expectBurst(reads, 4, 2, MPU_FIFO + 120, 2, 1, "read right after a port") && ok;
+  }
+  {
+    i2c_burst_read_t reads[] = {{0x68, MPU_FIFO, 12, I2C_BURST_PORT}, {0x68, MPU_FIFO, 12, I2C_BURST_PORT}};
+    ok = expectBurst(reads, 2, 0, MPU_FIFO, 12, 1, "two port reads") && ok;
+  }
+  return ok;
+}
+
+// MPU6050 behind the fake bus: registers auto-increment, the FIFO port keeps its address and pops a byte per
+// read. The count is latched when a burst starts. A full FIFO overwrites its oldest bytes.
+typedef struct
+{
+  uint8_t registers[256];
+  std::deque<uint8_t> fifo;
+  uint32_t bursts;  // Bus reads.
+  uint32_t merged;  // readFifo() calls that ran as one burst.
+  bool wrapped;     // A read ran past register 0xFF.
+  bool underflowed; // A read popped an empty FIFO.
+} fake_mpu_t;
+
+static fake_mpu_t mpu;
+
+static void mpuBurst(uint8_t reg, uint8_t *data, size_t length)
+{
+  ++mpu.bursts;
+  uint16_t count = mpu.fifo.size();
+  uint16_t address = reg;
+  for (size_t i = 0; i < length; i++)
+  {
+    if (address == MPU_FIFO)
+    {
+      mpu.underflowed = mpu.underflowed || mpu.fifo.empty();
+      data[i] = mpu.fifo.empty() ? 0xFF : mpu.fifo.front();
+      if (!mpu.fifo.empty())
+      {
+        mpu.fifo.pop_front();
+      }
+      continue;
+    }
+    mpu.wrapped = mpu.wrapped || address > 0xFF;
+    data[i] = address == MPU_COUNTH ? count >> 8 : (address == MPU_COUNTH + 1 ? count & 0xFF : mpu.registers[address & 0xFF]);
+    ++address;
+  }
+}
+
+static bool mpuWrite(uint8_t reg, uint8_t value, void *)
+{
+  mpu.registers[reg] = value;
+  if (reg == MPU_USER_CTRL && (value & 0x04) != 0)
+  {
+    mpu.fifo.clear();
+  }
+  return true;
+}
+
+static bool mpuRead(uint8_t reg, uint8_t *data, size_t length, void *)
+{
+  mpuBurst(reg, data, length);
+  return true;
+}
+
+// What the bus task does with the two reads of a transfer(): plan a burst and hand out the slices
+static bool mpuReadFifo(uint8_t countReg, uint8_t *count, uint8_t fifoReg, uint8_t *data, size_t length, void *)
+{
+  i2c_burst_read_t reads[2] = {{MPU6050_FIFO_ADDRESS, countReg, 2, I2C_BURST_INCREMENT},
+                               {MPU6050_FIFO_ADDRESS, fifoReg, (uint16_t)length, I2C_BURST_PORT}};
+  uint8_t *targets[2] = {count, data};
+  uint8_t batch[2];
+  i2c_burst_t burst = i2cBurstPlan(reads, 2, 0, BURST_MAX_LENGTH, batch);
+  if (burst.members == 1)
+  {
+    mpuBurst(countReg, count, 2);
+    mpuBurst(fifoReg, data, length);
+    return true;
+  }
+  ++mpu.merged;
+  uint8_t bytes[BURST_MAX_LENGTH];
+  mpuBurst(burst.reg, bytes, burst.length);
+  for (uint8_t i = 0; i < burst.members; i++)
+  {
+    memcpy(targets[batch[i]], bytes + reads[batch[i]].reg - burst.reg, reads[batch[i]].length);
+  }
+  return true;
+}
+
+static int16_t sampleValue(uint32_t n, uint8_t field)
+{
+  return (int16_t)(n * 12 + field * 1001);
+}
+
+static void pushSamples(uint32_t first, uint32_t count)
+{
+  for (uint32_t n = first; n < first + count; n++)
+  {
+    for (uint8_t field = 0; field < 6; field++)
+    {
+      uint16_t value = (uint16_t)sampleValue(n, field);
+      mpu.fifo.push_back(value >> 8);
+      mpu.fifo.push_back(value & 0xFF);
+    }
+  }
+  while (mpu.fifo.size() > MPU6050_FIFO_CAPACITY)
+  {
+    mpu.fifo.pop_front();
+  }
+}
+
+static bool isSample(const mpu6050_sample_t &sample, uint32_t n)
+{
+  for (uint8_t axis = 0; axis < 3; axis++)
+  {
+    if (sample.accel[axis] != sampleValue(n, axis) || sample.gyro[axis] != sampleValue(n, axis + 3))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool checkFifo(uint32_t seed, uint32_t rounds)
+{
+  mpu = {};
+  Mpu6050Fifo fifo;
+  mpu6050_bus_t bus = {.write = mpuWrite, .read = mpuRead, .readFifo = mpuReadFifo, .arg = NULL};
+  bool ok = benchExpect(fifo.begin(bus, 200), "begin");
+
+  std::mt19937 random(seed);
+  uint32_t pushed = 0;
+  uint32_t received = 0;
+  bool ordered = true;
+  mpu6050_sample_t samples[32];
+  for (uint32_t round = 0; round < rounds; round++)
+  {
+    // Up to 12 new samples per read and at most 16 taken, the FIFO keeps a backlog now and then
+    uint32_t arrived = random() % 13;
+    pushSamples(pushed, arrived);
+    pushed += arrived;
+    size_t count = fifo.read(samples, 1 + random() % 16);
+    for (size_t i = 0; i < count; i++)
+    {
+      ordered = isSample(samples[i], received++) && ordered;
+    }
+  }
+  size_t count;
+  while ((count = fifo.read(samples, 32)) > 0)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      ordered = isSample(samples[i], received++) && ordered;
+    }
+  }
+  const mpu6050_fifo_stats_t &stats = fifo.stats();
+  ok = benchExpect(ordered && received == pushed, "every sample once and in order") && ok;
+  ok = benchExpect(stats.combined > 0 && stats.combined == mpu.merged, "backlog read with the count in one burst") && ok;
+  ok = benchExpect(!mpu.wrapped && !mpu.underflowed, "no read past register 0xFF or the FIFO content") && ok;
+  ok = benchExpect(stats.overflows == 0 && stats.resyncs == 0 && stats.errors == 0, "no resets") && ok;
+  printf("  %u samples in %u bus reads, %u of %u FIFO reads came with the count\n", received, mpu.bursts,
+         stats.combined, stats.reads);
+
+  // An overflow resets the FIFO, nothing may be taken for backlog afterwards
+  pushSamples(pushed, 40);
+  pushed += 40;
+  fifo.read(samples, 8);
+  pushSamples(pushed, 60);
+  pushed += 60;
+  ok = benchExpect(fifo.read(samples, 32) == 0 && fifo.stats().overflows == 1, "overflow reported") && ok;
+  pushSamples(pushed, 5);
+  count = fifo.read(samples, 32);
+  bool fresh = count == 5;
+  for (size_t i = 0; i < count; i++)
+  {
+    fresh = isSample(samples[i], pushed + i) && fresh;
+  }
+  ok = benchExpect(fresh && !mpu.underflowed && fifo.stats().resyncs == 0, "samples after the overflow") && ok;
+  return ok;
+}
+
+bool checkI2cBurst(const bench_options_t &options)
+{
+  bool ok = checkPlans();
+  ok = checkFifo(options.seed, options.iterations / 200) && ok;
+  return ok;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "bench.h"
+
+typedef struct
+{
+  const char *name;
+  bool (*run)(const bench_options_t &options);
+} bench_suite_t;
+
+static const bench_suite_t suites[] = {
+    {"sequence_tracker", benchSequenceTracker},
+    {"spsc_ring", benchSpscRing},
+    {"crc16", benchCrc16},
+    {"esp32time", benchEsp32Time},
+    {"batch_codec", benchBatchCodec},
+    {"flash_spool", checkFlashSpool},
+    {"i2c_burst", checkI2cBurst},
+};
+
+bool benchExpect(bool condition, const char *what)
+{
+  if (!condition)
+  {
+    printf("  failed: %s\n", what);
+  }
+  return condition;
+}
+
+static void usage(const char *name)
+{
+  printf("Usage: %s [options]\n"
+         "  --only NAME       run one suite:",
+         name);
+  for (const bench_suite_t &suite : suites)
+  {
+    printf(" %s", suite.name);
+  }
+  printf("\n"
+         "  --iterations N    repetitions of every timed loop (200000)\n"
+         "  --seed N          seed of the random inputs (1)\n");
+}
+
+int main(int argc, char **argv)
+{
+  bench_options_t benchOptions = {.iterations = 200000, .seed = 1};
+  const char *only = NULL;
+
+  static const struct option options[] = {
+      {"only", required_argument, NULL, 'o'},
+      {"iterations", required_argument, NULL, 'i'},
+      {"seed", required_argument, NULL, 's'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  int option;
+  while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+  {
+    switch (option)
+    {
+    case 'o':
+      only = optarg;
+      break;
+    case 'i':
+      benchOptions.iterations = (uint32_t)atoi(optarg);
+      break;
+    case 's':
+      benchOptions.seed = (uint32_t)atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return option == 'h' ? 0 : 2;
+    }
+  }
+  if (benchOptions.iterations == 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  bool pass = true;
+  bool found = false;
+  for (const bench_suite_t &suite : suites)
+  {
+    if (only != NULL && strcmp(only, suite.name) != 0)
+    {
+      continue;
+    }
+    found = true;
+    printf("%s\n", suite.name);
+    bool ok = suite.run(benchOptions);
+    printf("  %s\n\n", ok ? "ok" : "FAILED");
+    pass = ok && pass;
+  }
+  if (!found)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  printf("%s\n", pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
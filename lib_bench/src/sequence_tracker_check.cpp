@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <set>
+#include <vector>
+#include "bench.h"
+#include "sequence_tracker.h"
+
+static const uint8_t macA[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x01};
+
+typedef struct
+{
+  uint32_t accepted;
+  uint32_t duplicates;
+  uint32_t lost;
+  uint32_t reordered;
+  uint32_t restarts;
+} tracker_counts_t;
+
+static bool expectCounts(SequenceTracker &tracker, const uint8_t *mac, const tracker_counts_t &expected, const char *what)
+{
+  sequence_tracker_source_t all[SEQUENCE_TRACKER_MAX_SOURCES];
+  uint8_t count = tracker.sources(all, SEQUENCE_TRACKER_MAX_SOURCES);
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    if (memcmp(all[i].mac_addr, mac, 6) != 0)
+    {
+      continue;
+    }
+    const sequence_tracker_source_t &s = all[i];
+    bool ok = s.accepted == expected.accepted && s.duplicates == expected.duplicates && s.lost == expected.lost &&
+              s.reordered == expected.reordered && s.restarts == expected.restarts;
+    if (!ok)
+    {
+      printf("  %s: accepted=%u duplicates=%u lost=%u reordered=%u restarts=%u, expected %u %u %u %u %u\n", what,
+             s.accepted, s.duplicates, s.lost, s.reordered, s.restarts, expected.accepted, expected.duplicates,
+             expected.lost, expected.reordered, expected.restarts);
+    }
+    return ok;
+  }
+  return benchExpect(false, what);
+}
+
+static bool feed(SequenceTracker &tracker, const uint8_t *mac, std::initializer_list<uint16_t> seqs)
+{
+  bool all = true;
+  for (uint16_t seq : seqs)
+  {
+    all = tracker.accept(mac, seq) && all;
+  }
+  return all;
+}
+
+static bool checkCases()
+{
+  bool ok = true;
+  {
+    SequenceTracker tracker;
+    feed(tracker, macA, {1, 2, 5});
+    ok = expectCounts(tracker, macA, {3, 0, 2, 0, 0}, "gap of two") && ok;
+    feed(tracker, macA, {3, 4});
+    ok = expectCounts(tracker, macA, {5, 0, 0, 2, 0}, "gap filled late") && ok;
+    ok = benchExpect(!tracker.accept(macA, 3), "retransmission is a duplicate") && ok;
+    ok = expectCounts(tracker, macA, {5, 1, 0, 2, 0}, "duplicate counted") && ok;
+  }
+  {
+    SequenceTracker tracker;
+    feed(tracker, macA, {65534, 65535, 1});
+    feed(tracker, macA, {0});
+    ok = expectCounts(tracker, macA, {4, 0, 0, 1, 0}, "gap across the wrap-around") && ok;
+  }
+  {
+    // The first message heard is not the oldest one sent, nothing before it was counted as lost
+    SequenceTracker tracker;
+    feed(tracker, macA, {100, 99, 98});
+    ok = expectCounts(tracker, macA, {3, 0, 0, 2, 0}, "reordered on first contact") && ok;
+  }
+  {
+    SequenceTracker tracker;
+    feed(tracker, macA, {500, 502});
+    feed(tracker, macA, {40000, 39999});
+    ok = expectCounts(tracker, macA, {4, 0, 1, 1, 1}, "reordered after a restart") && ok;
+  }
+  {
+    // More sources than slots, the first one is evicted and starts over when heard again
+    SequenceTracker tracker;
+    feed(tracker, macA, {500, 502});
+    for (uint8_t i = 0; i < SEQUENCE_TRACKER_MAX_SOURCES; ++i)
+    {
+      uint8_t other[6] = {0x24, 0x6F, 0x28, 0x00, 0x01, i};
+      tracker.accept(other, 7);
+    }
+    feed(tracker, macA, {900, 899});
+    ok = expectCounts(tracker, macA, {2, 0, 0, 1, 0}, "reordered after eviction") && ok;
+  }
+  {
+    // The slot identifies a source for as long as it is tracked, the evicted one's slot goes to the newcomer
+    SequenceTracker tracker;
+    uint8_t slotA = 0xFF, slotB = 0xFF, again = 0xFF, other = 0xFF;
+    uint8_t macB[6] = {0x24, 0x6F, 0x28, 0x00, 0x00, 0x02};
+    tracker.accept(macA, 1, &slotA);
+    tracker.accept(macB, 1, &slotB);
+    tracker.accept(macA, 1, &again);
+    ok = benchExpect(slotA == 0 && slotB == 1 && again == slotA, "each source keeps its slot, duplicates included") && ok;
+    for (uint8_t i = 0; i < SEQUENCE_TRACKER_MAX_SOURCES - 1; ++i)
+    {
+      uint8_t mac[6] = {0x24, 0x6F, 0x28, 0x00, 0x01, i};
+      tracker.accept(mac, 7, &other);
+    }
+    ok = benchExpect(other == slotB, "a new source takes the least recently heard slot") && ok;
+  }
+  {
+    // A jump of more than the window, the numbers still in it stay countable
+    SequenceTracker tracker;
+    feed(tracker, macA, {10, 200, 199, 150});
+    ok = expectCounts(tracker, macA, {4, 0, 187, 2, 0}, "gap longer than the window") && ok;
+  }
+  return ok;
+}
+
+// Loss, neighbour swaps and retransmissions against a model that remembers every number
+static bool checkRandom(uint32_t seed)
+{
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  const uint32_t count = 20000;
+  const uint32_t base = 65536 - 5000; // Crosses the wrap-around
+
+  std::vector<uint32_t> sent;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    if (uniform(random) > 0.03)
+    {
+      sent.push_back(base + i);
+    }
+  }
+  for (size_t i = 0; i + 8 < sent.size(); ++i)
+  {
+    if (uniform(random) < 0.05)
+    {
+      std::swap(sent[i], sent[i + 1 + random() % 8]);
+    }
+  }
+  std::vector<uint32_t> arrivals;
+  for (size_t i = 0; i < sent.size(); ++i)
+  {
+    arrivals.push_back(sent[i]);
+    if (i >= 32 && uniform(random) < 0.02)
+    {
+      arrivals.push_back(sent[i - random() % 32]);
+    }
+  }
+
+  SequenceTracker tracker;
+  tracker_counts_t expected = {};
+  std::set<uint32_t> received;
+  uint32_t first = arrivals[0], newest = arrivals[0];
+  for (uint32_t seq : arrivals)
+  {
+    bool isNew = received.insert(seq).second;
+    if (!isNew)
+    {
+      ++expected.duplicates;
+    }
+    else if (seq > newest)
+    {
+      newest = seq;
+    }
+    else if (seq != first)
+    {
+      ++expected.reordered;
+    }
+    expected.accepted += isNew;
+    if (tracker.accept(macA, (uint16_t)seq) != isNew)
+    {
+      printf("  seq %u: accept() returned %d\n", seq, !isNew);
+      return false;
+    }
+  }
+  for (uint32_t seq = first + 1; seq < newest; ++seq)
+  {
+    expected.lost += received.count(seq) == 0;
+  }
+  printf("  random stream: %u arrivals, %u lost, %u reordered, %u duplicates\n", (unsigned)arrivals.size(),
+         expected.lost, expected.reordered, expected.duplicates);
+  return expectCounts(tracker, macA, expected, "random stream");
+}
+
+bool benchSequenceTracker(const bench_options_t &options)
+{
+  bool ok = checkCases();
+  ok = checkRandom(options.seed) && ok;
+  return ok;
+}
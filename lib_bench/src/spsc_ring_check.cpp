@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "bench.h"
+#include "spsc_ring.h"
+
+typedef struct // Size of the root's message_t, every byte derived from seq so a torn copy shows.
+{
+  uint32_t seq;
+  uint8_t payload[76];
+} ring_item_t;
+
+static void fill(ring_item_t &item, uint32_t seq)
+{
+  item.seq = seq;
+  for (uint8_t i = 0; i < sizeof(item.payload); ++i)
+  {
+    item.payload[i] = (uint8_t)(seq * 31 + i);
+  }
+}
+
+static bool intact(const ring_item_t &item)
+{
+  for (uint8_t i = 0; i < sizeof(item.payload); ++i)
+  {
+    if (item.payload[i] != (uint8_t)(item.seq * 31 + i))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// One thread: rounding, full ring, order over many laps of the index mask
+static bool checkSingle()
+{
+  bool ok = true;
+  SpscRing<ring_item_t> ring;
+  ok = benchExpect(!ring.init(0), "init(0) is refused") && ok;
+  ok = benchExpect(ring.init(20) && ring.capacity() == 32, "capacity 20 rounds up to 32") && ok;
+  ok = benchExpect(!ring.init(64), "second init() is refused") && ok;
+
+  ring_item_t item;
+  for (uint32_t i = 0; i < 32; ++i)
+  {
+    fill(item, i);
+    ok = benchExpect(ring.push(item), "push into a ring with room") && ok;
+  }
+  fill(item, 32);
+  ok = benchExpect(!ring.push(item) && ring.dropped() == 1, "push into a full ring is dropped") && ok;
+  ok = benchExpect(ring.size() == 32 && ring.highWatermark() == 32, "full ring reports size and watermark") && ok;
+
+  uint32_t next = 0, pushed = 32;
+  for (uint32_t lap = 0; lap < 1000 && ok; ++lap)
+  {
+    // Take a few and refill, so head and tail cross the end of the storage at every offset
+    uint32_t take = 1 + lap % 31;
+    for (uint32_t i = 0; i < take; ++i)
+    {
+      ok = benchExpect(ring.pop(item) && item.seq == next++ && intact(item), "items leave in order") && ok;
+    }
+    for (uint32_t i = 0; i < take; ++i)
+    {
+      fill(item, pushed++);
+      ok = benchExpect(ring.push(item), "refill after pop") && ok;
+    }
+  }
+  while (ring.pop(item))
+  {
+    ok = benchExpect(item.seq == next++, "drained in order") && ok;
+  }
+  ok = benchExpect(next == pushed && ring.empty() && ring.peek() == NULL, "drained ring is empty") && ok;
+  ok = benchExpect(ring.pushed() == pushed && ring.dropped() == 1, "pushed and dropped counters") && ok;
+  return ok;
+}
+
+// Producer and consumer on their own threads; the consumer pauses now and then so the ring runs full
+static bool checkThreads(uint32_t capacity, uint32_t count)
+{
+  SpscRing<ring_item_t> ring;
+  if (!ring.init(capacity))
+  {
+    return benchExpect(false, "init");
+  }
+  std::atomic<bool> producing{true};
+  uint32_t producerDrops = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::thread producer([&]()
+                       {
+                         ring_item_t item;
+                         for (uint32_t seq = 0; seq < count; ++seq)
+                         {
+                           fill(item, seq);
+                           if (!ring.push(item))
+                           {
+                             // Dropped, give the consumer time so most items still get through
+                             ++producerDrops;
+                             std::this_thread::yield();
+                           }
+                         }
+                         producing.store(false, std::memory_order_release); });
+
+  uint32_t received = 0, gaps = 0, errors = 0;
+  uint32_t expected = 0;
+  for (;;)
+  {
+    // Alternate both consumer paths
+    const ring_item_t *front = ring.peek();
+    if (front == NULL)
+    {
+      if (!producing.load(std::memory_order_acquire) && ring.empty())
+      {
+        break;
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    ring_item_t item;
+    if (received % 2 == 0)
+    {
+      memcpy(&item, front, sizeof(item));
+      ring.release();
+    }
+    else if (!ring.pop(item))
+    {
+      ++errors;
+      break;
+    }
+    if (item.seq < expected || !intact(item))
+    {
+      ++errors;
+    }
+    gaps += item.seq - expected;
+    expected = item.seq + 1;
+    ++received;
+    if (received % 4096 == 0)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }
+  producer.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  gaps += count - expected; // Dropped at the very end
+
+  printf("  capacity %5u: %u offered, %u received, %u dropped, watermark %u, %.1f M items/s\n", ring.capacity(),
+         count, received, ring.dropped(), ring.highWatermark(), count / seconds / 1e6);
+  bool ok = benchExpect(errors == 0, "items arrive in order and intact");
+  ok = benchExpect(ring.dropped() == producerDrops && gaps == producerDrops, "every missing item was counted as dropped") && ok;
+  ok = benchExpect(received + ring.dropped() == count && ring.pushed() == received, "pushed = received") && ok;
+  ok = benchExpect(ring.highWatermark() <= ring.capacity(), "watermark within capacity") && ok;
+  ok = benchExpect(ring.dropped() == 0 || ring.highWatermark() == ring.capacity(), "drops only when full") && ok;
+  return ok;
+}
+
+bool benchSpscRing(const bench_options_t &options)
+{
+  bool ok = checkSingle();
+  uint32_t count = options.iterations * 10;
+  ok = checkThreads(8, count) && ok;
+  ok = checkThreads(1024, count) && ok;
+  return ok;
+}
@@ -32,6 +32,23 @@ RTC_DATA_ATTR static bool overflow;
 static bool overflow;
 #endif
 
+// Broken down time of the last requested second, only recomputed when the second, offset or overflow changes
+static time_t cachedNow = -1;
+static long cachedOffset = 0;
+static bool cachedOverflow = false;
+static struct tm cachedTm;
+static uint32_t cacheHits = 0;
+static uint32_t cacheMisses = 0;
+
+#ifdef ESP32
+static portMUX_TYPE cacheMux = portMUX_INITIALIZER_UNLOCKED;
+#define CACHE_LOCK() portENTER_CRITICAL(&cacheMux)
+#define CACHE_UNLOCK() portEXIT_CRITICAL(&cacheMux)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#endif
+
 /*!
     @brief  Constructor for ESP32Time
 */
@@ -114,6 +131,10 @@ void ESP32Time::setTime(unsigned long epoch, int ms) const
   }
   tv.tv_usec = ms; // microseconds
   settimeofday(&tv, NULL);
+
+  CACHE_LOCK();
+  cachedNow = -1;
+  CACHE_UNLOCK();
 }
 
 /*!
@@ -122,11 +143,33 @@ void ESP32Time::setTime(unsigned long epoch, int ms) const
 tm ESP32Time::getTimeStruct() const
 {
   struct tm timeinfo;
+  getTimeStruct(timeinfo);
+  return timeinfo;
+}
+
+/*!
+    @brief  get the internal RTC time as a tm struct, reusing the cached
+            value while the second has not changed
+  @param	t
+      time struct to fill
+*/
+void ESP32Time::getTimeStruct(tm &t) const
+{
   time_t now;
   time(&now);
-  localtime_r(&now, &timeinfo);
-  time_t tt = mktime(&timeinfo);
 
+  CACHE_LOCK();
+  if (now == cachedNow && offset == cachedOffset && overflow == cachedOverflow)
+  {
+    t = cachedTm;
+    ++cacheHits;
+    CACHE_UNLOCK();
+    return;
+  }
+  ++cacheMisses;
+  CACHE_UNLOCK();
+
+  time_t tt = now;
   if (overflow)
   {
     tt += 63071999;
@@ -139,12 +182,33 @@ tm ESP32Time::getTimeStruct() const
   {
     tt -= (unsigned long)(offset * -1);
   }
-  struct tm *tn = localtime(&tt);
+  localtime_r(&tt, &t);
   if (overflow)
   {
-    tn->tm_year += 64;
+    t.tm_year += 64;
   }
-  return *tn;
+
+  CACHE_LOCK();
+  cachedNow = now;
+  cachedOffset = offset;
+  cachedOverflow = overflow;
+  cachedTm = t;
+  CACHE_UNLOCK();
+}
+
+/*!
+    @brief  get how often getTimeStruct was answered from the cached second
+  @param	hits
+      calls that reused the cached time struct
+  @param	misses
+      calls that converted the time
+*/
+void ESP32Time::getCacheStats(uint32_t &hits, uint32_t &misses) const
+{
+  CACHE_LOCK();
+  hits = cacheHits;
+  misses = cacheMisses;
+  CACHE_UNLOCK();
 }
 
 /*!
@@ -237,6 +301,102 @@ String ESP32Time::getDate(bool mode) const
   return String(s);
 }
 
+/*!
+    @brief  write the time with the specified format into a buffer
+  @param	buf
+      destination buffer
+  @param	len
+      size of the destination buffer
+  @param	format
+      time format
+      http://www.cplusplus.com/reference/ctime/strftime/
+*/
+size_t ESP32Time::getTime(char *buf, size_t len, const char *format) const
+{
+  struct tm timeinfo;
+  getTimeStruct(timeinfo);
+  size_t n = strftime(buf, len, format, &timeinfo);
+  if (n == 0 && len > 0)
+  {
+    buf[0] = '\0';
+  }
+  return n;
+}
+
+/*!
+    @brief  write the time (HH:MM:SS) into a buffer
+  @param	buf
+      destination buffer
+  @param	len
+      size of the destination buffer
+*/
+size_t ESP32Time::getTime(char *buf, size_t len) const
+{
+  return getTime(buf, len, "%H:%M:%S");
+}
+
+/*!
+    @brief  write the time and date into a buffer
+  @param	buf
+      destination buffer
+  @param	len
+      size of the destination buffer
+    @param  mode
+            true = Long date format
+      false = Short date format
+*/
+size_t ESP32Time::getDateTime(char *buf, size_t len, bool mode) const
+{
+  return getTime(buf, len, mode ? "%A, %B %d %Y %H:%M:%S" : "%a, %b %d %Y %H:%M:%S");
+}
+
+/*!
+    @brief  write the time and date into a buffer
+  @param	buf
+      destination buffer
+  @param	len
+      size of the destination buffer
+    @param  mode
+            true = Long date format
+      false = Short date format
+*/
+size_t ESP32Time::getTimeDate(char *buf, size_t len, bool mode) const
+{
+  return getTime(buf, len, mode ? "%H:%M:%S %A, %B %d %Y" : "%H:%M:%S %a, %b %d %Y");
+}
+
+/*!
+    @brief  write the date into a buffer
+  @param	buf
+      destination buffer
+  @param	len
+      size of the destination buffer
+    @param  mode
+            true = Long date format
+      false = Short date format
+*/
+size_t ESP32Time::getDate(char *buf, size_t len, bool mode) const
+{
+  return getTime(buf, len, mode ? "%A, %B %d %Y" : "%a, %b %d %Y");
+}
+
+/*!
+    @brief  return current hour am or pm as a static string
+  @param	lowercase
+      true = lowercase
+      false = uppercase
+*/
+const char *ESP32Time::getAmPmStr(bool lowercase) const
+{
+  struct tm timeinfo;
+  getTimeStruct(timeinfo);
+  if (timeinfo.tm_hour >= 12)
+  {
+    return lowercase ? "pm" : "PM";
+  }
+  return lowercase ? "am" : "AM";
+}
+
 /*!
     @brief  get the current milliseconds as unsigned long
 */
@@ -37,6 +37,8 @@ public:
   void setTime(int sc, int mn, int hr, int dy, int mt, int yr, int ms = 0) const;
   void setTimeStruct(tm t) const;
   tm getTimeStruct() const;
+  void getTimeStruct(tm &t) const;
+  void getCacheStats(uint32_t &hits, uint32_t &misses) const;
   String getTime(String format) const;
 
   String getTime() const;
@@ -45,6 +47,14 @@ public:
   String getDate(bool mode = false) const;
   String getAmPm(bool lowercase = false) const;
 
+  // Allocation free variants, write into a caller supplied buffer and return strftime's length
+  size_t getTime(char *buf, size_t len, const char *format) const;
+  size_t getTime(char *buf, size_t len) const;
+  size_t getDateTime(char *buf, size_t len, bool mode = false) const;
+  size_t getTimeDate(char *buf, size_t len, bool mode = false) const;
+  size_t getDate(char *buf, size_t len, bool mode = false) const;
+  const char *getAmPmStr(bool lowercase = false) const;
+
   unsigned long getEpoch() const;
   unsigned long getMillis() const;
   unsigned long getMicros() const;
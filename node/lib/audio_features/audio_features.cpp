@@ -0,0 +1,179 @@
+#include "audio_features.h"
+#include "math.h"
+
+audio_spectrum_features_t audioSpectrumFeatures(const float *magnitude, uint16_t bins, float sampleRate, float lowFrequency, float highFrequency)
+{
+  audio_spectrum_features_t features = {
+      .peakFrequency = 0,
+      .averageMagnitude = 0,
+      .averageDb = 0};
+  const float binWidth = sampleRate / (2.0f * bins);
+  // Bins are scanned in ascending order, a tie keeps the lower frequency like the former double path
+  float maxMagnitude = 0;
+  float total = 0;
+  for (uint16_t i = 1; i < bins; i++)
+  {
+    float frequency = i * binWidth;
+    if (frequency >= lowFrequency && frequency <= highFrequency && magnitude[i] > maxMagnitude)
+    {
+      maxMagnitude = magnitude[i];
+      features.peakFrequency = frequency;
+    }
+    total += magnitude[i];
+  }
+  features.averageMagnitude = total / (bins - 1);
+  features.averageDb = 20.0f * log10f(features.averageMagnitude);
+  return features;
+}
+
+#define AUDIO_TIME_BLOCK 32768 // Samples per block, the 32-bit sum of a block cannot overflow.
+
+void audioTimeFeatures(const int16_t *samples, size_t count, int16_t centre, audio_time_features_t *features)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  if (!features->started)
+  {
+    features->last = samples[0];
+    features->started = true;
+  }
+  int32_t previous = features->last - centre;
+  while (count > 0)
+  {
+    size_t block = count < AUDIO_TIME_BLOCK ? count : AUDIO_TIME_BLOCK;
+    int32_t sum = 0;
+    uint64_t energy = 0;
+    uint32_t crossings = 0;
+    int32_t high = INT16_MIN;
+    int32_t low = INT16_MAX;
+    size_t i = 0;
+    for (; i + 4 <= block; i += 4)
+    {
+      int32_t s0 = samples[i];
+      int32_t s1 = samples[i + 1];
+      int32_t s2 = samples[i + 2];
+      int32_t s3 = samples[i + 3];
+      sum += s0 + s1 + s2 + s3;
+      // Two squares of int16_t fit in a uint32_t
+      energy += (uint32_t)(s0 * s0) + (uint32_t)(s1 * s1);
+      energy += (uint32_t)(s2 * s2) + (uint32_t)(s3 * s3);
+      int32_t h = s0 > s1 ? s0 : s1;
+      int32_t l = s0 < s1 ? s0 : s1;
+      h = h > s2 ? h : s2;
+      l = l < s2 ? l : s2;
+      h = h > s3 ? h : s3;
+      l = l < s3 ? l : s3;
+      high = high > h ? high : h;
+      low = low < l ? low : l;
+      // The sign bit of the XOR is set exactly when the two samples lie on different sides of the centre
+      int32_t d0 = s0 - centre;
+      int32_t d1 = s1 - centre;
+      int32_t d2 = s2 - centre;
+      int32_t d3 = s3 - centre;
+      crossings += ((uint32_t)(previous ^ d0) >> 31) + ((uint32_t)(d0 ^ d1) >> 31) + ((uint32_t)(d1 ^ d2) >> 31) + ((uint32_t)(d2 ^ d3) >> 31);
+      previous = d3;
+    }
+    for (; i < block; i++)
+    {
+      int32_t s = samples[i];
+      int32_t d = s - centre;
+      sum += s;
+      energy += (uint32_t)(s * s);
+      high = high > s ? high : s;
+      low = low < s ? low : s;
+      crossings += (uint32_t)(previous ^ d) >> 31;
+      previous = d;
+    }
+    features->count += block;
+    features->sum += sum;
+    features->energy += energy;
+    features->zeroCrossings += crossings;
+    uint16_t peak = (uint16_t)(high > -low ? high : -low);
+    features->peak = features->peak > peak ? features->peak : peak;
+    samples += block;
+    count -= block;
+  }
+  features->last = (int16_t)(previous + centre);
+}
+
+void audioTimeClear(audio_time_features_t *features)
+{
+  features->count = 0;
+  features->sum = 0;
+  features->energy = 0;
+  features->zeroCrossings = 0;
+  features->peak = 0;
+}
+
+void audioTimeMerge(audio_time_features_t *target, const audio_time_features_t *source)
+{
+  target->count += source->count;
+  target->sum += source->sum;
+  target->energy += source->energy;
+  target->zeroCrossings += source->zeroCrossings;
+  target->peak = target->peak > source->peak ? target->peak : source->peak;
+  target->last = source->last;
+  target->started = target->started || source->started;
+}
+
+float audioTimeDcOffset(const audio_time_features_t *features)
+{
+  return features->count == 0 ? 0 : (float)((double)features->sum / features->count);
+}
+
+float audioTimeLevelDb(const audio_time_features_t *features)
+{
+  if (features->count == 0)
+  {
+    return 0;
+  }
+  // Double here, the mean square and the squared mean are close for a quiet signal with a large offset
+  double mean = (double)features->sum / features->count;
+  double variance = (double)features->energy / features->count - mean * mean;
+  return variance <= 1.0 ? 0 : (float)(10.0 * log10(variance));
+}
+
+float audioTimeCrossingRate(const audio_time_features_t *features, float sampleRate)
+{
+  return features->count == 0 ? 0 : features->zeroCrossings * sampleRate / features->count;
+}
+
+void audioBandsAdd(audio_bands_t *bands, const float *meanSquare, uint8_t count)
+{
+  if (bands->blocks == 0)
+  {
+    bands->bands = count < AUDIO_MAX_BANDS ? count : AUDIO_MAX_BANDS;
+  }
+  for (uint8_t i = 0; i < bands->bands && i < count; ++i)
+  {
+    bands->meanSquare[i] += meanSquare[i];
+  }
+  ++bands->blocks;
+}
+
+void audioBandsClear(audio_bands_t *bands)
+{
+  for (uint8_t i = 0; i < AUDIO_MAX_BANDS; ++i)
+  {
+    bands->meanSquare[i] = 0;
+  }
+  bands->blocks = 0;
+}
+
+uint8_t audioBandsQuantise(const audio_bands_t *bands, uint8_t *levels, uint8_t max)
+{
+  if (bands->blocks == 0)
+  {
+    return 0;
+  }
+  uint8_t count = bands->bands < max ? bands->bands : max;
+  for (uint8_t i = 0; i < count; ++i)
+  {
+    float meanSquare = bands->meanSquare[i] / bands->blocks;
+    float steps = meanSquare > 1.0f ? 20.0f * log10f(meanSquare) : 0; // 10 log10 in 0.5 dB steps
+    levels[i] = steps >= 255.0f ? 255 : (uint8_t)lroundf(steps);
+  }
+  return count;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define AUDIO_MAX_BANDS 22 // Bands one report can carry, matches AudioBands in data_packaging.h.
+
+typedef struct // Features of one magnitude spectrum.
+{
+  float peakFrequency;    // Centre of the strongest bin inside the searched range (in Hz), 0 if the range holds no bin.
+  float averageMagnitude; // Mean magnitude of all bins but DC.
+  float averageDb;        // 20 log10 of averageMagnitude.
+} audio_spectrum_features_t;
+
+/**
+ * @brief Extract the spectrum features the node reports from the output of RealFFT::magnitude().
+ *
+ * @param[in] magnitude Magnitudes of bins 0 to bins - 1.
+ * @param[in] bins Number of bins, half the frame size.
+ * @param[in] sampleRate Sample rate of the frame (in Hz).
+ * @param[in] lowFrequency Lowest frequency considered for the peak (in Hz).
+ * @param[in] highFrequency Highest frequency considered for the peak (in Hz).
+ */
+audio_spectrum_features_t audioSpectrumFeatures(const float *magnitude, uint16_t bins, float sampleRate, float lowFrequency, float highFrequency);
+
+typedef struct // Time domain features of a run of samples, accumulated by audioTimeFeatures().
+{
+  uint32_t count;         // Samples.
+  int64_t sum;            // Sum of the samples, count times the DC offset.
+  uint64_t energy;        // Sum of the squared samples.
+  uint32_t zeroCrossings; // Sign changes around the centre passed to audioTimeFeatures().
+  uint16_t peak;          // Largest absolute sample.
+  int16_t last;           // Last sample seen, so crossings are counted across calls and audioTimeClear().
+  bool started;           // last is valid.
+} audio_time_features_t;
+
+/**
+ * @brief Fused single pass over raw samples: sum, energy, zero crossings and peak.
+ *
+ * @note Accumulates into features, a zero initialised struct is empty. The sample sum and the crossings are
+ * kept in 32-bit registers and folded into the totals per block. The energy goes straight into a 64-bit
+ * register, two squares at a time: a full-scale square is 2^30, so one unrolled step of four can overflow
+ * 32 bits. The loop is unrolled by four so the Xtensa core can keep all accumulators in registers and use
+ * its MIN/MAX instructions for the peak.
+ *
+ * @param[in] samples Samples in stream order.
+ * @param[in] count Number of samples.
+ * @param[in] centre Level the crossings are counted around, e.g. the DC offset of earlier samples.
+ * @param[in, out] features Accumulated features.
+ */
+void audioTimeFeatures(const int16_t *samples, size_t count, int16_t centre, audio_time_features_t *features);
+
+/**
+ * @brief Empty the accumulators but keep the last sample, so the next call still sees a crossing at the boundary.
+ */
+void audioTimeClear(audio_time_features_t *features);
+
+/**
+ * @brief Add the accumulators of source to target.
+ */
+void audioTimeMerge(audio_time_features_t *target, const audio_time_features_t *source);
+
+/**
+ * @brief Mean of the samples, 0 if empty.
+ */
+float audioTimeDcOffset(const audio_time_features_t *features);
+
+/**
+ * @brief RMS around the DC offset in dB relative to one LSB, i.e. dBFS + 90.3 for 16-bit samples. 0 if empty or below 1 LSB.
+ */
+float audioTimeLevelDb(const audio_time_features_t *features);
+
+/**
+ * @brief Zero crossings per second, 0 if empty.
+ */
+float audioTimeCrossingRate(const audio_time_features_t *features, float sampleRate);
+
+typedef struct // Band levels averaged over blocks, see audioBandsAdd().
+{
+  uint8_t bands;                     // Bands per block, taken from the first block added.
+  uint32_t blocks;                   // Blocks added.
+  float meanSquare[AUDIO_MAX_BANDS]; // Sum of the mean squares of every band (in LSB^2).
+} audio_bands_t;
+
+/**
+ * @brief Add the mean squares of one block. A zero initialised struct is empty.
+ */
+void audioBandsAdd(audio_bands_t *bands, const float *meanSquare, uint8_t count);
+
+void audioBandsClear(audio_bands_t *bands);
+
+/**
+ * @brief Mean level of every band in 0.5 dB steps relative to one LSB (dBFS + 90.3), clamped to 0..255.
+ *
+ * @return Number of levels written, at most max.
+ */
+uint8_t audioBandsQuantise(const audio_bands_t *bands, uint8_t *levels, uint8_t max);
@@ -0,0 +1,125 @@
+#include "audio_stream.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+
+void audioReportAdd(audio_report_t *report, const audio_spectrum_features_t *spectrum, const audio_time_features_t *time, const audio_bands_t *bands)
+{
+  if (report->windows == 0 || spectrum->averageDb > report->loudestDb)
+  {
+    report->loudestDb = spectrum->averageDb;
+    report->peakFrequency = spectrum->peakFrequency;
+  }
+  audioTimeMerge(&report->time, time);
+  if (bands != NULL)
+  {
+    audioBandsAdd(&report->bands, bands->meanSquare, bands->bands);
+  }
+  ++report->windows;
+}
+
+void audioReportClear(audio_report_t *report)
+{
+  report->windows = 0;
+  report->loudestDb = 0;
+  report->peakFrequency = 0;
+  audioTimeClear(&report->time);
+  audioBandsClear(&report->bands);
+}
+
+bool AudioStream::init(uint16_t size, uint16_t hop, float sampleRate, float lowFrequency, float highFrequency)
+{
+  if (_history != NULL || hop == 0 || hop > size || !_fft.init(size))
+  {
+    return false;
+  }
+  _history = (int16_t *)malloc(size * sizeof(int16_t));
+  _frame = (float *)malloc(size * sizeof(float));
+  if (_history == NULL || _frame == NULL)
+  {
+    deinit();
+    return false;
+  }
+  _filled = 0;
+  _hop = hop;
+  _windows = 0;
+  _time = {};
+  _centre = 0;
+  _sampleRate = sampleRate;
+  _lowFrequency = lowFrequency;
+  _highFrequency = highFrequency;
+  return true;
+}
+
+void AudioStream::deinit()
+{
+  free(_history);
+  free(_frame);
+  _history = NULL;
+  _frame = NULL;
+  _bands.deinit();
+  _fft.deinit();
+}
+
+bool AudioStream::initBands(uint8_t fraction, bool aWeighting)
+{
+  return _history != NULL && _bands.init(fraction, _fft.size(), _sampleRate, aWeighting);
+}
+
+uint32_t AudioStream::push(const int16_t *samples, size_t count, audio_window_cb_t callback, void *arg)
+{
+  uint32_t analysed = 0;
+  while (count > 0)
+  {
+    size_t space = 0;
+    int16_t *tail = reserve(&space);
+    size_t take = count < space ? count : space;
+    memcpy(tail, samples, take * sizeof(int16_t));
+    samples += take;
+    count -= take;
+    analysed += commit(take, callback, arg);
+  }
+  return analysed;
+}
+
+int16_t *AudioStream::reserve(size_t *count)
+{
+  *count = _fft.size() - _filled;
+  return _history + _filled;
+}
+
+uint32_t AudioStream::commit(size_t count, audio_window_cb_t callback, void *arg)
+{
+  const uint16_t size = _fft.size();
+  if (count > (size_t)(size - _filled))
+  {
+    count = size - _filled;
+  }
+  audioTimeFeatures(_history + _filled, count, _centre, &_time);
+  _filled += count;
+  if (_filled < size)
+  {
+    return 0;
+  }
+  // The window is applied while the samples are converted, the int16_t buffer keeps the overlap untouched
+  _fft.window(_history, _frame);
+  _fft.forward(_frame);
+  _fft.magnitude(_frame);
+  audio_spectrum_features_t features = audioSpectrumFeatures(_frame, size / 2, _sampleRate, _lowFrequency, _highFrequency);
+  audio_bands_t bands;
+  if (_bands.bands() > 0)
+  {
+    _bands.measure(_frame, &bands);
+  }
+  // Keep the overlap for the next window, moving a few KB per hop is cheaper than windowing a wrapped ring
+  memmove(_history, _history + _hop, (size - _hop) * sizeof(int16_t));
+  _filled = size - _hop;
+  ++_windows;
+  if (callback != NULL)
+  {
+    callback(&features, &_time, _bands.bands() > 0 ? &bands : NULL, arg);
+  }
+  _centre = (int16_t)lroundf(audioTimeDcOffset(&_time));
+  audioTimeClear(&_time);
+  return 1;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+#include "real_fft.h"
+#include "audio_features.h"
+#include "octave_bands.h"
+
+typedef struct // Windows analysed during one reporting interval, see audioReportAdd().
+{
+  uint32_t windows;           // Windows added.
+  float loudestDb;            // Spectral level of the loudest window.
+  float peakFrequency;        // Peak frequency of the loudest window (in Hz), so a short event is not averaged away.
+  audio_time_features_t time; // Every sample of the interval, each counted once.
+  audio_bands_t bands;        // Band levels, of every window or filled by the caller (e.g. from a GoertzelBank).
+} audio_report_t;
+
+/**
+ * @brief Add the features of one window and of the samples that completed it to a report. A zero initialised report is empty.
+ *
+ * @param[in] bands Band levels of the window, NULL if the stream measures none.
+ */
+void audioReportAdd(audio_report_t *report, const audio_spectrum_features_t *spectrum, const audio_time_features_t *time, const audio_bands_t *bands);
+
+/**
+ * @brief Empty a report, crossings at the boundary to the next interval are still counted.
+ */
+void audioReportClear(audio_report_t *report);
+
+typedef void (*audio_window_cb_t)(const audio_spectrum_features_t *spectrum, const audio_time_features_t *time, const audio_bands_t *bands, void *arg);
+
+/**
+ * @brief Cuts a continuous sample stream into overlapping windows and analyses each of them.
+ *
+ * @note The last size() samples are kept in a sliding int16_t buffer. Every hop() new samples complete a window,
+ * which is windowed, transformed with RealFFT and reduced with audioSpectrumFeatures(). With hop() = size() / 2
+ * every sample lies in two windows, which makes up for the Hamming window fading out the frame edges.
+ * New samples also pass audioTimeFeatures() once, around the DC offset of the previous hop, and the callback
+ * gets the time domain features of the samples since the previous window along with the spectrum. After
+ * initBands() it also gets the octave band levels of the window.
+ * Analysis runs in the task calling push(), the callback should only store the result.
+ */
+class AudioStream
+{
+public:
+  AudioStream() {}
+  ~AudioStream() { deinit(); }
+
+  AudioStream(const AudioStream &) = delete;
+  AudioStream &operator=(const AudioStream &) = delete;
+
+  /**
+   * @brief Allocate the buffers and the FFT tables.
+   *
+   * @param[in] size Samples per window. Power of two, at least 8.
+   * @param[in] hop Samples between the starts of two windows, 0 < hop <= size.
+   * @param[in] sampleRate Sample rate of the stream (in Hz).
+   * @param[in] lowFrequency Lowest frequency considered for the peak (in Hz).
+   * @param[in] highFrequency Highest frequency considered for the peak (in Hz).
+   *
+   * @return
+   *              - true if the stream is ready
+   *              - false if a parameter is invalid, already initialised or there is no free memory
+   */
+  bool init(uint16_t size, uint16_t hop, float sampleRate, float lowFrequency, float highFrequency);
+
+  void deinit();
+
+  /**
+   * @brief Measure octave band levels in every window from now on, see OctaveBands.
+   *
+   * @param[in] fraction 1 for octave or 3 for third octave bands.
+   * @param[in] aWeighting Apply the A-weighting.
+   *
+   * @return
+   *              - true if the bands are measured
+   *              - false if the stream is not initialised or a parameter is invalid
+   */
+  bool initBands(uint8_t fraction, bool aWeighting);
+
+  /**
+   * @brief Append samples and analyse every window they complete.
+   *
+   * @param[in] samples Samples in stream order, any count.
+   * @param[in] count Number of samples.
+   * @param[in] callback Called once per completed window with its features.
+   * @param[in] arg Passed to the callback.
+   *
+   * @return Number of windows analysed.
+   */
+  uint32_t push(const int16_t *samples, size_t count, audio_window_cb_t callback, void *arg);
+
+  /**
+   * @brief Free space at the end of the sliding buffer, so a driver can read straight into it.
+   *
+   * @param[out] count Samples that fit, at least hop().
+   *
+   * @return Where the next sample goes. Fill it and call commit().
+   */
+  int16_t *reserve(size_t *count);
+
+  /**
+   * @brief Take samples written to the space returned by reserve() and analyse the window they complete.
+   *
+   * @param[in] count Number of samples written, at most the count returned by reserve().
+   * @param[in] callback Called once per completed window with its features.
+   * @param[in] arg Passed to the callback.
+   *
+   * @return Number of windows analysed, 0 or 1.
+   */
+  uint32_t commit(size_t count, audio_window_cb_t callback, void *arg);
+
+  uint16_t size() const { return _fft.size(); }
+  uint16_t hop() const { return _hop; }
+  uint32_t windows() const { return _windows; } // Windows analysed since init().
+  const OctaveBands &bands() const { return _bands; }
+
+private:
+  RealFFT _fft;
+  OctaveBands _bands;
+  int16_t *_history = NULL; // Samples of the window being filled, oldest first.
+  float *_frame = NULL;     // Scratch of the analysis, windowed samples, spectrum and magnitudes in turn.
+  uint16_t _filled = 0;
+  uint16_t _hop = 0;
+  uint32_t _windows = 0;
+  audio_time_features_t _time = {}; // Samples since the previous window.
+  int16_t _centre = 0;              // DC offset of the previous hop.
+  float _sampleRate = 0;
+  float _lowFrequency = 0;
+  float _highFrequency = 0;
+};
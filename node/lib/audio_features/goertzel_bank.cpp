@@ -0,0 +1,107 @@
+#include "goertzel_bank.h"
+#include "stdlib.h"
+#include "math.h"
+
+#define GOERTZEL_BANK_CHUNK 64 // Samples windowed at once, then run through every filter while they sit in registers and cache.
+
+bool GoertzelBank::init(const float *frequencies, uint8_t bands, float sampleRate, uint16_t blockSize)
+{
+  if (_window != NULL || frequencies == NULL || bands == 0 || bands > GOERTZEL_BANK_MAX_BANDS || blockSize < 16 || sampleRate <= 0)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < bands; ++i)
+  {
+    if (frequencies[i] <= 0 || frequencies[i] >= sampleRate / 2)
+    {
+      return false;
+    }
+  }
+  _window = (float *)malloc(blockSize * sizeof(float));
+  if (_window == NULL)
+  {
+    return false;
+  }
+  double gain = 0;
+  for (uint16_t n = 0; n < blockSize; ++n)
+  {
+    _window[n] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * n / blockSize));
+    gain += _window[n];
+  }
+  // A sine of amplitude A gives |X| = A * gain / 2, its mean square is A^2 / 2
+  _scale = (float)(2.0 / (gain * gain));
+  for (uint8_t i = 0; i < bands; ++i)
+  {
+    _frequency[i] = frequencies[i];
+    _coefficient[i] = (float)(2.0 * cos(2.0 * M_PI * frequencies[i] / sampleRate));
+    _s1[i] = 0;
+    _s2[i] = 0;
+  }
+  _bands = bands;
+  _block_size = blockSize;
+  _position = 0;
+  return true;
+}
+
+void GoertzelBank::deinit()
+{
+  free(_window);
+  _window = NULL;
+  _bands = 0;
+  _block_size = 0;
+}
+
+uint32_t GoertzelBank::process(const int16_t *samples, size_t count, goertzel_block_cb_t callback, void *arg)
+{
+  uint32_t blocks = 0;
+  float chunk[GOERTZEL_BANK_CHUNK];
+  while (count > 0)
+  {
+    size_t take = _block_size - _position;
+    take = take < count ? take : count;
+    take = take < GOERTZEL_BANK_CHUNK ? take : GOERTZEL_BANK_CHUNK;
+    const float *window = _window + _position;
+    for (size_t n = 0; n < take; ++n)
+    {
+      chunk[n] = samples[n] * window[n];
+    }
+    for (uint8_t i = 0; i < _bands; ++i)
+    {
+      float coefficient = _coefficient[i];
+      float s1 = _s1[i];
+      float s2 = _s2[i];
+      for (size_t n = 0; n < take; ++n)
+      {
+        float s0 = chunk[n] + coefficient * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+      }
+      _s1[i] = s1;
+      _s2[i] = s2;
+    }
+    samples += take;
+    count -= take;
+    _position += take;
+    if (_position < _block_size)
+    {
+      continue;
+    }
+    float meanSquare[GOERTZEL_BANK_MAX_BANDS];
+    for (uint8_t i = 0; i < _bands; ++i)
+    {
+      float s1 = _s1[i];
+      float s2 = _s2[i];
+      // |X|^2 of the block, exact for any frequency, only the phase would need a correction
+      meanSquare[i] = (s1 * s1 + s2 * s2 - _coefficient[i] * s1 * s2) * _scale;
+      _s1[i] = 0;
+      _s2[i] = 0;
+    }
+    _position = 0;
+    ++blocks;
+    if (callback != NULL)
+    {
+      callback(meanSquare, _bands, arg);
+    }
+  }
+  return blocks;
+}
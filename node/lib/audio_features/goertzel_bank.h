@@ -0,0 +1,67 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define GOERTZEL_BANK_MAX_BANDS 16 // Beyond this a RealFFT of the same block is cheaper.
+
+typedef void (*goertzel_block_cb_t)(const float *meanSquare, uint8_t bands, void *arg);
+
+/**
+ * @brief Bank of Goertzel filters measuring the level at a few fixed frequencies.
+ *
+ * @note Samples are cut into consecutive blocks of blockSize() samples with a Hann window, each block costs one
+ * multiply-add per sample and band plus a few operations per band at the end. The frequencies need not be
+ * multiples of sampleRate / blockSize. Blocks continue across process() calls, nothing is skipped.
+ */
+class GoertzelBank
+{
+public:
+  GoertzelBank() {}
+  ~GoertzelBank() { deinit(); }
+
+  GoertzelBank(const GoertzelBank &) = delete;
+  GoertzelBank &operator=(const GoertzelBank &) = delete;
+
+  /**
+   * @brief Allocate the window and compute the filter coefficients.
+   *
+   * @param[in] frequencies Centre frequencies (in Hz), below sampleRate / 2.
+   * @param[in] bands Number of frequencies, 1 to GOERTZEL_BANK_MAX_BANDS.
+   * @param[in] sampleRate Sample rate (in Hz).
+   * @param[in] blockSize Samples per block, the bandwidth of a filter is about 2 * sampleRate / blockSize.
+   *
+   * @return
+   *              - true if the bank is ready
+   *              - false if a parameter is invalid, already initialised or there is no free memory
+   */
+  bool init(const float *frequencies, uint8_t bands, float sampleRate, uint16_t blockSize);
+
+  void deinit();
+
+  /**
+   * @brief Run the samples through all filters.
+   *
+   * @param[in] callback Called once per completed block with the mean square of every band (in LSB^2, as the
+   * mean square of a sine with the measured amplitude would be).
+   * @param[in] arg Passed to the callback.
+   *
+   * @return Number of blocks completed.
+   */
+  uint32_t process(const int16_t *samples, size_t count, goertzel_block_cb_t callback, void *arg);
+
+  uint8_t bands() const { return _bands; }
+  uint16_t blockSize() const { return _block_size; }
+  float frequency(uint8_t band) const { return _frequency[band]; }
+
+private:
+  uint8_t _bands = 0;
+  uint16_t _block_size = 0;
+  uint16_t _position = 0;     // Samples of the current block already processed.
+  float *_window = NULL;      // Hann window of one block.
+  float _scale = 0;           // Turns |X|^2 into a mean square.
+  float _frequency[GOERTZEL_BANK_MAX_BANDS];
+  float _coefficient[GOERTZEL_BANK_MAX_BANDS]; // 2 cos(2 pi f / sampleRate).
+  float _s1[GOERTZEL_BANK_MAX_BANDS];
+  float _s2[GOERTZEL_BANK_MAX_BANDS];
+};
@@ -0,0 +1,85 @@
+#include "octave_bands.h"
+#include "math.h"
+
+// A-weighting of IEC 61672 (in dB), 0 at 1 kHz
+static double _a_weighting_db(double frequency)
+{
+  const double f2 = frequency * frequency;
+  const double gain = 12194.0 * 12194.0 * f2 * f2 /
+                      ((f2 + 20.6 * 20.6) * sqrt((f2 + 107.7 * 107.7) * (f2 + 737.9 * 737.9)) * (f2 + 12194.0 * 12194.0));
+  return 20.0 * log10(gain) + 2.0;
+}
+
+bool OctaveBands::init(uint8_t fraction, uint16_t size, float sampleRate, bool aWeighting)
+{
+  if ((fraction != 1 && fraction != 3) || size < 8 || sampleRate <= 0)
+  {
+    return false;
+  }
+  // Steps of 10^(1/10) between third octave centres, three of them between octave centres
+  const double step = 3.0 / fraction;
+  const int first = (int)ceil(10.0 * log10(OCTAVE_BANDS_LOWEST / 1000.0) / step - 1e-9);
+  const double binWidth = sampleRate / size;
+  const uint16_t bins = size / 2;
+
+  // Parseval: the one-sided sum of |X|^2 is size / 2 times the sum of the squared windowed samples
+  double windowPower = 0;
+  for (uint16_t i = 0; i < size; ++i)
+  {
+    double weight = 0.54 - 0.46 * cos(2.0 * M_PI * i / (size - 1));
+    windowPower += weight * weight;
+  }
+  const double scale = 2.0 / (size * windowPower);
+
+  uint8_t bands = 0;
+  while (bands < AUDIO_MAX_BANDS)
+  {
+    double centre = 1000.0 * pow(10.0, (first + bands) * step / 10.0);
+    double lower = centre * pow(10.0, -step / 20.0);
+    double upper = centre * pow(10.0, step / 20.0);
+    if (upper > sampleRate / 2)
+    {
+      break;
+    }
+    uint32_t edge = (uint32_t)ceil(lower / binWidth);
+    _edge[bands] = edge < 1 ? 1 : (edge > bins ? bins : edge);
+    _edge[bands + 1] = (uint16_t)fmin(bins, ceil(upper / binWidth));
+    _gain[bands] = (float)(scale * (aWeighting ? pow(10.0, _a_weighting_db(centre) / 10.0) : 1.0));
+    ++bands;
+  }
+  if (bands == 0)
+  {
+    return false;
+  }
+  _fraction = fraction;
+  _bands = bands;
+  _a_weighting = aWeighting;
+  _first = (int8_t)first;
+  return true;
+}
+
+void OctaveBands::deinit()
+{
+  _bands = 0;
+  _fraction = 0;
+}
+
+void OctaveBands::measure(const float *magnitude, audio_bands_t *bands) const
+{
+  for (uint8_t i = 0; i < _bands; ++i)
+  {
+    float power = 0;
+    for (uint16_t bin = _edge[i]; bin < _edge[i + 1]; ++bin)
+    {
+      power += magnitude[bin] * magnitude[bin];
+    }
+    bands->meanSquare[i] = power * _gain[i];
+  }
+  bands->bands = _bands;
+  bands->blocks = 1;
+}
+
+float OctaveBands::frequency(uint8_t band) const
+{
+  return (float)(1000.0 * pow(10.0, (_first + band) * 3.0 / _fraction / 10.0));
+}
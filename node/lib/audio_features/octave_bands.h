@@ -0,0 +1,59 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+#include "audio_features.h"
+
+#define OCTAVE_BANDS_LOWEST 50.0f // No band is centred below this (in Hz), 63 Hz for octaves and 50 Hz for third octaves.
+
+/**
+ * @brief Sums the power of FFT bins into 1/1 or 1/3 octave bands, optionally A-weighted.
+ *
+ * @note Centres are the base 10 frequencies of IEC 61260 (1000 * 10^(k / 10) Hz for third octaves), from the
+ * first at or above OCTAVE_BANDS_LOWEST up to the last band whose upper edge is below the Nyquist frequency,
+ * at most AUDIO_MAX_BANDS. Bins are assigned by their centre frequency. Bands are contiguous, so the table is
+ * the first bin of every band plus one end, built once in init(). A-weighting is applied per band at its
+ * centre frequency, as a sound level meter does for band levels.
+ */
+class OctaveBands
+{
+public:
+  OctaveBands() {}
+
+  /**
+   * @brief Build the bin to band table for the frames of a RealFFT.
+   *
+   * @param[in] fraction 1 for octave or 3 for third octave bands.
+   * @param[in] size Samples per frame, passed to RealFFT::init().
+   * @param[in] sampleRate Sample rate (in Hz).
+   * @param[in] aWeighting Apply the A-weighting at the centre of every band.
+   *
+   * @return
+   *              - true if at least one band fits below the Nyquist frequency
+   *              - false if a parameter is invalid
+   */
+  bool init(uint8_t fraction, uint16_t size, float sampleRate, bool aWeighting);
+
+  void deinit();
+
+  /**
+   * @brief Mean square of every band in one frame.
+   *
+   * @param[in] magnitude Output of RealFFT::magnitude() for a frame windowed with RealFFT::window().
+   * @param[out] bands Mean square (in LSB^2) a band contributes to the windowed samples, with blocks set to 1.
+   */
+  void measure(const float *magnitude, audio_bands_t *bands) const;
+
+  uint8_t bands() const { return _bands; } // 0 before init().
+  uint8_t fraction() const { return _fraction; }
+  bool aWeighting() const { return _a_weighting; }
+  float frequency(uint8_t band) const; // Exact centre (in Hz), e.g. 1995 for the nominal 2 kHz band.
+
+private:
+  uint8_t _fraction = 0;
+  uint8_t _bands = 0;
+  bool _a_weighting = false;
+  int8_t _first = 0;                   // Index k of the lowest centre.
+  uint16_t _edge[AUDIO_MAX_BANDS + 1]; // First bin of every band, then the end of the last band.
+  float _gain[AUDIO_MAX_BANDS];        // Turns a sum of |X|^2 into a mean square, times the weighting.
+};
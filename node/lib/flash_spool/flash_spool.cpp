@@ -0,0 +1,357 @@
+#include "flash_spool.h"
+#include "string.h"
+#include "esp_log.h"
+#include "crc16.h"
+
+#define FLASH_SPOOL_MAGIC 0x4C4F5053 // "SPOL"
+#define FLASH_SPOOL_STATE_FREE 0xFF
+#define FLASH_SPOOL_STATE_WRITTEN 0xFE
+#define FLASH_SPOOL_STATE_CONSUMED 0x00
+
+static const char *TAG = "flash_spool";
+
+typedef struct // Written once when a sector is opened.
+{
+  uint32_t magic;
+  uint32_t sequence; // Increments for every opened sector, the lowest valid one is the oldest.
+  uint32_t reserved[2];
+} __attribute__((packed)) _sector_header_t;
+
+typedef struct // Precedes every record, the payload is padded to a multiple of 4 bytes.
+{
+  uint8_t state; // Bits only ever go from 1 to 0, so the state can be rewritten without an erase.
+  uint8_t reserved;
+  uint16_t length;
+  uint16_t crc; // CRC-16-CCITT of the payload.
+  uint16_t reserved2;
+} __attribute__((packed)) _record_header_t;
+
+#define FLASH_SPOOL_DATA_OFFSET sizeof(_sector_header_t)
+#define FLASH_SPOOL_RECORD_SIZE(length) (sizeof(_record_header_t) + (((length) + 3) & ~3))
+
+esp_err_t FlashSpool::init(const char *label)
+{
+  ESP_LOGI(TAG, "Spool initialization begin.");
+  _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (_partition == NULL)
+  {
+    ESP_LOGE(TAG, "Spool initialization fail. Partition %s not found.", label);
+    return ESP_ERR_NOT_FOUND;
+  }
+  _sectors = _partition->size / FLASH_SPOOL_SECTOR_SIZE;
+  if (_sectors < 2)
+  {
+    ESP_LOGE(TAG, "Spool initialization fail. Partition %s is too small.", label);
+    _partition = NULL;
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (_mutex == NULL)
+  {
+    _mutex = xSemaphoreCreateMutex();
+  }
+  _stats = {};
+  _pending = 0;
+  // Active sectors always form one run in ring order, from the reader's sector to the writer's sector.
+  bool found = false;
+  uint32_t newest = 0;
+  for (uint32_t sector = 0; sector < _sectors; ++sector)
+  {
+    _sector_header_t header;
+    if (esp_partition_read(_partition, _sectorAddress(sector), &header, sizeof(header)) != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Spool initialization fail. Flash read error.");
+      _partition = NULL;
+      return ESP_FAIL;
+    }
+    if (header.magic != FLASH_SPOOL_MAGIC)
+    {
+      const uint8_t *bytes = (const uint8_t *)&header;
+      for (uint8_t i = 0; i < sizeof(header); ++i)
+      {
+        if (bytes[i] != 0xFF)
+        {
+          _eraseSector(sector); // Not ours or torn while opening, must be blank before it can be used.
+          break;
+        }
+      }
+      continue;
+    }
+    if (found == false || (int32_t)(header.sequence - _next_sequence) > 0)
+    {
+      _next_sequence = header.sequence;
+      newest = sector;
+    }
+    found = true;
+  }
+  if (found == false)
+  {
+    _write_sector = 0;
+    _read_sector = 0;
+    _next_sequence = 0;
+    if (_openSector(0) != ESP_OK)
+    {
+      ESP_LOGE(TAG, "Spool initialization fail. Flash write error.");
+      _partition = NULL;
+      return ESP_FAIL;
+    }
+    _read_offset = FLASH_SPOOL_DATA_OFFSET;
+    ESP_LOGI(TAG, "Spool initialization success. Partition %s is empty, %u sectors.", label, _sectors);
+    return ESP_OK;
+  }
+  // The reader's sector is the first active one following an erased sector (or the writer's sector itself).
+  uint32_t oldest = newest;
+  for (uint32_t i = 1; i < _sectors; ++i)
+  {
+    uint32_t sector = (newest + _sectors - i) % _sectors;
+    uint32_t magic;
+    esp_partition_read(_partition, _sectorAddress(sector), &magic, sizeof(magic));
+    if (magic != FLASH_SPOOL_MAGIC)
+    {
+      break;
+    }
+    oldest = sector;
+  }
+  _write_sector = newest;
+  _next_sequence += 1;
+  _write_offset = FLASH_SPOOL_DATA_OFFSET;
+  _record_header_t header;
+  while (_readRecord(_write_sector, _write_offset, &header) == true)
+  {
+    _write_offset += FLASH_SPOOL_RECORD_SIZE(header.length);
+  }
+  if (_write_offset + sizeof(header) <= FLASH_SPOOL_SECTOR_SIZE && header.state != FLASH_SPOOL_STATE_FREE)
+  {
+    _write_offset = FLASH_SPOOL_SECTOR_SIZE; // Torn record, the next append opens a new sector.
+  }
+  _read_sector = oldest;
+  _read_offset = FLASH_SPOOL_DATA_OFFSET;
+  for (uint32_t sector = oldest;; sector = (sector + 1) % _sectors)
+  {
+    for (uint32_t offset = FLASH_SPOOL_DATA_OFFSET; _readRecord(sector, offset, &header) == true; offset += FLASH_SPOOL_RECORD_SIZE(header.length))
+    {
+      _pending += header.state == FLASH_SPOOL_STATE_WRITTEN;
+    }
+    if (sector == _write_sector)
+    {
+      break;
+    }
+  }
+  ESP_LOGI(TAG, "Spool initialization success. Partition %s, %u sectors, reading from %u, writing to %u, %u records pending.", label, _sectors, _read_sector, _write_sector, _pending);
+  return ESP_OK;
+}
+
+esp_err_t FlashSpool::append(const void *data, uint16_t length)
+{
+  if (data == NULL || length == 0 || length > FLASH_SPOOL_MAX_RECORD)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (_partition == NULL)
+  {
+    return ESP_FAIL;
+  }
+  uint8_t record[FLASH_SPOOL_RECORD_SIZE(FLASH_SPOOL_MAX_RECORD)];
+  uint16_t size = FLASH_SPOOL_RECORD_SIZE(length);
+  _record_header_t header = {
+      .state = FLASH_SPOOL_STATE_WRITTEN,
+      .reserved = 0xFF,
+      .length = length,
+      .crc = crc16_ccitt((const uint8_t *)data, length),
+      .reserved2 = 0xFFFF,
+  };
+  memcpy(record, &header, sizeof(header));
+  memcpy(record + sizeof(header), data, length);
+  memset(record + sizeof(header) + length, 0xFF, size - sizeof(header) - length);
+  esp_err_t err = ESP_OK;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  if (_write_offset + size > FLASH_SPOOL_SECTOR_SIZE)
+  {
+    uint32_t next = (_write_sector + 1) % _sectors;
+    if (next == _read_sector)
+    {
+      ++_stats.dropped;
+      err = ESP_ERR_NO_MEM;
+      goto FLASH_SPOOL_APPEND_EXIT;
+    }
+    err = _openSector(next);
+    if (err != ESP_OK)
+    {
+      goto FLASH_SPOOL_APPEND_EXIT;
+    }
+  }
+  // Header and payload go out in one write, a record torn by a power loss fails its CRC.
+  err = esp_partition_write(_partition, _sectorAddress(_write_sector) + _write_offset, record, size);
+  if (err == ESP_OK)
+  {
+    _write_offset += size;
+    ++_stats.appended;
+    ++_pending;
+  }
+  else
+  {
+    _write_offset = FLASH_SPOOL_SECTOR_SIZE;
+  }
+FLASH_SPOOL_APPEND_EXIT:
+  xSemaphoreGive(_mutex);
+  return err;
+}
+
+esp_err_t FlashSpool::pop(void *data, uint16_t capacity, uint16_t *length)
+{
+  if (data == NULL || length == NULL)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (_partition == NULL)
+  {
+    return ESP_FAIL;
+  }
+  esp_err_t err = ESP_ERR_NOT_FOUND;
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  for (;;)
+  {
+    if (_read_sector == _write_sector && _read_offset >= _write_offset)
+    {
+      break;
+    }
+    _record_header_t header;
+    if (_readRecord(_read_sector, _read_offset, &header) == false)
+    {
+      if (_read_sector == _write_sector)
+      {
+        break;
+      }
+      // Sector fully consumed. Erasing it right away keeps the writer from ever having to wait for an erase of live data.
+      _eraseSector(_read_sector);
+      _read_sector = (_read_sector + 1) % _sectors;
+      _read_offset = FLASH_SPOOL_DATA_OFFSET;
+      continue;
+    }
+    uint32_t address = _sectorAddress(_read_sector) + _read_offset;
+    if (header.state == FLASH_SPOOL_STATE_CONSUMED)
+    {
+      _read_offset += FLASH_SPOOL_RECORD_SIZE(header.length);
+      continue;
+    }
+    const uint8_t consumed = FLASH_SPOOL_STATE_CONSUMED;
+    if (header.length > capacity)
+    {
+      // Left behind by a firmware with a larger record layout, it would block the spool forever.
+      esp_partition_write(_partition, address, &consumed, sizeof(consumed));
+      _read_offset += FLASH_SPOOL_RECORD_SIZE(header.length);
+      _pending -= _pending > 0;
+      *length = header.length;
+      err = ESP_ERR_INVALID_SIZE;
+      break;
+    }
+    if (esp_partition_read(_partition, address + sizeof(header), data, header.length) != ESP_OK)
+    {
+      err = ESP_FAIL;
+      break;
+    }
+    esp_partition_write(_partition, address, &consumed, sizeof(consumed));
+    _read_offset += FLASH_SPOOL_RECORD_SIZE(header.length);
+    _pending -= _pending > 0;
+    if (crc16_ccitt((const uint8_t *)data, header.length) != header.crc)
+    {
+      ++_stats.corrupt;
+      continue;
+    }
+    *length = header.length;
+    ++_stats.drained;
+    err = ESP_OK;
+    break;
+  }
+  xSemaphoreGive(_mutex);
+  return err;
+}
+
+bool FlashSpool::empty()
+{
+  if (_partition == NULL)
+  {
+    return true;
+  }
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  bool empty = _read_sector == _write_sector && _read_offset >= _write_offset;
+  xSemaphoreGive(_mutex);
+  return empty;
+}
+
+uint32_t FlashSpool::pending()
+{
+  if (_partition == NULL)
+  {
+    return 0;
+  }
+  xSemaphoreTake(_mutex, portMAX_DELAY);
+  uint32_t pending = _pending;
+  xSemaphoreGive(_mutex);
+  return pending;
+}
+
+esp_err_t FlashSpool::_openSector(uint32_t sector)
+{
+  _sector_header_t header;
+  esp_err_t err = esp_partition_read(_partition, _sectorAddress(sector), &header, sizeof(header));
+  if (err == ESP_OK && (header.magic != 0xFFFFFFFF || header.sequence != 0xFFFFFFFF))
+  {
+    err = _eraseSector(sector); // Its erase after the last pop failed, writing over old records would garble them.
+  }
+  header = {
+      .magic = FLASH_SPOOL_MAGIC,
+      .sequence = _next_sequence,
+      .reserved = {0xFFFFFFFF, 0xFFFFFFFF},
+  };
+  // Magic last, so a header torn by a power loss never looks valid with a garbled sequence number.
+  if (err == ESP_OK)
+  {
+    err = esp_partition_write(_partition, _sectorAddress(sector) + sizeof(header.magic), &header.sequence, sizeof(header) - sizeof(header.magic));
+  }
+  if (err == ESP_OK)
+  {
+    err = esp_partition_write(_partition, _sectorAddress(sector), &header.magic, sizeof(header.magic));
+  }
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Sector %u open fail.", sector);
+    return err;
+  }
+  ++_next_sequence;
+  _write_sector = sector;
+  _write_offset = FLASH_SPOOL_DATA_OFFSET;
+  return ESP_OK;
+}
+
+esp_err_t FlashSpool::_eraseSector(uint32_t sector)
+{
+  esp_err_t err = esp_partition_erase_range(_partition, _sectorAddress(sector), FLASH_SPOOL_SECTOR_SIZE);
+  if (err != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Sector %u erase fail.", sector);
+    return err;
+  }
+  ++_stats.erases;
+  return ESP_OK;
+}
+
+bool FlashSpool::_readRecord(uint32_t sector, uint32_t offset, void *header)
+{
+  _record_header_t *record = (_record_header_t *)header;
+  if (offset + sizeof(_record_header_t) > FLASH_SPOOL_SECTOR_SIZE)
+  {
+    record->state = FLASH_SPOOL_STATE_FREE;
+    return false;
+  }
+  if (esp_partition_read(_partition, _sectorAddress(sector) + offset, record, sizeof(_record_header_t)) != ESP_OK)
+  {
+    return false;
+  }
+  // A free slot ends the sector, so does a header with an impossible length left behind by a torn write.
+  if (record->state == FLASH_SPOOL_STATE_FREE || record->length == 0 || record->length > FLASH_SPOOL_MAX_RECORD ||
+      offset + FLASH_SPOOL_RECORD_SIZE(record->length) > FLASH_SPOOL_SECTOR_SIZE)
+  {
+    return false;
+  }
+  return true;
+}
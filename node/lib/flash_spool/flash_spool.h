@@ -0,0 +1,96 @@
+#pragma once
+
+#include "stdint.h"
+#include "esp_err.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define FLASH_SPOOL_SECTOR_SIZE 4096
+#define FLASH_SPOOL_MAX_RECORD 256 // Maximum payload of a single record.
+
+typedef struct // Counters since init.
+{
+  uint32_t appended; // Records written.
+  uint32_t drained;  // Records read back and marked consumed.
+  uint32_t dropped;  // Records rejected because every sector holds unread data.
+  uint32_t corrupt;  // Records skipped because of a CRC mismatch (e.g. power loss during a write).
+  uint32_t erases;   // Sector erases.
+} flash_spool_stats_t;
+
+/**
+ * @brief Append-only FIFO of records in a raw flash data partition.
+ *
+ * @note Sectors are used as a ring: the writer fills one sector after the other and the reader erases a
+ * sector as soon as every record in it has been consumed. Every sector is therefore erased equally often.
+ * A consumed record is marked by clearing its state byte, so the read position survives a reboot
+ * without a separate index. append() and pop() may be called from different tasks.
+ */
+class FlashSpool
+{
+public:
+  /**
+   * @brief Open the spool on the data partition with the given label and recover the read/write positions.
+   *
+   * @return
+   *              - ESP_OK if the spool is ready
+   *              - ESP_ERR_NOT_FOUND if there is no such partition
+   *              - ESP_FAIL if any flash error
+   */
+  esp_err_t init(const char *label);
+
+  /**
+   * @brief Append a record.
+   *
+   * @return
+   *              - ESP_OK if the record was written
+   *              - ESP_ERR_INVALID_ARG if length is 0 or larger than FLASH_SPOOL_MAX_RECORD
+   *              - ESP_ERR_NO_MEM if the spool is full
+   *              - ESP_FAIL if not initialized or any flash error
+   */
+  esp_err_t append(const void *data, uint16_t length);
+
+  /**
+   * @brief Copy the oldest record into data and mark it consumed.
+   *
+   * @return
+   *              - ESP_OK if a record was copied, length holds its size
+   *              - ESP_ERR_NOT_FOUND if the spool is empty
+   *              - ESP_ERR_INVALID_SIZE if the record does not fit into capacity, it is discarded
+   *              - ESP_FAIL if not initialized or any flash error
+   */
+  esp_err_t pop(void *data, uint16_t capacity, uint16_t *length);
+
+  /**
+   * @brief Check whether there is nothing left to pop.
+   *
+   * @note Right after init() this may report false for a spool that only holds consumed records, the next
+   * pop() then returns ESP_ERR_NOT_FOUND.
+   */
+  bool empty();
+
+  /**
+   * @brief Number of records appended and not yet popped, including those left over from before a reboot.
+   */
+  uint32_t pending();
+
+  uint32_t sectors() const { return _sectors; }
+  const flash_spool_stats_t &stats() const { return _stats; }
+
+private:
+  uint32_t _sectorAddress(uint32_t sector) const { return sector * FLASH_SPOOL_SECTOR_SIZE; }
+  esp_err_t _openSector(uint32_t sector);
+  esp_err_t _eraseSector(uint32_t sector);
+  bool _readRecord(uint32_t sector, uint32_t offset, void *header);
+
+  const esp_partition_t *_partition = NULL;
+  SemaphoreHandle_t _mutex = NULL;
+  flash_spool_stats_t _stats = {};
+  uint32_t _sectors = 0;
+  uint32_t _next_sequence = 0; // Sequence number of the next opened sector, orders sectors after a reboot.
+  uint32_t _write_sector = 0;
+  uint32_t _write_offset = 0;  // FLASH_SPOOL_SECTOR_SIZE if no sector is open yet.
+  uint32_t _read_sector = 0;
+  uint32_t _read_offset = 0;
+  uint32_t _pending = 0;
+};
@@ -4,9 +4,9 @@
 #include "Arduino.h"
 struct MicrophoneData
 {
-  uint16_t avgDb;
-  uint16_t peakFrequency;
-  uint16_t zeroCrossingsCount;
+  uint16_t avgDb;              // RMS level in dB relative to one LSB (dBFS + 90.3)
+  uint16_t peakFrequency;      // Peak of the loudest analysis window (in Hz)
+  uint16_t zeroCrossingsCount; // Zero crossings per second
 };
 // Struct to hold accelerometer data
 struct AccelerometerData
@@ -27,12 +27,28 @@ struct DeviceRSSI
 //   DeviceRSSI device[10];
 // };
 
+#define AUDIO_BANDS_MAX 22          // Band levels per message, the 1/3 octaves from 50 Hz to 6.3 kHz. Keeps message_t at 80 of the 89 bytes zh_network puts on air
+#define AUDIO_BANDS_NONE 0          // No band levels
+#define AUDIO_BANDS_GOERTZEL 1      // Goertzel filters at the frequencies the node was built with (MICROPHONE_GOERTZEL_BANDS)
+#define AUDIO_BANDS_OCTAVE 2        // 1/1 octaves from 63 Hz, summed from the FFT bins (MICROPHONE_OCTAVE_BANDS=1)
+#define AUDIO_BANDS_THIRD_OCTAVE 3  // 1/3 octaves from 50 Hz (MICROPHONE_OCTAVE_BANDS=3)
+#define AUDIO_BANDS_A_WEIGHTED 0x80 // Flag on the mode, levels are A-weighted (MICROPHONE_A_WEIGHTING)
+
+// Struct to hold band levels of the reporting interval
+struct AudioBands
+{
+  uint8_t mode;                   // AUDIO_BANDS_*, optionally with AUDIO_BANDS_A_WEIGHTED
+  uint8_t count;                  // Valid entries of level
+  uint8_t level[AUDIO_BANDS_MAX]; // Mean level in 0.5 dB steps relative to one LSB (dBFS + 90.3)
+};
+
 // Struct to hold all relevant output data
 struct OutputData
 {
   MicrophoneData microphoneData;
   AccelerometerData accelerometerData;
   DeviceRSSI bleData[10];
+  AudioBands audioBands;
 };
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 // #include "data_packaging.h"
 extern uint8_t target[6];
 extern bool bleIsActive;
-extern SemaphoreHandle_t xSemaphore;
+class I2cBus;
+extern I2cBus i2cBus; // Owner of the sensor I2C bus, see i2c_bus.h
 extern bool timeIsSynced;
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "i2c_burst.h"
+
+static bool mergeable(const i2c_burst_read_t &read)
+{
+  if (read.length == 0)
+  {
+    return false;
+  }
+  if (read.merge == I2C_BURST_INCREMENT)
+  {
+    return read.reg + read.length <= I2C_BURST_REGISTERS;
+  }
+  return read.merge == I2C_BURST_PORT;
+}
+
+static bool member(const uint8_t *batch, uint8_t members, uint8_t index)
+{
+  for (uint8_t i = 0; i < members; i++)
+  {
+    if (batch[i] == index)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+i2c_burst_t i2cBurstPlan(const i2c_burst_read_t *reads, uint8_t count, uint8_t lead, uint16_t maxLength, uint8_t *batch)
+{
+  const i2c_burst_read_t &first = reads[lead];
+  i2c_burst_t burst = {.reg = first.reg, .length = first.length, .members = 1};
+  batch[0] = lead;
+  if (!mergeable(first) || first.length > maxLength)
+  {
+    return burst;
+  }
+  uint16_t start = first.reg;
+  uint16_t end = first.reg + first.length;
+  bool closed = first.merge == I2C_BURST_PORT; // Past a port the address no longer advances
+  bool grown = true;
+  while (grown)
+  {
+    grown = false;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      const i2c_burst_read_t &other = reads[i];
+      if (other.address != first.address || !mergeable(other) || end - start + other.length > maxLength ||
+          member(batch, burst.members, i))
+      {
+        continue;
+      }
+      if (!closed && other.reg == end)
+      {
+        end += other.length;
+        closed = other.merge == I2C_BURST_PORT;
+      }
+      else if (other.merge == I2C_BURST_INCREMENT && other.reg + other.length == start)
+      {
+        start = other.reg;
+      }
+      else
+      {
+        continue;
+      }
+      batch[burst.members++] = i;
+      grown = true;
+    }
+  }
+  burst.reg = (uint8_t)start;
+  burst.length = end - start;
+  return burst;
+}
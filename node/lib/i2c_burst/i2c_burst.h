@@ -0,0 +1,43 @@
+#pragma once
+
+#include "stdint.h"
+
+#define I2C_BURST_REGISTERS 0x100 // Register addresses of a device, a read of auto-incrementing registers must not run past the last one.
+
+typedef enum
+{
+  I2C_BURST_NONE,      // Runs on its own, e.g. any write.
+  I2C_BURST_INCREMENT, // Read of auto-incrementing registers, may share a burst with reads of the registers right before or after it.
+  I2C_BURST_PORT,      // Read of a FIFO port that keeps its address, may only end a burst, right after the register before it.
+} i2c_burst_merge_t;
+
+typedef struct // What the planner needs to know of a pending read.
+{
+  uint8_t address;         // 7-bit device address.
+  uint8_t reg;             // First register.
+  uint16_t length;         // Bytes to read.
+  i2c_burst_merge_t merge; // How it may be merged.
+} i2c_burst_read_t;
+
+typedef struct // One bus read covering several pending reads. Member i gets length bytes from offset reg - burst reg.
+{
+  uint8_t reg;     // First register.
+  uint16_t length; // Bytes to read.
+  uint8_t members; // Entries of batch used, the lead first.
+} i2c_burst_t;
+
+/**
+ * @brief Grow a burst around one read by the pending reads of the neighbouring registers of the same device.
+ *
+ * @note A read of I2C_BURST_INCREMENT registers that would run past register 0xFF is never merged, nor is a
+ * read merged after a port. The burst stays within maxLength, so two reads that each fit may still run apart.
+ *
+ * @param[in] reads Pending reads.
+ * @param[in] count Entries of reads, at most 255.
+ * @param[in] lead Entry the burst starts from, it is always a member.
+ * @param[in] maxLength Largest burst (in bytes).
+ * @param[out] batch Room for count indices into reads, the members.
+ *
+ * @return The burst, the read of lead alone if nothing could be merged.
+ */
+i2c_burst_t i2cBurstPlan(const i2c_burst_read_t *reads, uint8_t count, uint8_t lead, uint16_t maxLength, uint8_t *batch);
@@ -0,0 +1,264 @@
+#include "i2c_bus.h"
+#include "string.h"
+#include "freertos/semphr.h"
+
+typedef struct // A transfer() waiting for its transactions.
+{
+  SemaphoreHandle_t done; // Given once per transaction.
+  esp_err_t result;       // ESP_OK or the first failure.
+} i2c_bus_waiter_t;
+
+static void transferDone(esp_err_t result, void *arg)
+{
+  i2c_bus_waiter_t *waiter = (i2c_bus_waiter_t *)arg;
+  if (result != ESP_OK && waiter->result == ESP_OK)
+  {
+    waiter->result = result;
+  }
+  xSemaphoreGive(waiter->done);
+}
+
+// Tick counts wrap, the difference tells which deadline comes first
+static bool earlier(TickType_t a, TickType_t b)
+{
+  return (int32_t)(a - b) < 0;
+}
+
+esp_err_t I2cBus::init(TwoWire &wire, uint32_t frequency, BaseType_t core)
+{
+  if (_queue != NULL)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  _wire = &wire;
+  _wire->setClock(frequency);
+  _stats = {};
+  _queue = xQueueCreate(I2C_BUS_QUEUE_LENGTH, sizeof(i2c_bus_transaction_t));
+  if (_queue == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  if (xTaskCreatePinnedToCore(_task, "I2C bus", I2C_BUS_TASK_STACK_SIZE, this, I2C_BUS_TASK_PRIORITY, NULL, core) != pdPASS)
+  {
+    vQueueDelete(_queue);
+    _queue = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+bool I2cBus::_valid(const i2c_bus_transaction_t &transaction) const
+{
+  if (transaction.length == 0 || transaction.length > I2C_BUS_MAX_LENGTH || transaction.data == NULL)
+  {
+    return false;
+  }
+  if (transaction.merge != I2C_BURST_NONE && transaction.op != I2C_BUS_READ)
+  {
+    return false;
+  }
+  // Only a FIFO port keeps its address, anything else would wrap around to register 0
+  return transaction.op == I2C_BUS_RECEIVE || transaction.merge == I2C_BURST_PORT ||
+         transaction.reg + transaction.length <= I2C_BURST_REGISTERS;
+}
+
+esp_err_t I2cBus::submit(const i2c_bus_transaction_t &transaction, TickType_t wait)
+{
+  if (!_valid(transaction))
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (_queue == NULL)
+  {
+    return ESP_FAIL;
+  }
+  if (xQueueSend(_queue, &transaction, wait) != pdTRUE)
+  {
+    portENTER_CRITICAL(&_stats_lock);
+    ++_stats.rejected;
+    portEXIT_CRITICAL(&_stats_lock);
+    return ESP_ERR_TIMEOUT;
+  }
+  return ESP_OK;
+}
+
+esp_err_t I2cBus::transfer(const i2c_bus_transaction_t *transactions, uint8_t count)
+{
+  if (count == 0 || count > I2C_BUS_QUEUE_LENGTH)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (!_valid(transactions[i]))
+    {
+      return ESP_ERR_INVALID_ARG;
+    }
+  }
+  if (_queue == NULL)
+  {
+    return ESP_FAIL;
+  }
+  StaticSemaphore_t storage;
+  i2c_bus_waiter_t waiter = {.done = xSemaphoreCreateCountingStatic(count, 0, &storage), .result = ESP_OK};
+  for (uint8_t i = 0; i < count; i++)
+  {
+    i2c_bus_transaction_t queued = transactions[i];
+    queued.done = transferDone;
+    queued.arg = &waiter;
+    queued.group = count - 1 - i;
+    xQueueSend(_queue, &queued, portMAX_DELAY);
+  }
+  for (uint8_t i = 0; i < count; i++)
+  {
+    xSemaphoreTake(waiter.done, portMAX_DELAY);
+  }
+  vSemaphoreDelete(waiter.done);
+  return waiter.result;
+}
+
+i2c_bus_stats_t I2cBus::stats() const
+{
+  portENTER_CRITICAL(&_stats_lock);
+  i2c_bus_stats_t stats = _stats;
+  portEXIT_CRITICAL(&_stats_lock);
+  return stats;
+}
+
+esp_err_t I2cBus::_execute(const i2c_bus_transaction_t &transaction, uint8_t *data)
+{
+  if (transaction.op != I2C_BUS_RECEIVE)
+  {
+    _wire->beginTransmission(transaction.address);
+    _wire->write(transaction.reg);
+    if (transaction.op == I2C_BUS_WRITE)
+    {
+      _wire->write(data, transaction.length);
+      return _wire->endTransmission() == 0 ? ESP_OK : ESP_FAIL;
+    }
+    // Repeated start, nobody else gets the bus between address and data
+    if (_wire->endTransmission(false) != 0)
+    {
+      return ESP_FAIL;
+    }
+  }
+  if (_wire->requestFrom((uint8_t)transaction.address, (uint8_t)transaction.length) != transaction.length)
+  {
+    return ESP_FAIL;
+  }
+  for (uint16_t i = 0; i < transaction.length; i++)
+  {
+    data[i] = _wire->read();
+  }
+  return ESP_OK;
+}
+
+uint8_t I2cBus::_run(i2c_bus_transaction_t *pending, uint8_t count, uint8_t first, uint8_t *batch)
+{
+  i2c_burst_read_t reads[I2C_BUS_QUEUE_LENGTH];
+  for (uint8_t i = 0; i < count; i++)
+  {
+    reads[i] = {.address = pending[i].address,
+                .reg = pending[i].reg,
+                .length = pending[i].length,
+                .merge = pending[i].op == I2C_BUS_READ ? pending[i].merge : I2C_BURST_NONE};
+  }
+  i2c_burst_t burst = i2cBurstPlan(reads, count, first, I2C_BUS_MAX_LENGTH, batch);
+
+  esp_err_t result;
+  if (burst.members == 1)
+  {
+    result = _execute(pending[first], pending[first].data);
+  }
+  else
+  {
+    // One burst over the registers of every member, then each gets its slice
+    uint8_t data[I2C_BUS_MAX_LENGTH];
+    i2c_bus_transaction_t merged = pending[first];
+    merged.reg = burst.reg;
+    merged.length = burst.length;
+    result = _execute(merged, data);
+    if (result == ESP_OK)
+    {
+      for (uint8_t i = 0; i < burst.members; i++)
+      {
+        memcpy(pending[batch[i]].data, data + pending[batch[i]].reg - burst.reg, pending[batch[i]].length);
+      }
+    }
+  }
+
+  TickType_t now = xTaskGetTickCount();
+  portENTER_CRITICAL(&_stats_lock);
+  ++_stats.bursts;
+  for (uint8_t i = 0; i < burst.members; i++)
+  {
+    ++_stats.transactions;
+    _stats.late += earlier(pending[batch[i]].deadline, now) ? 1 : 0;
+    _stats.errors += result != ESP_OK ? 1 : 0;
+  }
+  portEXIT_CRITICAL(&_stats_lock);
+
+  for (uint8_t i = 0; i < burst.members; i++)
+  {
+    const i2c_bus_transaction_t &transaction = pending[batch[i]];
+    if (transaction.done != NULL)
+    {
+      transaction.done(result, transaction.arg);
+    }
+  }
+  return burst.members;
+}
+
+void I2cBus::_task(void *arg)
+{
+  I2cBus *bus = (I2cBus *)arg;
+  i2c_bus_transaction_t pending[I2C_BUS_QUEUE_LENGTH];
+  uint8_t batch[I2C_BUS_QUEUE_LENGTH];
+  uint8_t count = 0;
+  while (true)
+  {
+    // Sleep while there is nothing to do, then take everything that is waiting. The rest of a transfer() of
+    // several transactions is on its way, it is worth a short wait so its reads can be merged.
+    uint8_t awaited = 0;
+    if (count == 0 && xQueueReceive(bus->_queue, &pending[count], portMAX_DELAY) == pdTRUE)
+    {
+      awaited = pending[count++].group;
+    }
+    while (count < I2C_BUS_QUEUE_LENGTH &&
+           xQueueReceive(bus->_queue, &pending[count], awaited > 0 ? I2C_BUS_GROUP_WAIT : 0) == pdTRUE)
+    {
+      awaited = pending[count++].group;
+    }
+    if (count == 0)
+    {
+      continue;
+    }
+
+    uint8_t first = 0;
+    for (uint8_t i = 1; i < count; i++)
+    {
+      if (earlier(pending[i].deadline, pending[first].deadline))
+      {
+        first = i;
+      }
+    }
+
+    uint8_t members = bus->_run(pending, count, first, batch);
+
+    // Keep the rest in order, the next round sees them together with whatever arrived meanwhile
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      bool done = false;
+      for (uint8_t j = 0; j < members; j++)
+      {
+        done = done || batch[j] == i;
+      }
+      if (!done)
+      {
+        pending[kept++] = pending[i];
+      }
+    }
+    count = kept;
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "stdint.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "Wire.h"
+#include "i2c_burst.h"
+
+#define I2C_BUS_FREQUENCY 400000 // Fast mode, every device on the node's bus supports it.
+#define I2C_BUS_QUEUE_LENGTH 16  // Transactions waiting in the queue, also the most the task holds to pick the earliest deadline from.
+#define I2C_BUS_MAX_LENGTH 128   // Largest transfer (in bytes), the Arduino Wire buffer. Merged reads stay within it as well.
+#define I2C_BUS_GROUP_WAIT 1     // Ticks the task waits for the rest of a transfer() of several transactions before it runs what it has.
+#define I2C_BUS_TASK_STACK_SIZE 3072
+#define I2C_BUS_TASK_PRIORITY 12 // Above every task that submits, so a queued transaction never waits for a preempted one.
+
+typedef enum
+{
+  I2C_BUS_WRITE,   // Register address, then length bytes from data.
+  I2C_BUS_READ,    // Register address, repeated start, then length bytes into data.
+  I2C_BUS_RECEIVE, // length bytes into data without a register address, for a slave that answers every request the same way.
+} i2c_bus_op_t;
+
+typedef void (*i2c_bus_done_cb_t)(esp_err_t result, void *arg);
+
+typedef struct // One bus transaction. data belongs to the caller until done() ran.
+{
+  i2c_bus_op_t op;
+  uint8_t address;         // 7-bit device address.
+  uint8_t reg;             // First register, unused by I2C_BUS_RECEIVE.
+  uint16_t length;         // Bytes to transfer, 1 to I2C_BUS_MAX_LENGTH, and up to register 0xFF unless merge is I2C_BURST_PORT.
+  uint8_t *data;           // Bytes to write or room for the bytes read.
+  TickType_t deadline;     // Tick count by which the transaction should be done, the earliest runs first.
+  i2c_bus_done_cb_t done;  // Called on the bus task when the transaction is done, NULL if nobody waits. Must not block.
+  void *arg;               // Passed to done().
+  i2c_burst_merge_t merge; // I2C_BUS_READ only: whether it may share one burst with pending reads of the neighbouring registers.
+  uint8_t group;           // Set by transfer(), leave 0: transactions of the same transfer() still to come.
+} i2c_bus_transaction_t;
+
+typedef struct // Counters since init.
+{
+  uint32_t transactions; // Transactions done.
+  uint32_t bursts;       // Bus transfers, fewer than transactions when reads were merged.
+  uint32_t late;         // Transactions done after their deadline.
+  uint32_t errors;       // Transactions the device did not acknowledge or answered short.
+  uint32_t rejected;     // submit() calls refused because the queue was full.
+} i2c_bus_stats_t;
+
+/**
+ * @brief Single owner of an I2C bus, drivers queue transactions instead of holding a mutex.
+ *
+ * @note A task of its own takes transactions from a queue. Every wake-up it drains the queue and runs what
+ * is pending back to back, earliest deadline first, so a low priority sensor that submitted first does not
+ * delay one whose samples are due. A read that may be merged runs as one burst together with the pending
+ * reads of the registers right before and after it, see i2cBurstPlan(). Completion is reported through a
+ * callback on the bus task; transfer() wraps this for drivers that need the answer before they go on.
+ */
+class I2cBus
+{
+public:
+  I2cBus() {}
+  I2cBus(const I2cBus &) = delete;
+  I2cBus &operator=(const I2cBus &) = delete;
+
+  /**
+   * @brief Set the clock and start the bus task. wire must have been begun with its pins.
+   *
+   * @note Code running before init() may still use wire directly (e.g. a driver's own setup), afterwards only
+   * the bus task does.
+   *
+   * @return
+   *              - ESP_OK if the task runs
+   *              - ESP_ERR_INVALID_STATE if already started
+   *              - ESP_ERR_NO_MEM if the queue or the task could not be created
+   */
+  esp_err_t init(TwoWire &wire, uint32_t frequency = I2C_BUS_FREQUENCY, BaseType_t core = 1);
+
+  /**
+   * @brief Queue a transaction and return, done() reports the result.
+   *
+   * @param[in] wait Ticks to wait for room in the queue.
+   *
+   * @return
+   *              - ESP_OK if queued
+   *              - ESP_ERR_INVALID_ARG if length is out of range, data is NULL or merge is set on anything but a read
+   *              - ESP_ERR_TIMEOUT if the queue stayed full
+   *              - ESP_FAIL if not started
+   */
+  esp_err_t submit(const i2c_bus_transaction_t &transaction, TickType_t wait = 0);
+
+  /**
+   * @brief Queue a transaction and wait until it is done. done and arg of transaction are ignored.
+   *
+   * @note Waits for the queue without limit, the bus task finishes every transaction within the Wire timeout.
+   * Must not be called from a done() callback.
+   *
+   * @return
+   *              - ESP_OK if the transfer succeeded
+   *              - ESP_FAIL if the device did not acknowledge or answered short, or not started
+   *              - ESP_ERR_INVALID_ARG as for submit()
+   */
+  esp_err_t transfer(const i2c_bus_transaction_t &transaction) { return transfer(&transaction, 1); }
+
+  /**
+   * @brief Queue count transactions back to back and wait until all are done, so their reads can be merged.
+   *
+   * @note The bus task waits up to I2C_BUS_GROUP_WAIT for the rest of them before it picks the next one.
+   * Nothing is queued unless every transaction is valid. Otherwise as transfer() of one.
+   *
+   * @return
+   *              - ESP_OK if every transfer succeeded
+   *              - ESP_FAIL if any failed, or not started
+   *              - ESP_ERR_INVALID_ARG as for submit(), or count is 0 or above I2C_BUS_QUEUE_LENGTH
+   */
+  esp_err_t transfer(const i2c_bus_transaction_t *transactions, uint8_t count);
+
+  /**
+   * @brief Counters since init(), taken under the lock the submitting tasks update rejected with.
+   */
+  i2c_bus_stats_t stats() const;
+
+private:
+  static void _task(void *arg);
+  uint8_t _run(i2c_bus_transaction_t *pending, uint8_t count, uint8_t first, uint8_t *batch); // Returns the entries of batch it completed.
+  esp_err_t _execute(const i2c_bus_transaction_t &transaction, uint8_t *data);
+  bool _valid(const i2c_bus_transaction_t &transaction) const;
+
+  TwoWire *_wire = NULL;
+  QueueHandle_t _queue = NULL;
+  i2c_bus_stats_t _stats = {};
+  mutable portMUX_TYPE _stats_lock = portMUX_INITIALIZER_UNLOCKED;
+};
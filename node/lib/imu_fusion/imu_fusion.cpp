@@ -0,0 +1,139 @@
+#include "imu_fusion.h"
+#include "math.h"
+#include "string.h"
+
+#define IMU_FUSION_PI 3.14159265f
+#define IMU_FUSION_RAD_TO_DEG 57.2957795f
+
+// Bias estimate limited to +-IMU_FUSION_MAX_BIAS
+static inline float clampBias(float bias)
+{
+  return bias > IMU_FUSION_MAX_BIAS ? IMU_FUSION_MAX_BIAS : bias < -IMU_FUSION_MAX_BIAS ? -IMU_FUSION_MAX_BIAS : bias;
+}
+
+float imuInvSqrt(float x)
+{
+  uint32_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  bits = 0x5F375A86 - (bits >> 1);
+  float y;
+  memcpy(&y, &bits, sizeof(y));
+  const float half = 0.5f * x;
+  y = y * (1.5f - half * y * y);
+  y = y * (1.5f - half * y * y);
+  return y;
+}
+
+float imuAtan2(float y, float x)
+{
+  float ay = y < 0 ? -y : y;
+  float ax = x < 0 ? -x : x;
+  if (ax == 0 && ay == 0)
+  {
+    return 0;
+  }
+  // atan of the ratio below 1, the other octants follow from symmetry
+  bool swap = ay > ax;
+  float z = swap ? ax / ay : ay / ax;
+  float z2 = z * z;
+  float angle = z * (0.99997726f + z2 * (-0.33262347f + z2 * (0.19354346f + z2 * (-0.11643287f + z2 * (0.05265332f + z2 * -0.01172120f)))));
+  if (swap)
+  {
+    angle = IMU_FUSION_PI / 2 - angle;
+  }
+  if (x < 0)
+  {
+    angle = IMU_FUSION_PI - angle;
+  }
+  return y < 0 ? -angle : angle;
+}
+
+void MahonyFilter::init(float sampleRate, float kp, float ki)
+{
+  _q = {1, 0, 0, 0};
+  _half_dt = 0.5f / sampleRate;
+  _kp = kp;
+  _ki = ki;
+  _bias[0] = _bias[1] = _bias[2] = 0;
+}
+
+void MahonyFilter::align(float ax, float ay, float az)
+{
+  float norm = ax * ax + ay * ay + az * az;
+  if (norm == 0)
+  {
+    return;
+  }
+  // Runs once, the library functions are fine here
+  float roll = atan2f(ay, az);
+  float pitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+  float cr = cosf(roll / 2), sr = sinf(roll / 2);
+  float cp = cosf(pitch / 2), sp = sinf(pitch / 2);
+  _q = {cr * cp, sr * cp, cr * sp, -sr * sp};
+  _bias[0] = _bias[1] = _bias[2] = 0;
+}
+
+void MahonyFilter::update(float gx, float gy, float gz, float ax, float ay, float az)
+{
+  float q0 = _q.w, q1 = _q.x, q2 = _q.y, q3 = _q.z;
+  float norm = ax * ax + ay * ay + az * az;
+  if (norm > 0)
+  {
+    float recip = imuInvSqrt(norm);
+    ax *= recip;
+    ay *= recip;
+    az *= recip;
+    // Half the gravity direction the quaternion expects in the body frame
+    float vx = q1 * q3 - q0 * q2;
+    float vy = q0 * q1 + q2 * q3;
+    float vz = q0 * q0 - 0.5f + q3 * q3;
+    // Half the error, the cross product of measured and expected direction
+    float ex = ay * vz - az * vy;
+    float ey = az * vx - ax * vz;
+    float ez = ax * vy - ay * vx;
+    if (_ki > 0)
+    {
+      // Linear acceleration and rotation also show up as error, bounded they cannot wind the integral up
+      _bias[0] = clampBias(_bias[0] + _ki * ex * 4 * _half_dt);
+      _bias[1] = clampBias(_bias[1] + _ki * ey * 4 * _half_dt);
+      _bias[2] = clampBias(_bias[2] + _ki * ez * 4 * _half_dt);
+      gx += _bias[0];
+      gy += _bias[1];
+      gz += _bias[2];
+    }
+    gx += 2 * _kp * ex;
+    gy += 2 * _kp * ey;
+    gz += 2 * _kp * ez;
+  }
+  // q' = q + q * (0, g) * dt / 2
+  gx *= _half_dt;
+  gy *= _half_dt;
+  gz *= _half_dt;
+  float w = q0 - q1 * gx - q2 * gy - q3 * gz;
+  float x = q1 + q0 * gx + q2 * gz - q3 * gy;
+  float y = q2 + q0 * gy - q1 * gz + q3 * gx;
+  float z = q3 + q0 * gz + q1 * gy - q2 * gx;
+  float recip = imuInvSqrt(w * w + x * x + y * y + z * z);
+  _q = {w * recip, x * recip, y * recip, z * recip};
+}
+
+void MahonyFilter::bias(float *gyro) const
+{
+  // The feedback is added to the rate, the bias is its opposite
+  gyro[0] = -_bias[0];
+  gyro[1] = -_bias[1];
+  gyro[2] = -_bias[2];
+}
+
+imu_euler_t MahonyFilter::euler() const
+{
+  const imu_quaternion_t &q = _q;
+  float sinPitch = 2 * (q.w * q.y - q.x * q.z);
+  sinPitch = sinPitch > 1 ? 1 : (sinPitch < -1 ? -1 : sinPitch);
+  float cosPitch2 = 1 - sinPitch * sinPitch;
+  imu_euler_t angles = {
+      .roll = imuAtan2(2 * (q.w * q.x + q.y * q.z), 1 - 2 * (q.x * q.x + q.y * q.y)) * IMU_FUSION_RAD_TO_DEG,
+      .pitch = imuAtan2(sinPitch, cosPitch2 > 0 ? cosPitch2 * imuInvSqrt(cosPitch2) : 0) * IMU_FUSION_RAD_TO_DEG,
+      .yaw = imuAtan2(2 * (q.w * q.z + q.x * q.y), 1 - 2 * (q.y * q.y + q.z * q.z)) * IMU_FUSION_RAD_TO_DEG};
+  return angles;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "stdint.h"
+
+#define IMU_FUSION_KP 1.0f    // Default proportional gain of the accelerometer correction, time constant of about 1 / KP seconds.
+#define IMU_FUSION_KI 0.1f    // Default integral gain, removes a gyroscope bias within about KP / KI seconds.
+#ifndef IMU_FUSION_MAX_BIAS
+#define IMU_FUSION_MAX_BIAS 0.0873f // Largest bias estimate (in rad/s, 5 deg/s), well above what the MPU6050 drifts after calibration.
+#endif
+
+typedef struct // Orientation of the body frame, unit length.
+{
+  float w;
+  float x;
+  float y;
+  float z;
+} imu_quaternion_t;
+
+typedef struct // Tait-Bryan angles (in degrees), applied yaw, pitch, roll.
+{
+  float roll;  // About x, -180 to 180, atan2(ay, az) at rest.
+  float pitch; // About y, -90 to 90, asin(-ax / |a|) at rest.
+  float yaw;   // About z, -180 to 180, integrated gyroscope only (there is no magnetometer).
+} imu_euler_t;
+
+/**
+ * @brief 1 / sqrt(x) from the bit pattern of x and two Newton steps, relative error below 5e-6.
+ */
+float imuInvSqrt(float x);
+
+/**
+ * @brief atan2(y, x) from a degree 11 odd polynomial on [0, 1] and octant folding, error below 1e-5 rad.
+ */
+float imuAtan2(float y, float x);
+
+/**
+ * @brief Mahony complementary filter on the rotation quaternion, float only.
+ *
+ * @note Every sample integrates the gyroscope; the angle between the measured and the estimated gravity
+ * direction feeds back proportionally (kp) and integrally (ki, an online gyroscope bias estimate) into the
+ * rotation rate. Yaw is not observable from gravity, it drifts with the uncorrected z bias. One update costs
+ * two imuInvSqrt() and about 60 multiply-adds, euler() adds three imuAtan2() and can run at the report rate.
+ */
+class MahonyFilter
+{
+public:
+  /**
+   * @param[in] sampleRate Updates per second, every update advances 1 / sampleRate seconds.
+   * @param[in] kp Proportional gain, 0 for gyroscope integration only.
+   * @param[in] ki Integral gain, 0 to disable the bias estimate.
+   */
+  void init(float sampleRate, float kp = IMU_FUSION_KP, float ki = IMU_FUSION_KI);
+
+  /**
+   * @brief Start from roll and pitch of a gravity measurement with yaw 0, so the filter does not have to converge from level.
+   */
+  void align(float ax, float ay, float az);
+
+  /**
+   * @brief Advance by one sample.
+   *
+   * @param[in] gx, gy, gz Rotation rate (in rad/s).
+   * @param[in] ax, ay, az Acceleration in any unit, only the direction is used. All 0 skips the correction.
+   */
+  void update(float gx, float gy, float gz, float ax, float ay, float az);
+
+  /**
+   * @brief Gyroscope bias (in rad/s) the integral feedback currently takes off, x, y, z.
+   *
+   * @note Only axes that are not parallel to gravity converge, at rest the vertical one stays at 0. Each axis is
+   * limited to +-IMU_FUSION_MAX_BIAS, and while the body moves it also follows the linear acceleration.
+   */
+  void bias(float *gyro) const;
+
+  /**
+   * @brief Forget the bias estimate, e.g. after it was moved into the gyroscope offsets.
+   */
+  void clearBias() { _bias[0] = _bias[1] = _bias[2] = 0; }
+
+  imu_quaternion_t quaternion() const { return _q; }
+  imu_euler_t euler() const;
+
+private:
+  imu_quaternion_t _q = {1, 0, 0, 0};
+  float _half_dt = 0;
+  float _kp = 0;
+  float _ki = 0;
+  float _bias[3] = {0, 0, 0}; // Integral feedback (in rad/s).
+};
@@ -0,0 +1,180 @@
+#include "mpu6050_fifo.h"
+
+#define MPU6050_SMPLRT_DIV 0x19
+#define MPU6050_CONFIG 0x1A
+#define MPU6050_GYRO_CONFIG 0x1B
+#define MPU6050_ACCEL_CONFIG 0x1C
+#define MPU6050_FIFO_EN 0x23
+#define MPU6050_INT_PIN_CFG 0x37
+#define MPU6050_INT_ENABLE 0x38
+#define MPU6050_TEMP_OUT_H 0x41
+#define MPU6050_USER_CTRL 0x6A
+#define MPU6050_FIFO_COUNTH 0x72
+#define MPU6050_FIFO_R_W 0x74
+
+#define MPU6050_FIFO_EN_GYRO_ACCEL 0x78 // XG, YG, ZG and ACCEL, queued in register order: accelerometer first.
+#define MPU6050_USER_CTRL_FIFO_EN 0x40
+#define MPU6050_USER_CTRL_FIFO_RESET 0x04
+#define MPU6050_INT_ENABLE_DATA_RDY 0x01
+
+#define MPU6050_STANDARD_GRAVITY 9.80665f
+#define MPU6050_DEG_TO_RAD 0.017453292f
+
+bool Mpu6050Fifo::begin(const mpu6050_bus_t &bus, uint16_t sampleRate)
+{
+  if (sampleRate == 0 || bus.read == NULL || bus.write == NULL)
+  {
+    return false;
+  }
+  _bus = bus;
+  _stats = {};
+  uint8_t config[3]; // CONFIG, GYRO_CONFIG and ACCEL_CONFIG in one read
+  if (!_bus.read(MPU6050_CONFIG, config, 3, _bus.arg))
+  {
+    ++_stats.errors;
+    return false;
+  }
+  // FS_SEL and AFS_SEL double the range per step
+  _gyro_scale = MPU6050_DEG_TO_RAD / (131.0f / (1 << ((config[1] >> 3) & 0x03)));
+  _accel_scale = MPU6050_STANDARD_GRAVITY / (16384 >> ((config[2] >> 3) & 0x03));
+
+  uint8_t lowPass = config[0] & 0x07;
+  uint32_t clock = lowPass == 0 || lowPass == 7 ? 8000 : 1000;
+  uint32_t divider = clock / sampleRate;
+  divider = divider < 1 ? 1 : (divider > 256 ? 256 : divider);
+  _sample_rate = clock / divider;
+
+  // Push-pull, active high, 50 us pulse per sample, no latch to clear
+  bool ok = _bus.write(MPU6050_SMPLRT_DIV, divider - 1, _bus.arg) &&
+            _bus.write(MPU6050_INT_PIN_CFG, 0x00, _bus.arg) &&
+            _bus.write(MPU6050_FIFO_EN, MPU6050_FIFO_EN_GYRO_ACCEL, _bus.arg) &&
+            _reset() &&
+            _bus.write(MPU6050_INT_ENABLE, MPU6050_INT_ENABLE_DATA_RDY, _bus.arg);
+  if (!ok)
+  {
+    ++_stats.errors;
+  }
+  return ok;
+}
+
+void Mpu6050Fifo::end()
+{
+  if (_bus.write != NULL)
+  {
+    _bus.write(MPU6050_INT_ENABLE, 0x00, _bus.arg);
+    _bus.write(MPU6050_USER_CTRL, 0x00, _bus.arg);
+    _bus.write(MPU6050_FIFO_EN, 0x00, _bus.arg);
+  }
+}
+
+bool Mpu6050Fifo::_reset()
+{
+  _backlog = 0;
+  return _bus.write(MPU6050_USER_CTRL, MPU6050_USER_CTRL_FIFO_RESET, _bus.arg) &&
+         _bus.write(MPU6050_USER_CTRL, MPU6050_USER_CTRL_FIFO_EN, _bus.arg);
+}
+
+size_t Mpu6050Fifo::read(mpu6050_sample_t *samples, size_t max)
+{
+  uint8_t count[2];
+  uint8_t burst[MPU6050_FIFO_BURST];
+  // Samples left behind last time come along with the count, which the chip sends before it pops them
+  size_t early = _backlog / MPU6050_FIFO_SAMPLE_SIZE;
+  early = early < max ? early : max;
+  early = early < MPU6050_FIFO_BURST / MPU6050_FIFO_SAMPLE_SIZE ? early : MPU6050_FIFO_BURST / MPU6050_FIFO_SAMPLE_SIZE;
+  early = _bus.readFifo != NULL ? early : 0;
+  bool ok = early > 0 ? _bus.readFifo(MPU6050_FIFO_COUNTH, count, MPU6050_FIFO_R_W, burst, early * MPU6050_FIFO_SAMPLE_SIZE, _bus.arg)
+                      : _bus.read(MPU6050_FIFO_COUNTH, count, 2, _bus.arg);
+  uint16_t bytes = (count[0] << 8) | count[1];
+  if (ok && bytes < early * MPU6050_FIFO_SAMPLE_SIZE)
+  {
+    ok = false; // The FIFO was reset behind our back, the burst does not start at a sample
+  }
+  if (!ok)
+  {
+    ++_stats.errors;
+    if (early > 0)
+    {
+      ++_stats.resyncs;
+      if (!_reset())
+      {
+        ++_stats.errors;
+      }
+    }
+    return 0;
+  }
+  // A full FIFO drops bytes, not samples, so its content is no longer aligned to samples
+  if (bytes > MPU6050_FIFO_CAPACITY - MPU6050_FIFO_SAMPLE_SIZE)
+  {
+    ++_stats.overflows;
+    if (!_reset())
+    {
+      ++_stats.errors;
+    }
+    return 0;
+  }
+  // A sample still being written is left for the next call
+  size_t available = bytes / MPU6050_FIFO_SAMPLE_SIZE;
+  available = available < max ? available : max;
+  size_t done = 0;
+  bool resynced = false;
+  if (early > 0)
+  {
+    ++_stats.reads;
+    ++_stats.combined;
+    done = parse(burst, early * MPU6050_FIFO_SAMPLE_SIZE, samples);
+  }
+  while (done < available)
+  {
+    size_t take = available - done;
+    take = take < MPU6050_FIFO_BURST / MPU6050_FIFO_SAMPLE_SIZE ? take : MPU6050_FIFO_BURST / MPU6050_FIFO_SAMPLE_SIZE;
+    if (!_bus.read(MPU6050_FIFO_R_W, burst, take * MPU6050_FIFO_SAMPLE_SIZE, _bus.arg))
+    {
+      // The chip may have sent part of the burst, what is left no longer starts at a sample
+      ++_stats.errors;
+      ++_stats.resyncs;
+      if (!_reset())
+      {
+        ++_stats.errors;
+      }
+      resynced = true;
+      break;
+    }
+    ++_stats.reads;
+    done += parse(burst, take * MPU6050_FIFO_SAMPLE_SIZE, samples + done);
+  }
+  if (!resynced)
+  {
+    _backlog = bytes - done * MPU6050_FIFO_SAMPLE_SIZE;
+  }
+  _stats.samples += done;
+  return done;
+}
+
+bool Mpu6050Fifo::temperature(float *celsius)
+{
+  uint8_t raw[2];
+  if (!_bus.read(MPU6050_TEMP_OUT_H, raw, 2, _bus.arg))
+  {
+    ++_stats.errors;
+    return false;
+  }
+  // Register map, section 4.18
+  *celsius = (int16_t)((raw[0] << 8) | raw[1]) / 340.0f + 36.53f;
+  return true;
+}
+
+size_t Mpu6050Fifo::parse(const uint8_t *data, size_t length, mpu6050_sample_t *samples)
+{
+  size_t count = length / MPU6050_FIFO_SAMPLE_SIZE;
+  for (size_t i = 0; i < count; ++i)
+  {
+    const uint8_t *raw = data + i * MPU6050_FIFO_SAMPLE_SIZE;
+    for (uint8_t axis = 0; axis < 3; ++axis)
+    {
+      samples[i].accel[axis] = (int16_t)((raw[2 * axis] << 8) | raw[2 * axis + 1]);
+      samples[i].gyro[axis] = (int16_t)((raw[6 + 2 * axis] << 8) | raw[7 + 2 * axis]);
+    }
+  }
+  return count;
+}
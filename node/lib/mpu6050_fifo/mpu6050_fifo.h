@@ -0,0 +1,108 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+#define MPU6050_FIFO_ADDRESS 0x68   // I2C address with AD0 low.
+#define MPU6050_FIFO_SAMPLE_SIZE 12 // Bytes per sample in the FIFO: accelerometer X, Y, Z, then gyroscope X, Y, Z, big endian int16_t.
+#define MPU6050_FIFO_CAPACITY 1024  // FIFO size of the chip (in bytes), 85 samples.
+#define MPU6050_FIFO_BURST 120      // Bytes per bus read, 10 samples. The Arduino Wire buffer holds 128.
+
+typedef struct // Register access of the chip. Keeps the driver independent of the I2C implementation.
+{
+  bool (*write)(uint8_t reg, uint8_t value, void *arg);                // Write one register. Returns false on a bus error.
+  bool (*read)(uint8_t reg, uint8_t *data, size_t length, void *arg); // Read length bytes starting at reg. Returns false on a bus error.
+  // Optional, NULL to use read() twice: read the two count registers from countReg, then length bytes from the FIFO port right
+  // after them, which keeps its address. The bus may run both as one burst. Returns false on a bus error.
+  bool (*readFifo)(uint8_t countReg, uint8_t *count, uint8_t fifoReg, uint8_t *data, size_t length, void *arg);
+  void *arg; // Passed to write(), read() and readFifo().
+} mpu6050_bus_t;
+
+typedef struct // One raw sample as it leaves the FIFO.
+{
+  int16_t accel[3]; // X, Y, Z (in LSB, see Mpu6050Fifo::accelScale()).
+  int16_t gyro[3];  // X, Y, Z (in LSB, see Mpu6050Fifo::gyroScale()).
+} mpu6050_sample_t;
+
+typedef struct // Counters since begin().
+{
+  uint32_t samples;   // Samples read.
+  uint32_t reads;     // Bus reads of FIFO data.
+  uint32_t combined;  // Reads of FIFO data that came with the count, see Mpu6050Fifo::read().
+  uint32_t overflows; // FIFO resets after it filled up, the samples it held are lost.
+  uint32_t resyncs;   // FIFO resets after a failed burst read, the samples it still held are lost.
+  uint32_t errors;    // Failed bus transactions.
+} mpu6050_fifo_stats_t;
+
+/**
+ * @brief Fixed rate sampling of an MPU6050 through its FIFO.
+ *
+ * @note The chip samples accelerometer and gyroscope on its own clock and queues them in its 1 KB FIFO, so the
+ * sample interval has no jitter from the reading task. read() fetches the FIFO count and then every complete
+ * sample in bursts of MPU6050_FIFO_BURST bytes, one bus transaction per burst instead of one per sample.
+ * The samples the previous count left in the FIFO are certain to be there, with readFifo() the first burst
+ * of them is read together with the new count.
+ * The data ready interrupt is enabled; the pin pulses once per sample and can be used to wake the reader
+ * after a batch of samples (the chip has no FIFO watermark interrupt). Ranges and the digital low pass filter
+ * are left as configured before begin().
+ */
+class Mpu6050Fifo
+{
+public:
+  /**
+   * @brief Derive the scales from the configured ranges, set the sample rate and start the FIFO.
+   *
+   * @param[in] bus Register access, called from begin() and read() only.
+   * @param[in] sampleRate Samples per second. The chip divides its 1 kHz (8 kHz without low pass filter) clock
+   * by an integer, sampleRate() returns the rate actually used.
+   *
+   * @return
+   *              - true if the FIFO runs
+   *              - false if sampleRate is 0 or any bus error
+   */
+  bool begin(const mpu6050_bus_t &bus, uint16_t sampleRate);
+
+  /**
+   * @brief Stop the FIFO and the interrupt.
+   */
+  void end();
+
+  /**
+   * @brief Move the complete samples in the FIFO into samples, oldest first.
+   *
+   * @param[in] max Capacity of samples. Samples beyond it stay in the FIFO for the next call.
+   *
+   * @return Number of samples written, 0 if the FIFO is empty, overflowed (it is reset) or on a bus error.
+   * A failed burst also resets the FIFO, the samples of the bursts before it are still returned.
+   */
+  size_t read(mpu6050_sample_t *samples, size_t max);
+
+  /**
+   * @brief Decode FIFO bytes, complete samples only.
+   *
+   * @return Number of samples written, length / MPU6050_FIFO_SAMPLE_SIZE.
+   */
+  static size_t parse(const uint8_t *data, size_t length, mpu6050_sample_t *samples);
+
+  /**
+   * @brief Read the die temperature, it is not part of the FIFO samples.
+   *
+   * @return false on a bus error.
+   */
+  bool temperature(float *celsius);
+
+  uint16_t sampleRate() const { return _sample_rate; }
+  float accelScale() const { return _accel_scale; } // m/s^2 per LSB.
+  float gyroScale() const { return _gyro_scale; }   // rad/s per LSB.
+  const mpu6050_fifo_stats_t &stats() const { return _stats; }
+
+private:
+  bool _reset();
+
+  mpu6050_bus_t _bus = {};
+  uint16_t _sample_rate = 0;
+  float _accel_scale = 0;
+  float _gyro_scale = 0;
+  uint16_t _backlog = 0; // Bytes the last count reported that were not read, the FIFO only grows until they are.
+  mpu6050_fifo_stats_t _stats = {};
+};
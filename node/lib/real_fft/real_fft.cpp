@@ -0,0 +1,152 @@
+#include "real_fft.h"
+#include "stdlib.h"
+#include "math.h"
+
+bool RealFFT::init(uint16_t size)
+{
+  if (_sine != NULL || size < 8 || (size & (size - 1)) != 0)
+  {
+    return false;
+  }
+  _sine = (float *)malloc((size / 4 + 1) * sizeof(float));
+  _window = (uint16_t *)malloc(size / 2 * sizeof(uint16_t));
+  if (_sine == NULL || _window == NULL)
+  {
+    deinit();
+    return false;
+  }
+  _size = size;
+  // Computed in double once, so the tables carry no accumulated rounding error
+  for (uint16_t k = 0; k <= size / 4; ++k)
+  {
+    _sine[k] = (float)sin(2.0 * M_PI * k / size);
+  }
+  for (uint16_t k = 0; k < size / 2; ++k)
+  {
+    double weight = 0.54 - 0.46 * cos(2.0 * M_PI * k / (size - 1));
+    _window[k] = (uint16_t)fmin(65535.0, round(weight * 65536.0));
+  }
+  return true;
+}
+
+void RealFFT::deinit()
+{
+  free(_sine);
+  free(_window);
+  _sine = NULL;
+  _window = NULL;
+  _size = 0;
+}
+
+void RealFFT::window(float *frame) const
+{
+  const float scale = 1.0f / 65536.0f;
+  for (uint16_t i = 0; i < _size / 2; ++i)
+  {
+    float weight = _window[i] * scale;
+    frame[i] *= weight;
+    frame[_size - 1 - i] *= weight;
+  }
+}
+
+void RealFFT::window(const int16_t *samples, float *frame) const
+{
+  // The product of a sample and a weight fits in 32 bits, so only the result is converted to float
+  const float scale = 1.0f / 65536.0f;
+  for (uint16_t i = 0; i < _size / 2; ++i)
+  {
+    int32_t weight = _window[i];
+    frame[i] = (samples[i] * weight) * scale;
+    frame[_size - 1 - i] = (samples[_size - 1 - i] * weight) * scale;
+  }
+}
+
+void RealFFT::forward(float *frame) const
+{
+  // The even samples are the real, the odd samples the imaginary parts of the half size complex input
+  _complex(frame);
+  const uint16_t half = _size / 2;
+  float dc = frame[0];
+  frame[0] = dc + frame[1];
+  frame[1] = dc - frame[1];
+  // Bins k and half - k are built from the same two complex values, so the split step works in place
+  for (uint16_t k = 1; k <= half / 2; ++k)
+  {
+    float *a = frame + 2 * k;
+    float *b = frame + 2 * (half - k);
+    float evenRe = 0.5f * (a[0] + b[0]);
+    float evenIm = 0.5f * (a[1] - b[1]);
+    float oddRe = 0.5f * (a[1] + b[1]);
+    float oddIm = 0.5f * (b[0] - a[0]);
+    // k <= N / 4, so both come straight from the first quarter
+    float c = _sine[half / 2 - k];
+    float s = _sine[k];
+    float rotatedRe = c * oddRe + s * oddIm;
+    float rotatedIm = c * oddIm - s * oddRe;
+    a[0] = evenRe + rotatedRe;
+    a[1] = evenIm + rotatedIm;
+    b[0] = evenRe - rotatedRe;
+    b[1] = rotatedIm - evenIm;
+  }
+}
+
+void RealFFT::magnitude(float *frame) const
+{
+  frame[0] = fabsf(frame[0]);
+  // Bin k is read from 2k and 2k + 1, which are always ahead of the write position
+  for (uint16_t k = 1; k < _size / 2; ++k)
+  {
+    float re = frame[2 * k];
+    float im = frame[2 * k + 1];
+    frame[k] = sqrtf(re * re + im * im);
+  }
+}
+
+void RealFFT::_complex(float *data) const
+{
+  const uint16_t points = _size / 2;
+  const uint16_t quarter = _size / 4;
+  // Bit reversal permutation
+  for (uint16_t i = 1, j = 0; i < points; ++i)
+  {
+    uint16_t bit = points >> 1;
+    for (; j & bit; bit >>= 1)
+    {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j)
+    {
+      float re = data[2 * i];
+      float im = data[2 * i + 1];
+      data[2 * i] = data[2 * j];
+      data[2 * i + 1] = data[2 * j + 1];
+      data[2 * j] = re;
+      data[2 * j + 1] = im;
+    }
+  }
+  // Radix-2 decimation in time, the twiddle of a span is every (_size / length)-th angle
+  for (uint16_t length = 2; length <= points; length <<= 1)
+  {
+    const uint16_t span = length / 2;
+    const uint16_t stride = _size / length;
+    for (uint16_t j = 0; j < span; ++j)
+    {
+      // Angles up to 90 degrees read the table backwards for cos, beyond that cos and sin swap roles
+      const uint16_t k = j * stride;
+      float c = k <= quarter ? _sine[quarter - k] : -_sine[k - quarter];
+      float s = k <= quarter ? _sine[k] : _sine[2 * quarter - k];
+      for (uint16_t i = j; i < points; i += length)
+      {
+        float *a = data + 2 * i;
+        float *b = data + 2 * (i + span);
+        float re = c * b[0] + s * b[1];
+        float im = c * b[1] - s * b[0];
+        b[0] = a[0] - re;
+        b[1] = a[1] - im;
+        a[0] += re;
+        a[1] += im;
+      }
+    }
+  }
+}
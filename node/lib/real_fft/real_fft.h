@@ -0,0 +1,71 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+
+/**
+ * @brief Single precision FFT of real input, e.g. audio frames.
+ *
+ * @note A frame of N real samples is transformed as an N/2 point complex FFT of the even/odd sample pairs,
+ * followed by a split step that separates the two interleaved spectra. Compared to a complex FFT of N points
+ * with a zeroed imaginary part this halves the butterflies and the buffer. The ESP32 FPU only handles float,
+ * so all math is float. Twiddle factors and the (symmetric) Hamming window are computed once in init(), as a
+ * quarter wave sine table and half a window in 16-bit fixed point, (N / 4 + 1) * 4 + N bytes in total.
+ * One instance may be shared by several tasks as long as every task passes its own frame.
+ */
+class RealFFT
+{
+public:
+  RealFFT() {}
+  ~RealFFT() { deinit(); }
+
+  RealFFT(const RealFFT &) = delete;
+  RealFFT &operator=(const RealFFT &) = delete;
+
+  /**
+   * @brief Allocate and fill the tables.
+   *
+   * @param[in] size Samples per frame. Power of two, at least 8.
+   *
+   * @return
+   *              - true if the tables were allocated
+   *              - false if size is invalid, already initialised or there is no free memory
+   */
+  bool init(uint16_t size);
+
+  void deinit();
+
+  uint16_t size() const { return _size; }
+
+  /**
+   * @brief Multiply a frame with the Hamming window, 0.54 - 0.46 cos(2 pi i / (N - 1)) like arduinoFFT.
+   */
+  void window(float *frame) const;
+
+  /**
+   * @brief Convert int16_t samples to float and apply the window in the same pass.
+   */
+  void window(const int16_t *samples, float *frame) const;
+
+  /**
+   * @brief In-place forward transform of size() real values, not normalised.
+   *
+   * @note The result is packed into the same size() floats: frame[0] holds the real DC bin, frame[1] the real
+   * Nyquist bin and frame[2k], frame[2k + 1] the real and imaginary part of bin k for 0 < k < size() / 2.
+   */
+  void forward(float *frame) const;
+
+  /**
+   * @brief Replace a packed spectrum with the magnitudes of bins 0 to size() / 2 - 1 (Nyquist is dropped).
+   *
+   * @note Same scale as arduinoFFT's complexToMagnitude(), the upper half of the frame is left undefined.
+   */
+  void magnitude(float *frame) const;
+
+private:
+  void _complex(float *data) const;
+
+  uint16_t _size = 0;
+  float *_sine = NULL;      // sin(2 pi k / N) for 0 <= k <= N / 4, the other twiddles follow from symmetry.
+  uint16_t *_window = NULL; // First half of the Hamming window times 65536 (1.0 is stored as 65535), the second half is its mirror.
+};
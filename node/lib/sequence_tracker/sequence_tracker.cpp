@@ -0,0 +1,117 @@
+#include "sequence_tracker.h"
+#include "string.h"
+
+bool SequenceTracker::accept(const uint8_t *mac_addr, uint16_t seq, uint8_t *slot)
+{
+  if (mac_addr == NULL)
+  {
+    return true;
+  }
+  bool accepted = true;
+  taskENTER_CRITICAL(&_lock);
+  _source_t *source = _find(mac_addr);
+  if (slot != NULL)
+  {
+    *slot = source - _sources;
+  }
+  source->last_heard = ++_clock;
+  sequence_tracker_source_t &stats = source->stats;
+  uint16_t ahead = seq - stats.last_seq; // Modulo 2^16, so the wrap-around needs no special case
+  uint16_t behind = stats.last_seq - seq;
+  if (stats.accepted == 0 || (ahead > SEQUENCE_TRACKER_MAX_GAP && behind >= SEQUENCE_TRACKER_WINDOW))
+  {
+    if (stats.accepted != 0)
+    {
+      ++stats.restarts;
+    }
+    stats.last_seq = seq;
+    source->window = 1;
+    source->missing = 0;
+  }
+  else if (ahead != 0 && ahead <= SEQUENCE_TRACKER_MAX_GAP)
+  {
+    stats.lost += ahead - 1;
+    if (ahead < SEQUENCE_TRACKER_WINDOW)
+    {
+      source->window = (source->window << ahead) | 1;
+      source->missing = (source->missing << ahead) | (((uint64_t)1 << ahead) - 2);
+    }
+    else
+    {
+      source->window = 1;
+      source->missing = ~(uint64_t)1;
+    }
+    stats.last_seq = seq;
+  }
+  else if ((source->window >> behind) & 1)
+  {
+    ++stats.duplicates;
+    accepted = false;
+  }
+  else
+  {
+    // Late but new. Only a number skipped by a newer one was counted as lost, not one from before the
+    // source was (re)started here
+    source->window |= (uint64_t)1 << behind;
+    if ((source->missing >> behind) & 1)
+    {
+      source->missing &= ~((uint64_t)1 << behind);
+      --stats.lost;
+    }
+    ++stats.reordered;
+  }
+  if (accepted)
+  {
+    ++stats.accepted;
+  }
+  taskEXIT_CRITICAL(&_lock);
+  return accepted;
+}
+
+uint8_t SequenceTracker::sources(sequence_tracker_source_t *stats, uint8_t max)
+{
+  uint8_t copied = 0;
+  taskENTER_CRITICAL(&_lock);
+  for (; copied < _count && copied < max; ++copied)
+  {
+    stats[copied] = _sources[copied].stats;
+  }
+  taskEXIT_CRITICAL(&_lock);
+  return copied;
+}
+
+sequence_tracker_source_t SequenceTracker::total()
+{
+  sequence_tracker_source_t total = {};
+  taskENTER_CRITICAL(&_lock);
+  for (uint8_t i = 0; i < _count; ++i)
+  {
+    total.accepted += _sources[i].stats.accepted;
+    total.duplicates += _sources[i].stats.duplicates;
+    total.lost += _sources[i].stats.lost;
+    total.reordered += _sources[i].stats.reordered;
+    total.restarts += _sources[i].stats.restarts;
+  }
+  taskEXIT_CRITICAL(&_lock);
+  return total;
+}
+
+SequenceTracker::_source_t *SequenceTracker::_find(const uint8_t *mac_addr)
+{
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < _count; ++i)
+  {
+    if (memcmp(_sources[i].stats.mac_addr, mac_addr, sizeof(_sources[i].stats.mac_addr)) == 0)
+    {
+      return &_sources[i];
+    }
+    if ((int32_t)(_sources[i].last_heard - _sources[oldest].last_heard) < 0)
+    {
+      oldest = i;
+    }
+  }
+  uint8_t slot = _count < SEQUENCE_TRACKER_MAX_SOURCES ? _count++ : oldest;
+  _sources[slot] = {};
+  memcpy(_sources[slot].stats.mac_addr, mac_addr, sizeof(_sources[slot].stats.mac_addr));
+  return &_sources[slot];
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "stdint.h"
+#include "stddef.h"
+#include "freertos/FreeRTOS.h"
+
+#define SEQUENCE_TRACKER_MAX_SOURCES 16 // Sources tracked at the same time, the least recently heard one is replaced.
+#define SEQUENCE_TRACKER_WINDOW 64      // Sequence numbers behind the newest one that are still checked for duplicates.
+#define SEQUENCE_TRACKER_MAX_GAP 1024   // A larger jump forward (or any jump behind the window) is taken as a reboot of the source.
+
+typedef struct // Counters of one source since it was first heard.
+{
+  uint8_t mac_addr[6]; // MAC address of the source.
+  uint16_t last_seq;   // Newest sequence number accepted.
+  uint32_t accepted;   // Messages passed on.
+  uint32_t duplicates; // Messages dropped because their sequence number was already seen.
+  uint32_t lost;       // Sequence numbers skipped and not (yet) received.
+  uint32_t reordered;  // Messages that arrived after a newer one, those that filled a gap were taken off lost.
+  uint32_t restarts;   // Sequence jumps taken as a reboot of the source.
+} sequence_tracker_source_t;
+
+/**
+ * @brief Per-source sliding window over 16-bit sequence numbers.
+ *
+ * @note Every source keeps a bitmap of the last SEQUENCE_TRACKER_WINDOW sequence numbers it has sent, so a
+ * retransmission (e.g. after a lost delivery confirmation) is recognised even if newer messages arrived in
+ * between. Sources start counting at a random value after each boot, a reboot therefore almost never lands
+ * inside the old window. accept() and the getters may be called from different tasks.
+ */
+class SequenceTracker
+{
+public:
+  /**
+   * @brief Register a received sequence number.
+   *
+   * @param[out] slot Index (0 to SEQUENCE_TRACKER_MAX_SOURCES - 1) of the source's slot, NULL if not needed. It
+   * stays the same while the source is tracked, so it can stand in for the MAC address; an evicted source can
+   * come back on another slot.
+   *
+   * @return
+   *              - true if the message is new and should be passed on
+   *              - false if it is a duplicate
+   */
+  bool accept(const uint8_t *mac_addr, uint16_t seq, uint8_t *slot = NULL);
+
+  /**
+   * @brief Copy the counters of up to max sources into stats.
+   *
+   * @return Number of sources copied.
+   */
+  uint8_t sources(sequence_tracker_source_t *stats, uint8_t max);
+
+  /**
+   * @brief Sum of the counters over all sources, mac_addr and last_seq are zero.
+   */
+  sequence_tracker_source_t total();
+
+private:
+  typedef struct
+  {
+    sequence_tracker_source_t stats;
+    uint64_t window;     // Bit i is set if last_seq - i was received.
+    uint64_t missing;    // Bit i is set if last_seq - i was skipped and is counted in lost.
+    uint32_t last_heard; // Value of _clock when the source was last heard, picks the slot to replace.
+  } _source_t;
+
+  _source_t *_find(const uint8_t *mac_addr);
+
+  portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+  _source_t _sources[SEQUENCE_TRACKER_MAX_SOURCES] = {};
+  uint8_t _count = 0;
+  uint32_t _clock = 0; // Counts accept() calls.
+};
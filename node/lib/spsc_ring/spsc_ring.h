@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include "stdint.h"
+#include "stdlib.h"
+#include "string.h"
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+/**
+ * @brief Lock-free single-producer/single-consumer ring buffer.
+ *
+ * @note Exactly one task may call push() and exactly one (other) task may call pop()/peek()/release().
+ * Indices are free running 32-bit counters, the slot is selected with a power-of-two mask, so the full
+ * capacity is usable and no slot is sacrificed to tell "full" from "empty".
+ */
+template <typename T>
+class SpscRing
+{
+public:
+  SpscRing() {}
+  ~SpscRing() { deinit(); }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  /**
+   * @brief Allocate the ring storage.
+   *
+   * @param[in] capacity Number of slots. Rounded up to the next power of two.
+   * @param[in] spiram Place the storage in SPI RAM (PSRAM) if available. Falls back to internal RAM.
+   *
+   * @return
+   *              - true if the storage was allocated
+   *              - false if capacity is invalid or there is no free memory
+   */
+  bool init(uint32_t capacity, bool spiram = false)
+  {
+    if (_items != NULL || capacity == 0 || capacity > (1UL << 31))
+    {
+      return false;
+    }
+    uint32_t size = 1;
+    while (size < capacity)
+    {
+      size <<= 1;
+    }
+    _items = (T *)_alloc(size * sizeof(T), spiram);
+    if (_items == NULL)
+    {
+      return false;
+    }
+    _mask = size - 1;
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
+    _dropped.store(0, std::memory_order_relaxed);
+    _pushed.store(0, std::memory_order_relaxed);
+    _high_watermark.store(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  /**
+   * @brief Free the ring storage. Neither side may use the ring afterwards.
+   */
+  void deinit()
+  {
+    if (_items != NULL)
+    {
+      _free(_items);
+      _items = NULL;
+    }
+  }
+
+  /**
+   * @brief Copy an item into the ring. Producer side only.
+   *
+   * @return
+   *              - true if the item was queued
+   *              - false if the ring is full, the item is counted as dropped
+   */
+  bool push(const T &item)
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t used = head - _tail.load(std::memory_order_acquire);
+    if (used > _mask)
+    {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    memcpy(&_items[head & _mask], &item, sizeof(T));
+    _head.store(head + 1, std::memory_order_release);
+    _pushed.fetch_add(1, std::memory_order_relaxed);
+    if (used + 1 > _high_watermark.load(std::memory_order_relaxed))
+    {
+      _high_watermark.store(used + 1, std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Copy the oldest item out of the ring and remove it. Consumer side only.
+   *
+   * @return
+   *              - true if an item was copied to item
+   *              - false if the ring is empty
+   */
+  bool pop(T &item)
+  {
+    const T *front = peek();
+    if (front == NULL)
+    {
+      return false;
+    }
+    memcpy(&item, front, sizeof(T));
+    release();
+    return true;
+  }
+
+  /**
+   * @brief Pointer to the oldest item without removing it. Consumer side only.
+   *
+   * @note The pointer stays valid until release() is called.
+   */
+  const T *peek() const
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire))
+    {
+      return NULL;
+    }
+    return &_items[tail & _mask];
+  }
+
+  /**
+   * @brief Remove the item returned by peek(). Consumer side only.
+   */
+  void release()
+  {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  uint32_t size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+  uint32_t capacity() const { return _items == NULL ? 0 : _mask + 1; }
+  bool empty() const { return size() == 0; }
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }                // Items rejected because the ring was full.
+  uint32_t pushed() const { return _pushed.load(std::memory_order_relaxed); }                  // Items accepted since init.
+  uint32_t highWatermark() const { return _high_watermark.load(std::memory_order_relaxed); }   // Maximum fill level seen since init.
+
+private:
+  static void *_alloc(size_t bytes, bool spiram)
+  {
+#ifdef ESP_PLATFORM
+    void *ptr = NULL;
+#ifdef CONFIG_SPIRAM
+    if (spiram)
+    {
+      ptr = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+#endif
+    if (ptr == NULL)
+    {
+      ptr = heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    }
+    return ptr;
+#else
+    (void)spiram;
+    return malloc(bytes);
+#endif
+  }
+
+  static void _free(void *ptr)
+  {
+#ifdef ESP_PLATFORM
+    heap_caps_free(ptr);
+#else
+    free(ptr);
+#endif
+  }
+
+  T *_items = NULL;
+  uint32_t _mask = 0;
+  std::atomic<uint32_t> _head{0}; // Written by the producer only.
+  std::atomic<uint32_t> _tail{0}; // Written by the consumer only.
+  std::atomic<uint32_t> _dropped{0};
+  std::atomic<uint32_t> _pushed{0};
+  std::atomic<uint32_t> _high_watermark{0};
+};
@@ -1,6 +1,9 @@
 #include "zh_network.h"
 #include "soc/rtc_wdt.h"
 #include <ESP32Time.h>
+#ifdef ZH_NETWORK_TRACE
+#include "latency_histogram.h"
+#endif
 #define DATA_SEND_SUCCESS BIT0
 #define DATA_SEND_FAIL BIT1
 #define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
@@ -13,6 +16,7 @@ static void _recv_cb(const uint8_t *mac_addr, const uint8_t *data, int data_len)
 static void _recv_cb(const esp_now_recv_info_t *esp_now_info, const uint8_t *data, int data_len);
 #endif
 static void _processing(void *pvParameter);
+static uint8_t _route_hops(const uint8_t *target);
 
 static const char *TAG = "zh_network";
 
@@ -54,10 +58,28 @@ typedef enum
 } __attribute__((packed)) _message_type_t;
 ;
 
+typedef struct // Microsecond timestamps (lower 32 bits of esp_timer_get_time()) of a message sent by this node, 0 until reached.
+{
+  uint32_t enqueued;       // zh_network_send() accepted the message.
+  uint32_t dequeued;       // The processing task took it from the queue for the first time.
+  uint32_t first_transmit; // First esp_now_send() call.
+  uint32_t last_transmit;  // esp_now_send() call of the attempt that succeeded.
+  uint32_t sent;           // The send callback of that attempt reported success.
+} _trace_t;
+
+typedef struct // Delivery confirmation waiting for the WAIT_RESPONSE entry of its message to come around in the queue.
+{
+  uint32_t message_id;
+  uint32_t received; // _trace_now() when the confirmation was processed, handed on in zh_network_event_on_send_t.confirmed.
+} _response_t;
+
 typedef struct
 {
   uint64_t time;
   _queue_state id;
+#ifdef ZH_NETWORK_TRACE
+  _trace_t trace; // Local only, never sent.
+#endif
   struct
   {
     _message_type_t message_type;
@@ -72,6 +94,46 @@ typedef struct
     uint8_t payload[ZH_NETWORK_MAX_MESSAGE_SIZE];
   } __attribute__((packed)) data;
 } _queue_t;
+
+// What sizeof(_queue_t) - 14 has always put on air: the data block without its last two payload bytes.
+// Independent of the local fields in front of data, so nodes with and without ZH_NETWORK_TRACE interoperate.
+#define ZH_NETWORK_FRAME_SIZE (sizeof(((_queue_t *)0)->data) - 2)
+
+static uint32_t _trace_now(void)
+{
+  uint32_t now = (uint32_t)esp_timer_get_time();
+  return now == 0 ? 1 : now; // 0 means "not reached".
+}
+
+#ifdef ZH_NETWORK_TRACE
+// Written by the processing task only, a reset requested from another task is applied there.
+static LatencyHistogram _stage_histograms[ZH_NETWORK_STAGE_MAX];
+static volatile bool _stage_reset_requested = false;
+
+static void _trace_record(const _trace_t *trace, uint32_t confirmed, uint32_t matched)
+{
+  if (_stage_reset_requested)
+  {
+    _stage_reset_requested = false;
+    for (uint8_t i = 0; i < ZH_NETWORK_STAGE_MAX; ++i)
+    {
+      _stage_histograms[i].reset();
+    }
+  }
+  if (trace->enqueued == 0 || trace->dequeued == 0 || trace->first_transmit == 0 || trace->sent == 0)
+  {
+    return;
+  }
+  _stage_histograms[ZH_NETWORK_STAGE_QUEUE].record(trace->dequeued - trace->enqueued);
+  _stage_histograms[ZH_NETWORK_STAGE_ROUTE].record(trace->first_transmit - trace->dequeued);
+  _stage_histograms[ZH_NETWORK_STAGE_RETRY].record(trace->last_transmit - trace->first_transmit);
+  _stage_histograms[ZH_NETWORK_STAGE_SEND].record(trace->sent - trace->last_transmit);
+  _stage_histograms[ZH_NETWORK_STAGE_CONFIRM].record(confirmed - trace->sent);
+  _stage_histograms[ZH_NETWORK_STAGE_MATCH].record(matched - confirmed);
+  _stage_histograms[ZH_NETWORK_STAGE_TOTAL].record(confirmed - trace->enqueued);
+}
+#endif
+
 ESP_EVENT_DEFINE_BASE(ZH_NETWORK);
 
 esp_err_t zh_network_init(const zh_network_init_config_t *config)
@@ -104,7 +166,7 @@ esp_err_t zh_network_init(const zh_network_init_config_t *config)
       ESP_LOGW(TAG, "ESP-NOW initialization warning. The device is connected to the router. Channel %d will be used for ESP-NOW.", prim);
     }
   }
-  if ((sizeof(_queue_t) - 14) > ESP_NOW_MAX_DATA_LEN)
+  if (ZH_NETWORK_FRAME_SIZE > ESP_NOW_MAX_DATA_LEN)
   {
     ESP_LOGE(TAG, "ESP-NOW initialization fail. The maximum value of the transmitted data size is incorrect.");
     return ESP_ERR_INVALID_ARG;
@@ -121,7 +183,7 @@ esp_err_t zh_network_init(const zh_network_init_config_t *config)
   _queue_handle = xQueueCreate(_init_config.queue_size, sizeof(_queue_t));
   zh_vector_init(&_id_vector, sizeof(uint32_t), false);
   zh_vector_init(&_route_vector, sizeof(_routing_table_t), false);
-  zh_vector_init(&_response_vector, sizeof(uint32_t), false);
+  zh_vector_init(&_response_vector, sizeof(_response_t), false);
   _id_vector_mutex = xSemaphoreCreateMutex();
   if (esp_now_init() != ESP_OK || esp_now_register_send_cb(_send_cb) != ESP_OK || esp_now_register_recv_cb(_recv_cb) != ESP_OK)
   {
@@ -210,6 +272,9 @@ esp_err_t zh_network_send(const uint8_t *target, const uint8_t *data, const uint
   }
   memcpy(queue.data.payload, data, data_len);
   queue.data.payload_len = data_len;
+#ifdef ZH_NETWORK_TRACE
+  queue.trace.enqueued = _trace_now();
+#endif
   if (target == NULL)
   {
     ESP_LOGI(TAG, "Adding outgoing ESP-NOW data to MAC FF:FF:FF:FF:FF:FF to queue success.");
@@ -254,7 +319,7 @@ static void _recv_cb(const esp_now_recv_info_t *esp_now_info, const uint8_t *dat
     ESP_LOGW(TAG, "Adding incoming ESP-NOW data to queue fail. Queue is almost full.");
     return;
   }
-  if (data_len == sizeof(_queue_t) - 14)
+  if (data_len == ZH_NETWORK_FRAME_SIZE)
   {
     _queue_t queue = {0};
     queue.id = ON_RECV;
@@ -322,6 +387,12 @@ static void _processing(void *pvParameter)
     {
     case TO_SEND:
     {
+#ifdef ZH_NETWORK_TRACE
+      if (queue.trace.dequeued == 0)
+      {
+        queue.trace.dequeued = _trace_now();
+      }
+#endif
       ESP_LOGI(TAG, "Outgoing ESP-NOW data from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X processing begin.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
       esp_now_peer_info_t *peer = (esp_now_peer_info_t *)heap_caps_malloc(sizeof(esp_now_peer_info_t), MALLOC_CAP_8BIT);
       if (peer == NULL)
@@ -447,7 +518,14 @@ static void _processing(void *pvParameter)
           ESP_LOGE(TAG, "ESP-NOW message processing task internal error at line %d.", __LINE__);
         }
       }
-      if (esp_now_send((uint8_t *)peer->peer_addr, (uint8_t *)&queue.data, sizeof(_queue_t) - 14) != ESP_OK)
+#ifdef ZH_NETWORK_TRACE
+      queue.trace.last_transmit = _trace_now();
+      if (queue.trace.first_transmit == 0)
+      {
+        queue.trace.first_transmit = queue.trace.last_transmit;
+      }
+#endif
+      if (esp_now_send((uint8_t *)peer->peer_addr, (uint8_t *)&queue.data, ZH_NETWORK_FRAME_SIZE) != ESP_OK)
       {
         ESP_LOGE(TAG, "ESP-NOW message processing task internal error at line %d.", __LINE__);
         heap_caps_free(peer);
@@ -458,12 +536,16 @@ static void _processing(void *pvParameter)
       if ((bit & DATA_SEND_SUCCESS) != 0)
       {
         _attempts = 0;
+#ifdef ZH_NETWORK_TRACE
+        queue.trace.sent = _trace_now();
+#endif
         if (memcmp(queue.data.original_sender_mac, _self_mac, 6) == 0)
         {
           if (queue.data.message_type == BROADCAST)
           {
             ESP_LOGI(TAG, "Broadcast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X sent success.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
             on_send->status = ZH_NETWORK_SEND_SUCCESS;
+            on_send->hops = UINT8_MAX;
             ESP_LOGI(TAG, "Outgoing ESP-NOW data from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X processed success.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
             if (esp_event_post(ZH_NETWORK, ZH_NETWORK_ON_SEND_EVENT, on_send, sizeof(zh_network_event_on_send_t) + on_send->data_len + sizeof(on_send->data_len), portTICK_PERIOD_MS) != ESP_OK)
             {
@@ -696,7 +778,8 @@ static void _processing(void *pvParameter)
         ESP_LOGI(TAG, "System message for message receiving confirmation from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X is received.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
         if (memcmp(queue.data.original_target_mac, _self_mac, 6) == 0)
         {
-          zh_vector_push_back(&_response_vector, &queue.data.confirm_id);
+          _response_t response = {.message_id = queue.data.confirm_id, .received = _trace_now()}; // The message itself is only matched when its WAIT_RESPONSE entry comes around.
+          zh_vector_push_back(&_response_vector, &response);
           if (zh_vector_get_size(&_response_vector) > _init_config.queue_size)
           {
             zh_vector_delete_item(&_response_vector, 0);
@@ -816,8 +899,8 @@ static void _processing(void *pvParameter)
     {
       for (uint16_t i = 0; i < zh_vector_get_size(&_response_vector); ++i)
       {
-        uint32_t *message_id = (uint32_t *)zh_vector_get_item(&_response_vector, i);
-        if (memcmp(&queue.data.message_id, message_id, sizeof(queue.data.message_id)) == 0)
+        _response_t response = *(_response_t *)zh_vector_get_item(&_response_vector, i);
+        if (response.message_id == queue.data.message_id)
         {
           zh_vector_delete_item(&_response_vector, i);
           zh_network_event_on_send_t *on_send = (zh_network_event_on_send_t *)heap_caps_malloc(sizeof(zh_network_event_on_send_t), MALLOC_CAP_8BIT);
@@ -837,21 +920,25 @@ static void _processing(void *pvParameter)
           {
             ESP_LOGE(TAG, "ESP-NOW message processing task internal error at line %d.", __LINE__);
             heap_caps_free(on_send);
-            heap_caps_free(on_send->data);
             break;
           }
           memset(on_send->data, 0, queue.data.payload_len);
           memcpy(on_send->data, queue.data.payload, queue.data.payload_len);
 
           on_send->status = ZH_NETWORK_SEND_SUCCESS;
+          on_send->hops = _route_hops(queue.data.original_target_mac);
+          on_send->confirmed = response.received;
+#ifdef ZH_NETWORK_TRACE
+          _trace_record(&queue.trace, response.received, _trace_now());
+#endif
           ESP_LOGI(TAG, "Unicast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X sent success.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
           ESP_LOGI(TAG, "Unicast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X removed from confirmation message waiting list.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
           if (esp_event_post(ZH_NETWORK, ZH_NETWORK_ON_SEND_EVENT, on_send, sizeof(zh_network_event_on_send_t) + on_send->data_len + sizeof(on_send->data_len), portTICK_PERIOD_MS) != ESP_OK)
           {
             ESP_LOGE(TAG, "ESP-NOW message processing task internal error at line %d.", __LINE__);
+            heap_caps_free(on_send->data);
           }
-          heap_caps_free(on_send);
-          heap_caps_free(on_send->data);
+          heap_caps_free(on_send); // on_send->data now belongs to the event handler, same as for ZH_NETWORK_ON_RECV_EVENT.
           flag = true;
           break;
         }
@@ -872,12 +959,24 @@ static void _processing(void *pvParameter)
             }
             memset(on_send, 0, sizeof(zh_network_event_on_send_t));
             memcpy(on_send->mac_addr, queue.data.original_target_mac, 6);
+            on_send->data_len = queue.data.payload_len;
+            on_send->data = (uint8_t *)heap_caps_malloc(queue.data.payload_len, MALLOC_CAP_8BIT); // Tells the handler which message failed, may stay NULL.
+            if (on_send->data != NULL)
+            {
+              memcpy(on_send->data, queue.data.payload, queue.data.payload_len);
+            }
+            else
+            {
+              on_send->data_len = 0;
+            }
             on_send->status = ZH_NETWORK_SEND_FAIL;
+            on_send->hops = UINT8_MAX;
             ESP_LOGE(TAG, "Unicast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X sent fail.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
             ESP_LOGI(TAG, "Unicast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X removed from confirmation message waiting list.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
             if (esp_event_post(ZH_NETWORK, ZH_NETWORK_ON_SEND_EVENT, on_send, sizeof(zh_network_event_on_send_t), portTICK_PERIOD_MS) != ESP_OK)
             {
               ESP_LOGE(TAG, "ESP-NOW message processing task internal error at line %d.", __LINE__);
+              heap_caps_free(on_send->data);
             }
             heap_caps_free(on_send);
           }
@@ -932,12 +1031,24 @@ static void _processing(void *pvParameter)
             }
             memset(on_send, 0, sizeof(zh_network_event_on_send_t));
             memcpy(on_send->mac_addr, queue.data.original_target_mac, 6);
+            on_send->data_len = queue.data.payload_len;
+            on_send->data = (uint8_t *)heap_caps_malloc(queue.data.payload_len, MALLOC_CAP_8BIT); // Tells the handler which message failed, may stay NULL.
+            if (on_send->data != NULL)
+            {
+              memcpy(on_send->data, queue.data.payload, queue.data.payload_len);
+            }
+            else
+            {
+              on_send->data_len = 0;
+            }
             on_send->status = ZH_NETWORK_SEND_FAIL;
+            on_send->hops = UINT8_MAX;
             ESP_LOGE(TAG, "Unicast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X sent fail.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
             ESP_LOGI(TAG, "Unicast message from MAC %02X:%02X:%02X:%02X:%02X:%02X to MAC %02X:%02X:%02X:%02X:%02X:%02X removed from routing waiting list.", MAC2STR(queue.data.original_sender_mac), MAC2STR(queue.data.original_target_mac));
             if (esp_event_post(ZH_NETWORK, ZH_NETWORK_ON_SEND_EVENT, on_send, sizeof(zh_network_event_on_send_t), portTICK_PERIOD_MS) != ESP_OK)
             {
               ESP_LOGE(TAG, "ESP-NOW message processing task internal error at line %d.", __LINE__);
+              heap_caps_free(on_send->data);
             }
             heap_caps_free(on_send);
           }
@@ -969,4 +1080,55 @@ static void _processing(void *pvParameter)
     }
   }
   vTaskDelete(NULL);
-}
\ No newline at end of file
+}
+
+static uint8_t _route_hops(const uint8_t *target)
+{
+  uint8_t min_hops = UINT8_MAX;
+  for (uint16_t i = 0; i < zh_vector_get_size(&_route_vector); ++i)
+  {
+    _routing_table_t *routing_table = (_routing_table_t *)zh_vector_get_item(&_route_vector, i);
+    if (memcmp(target, routing_table->original_target_mac, 6) == 0 && routing_table->hops < min_hops)
+    {
+      min_hops = routing_table->hops;
+    }
+  }
+  return min_hops;
+}
+
+esp_err_t zh_network_get_stage_stats(zh_network_stage_t stage, zh_network_stage_stats_t *stats)
+{
+  if (stats == NULL || stage >= ZH_NETWORK_STAGE_MAX)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+#ifdef ZH_NETWORK_TRACE
+  const LatencyHistogram &histogram = _stage_histograms[stage];
+  stats->count = histogram.count();
+  stats->mean = histogram.mean();
+  stats->p50 = histogram.percentile(50);
+  stats->p90 = histogram.percentile(90);
+  stats->p99 = histogram.percentile(99);
+  stats->max = histogram.max();
+  return ESP_OK;
+#else
+  memset(stats, 0, sizeof(zh_network_stage_stats_t));
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t zh_network_reset_stage_stats(void)
+{
+#ifdef ZH_NETWORK_TRACE
+  _stage_reset_requested = true;
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+const char *zh_network_stage_name(zh_network_stage_t stage)
+{
+  static const char *names[ZH_NETWORK_STAGE_MAX] = {"queue", "route", "retry", "send", "confirm", "match", "total"};
+  return stage < ZH_NETWORK_STAGE_MAX ? names[stage] : "unknown";
+}
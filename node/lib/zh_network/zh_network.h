@@ -19,7 +19,7 @@
 #include "globals.h"
 #include "data_packaging.h"
 
-#define ZH_NETWORK_MAX_MESSAGE_SIZE 91 // Maximum value of the transmitted data size. @attention All devices on the network must have the same ZH_NETWORK_MAX_MESSAGE_SIZE.
+#define ZH_NETWORK_MAX_MESSAGE_SIZE 91 // Maximum value of the transmitted data size. @attention All devices on the network must have the same ZH_NETWORK_MAX_MESSAGE_SIZE. @note Only the first 89 bytes go on air.
 
 #define ZH_NETWORK_INIT_CONFIG_DEFAULT() \
   {                                      \
@@ -71,8 +71,10 @@ extern "C"
   {
     uint8_t mac_addr[6];                    // MAC address of the device to which the ESP-NOW message was sent.
     zh_network_on_send_event_type_t status; // Status of sent ESP-NOW message.
-    uint8_t *data;                          // Pointer to the data of the received ESP-NOW message.
-    uint8_t data_len;                       // Size of the received ESP-NOW message.
+    uint8_t *data;                          // Pointer to a copy of the sent message (NULL for broadcasts). @attention Must be freed by the event handler with heap_caps_free().
+    uint8_t data_len;                       // Size of the sent message.
+    uint8_t hops;                           // Relays between this node and the target according to the routing table (0 if direct). UINT8_MAX for broadcasts and failed messages.
+    uint32_t confirmed;                     // Lower 32 bits of esp_timer_get_time() when the delivery confirmation arrived, 0 for broadcasts and failed messages. The event itself is posted up to one queue pass later.
   } zh_network_event_on_send_t;
 
   typedef struct // Structure for sending data to the event handler when an ESP-NOW message was received. @note Should be used with ZH_NETWORK event base and ZH_NETWORK_ON_RECV_EVENT event.
@@ -125,6 +127,55 @@ extern "C"
    */
   esp_err_t zh_network_send(const uint8_t *target, const uint8_t *data, const uint8_t data_len);
 
+  typedef enum // Stages of a unicast message sent by this node, see zh_network_get_stage_stats().
+  {
+    ZH_NETWORK_STAGE_QUEUE,   // zh_network_send() until the processing task takes the message.
+    ZH_NETWORK_STAGE_ROUTE,   // Taken until the first transmit attempt, includes route search and waiting for a route.
+    ZH_NETWORK_STAGE_RETRY,   // First until the last transmit attempt, 0 if the first one succeeded.
+    ZH_NETWORK_STAGE_SEND,    // Last transmit attempt until the send callback reported success.
+    ZH_NETWORK_STAGE_CONFIRM, // Send callback until the delivery confirmation of the target was received.
+    ZH_NETWORK_STAGE_MATCH,   // Delivery confirmation until the waiting message came around in the queue and was reported sent.
+    ZH_NETWORK_STAGE_TOTAL,   // zh_network_send() until the delivery confirmation was received.
+    ZH_NETWORK_STAGE_MAX
+  } zh_network_stage_t;
+
+  typedef struct // Latency of one stage in microseconds, over the messages confirmed since boot or the last reset.
+  {
+    uint32_t count;
+    uint32_t mean;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+  } zh_network_stage_stats_t;
+
+  /**
+   * @brief Get the latency statistics of one stage of the send pipeline.
+   *
+   * @note Only available when built with ZH_NETWORK_TRACE. Every queued message then carries its timestamps, which
+   * costs 20 bytes per queue slot. Values are read while the processing task may be recording, so they can be off by one sample.
+   *
+   * @return
+   *              - ESP_OK if stats was filled
+   *              - ESP_ERR_INVALID_ARG if parameter error
+   *              - ESP_ERR_NOT_SUPPORTED if built without ZH_NETWORK_TRACE
+   */
+  esp_err_t zh_network_get_stage_stats(zh_network_stage_t stage, zh_network_stage_stats_t *stats);
+
+  /**
+   * @brief Clear the latency statistics of all stages. Applied by the processing task before it records the next message.
+   *
+   * @return
+   *              - ESP_OK if the reset was requested
+   *              - ESP_ERR_NOT_SUPPORTED if built without ZH_NETWORK_TRACE
+   */
+  esp_err_t zh_network_reset_stage_stats(void);
+
+  /**
+   * @brief Short lower case name of a stage, e.g. "queue".
+   */
+  const char *zh_network_stage_name(zh_network_stage_t stage);
+
   typedef enum // Enumeration of possible status of sent ESP-NOW message.
   {
     SYNC_REQUEST,
@@ -139,6 +190,7 @@ extern "C"
   {
     message_type_t type;
     uint8_t id;
+    uint16_t seq; // Per-boot sequence number of the source, lets the root drop duplicates and count gaps. Fills former padding.
     unsigned long timestamp;
     unsigned long timestamp_us;
   } message_header_t;
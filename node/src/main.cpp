@@ -3,9 +3,7 @@
 #include "zh_network.h"
 #include <ESP32Time.h>
 #include "Arduino.h"
-#ifdef PERF
 #include "perf.h"
-#endif
 #include "globals.h"
 #ifdef STATIC
 #include <NimBLEDevice.h>
@@ -28,17 +26,15 @@ void zh_network_event_handler(void *arg, esp_event_base_t event_base, int32_t ev
 uint8_t target[6] = {0x88, 0x13, 0xBF, 0x09, 0x90, 0x94};
 
 #ifdef DEBUG
-String printEpochAsDateTime(unsigned long epoch, unsigned long offset)
+void printEpochAsDateTime(unsigned long epoch, unsigned long offset)
 {
   struct tm timeinfo;
   time_t now = epoch;
   localtime_r(&now, &timeinfo);
-  time_t tt = mktime(&timeinfo);
 
   char s[51];
-  strftime(s, 50, "%a, %b %d %Y %H:%M:%S", &timeinfo);
-  printf("%s:%d\n", s, offset);
-  return String(s);
+  strftime(s, sizeof(s), "%a, %b %d %Y %H:%M:%S", &timeinfo);
+  printf("%s:%lu\n", s, offset);
 }
 #endif
 
@@ -92,7 +88,7 @@ void sendIteration(void *pv)
 void setup()
 {
   WiFi.mode(WIFI_STA);
-#if defined(DEBUG) || defined(ROOT_NODE)
+#if defined(DEBUG) && !defined(ROOT_NODE)
   Serial.begin(115200);
   while (Serial.available() > 0)
   {
@@ -100,6 +96,17 @@ void setup()
   }
   // Send ready byte to indicate ESP32 is ready for communication
   Serial.write(0x01); // Ready byte
+#endif
+#ifdef ROOT_NODE
+  // Without its queue and UART the root has nowhere to put what the mesh delivers, so it goes no further
+  if (!serialSetup())
+  {
+    printf("Failed to start the serial link to the host\n");
+    while (1)
+    {
+      delay(10);
+    }
+  }
 #endif
   // setCpuFrequencyMhz(240);
 #ifdef DEBUG
@@ -131,16 +138,12 @@ void setup()
   zh_network_init_config_t network_init_config = ZH_NETWORK_INIT_CONFIG_DEFAULT();
   zh_network_init(&network_init_config);
 
-#ifdef PERF
-  init_perf();
-  return;
-#else
 #ifdef CONFIG_IDF_TARGET_ESP8266
   esp_event_handler_register(ZH_NETWORK, ESP_EVENT_ANY_ID, &zh_network_event_handler, NULL);
 #else
   esp_event_handler_instance_register(ZH_NETWORK, ESP_EVENT_ANY_ID, &zh_network_event_handler, NULL, NULL);
 #endif
-#endif
+  perfSetup();
 
 #ifndef STATIC
   sensorSetup();
@@ -181,14 +184,8 @@ void setup()
 
 void loop()
 {
-#ifdef PERF
-  return;
-#endif
 #ifndef STATIC
   sensorLoopTask();
-#endif
-#ifdef ROOT_NODE
-  processSerial();
 #endif
   delay(10);
 }
@@ -319,21 +316,22 @@ void zh_network_event_handler(void *arg, esp_event_base_t event_base, int32_t ev
     }
     case MESSAGE:
     {
+      perfOnReceive(recv_data);
       break;
     }
     case DATA:
     {
 #ifdef ROOT_NODE
-      enqueueMessage(*recv_message);
+      enqueueReceived(recv_data->mac_addr, *recv_message);
 #endif
 #ifdef DEBUG
       uint8_t message[sizeof(message_t)];
-
-      dequeueMessage(*reinterpret_cast<message_t *>(&message));
+      memcpy(message, recv_message, sizeof(message_t));
 
       printf("Incoming data message.\n");
       int test = sizeof(recv_message);
       printf("Id: %d\n", recv_message->message_header.id);
+      printf("Seq: %u\n", recv_message->message_header.seq);
       printf("Message time: ");
       printEpochAsDateTime(recv_message->message_header.timestamp, recv_message->message_header.timestamp_us);
 
@@ -371,6 +369,7 @@ void zh_network_event_handler(void *arg, esp_event_base_t event_base, int32_t ev
       }
       Serial.println();
 #endif
+      break;
     }
     case RESET_TIME:
     {
@@ -393,6 +392,8 @@ void zh_network_event_handler(void *arg, esp_event_base_t event_base, int32_t ev
       printf("Message to MAC %02X:%02X:%02X:%02X:%02X:%02X sent fail.\n", MAC2STR(send_data->mac_addr));
 #endif
     }
+    perfOnSent(send_data);
+    heap_caps_free(send_data->data); // Do not delete to avoid memory leaks!
     break;
   }
   default:
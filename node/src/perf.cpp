@@ -1,169 +1,547 @@
 #include "perf.h"
+#include "latency_histogram.h"
+#include <atomic>
 
-unsigned long start = 0;
-unsigned long end = 0;
+#define PERF_RESET_ID 255 // header.id of a broadcast MESSAGE that resets the RTT histograms of every node, never used as a run id
+#define PERF_CONSOLE_LINE 96
+#define PERF_CONSOLE_POLL 20           // Milliseconds between two looks at the console
+#define PERF_REPORT_INTERVAL 1000      // Milliseconds between two stress/receive reports
+#define PERF_RTT_REPORT_INTERVAL 10000 // Milliseconds between two RTT percentile reports
+#define PERF_DRAIN_TIME 3000           // Milliseconds to wait after sending for the outstanding confirmations, longer than max_waiting_time
+#define PERF_TASK_STACK_SIZE 4096
+#define PERF_TASK_PRIORITY 10
+#define PERF_MAX_COMMANDS 4 // Console commands other modules can register
 
-uint64_t packets = 0;
-uint64_t totalPackets = 0;
-uint64_t totalPacketsLost = 0;
+static perf_config_t config = {
+    .target = {0x08, 0xF9, 0xE0, 0xB9, 0xEF, 0xFC},
+    .rate = 10,
+    .duration = 10000,
+    .size = sizeof(message_header_t),
+    .step = 10,
+    .max_rate = 1000,
+    .threshold = 5.0f};
 
-// 88:13:BF:09:D7:CC
-// 08:F9:E0:B9:EF:FC
-uint8_t targetPerf[6] = {0x08, 0xF9, 0xE0, 0xB9, 0xEF, 0xFC};
+static volatile perf_test_t running = PERF_TEST_NONE;
+static volatile bool stopRequested = false;
 
-uint16_t delayTime = 5;
+// Counters of the current run or sweep step. Messages carry the run in header.id, so a confirmation that
+// arrives after its run was reported does not count towards the next one. The zh_network event task is the
+// only one that records into the histograms, a reset requested from elsewhere is applied before the next sample.
+static perf_counters_t counters = {};
+static LatencyHistogram latency;    // Microseconds from zh_network_send() to the delivery confirmation
+static LatencyHistogram rttDirect;  // Same, target is a direct neighbour
+static LatencyHistogram rttRelayed; // Same, target is reached through at least one relay
+static volatile bool latencyResetRequested = false;
+static volatile bool rttResetRequested = false;
+static volatile uint8_t runId = 0;
+static volatile uint32_t received = 0; // Benchmark messages received from other nodes
+static uint32_t reportDelivered = 0; // Counters at the previous stress report
+static uint32_t reportElapsed = 0;
 
-void testPacketsPerSecond(void *pv)
+typedef struct // Console command of another module
 {
-  while (true)
+  const char *name;
+  perf_command_handler_t handler;
+} perf_command_t;
+
+static perf_command_t commands[PERF_MAX_COMMANDS];
+static std::atomic<uint8_t> commandCount(0); // Raised after the entry is written, the console task may already read the table.
+
+static const char *testName(perf_test_t test)
+{
+  switch (test)
   {
-    end = millis();
-    Serial.print(end - start);
-    Serial.print(" ms, ");
-    Serial.print(packets);
-    Serial.print(" packets, ");
-    Serial.print(delayTime);
-    Serial.println(" ms delay");
-    packets = 0;
-    start = millis();
-    if (delayTime > 10)
+  case PERF_TEST_RECEIVE:
+    return "receive";
+  case PERF_TEST_STRESS:
+    return "stress";
+  case PERF_TEST_RTT:
+    return "rtt";
+  case PERF_TEST_SWEEP:
+    return "sweep";
+  default:
+    return "none";
+  }
+}
+
+static void beginRun()
+{
+  runId = runId + 1 >= PERF_RESET_ID ? 0 : runId + 1;
+  counters = {};
+  latencyResetRequested = true;
+  reportDelivered = 0;
+  reportElapsed = 0;
+}
+
+static void sendOne(uint16_t seq)
+{
+  uint8_t message[ZH_NETWORK_MAX_MESSAGE_SIZE] = {0};
+  message_header_t header = {
+      .type = MESSAGE,
+      .id = runId,
+      .seq = seq,
+      .timestamp = micros(),
+      .timestamp_us = 0};
+  memcpy(message, &header, sizeof(header));
+  counters.attempted++;
+  if (zh_network_send(config.target, message, config.size) != ESP_OK)
+  {
+    counters.rejected++; // Queue almost full, the offered load is not even reaching the radio
+  }
+}
+
+// Sends at rate on a fixed 1 ms tick until duration (0 = no limit) has passed or a stop is requested.
+// The credit in thousandths of a message carries fractional rates over to the next tick.
+static void sendPaced(uint32_t rate, uint32_t duration, void (*report)(uint32_t elapsed), uint32_t interval)
+{
+  uint32_t credit = 0;
+  uint16_t seq = 0;
+  uint32_t begin = millis();
+  uint32_t lastReport = begin;
+  TickType_t wake = xTaskGetTickCount();
+  while (!stopRequested && (duration == 0 || millis() - begin < duration))
+  {
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(1));
+    credit += rate;
+    while (credit >= 1000)
     {
-      delayTime -= 10;
+      credit -= 1000;
+      sendOne(seq++);
     }
-    else if (delayTime > 2)
+    if (report != NULL && millis() - lastReport >= interval)
     {
-      delayTime -= 1;
+      lastReport = millis();
+      report(lastReport - begin);
     }
-    delay(1000);
   }
 }
 
-void testReliability(void *pv)
+static void printRTT(const char *label, const LatencyHistogram &histogram)
 {
-  while (true)
+  Serial.printf("perf rtt %s n=%u p50=%u p90=%u p99=%u p99.9=%u max=%u us\n", label, histogram.count(),
+                histogram.percentile(50), histogram.percentile(90), histogram.percentile(99), histogram.percentile(99.9f), histogram.max());
+}
+
+static void reportStress(uint32_t elapsed)
+{
+  perf_counters_t now = counters;
+  uint32_t interval = elapsed - reportElapsed;
+  Serial.printf("perf stress t=%u attempted=%u rejected=%u delivered=%u failed=%u rate=%.1f\n", elapsed, now.attempted, now.rejected,
+                now.delivered, now.failed, interval == 0 ? 0 : (now.delivered - reportDelivered) * 1000.0f / interval);
+  reportDelivered = now.delivered;
+  reportElapsed = elapsed;
+}
+
+static void reportRTT(uint32_t elapsed)
+{
+  printRTT("one-hop", rttDirect);
+  printRTT("multi-hop", rttRelayed);
+}
+
+static void runSender(perf_test_t test)
+{
+  beginRun();
+  if (test == PERF_TEST_STRESS)
+  {
+    sendPaced(config.rate, config.duration, reportStress, PERF_REPORT_INTERVAL);
+  }
+  else
+  {
+    sendPaced(config.rate, config.duration, reportRTT, PERF_RTT_REPORT_INTERVAL);
+  }
+  vTaskDelay(pdMS_TO_TICKS(PERF_DRAIN_TIME));
+  perf_counters_t result = counters;
+  Serial.printf("perf result attempted=%u rejected=%u delivered=%u failed=%u stale=%u mean=%u p50=%u p99=%u max=%u us\n",
+                result.attempted, result.rejected, result.delivered, result.failed, result.stale,
+                latency.mean(), latency.percentile(50), latency.percentile(99), latency.max());
+  if (test == PERF_TEST_RTT)
   {
-    Serial.print(millis());
-    Serial.print(" ms, ");
-    Serial.print(totalPackets);
-    Serial.print(" packets, ");
-    Serial.print(totalPacketsLost);
-    Serial.println(" lost");
-    delay(10000);
+    reportRTT(0);
   }
 }
 
-void stress(void *pv)
+static void runSweep()
 {
-  while (true)
+  Serial.printf("perf # rate sweep, firmware %s %s, target " MACSTR ", %u bytes, %u ms per step, stop above %.1f %% loss\n",
+                __DATE__, __TIME__, MAC2STR(config.target), config.size, config.duration, config.threshold);
+  Serial.println("perf csv step,offered_rate,attempted,rejected,delivered,failed,stale,delivered_rate,loss_percent,latency_mean_us,latency_p50_us,latency_p99_us,latency_max_us");
+  uint32_t lastGoodRate = 0;
+  uint32_t duration = config.duration == 0 ? 10000 : config.duration; // A step must end
+  uint32_t step = 0;
+  for (uint32_t rate = config.rate; rate <= config.max_rate && !stopRequested; rate += config.step, step++)
   {
-    message1_t send_message;
-    send_message.message_header = {
-        .type = MESSAGE};
-    // send_message.message = {};
-    packets++;
-    zh_network_send(targetPerf, (uint8_t *)&send_message, sizeof(send_message));
-    delay(delayTime);
+    beginRun();
+    sendPaced(rate, duration, NULL, 0);
+    vTaskDelay(pdMS_TO_TICKS(PERF_DRAIN_TIME));
+
+    perf_counters_t result = counters;
+    float loss = result.attempted == 0 ? 0 : 100.0f * (result.attempted - result.delivered) / result.attempted;
+    Serial.printf("perf csv %u,%u,%u,%u,%u,%u,%u,%.1f,%.2f,%u,%u,%u,%u\n",
+                  step, rate, result.attempted, result.rejected, result.delivered, result.failed, result.stale,
+                  result.delivered * 1000.0f / duration, loss,
+                  latency.mean(), latency.percentile(50), latency.percentile(99), latency.max());
+    if (loss > config.threshold)
+    {
+      Serial.printf("perf # knee at %u msg/s, last step within the loss threshold %u msg/s\n", rate, lastGoodRate);
+      break;
+    }
+    lastGoodRate = rate;
+    if (config.step == 0)
+    {
+      break;
+    }
   }
 }
 
-void measureRTT(void *pv)
+static void runReceive()
 {
-  while (true)
+  uint32_t begin = millis();
+  uint32_t last = received;
+  while (!stopRequested && (config.duration == 0 || millis() - begin < config.duration))
   {
-    message1_t send_message;
-    send_message.message_header = {
-        .type = MESSAGE,
-        .id = 255,
-        .timestamp = micros(),
-        .timestamp_us = 255};
-    // send_message.message = {};
-    packets++;
-    zh_network_send(targetPerf, (uint8_t *)&send_message, sizeof(send_message));
-    delay(delayTime);
+    delay(PERF_REPORT_INTERVAL);
+    uint32_t now = received;
+    Serial.printf("perf receive t=%lu received=%u rate=%u\n", millis() - begin, now, (now - last) * 1000 / PERF_REPORT_INTERVAL);
+    last = now;
+  }
+}
+
+static void testTask(void *pv)
+{
+  perf_test_t test = (perf_test_t)(uintptr_t)pv;
+  switch (test)
+  {
+  case PERF_TEST_RECEIVE:
+    runReceive();
+    break;
+  case PERF_TEST_STRESS:
+  case PERF_TEST_RTT:
+    runSender(test);
+    break;
+  case PERF_TEST_SWEEP:
+    runSweep();
+    break;
+  default:
+    break;
+  }
+  Serial.printf("perf done %s\n", testName(test));
+  running = PERF_TEST_NONE;
+  vTaskDelete(NULL);
+}
+
+bool perfStart(perf_test_t test)
+{
+  if (running != PERF_TEST_NONE || test == PERF_TEST_NONE)
+  {
+    return false;
+  }
+  stopRequested = false;
+  running = test;
+  if (xTaskCreate(testTask, "perfTestTask", PERF_TASK_STACK_SIZE, (void *)(uintptr_t)test, PERF_TASK_PRIORITY, NULL) != pdPASS)
+  {
+    running = PERF_TEST_NONE;
+    return false;
+  }
+  return true;
+}
+
+void perfStop()
+{
+  stopRequested = true;
+}
+
+void perfOnReceive(const zh_network_event_on_recv_t *recv_data)
+{
+  if (recv_data->data == NULL || recv_data->data_len < sizeof(message_header_t))
+  {
+    return;
+  }
+  const message_header_t *header = (const message_header_t *)recv_data->data;
+  if (header->id == PERF_RESET_ID)
+  {
+    rttResetRequested = true;
+    return;
+  }
+  received++;
+}
+
+void perfOnSent(const zh_network_event_on_send_t *send_data)
+{
+  if (send_data->data == NULL || send_data->data_len < sizeof(message_header_t))
+  {
+    return;
+  }
+  const message_header_t *header = (const message_header_t *)send_data->data;
+  if (header->type != MESSAGE || header->id == PERF_RESET_ID)
+  {
+    return;
+  }
+  if (latencyResetRequested)
+  {
+    latencyResetRequested = false;
+    latency.reset();
+  }
+  if (rttResetRequested)
+  {
+    rttResetRequested = false;
+    rttDirect.reset();
+    rttRelayed.reset();
+  }
+  if (header->id != runId)
+  {
+    counters.stale++;
+    return;
+  }
+  if (send_data->status != ZH_NETWORK_SEND_SUCCESS)
+  {
+    counters.failed++;
+    return;
+  }
+  counters.delivered++;
+  // micros() is the same esp_timer clock; the event reaches us up to one queue pass after the confirmation did.
+  uint32_t confirmed = send_data->confirmed != 0 ? send_data->confirmed : micros();
+  uint32_t rtt = confirmed - header->timestamp;
+  latency.record(rtt);
+  if (send_data->hops == 0)
+  {
+    rttDirect.record(rtt);
   }
+  else
+  {
+    rttRelayed.record(rtt);
+  }
+}
+
+static bool parseMac(const char *text, uint8_t *mac)
+{
+  unsigned int bytes[6];
+  if (sscanf(text, "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6)
+  {
+    return false;
+  }
+  for (uint8_t i = 0; i < 6; i++)
+  {
+    if (bytes[i] > 0xFF)
+    {
+      return false;
+    }
+    mac[i] = bytes[i];
+  }
+  return true;
 }
 
-void zh_network_event_handler_perf(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+static const char *setParameter(const char *key, const char *value)
 {
-  zh_network_event_on_recv_t *recv_data = (zh_network_event_on_recv_t *)event_data;
-  message1_t *recv_message = (message1_t *)recv_data->data;
-  switch (event_id)
+  if (running != PERF_TEST_NONE)
+  {
+    return "busy";
+  }
+  if (key == NULL || value == NULL)
+  {
+    return "usage: set <key> <value>";
+  }
+  if (strcmp(key, "target") == 0)
+  {
+    return parseMac(value, config.target) ? NULL : "invalid mac";
+  }
+  if (strcmp(key, "threshold") == 0)
+  {
+    config.threshold = atof(value);
+    return NULL;
+  }
+  char *end;
+  unsigned long number = strtoul(value, &end, 10);
+  if (*end != '\0')
+  {
+    return "invalid number";
+  }
+  if (strcmp(key, "rate") == 0)
   {
-  case ZH_NETWORK_ON_RECV_EVENT:
+    config.rate = number;
+  }
+  else if (strcmp(key, "duration") == 0)
+  {
+    config.duration = number;
+  }
+  else if (strcmp(key, "size") == 0)
   {
-    switch (recv_message->message_header.type)
+    if (number < sizeof(message_header_t) || number > ZH_NETWORK_MAX_MESSAGE_SIZE)
     {
-    case MESSAGE:
+      return "size out of range";
+    }
+    config.size = number;
+  }
+  else if (strcmp(key, "step") == 0)
+  {
+    config.step = number;
+  }
+  else if (strcmp(key, "max") == 0)
+  {
+    config.max_rate = number;
+  }
+  else
+  {
+    return "unknown key";
+  }
+  return NULL;
+}
+
+static void printStatus()
+{
+  perf_test_t test = running;
+  const char *role = test == PERF_TEST_NONE ? "idle" : (test == PERF_TEST_RECEIVE ? "receiver" : "sender");
+  Serial.printf("perf status test=%s role=%s target=" MACSTR " rate=%u duration=%u size=%u step=%u max=%u threshold=%.1f\n",
+                testName(test), role, MAC2STR(config.target), config.rate, config.duration, config.size, config.step, config.max_rate, config.threshold);
+}
+
+static const char *printStages(const char *argument)
+{
+  if (argument != NULL && strcmp(argument, "reset") == 0)
+  {
+    return zh_network_reset_stage_stats() == ESP_OK ? NULL : "built without ZH_NETWORK_TRACE";
+  }
+  for (uint8_t stage = 0; stage < ZH_NETWORK_STAGE_MAX; stage++)
+  {
+    zh_network_stage_stats_t stats;
+    if (zh_network_get_stage_stats((zh_network_stage_t)stage, &stats) != ESP_OK)
     {
+      return "built without ZH_NETWORK_TRACE";
+    }
+    Serial.printf("perf stage %s n=%u mean=%u p50=%u p90=%u p99=%u max=%u us\n", zh_network_stage_name((zh_network_stage_t)stage),
+                  stats.count, stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+  }
+  return NULL;
+}
 
-      // Serial.print(" ms, ");
-      // Serial.print(totalPackets);
-      // Serial.print(" packets, ");
-      // Serial.print(totalPacketsLost);
-      // Serial.println(" lost");
-      packets++;
-      totalPackets++;
+static void handleCommand(char *line)
+{
+  char *save = NULL;
+  char *command = strtok_r(line, " \t", &save);
+  char *first = strtok_r(NULL, " \t", &save);
+  char *second = strtok_r(NULL, " \t", &save);
+  if (command == NULL)
+  {
+    return;
+  }
+  const char *error = NULL;
+  if (strcmp(command, "status") == 0)
+  {
+    printStatus();
+    return;
+  }
+  else if (strcmp(command, "set") == 0)
+  {
+    error = setParameter(first, second);
+  }
+  else if (strcmp(command, "start") == 0)
+  {
+    perf_test_t test = PERF_TEST_NONE;
+    for (uint8_t i = PERF_TEST_RECEIVE; i <= PERF_TEST_SWEEP; i++)
+    {
+      if (first != NULL && strcmp(first, testName((perf_test_t)i)) == 0)
+      {
+        test = (perf_test_t)i;
+      }
     }
+    if (test == PERF_TEST_NONE)
+    {
+      error = "unknown test";
     }
-    heap_caps_free(recv_data->data); // Do not delete to avoid memory leaks!
-    break;
+    else if (!perfStart(test))
+    {
+      error = "busy";
+    }
+  }
+  else if (strcmp(command, "stop") == 0)
+  {
+    perfStop();
+  }
+  else if (strcmp(command, "reset") == 0)
+  {
+    // Here and, through a broadcast, on every other node
+    rttResetRequested = true;
+    message_header_t header = {
+        .type = MESSAGE,
+        .id = PERF_RESET_ID};
+    zh_network_send(NULL, (uint8_t *)&header, sizeof(header));
+  }
+  else if (strcmp(command, "stages") == 0)
+  {
+    error = printStages(first);
   }
-  case ZH_NETWORK_ON_SEND_EVENT:
+  else
   {
-    zh_network_event_on_send_t *send_data = (zh_network_event_on_send_t *)event_data;
-    message1_t *recv_message = (message1_t *)send_data->data;
-    if (send_data->status == ZH_NETWORK_SEND_SUCCESS)
+    error = "unknown command";
+    uint8_t count = commandCount.load(std::memory_order_acquire);
+    for (uint8_t i = 0; i < count; i++)
     {
-      // if (totalPackets - totalPacketsLost < 1000)
-      // {
-      //   // Serial.print(recv_message->message_header.timestamp);
-      //   // Serial.print("\t");
-      //   Serial.println(micros() - recv_message->message_header.timestamp);
-      // }
-      totalPackets++;
-      // printf("Message to MAC %02X:%02X:%02X:%02X:%02X:%02X sent success.\n", MAC2STR(send_data->mac_addr));
+      if (strcmp(command, commands[i].name) == 0)
+      {
+        error = commands[i].handler(first);
+        break;
+      }
     }
-    else
+  }
+  if (error == NULL)
+  {
+    Serial.println("perf ok");
+  }
+  else
+  {
+    Serial.printf("perf error %s\n", error);
+  }
+}
+
+static void consoleTask(void *pv)
+{
+  char line[PERF_CONSOLE_LINE];
+  uint8_t length = 0;
+  while (true)
+  {
+    while (Serial.available() > 0)
     {
-      totalPacketsLost++;
-      totalPackets++;
-      // printf("Message to MAC %02X:%02X:%02X:%02X:%02X:%02X sent fail.\n", MAC2STR(send_data->mac_addr));
+      char c = Serial.read();
+      if (c == '\r' || c == '\n')
+      {
+        line[length] = '\0';
+        handleCommand(line);
+        length = 0;
+      }
+      else if (length < sizeof(line) - 1)
+      {
+        line[length++] = c;
+      }
     }
-    break;
+    delay(PERF_CONSOLE_POLL);
   }
-  default:
-    break;
+}
+
+bool perfRegisterCommand(const char *name, perf_command_handler_t handler)
+{
+  uint8_t count = commandCount.load(std::memory_order_relaxed);
+  if (count == PERF_MAX_COMMANDS)
+  {
+    return false;
   }
+  commands[count] = {.name = name, .handler = handler};
+  commandCount.store(count + 1, std::memory_order_release);
+  return true;
 }
 
-void init_perf()
-{
-  esp_log_level_set("*", ESP_LOG_NONE);
-  esp_event_handler_instance_register(ZH_NETWORK, ESP_EVENT_ANY_ID, &zh_network_event_handler_perf, NULL, NULL);
-
-  // xTaskCreate(
-  //     testPacketsPerSecond,
-  //     "TestPacketsPerSecondTask",
-  //     3000,
-  //     NULL,
-  //     10,
-  //     NULL);
-
-  xTaskCreate(
-      testReliability,
-      "TestReliabilityTask",
-      3000,
-      NULL,
-      10,
-      NULL);
-
-#ifdef SENDER
-  xTaskCreate(
-      measureRTT,
-      "StressTask",
-      3000,
-      NULL,
-      10,
-      NULL);
+void perfSetup()
+{
+#ifndef ROOT_NODE
+#ifndef DEBUG
+  Serial.begin(115200); // DEBUG builds have opened it in setup() already
 #endif
-}
\ No newline at end of file
+  xTaskCreatePinnedToCore(
+      consoleTask,   // Function to run
+      "perfConsole", // Name of the task
+      4096,          // Stack size in bytes
+      NULL,          // Parameter
+      1,             // Priority
+      NULL,          // Task handle
+      1              // Core to run the task on (0 or 1)
+  );
+#endif
+}
@@ -1,28 +1,57 @@
 #ifndef PERF_H
 #define PERF_H
 
-#include "nvs_flash.h"
-#include "esp_netif.h"
 #include "zh_network.h"
 #include "Arduino.h"
 
-// #define SENDER
-
-extern unsigned long start;
-extern unsigned long end;
-
-extern uint64_t packets;
-extern uint64_t totalPackets;
-extern uint64_t totalPacketsLost;
-
-extern uint8_t targetPerf[6];
-
-extern uint16_t delayTime;
-
-void testPacketsPerSecond(void *pv);
-void testReliability(void *pv);
-void stress(void *pv);
-void zh_network_event_handler_perf(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
-void init_perf();
-
-#endif // PERF_H
\ No newline at end of file
+// Benchmark controller. Every non-root node takes line commands on Serial, so one firmware can act as sender
+// or receiver and a host script can drive a whole bench without reflashing:
+//   status                                  current test and parameters
+//   set target AA:BB:CC:DD:EE:FF            destination of sent benchmark messages
+//   set rate|duration|size|step|max|threshold <value>
+//   start stress|rtt|sweep|receive          run one test, "stop" ends it early
+//   reset                                   clear the RTT histograms here and on every other node
+//   stages [reset]                          zh_network per-stage latency (needs ZH_NETWORK_TRACE)
+// Other modules add their own commands with perfRegisterCommand(), the sensors for example:
+//   calibrate                               measure the accelerometer offsets again (keep it still) and store them
+// Every answer and report line starts with "perf ", followed by "ok", "error <reason>" or the report kind.
+
+typedef enum
+{
+  PERF_TEST_NONE,
+  PERF_TEST_RECEIVE, // Receiver role: report the rate of received benchmark messages.
+  PERF_TEST_STRESS,  // Sender role: fixed rate, report delivered rate and loss every second.
+  PERF_TEST_RTT,     // Sender role: fixed rate, report one-hop and multi-hop RTT percentiles.
+  PERF_TEST_SWEEP    // Sender role: raise the rate step by step up to the loss knee, one CSV row per step.
+} perf_test_t;
+
+typedef struct // Benchmark parameters, changed with "set <key> <value>"
+{
+  uint8_t target[6];
+  uint32_t rate;     // Messages per second, the first step of a sweep.
+  uint32_t duration; // Milliseconds a test runs (each step of a sweep), 0 runs until "stop".
+  uint8_t size;      // Bytes per message including the header.
+  uint32_t step;     // Sweep: added to the rate after every step.
+  uint32_t max_rate; // Sweep: highest rate.
+  float threshold;   // Sweep: loss in percent that ends the sweep.
+} perf_config_t;
+
+typedef struct // Outcome of one test run or sweep step
+{
+  uint32_t attempted; // zh_network_send() calls.
+  uint32_t rejected;  // Calls refused because the zh_network queue was almost full.
+  uint32_t delivered; // Messages confirmed by the target.
+  uint32_t failed;    // Messages reported as sent fail (no route or no confirmation in time).
+  uint32_t stale;     // Send events of an earlier run or step that arrived during this one.
+} perf_counters_t;
+
+typedef const char *(*perf_command_handler_t)(const char *argument); // Returns NULL for "perf ok" or the error reason.
+
+void perfSetup(); // Starts the console task, not on the root node whose UART belongs to the host protocol.
+bool perfStart(perf_test_t test);
+void perfStop();
+void perfOnReceive(const zh_network_event_on_recv_t *recv_data); // Call for every received MESSAGE.
+bool perfRegisterCommand(const char *name, perf_command_handler_t handler); // From setup(), false once PERF_MAX_COMMANDS are taken.
+void perfOnSent(const zh_network_event_on_send_t *send_data);    // Call for every ZH_NETWORK_ON_SEND_EVENT, before data is freed.
+
+#endif // PERF_H
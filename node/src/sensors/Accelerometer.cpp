@@ -1,15 +1,124 @@
 #include "Accelerometer.h"
+#include "nvs.h"
+#include "perf.h"
 
 Adafruit_MPU6050 mpu;
+Mpu6050Fifo fifo;
+MahonyFilter fusion;
 
 // Accelerometer pin connections
 #define SDA_PIN 21 // SDA pin
 #define SCL_PIN 22 // SCL pin
+#ifndef ACCELEROMETER_INT_PIN
+#define ACCELEROMETER_INT_PIN 4 // MPU6050 INT pin, -1 if not wired (the task then wakes on its timeout)
+#endif
+
+// Sampling settings
+#ifndef ACCELEROMETER_SAMPLE_RATE
+#define ACCELEROMETER_SAMPLE_RATE 200 // Samples per second, 4 to 1000
+#endif
+#ifndef ACCELEROMETER_BATCH_MS
+#define ACCELEROMETER_BATCH_MS 20 // The task reads the FIFO once per batch, it holds 85 samples (85 ms at 1 kHz)
+#endif
+#define ACCELEROMETER_MAX_BATCH 64 // Samples drained per FIFO read
+
+// Stored calibration
+#define ACCELEROMETER_NVS_NAMESPACE "accelerometer"
+#define ACCELEROMETER_NVS_KEY "calibration"
+#define ACCELEROMETER_CALIBRATION_VERSION 1 // Raise when the meaning of the stored offsets changes, older ones are then ignored
+#ifndef ACCELEROMETER_MAX_TEMPERATURE_CHANGE
+#define ACCELEROMETER_MAX_TEMPERATURE_CHANGE 10.0f // Degrees Celsius from the calibration temperature up to which the stored offsets are used
+#endif
+#ifndef ACCELEROMETER_DRIFT_LIMIT
+#define ACCELEROMETER_DRIFT_LIMIT 0.0087f // Gyroscope bias (in rad/s, 0.5 deg/s) estimated by the filter that is moved into the offsets and stored
+#endif
+#define ACCELEROMETER_DRIFT_SETTLE 60 // Seconds the node has to stay still before the filter's bias estimate is trusted
+#ifndef ACCELEROMETER_STILL_RATE
+#define ACCELEROMETER_STILL_RATE 0.05f // Rotation rate (in rad/s, 3 deg/s) below which a sample counts as still
+#endif
+#ifndef ACCELEROMETER_STILL_ACCEL
+#define ACCELEROMETER_STILL_ACCEL 0.5f // Deviation of |a| from gravity (in m/s^2) below which a sample counts as still
+#endif
 
 // Variables for continuous accelerometer updates
 float roll = 0, pitch = 0, yaw = 0;
 
-unsigned long lastTime = 0;
+TaskHandle_t accelerometerTaskHandle = NULL;
+volatile bool calibrationRequested = false; // Set by requestAccelerometerCalibration(), served by the task
+volatile uint32_t pendingSamples = 0; // Data ready pulses since the task was last woken
+uint32_t batchSamples = 1;            // Pulses that wake the task
+
+typedef struct // Samples since the node last moved, the bias estimate is only trusted after a whole window of them
+{
+  uint32_t samples;
+  float gravity[3]; // Sum of the accelerations, the direction of gravity in the body frame.
+} still_window_t;
+
+static still_window_t stillWindow = {};
+
+// I2C access of the FIFO driver, through the bus task. Due within one batch, before the FIFO fills up further
+static bool busWrite(uint8_t reg, uint8_t value, void *arg)
+{
+  i2c_bus_transaction_t transaction = {
+      .op = I2C_BUS_WRITE,
+      .address = MPU6050_FIFO_ADDRESS,
+      .reg = reg,
+      .length = 1,
+      .data = &value,
+      .deadline = xTaskGetTickCount() + pdMS_TO_TICKS(ACCELEROMETER_BATCH_MS)};
+  return i2cBus.transfer(transaction) == ESP_OK;
+}
+
+static bool busRead(uint8_t reg, uint8_t *data, size_t length, void *arg)
+{
+  i2c_bus_transaction_t transaction = {
+      .op = I2C_BUS_READ,
+      .address = MPU6050_FIFO_ADDRESS,
+      .reg = reg,
+      .length = (uint16_t)length,
+      .data = data,
+      .deadline = xTaskGetTickCount() + pdMS_TO_TICKS(ACCELEROMETER_BATCH_MS)};
+  return i2cBus.transfer(transaction) == ESP_OK;
+}
+
+// Count and FIFO data in one transfer(), the bus task runs them as one burst
+static bool busReadFifo(uint8_t countReg, uint8_t *count, uint8_t fifoReg, uint8_t *data, size_t length, void *arg)
+{
+  TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(ACCELEROMETER_BATCH_MS);
+  i2c_bus_transaction_t transactions[2] = {
+      {.op = I2C_BUS_READ,
+       .address = MPU6050_FIFO_ADDRESS,
+       .reg = countReg,
+       .length = 2,
+       .data = count,
+       .deadline = deadline,
+       .merge = I2C_BURST_INCREMENT},
+      {.op = I2C_BUS_READ,
+       .address = MPU6050_FIFO_ADDRESS,
+       .reg = fifoReg,
+       .length = (uint16_t)length,
+       .data = data,
+       .deadline = deadline,
+       .merge = I2C_BURST_PORT}};
+  return i2cBus.transfer(transactions, 2) == ESP_OK;
+}
+
+// Data ready pulse, once per sample. Wakes the task once a batch is waiting in the FIFO
+static void IRAM_ATTR accelerometerInterrupt()
+{
+  if (++pendingSamples < batchSamples || accelerometerTaskHandle == NULL)
+  {
+    return;
+  }
+  pendingSamples = 0;
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(accelerometerTaskHandle, &woken);
+  if (woken == pdTRUE)
+  {
+    portYIELD_FROM_ISR();
+  }
+}
+
 // set up the accelerometer
 void setupAccelerometer()
 {
@@ -25,6 +134,22 @@ void setupAccelerometer()
   mpu.setAccelerometerRange(MPU6050_RANGE_8_G);
   mpu.setGyroRange(MPU6050_RANGE_500_DEG);
   mpu.setFilterBandwidth(MPU6050_BAND_21_HZ);
+
+  // From here on one task owns the bus, the drivers queue their transactions
+  if (i2cBus.init(Wire) != ESP_OK)
+  {
+    Serial.println("Failed to start the I2C bus task");
+  }
+
+  // From here on the chip samples on its own clock into its FIFO
+  mpu6050_bus_t bus = {.write = busWrite, .read = busRead, .readFifo = busReadFifo, .arg = NULL};
+  if (!fifo.begin(bus, ACCELEROMETER_SAMPLE_RATE))
+  {
+    Serial.println("Failed to start the MPU6050 FIFO");
+  }
+  uint32_t batch = fifo.sampleRate() * ACCELEROMETER_BATCH_MS / 1000;
+  batchSamples = batch > 0 ? batch : 1;
+  Serial.printf("MPU6050 FIFO at %u Hz, %u samples per read\n", fifo.sampleRate(), batchSamples);
 }
 
 // Calibration offsets
@@ -42,6 +167,82 @@ float gyroOffsetZ = 0.0;
 // Constants for gravitational acceleration
 const float GRAVITY = 9.81; // m/s^2
 
+typedef struct // The offsets as stored in NVS, with what they are valid for
+{
+  uint8_t version;      // ACCELEROMETER_CALIBRATION_VERSION.
+  float accelScale;     // Mpu6050Fifo::accelScale() during calibration, another range makes the offsets invalid.
+  float gyroScale;      // Mpu6050Fifo::gyroScale() during calibration.
+  float temperature;    // Die temperature during calibration (in degrees Celsius).
+  float accelOffset[3]; // m/s^2.
+  float gyroOffset[3];  // rad/s.
+} accelerometer_calibration_t;
+
+static float calibrationTemperature = 0;
+
+static void saveCalibration()
+{
+  accelerometer_calibration_t calibration = {
+      .version = ACCELEROMETER_CALIBRATION_VERSION,
+      .accelScale = fifo.accelScale(),
+      .gyroScale = fifo.gyroScale(),
+      .temperature = calibrationTemperature,
+      .accelOffset = {accelOffsetX, accelOffsetY, accelOffsetZ},
+      .gyroOffset = {gyroOffsetX, gyroOffsetY, gyroOffsetZ}};
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open(ACCELEROMETER_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (err == ESP_OK)
+  {
+    err = nvs_set_blob(handle, ACCELEROMETER_NVS_KEY, &calibration, sizeof(calibration));
+    if (err == ESP_OK)
+    {
+      err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (err != ESP_OK)
+  {
+    Serial.printf("Failed to store the calibration: %s\n", esp_err_to_name(err));
+  }
+}
+
+bool loadAccelerometerCalibration()
+{
+  accelerometer_calibration_t calibration;
+  size_t length = sizeof(calibration);
+  nvs_handle_t handle;
+  if (nvs_open(ACCELEROMETER_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+  {
+    return false; // Never stored
+  }
+  esp_err_t err = nvs_get_blob(handle, ACCELEROMETER_NVS_KEY, &calibration, &length);
+  nvs_close(handle);
+  if (err != ESP_OK || length != sizeof(calibration) || calibration.version != ACCELEROMETER_CALIBRATION_VERSION ||
+      calibration.accelScale != fifo.accelScale() || calibration.gyroScale != fifo.gyroScale())
+  {
+    Serial.println("Stored calibration does not match, calibrating again");
+    return false;
+  }
+  // The offsets, the gyroscope ones above all, move with the die temperature
+  float temperature = NAN;
+  if (!fifo.temperature(&temperature) || fabsf(temperature - calibration.temperature) > ACCELEROMETER_MAX_TEMPERATURE_CHANGE)
+  {
+    Serial.printf("Stored calibration is from %.1f C, now %.1f C, calibrating again\n", calibration.temperature, temperature);
+    return false;
+  }
+
+  calibrationTemperature = calibration.temperature;
+  accelOffsetX = calibration.accelOffset[0];
+  accelOffsetY = calibration.accelOffset[1];
+  accelOffsetZ = calibration.accelOffset[2];
+  gyroOffsetX = calibration.gyroOffset[0];
+  gyroOffsetY = calibration.gyroOffset[1];
+  gyroOffsetZ = calibration.gyroOffset[2];
+  Serial.printf("Calibration loaded, taken at %.1f C\n", calibration.temperature);
+  Serial.printf("Accelerometer offsets: X: %.2f, Y: %.2f, Z: %.2f\n", accelOffsetX, accelOffsetY, accelOffsetZ);
+  Serial.printf("Gyroscope offsets: X: %.2f, Y: %.2f, Z: %.2f\n", gyroOffsetX, gyroOffsetY, gyroOffsetZ);
+  return true;
+}
+
 void calibrateAccelerometer()
 {
   float gyroX = 0, gyroY = 0, gyroZ = 0;
@@ -50,24 +251,33 @@ void calibrateAccelerometer()
 
   Serial.println("Calibrating sensor, keep the sensor still...");
 
-  // Collect sampleCount readings of sensor data
-  for (int i = 0; i < sampleCount; i++)
+  // Collect sampleCount consecutive samples from the FIFO, half a second at 200 Hz
+  mpu6050_sample_t samples[ACCELEROMETER_MAX_BATCH];
+  int collected = 0;
+  for (int attempt = 0; collected < sampleCount && attempt < sampleCount; attempt++)
   {
-    sensors_event_t a, g, temp;
-    mpu.getEvent(&a, &g, &temp);
-
-    // Sum up accelerometer readings
-    accelX += a.acceleration.x;
-    accelY += a.acceleration.y;
-    accelZ += a.acceleration.z;
-
-    // Sum up gyroscope readings
-    gyroX += g.gyro.x;
-    gyroY += g.gyro.y;
-    gyroZ += g.gyro.z;
+    size_t count = fifo.read(samples, min(ACCELEROMETER_MAX_BATCH, sampleCount - collected));
+    for (size_t i = 0; i < count; i++)
+    {
+      // Sum up accelerometer readings
+      accelX += samples[i].accel[0] * fifo.accelScale();
+      accelY += samples[i].accel[1] * fifo.accelScale();
+      accelZ += samples[i].accel[2] * fifo.accelScale();
 
-    delay(50); // Small delay between readings
+      // Sum up gyroscope readings
+      gyroX += samples[i].gyro[0] * fifo.gyroScale();
+      gyroY += samples[i].gyro[1] * fifo.gyroScale();
+      gyroZ += samples[i].gyro[2] * fifo.gyroScale();
+    }
+    collected += count;
+    delay(ACCELEROMETER_BATCH_MS);
+  }
+  if (collected == 0)
+  {
+    Serial.println("Calibration failed, no samples from the MPU6050");
+    return;
   }
+  sampleCount = collected;
 
   // Calculate the average offset for accelerometer and gyroscope
   accelOffsetX = accelX / sampleCount;
@@ -79,69 +289,144 @@ void calibrateAccelerometer()
   gyroOffsetY = gyroY / sampleCount;
   gyroOffsetZ = gyroZ / sampleCount;
 
+  // Stored, so the next boot can skip this
+  fifo.temperature(&calibrationTemperature);
+  saveCalibration();
+
   Serial.println("Calibration complete!");
   Serial.printf("Accelerometer offsets: X: %.2f, Y: %.2f, Z: %.2f\n", accelOffsetX, accelOffsetY, accelOffsetZ);
   Serial.printf("Gyroscope offsets: X: %.2f, Y: %.2f, Z: %.2f\n", gyroOffsetX, gyroOffsetY, gyroOffsetZ);
-  lastTime = millis();
 }
 
-// Task for continuous accelerometer updates
-void accelerometerTask(void *parameter)
+bool requestAccelerometerCalibration()
 {
-  static float previousYaw = 0;
+  if (accelerometerTaskHandle == NULL)
+  {
+    return false;
+  }
+  calibrationRequested = true;
+  xTaskNotifyGive(accelerometerTaskHandle);
+  return true;
+}
 
-  while (true)
+// Console "calibrate": runs in the accelerometer task, the offsets replace the stored ones
+static const char *calibrateCommand(const char *argument)
+{
+  return requestAccelerometerCalibration() ? NULL : "no accelerometer";
+}
+
+// A bias the filter keeps taking off while the node stays still is an offset that drifted, it moves into the
+// stored offsets. Gravity does not show the rotation about itself, that part of the estimate is left alone
+static bool checkDrift()
+{
+  const float *g = stillWindow.gravity;
+  float norm = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+  if (norm == 0)
   {
-    // Serial.println("running task");
-    sensors_event_t a,
-        g, temp;
-    if (xSemaphoreTake(xSemaphore, (TickType_t)10) == pdTRUE)
-    {
-      // Critical section
-      mpu.getEvent(&a, &g, &temp);
+    return false;
+  }
+  float bias[3];
+  fusion.bias(bias);
+  float vertical = (bias[0] * g[0] + bias[1] * g[1] + bias[2] * g[2]) / norm;
+  for (int i = 0; i < 3; i++)
+  {
+    bias[i] -= vertical * g[i];
+  }
+  if (fabsf(bias[0]) < ACCELEROMETER_DRIFT_LIMIT && fabsf(bias[1]) < ACCELEROMETER_DRIFT_LIMIT && fabsf(bias[2]) < ACCELEROMETER_DRIFT_LIMIT)
+  {
+    return false;
+  }
+  gyroOffsetX += bias[0];
+  gyroOffsetY += bias[1];
+  gyroOffsetZ += bias[2];
+  fusion.clearBias();
+  fifo.temperature(&calibrationTemperature);
+  saveCalibration();
+  Serial.printf("Gyroscope drift, offsets now X: %.4f, Y: %.4f, Z: %.4f\n", gyroOffsetX, gyroOffsetY, gyroOffsetZ);
+  return true;
+}
 
-      // Give the semaphore back
-      xSemaphoreGive(xSemaphore);
+// Feed one sample to the orientation filter, at the fixed sample rate of the FIFO. Any rotation or linear
+// acceleration restarts the still window, the filter takes part of it for bias
+static void processSample(const mpu6050_sample_t &sample)
+{
+  float ax = sample.accel[0] * fifo.accelScale() - accelOffsetX;
+  float ay = sample.accel[1] * fifo.accelScale() - accelOffsetY;
+  float az = sample.accel[2] * fifo.accelScale() - accelOffsetZ;
+  float gx = sample.gyro[0] * fifo.gyroScale() - gyroOffsetX;
+  float gy = sample.gyro[1] * fifo.gyroScale() - gyroOffsetY;
+  float gz = sample.gyro[2] * fifo.gyroScale() - gyroOffsetZ;
+
+  fusion.update(gx, gy, gz, ax, ay, az);
 
-      // Serial.printf("Accelerometer offsets: X: %.2f, Y: %.2f, Z: %.2f\n", a.acceleration.x - accelOffsetX, a.acceleration.y - accelOffsetY, a.acceleration.z - accelOffsetZ);
-      // Serial.printf("Gyroscope offsets: X: %.2f, Y: %.2f, Z: %.2f\n", g.gyro.x - gyroOffsetX, g.gyro.y - gyroOffsetY, g.gyro.z - gyroOffsetZ);
+  float rate = gx * gx + gy * gy + gz * gz;
+  float accel = sqrtf(ax * ax + ay * ay + az * az);
+  if (rate > ACCELEROMETER_STILL_RATE * ACCELEROMETER_STILL_RATE || fabsf(accel - GRAVITY) > ACCELEROMETER_STILL_ACCEL)
+  {
+    stillWindow = {};
+    return;
+  }
+  stillWindow.samples++;
+  stillWindow.gravity[0] += ax;
+  stillWindow.gravity[1] += ay;
+  stillWindow.gravity[2] += az;
+}
 
-      // Calculate roll and pitch
-      roll = atan2((a.acceleration.y - accelOffsetY), (a.acceleration.z - accelOffsetZ)) * 180 / PI;
-      pitch = atan2(-(a.acceleration.x - accelOffsetX), sqrt((a.acceleration.y - accelOffsetY) * (a.acceleration.y - accelOffsetY) + (a.acceleration.z - accelOffsetZ) * (a.acceleration.z - accelOffsetZ))) * 180 / PI;
+// Task for continuous accelerometer updates, drains the FIFO once per batch
+void accelerometerTask(void *parameter)
+{
+  static mpu6050_sample_t samples[ACCELEROMETER_MAX_BATCH];
+  bool aligned = false;
+  const uint32_t settle = ACCELEROMETER_DRIFT_SETTLE * fifo.sampleRate();
+  fusion.init(fifo.sampleRate());
+  // Twice the batch time, so a missing interrupt only doubles the latency
+  const TickType_t timeout = pdMS_TO_TICKS(2 * ACCELEROMETER_BATCH_MS) + 1;
 
-      //@TODO: no safe for overflow
-      unsigned long diff = millis() - lastTime;
-      lastTime = millis();
-      // Integrate yaw from gyroscope data
-      float newYaw = previousYaw + ((g.gyro.z - gyroOffsetZ) * (diff / 1000)) * 180 / PI; // Assuming 10ms interval
-      // previousYaw = yaw;
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, timeout);
 
-      // Only update yaw if change is greater than 0.5 degrees
-      if (fabs(newYaw - previousYaw) >= 0)
+    // Keep the sensor still, the calibration drains the FIFO itself
+    if (calibrationRequested)
+    {
+      calibrationRequested = false;
+      calibrateAccelerometer();
+      aligned = false; // align() also clears the bias estimate
+      stillWindow = {};
+    }
+
+    // A full buffer means more samples are waiting
+    size_t count = ACCELEROMETER_MAX_BATCH;
+    while (count == ACCELEROMETER_MAX_BATCH)
+    {
+      // Samples wait in the FIFO while the bus task serves others, none are lost
+      count = fifo.read(samples, ACCELEROMETER_MAX_BATCH);
+
+      // Start from the tilt of the first sample instead of converging from level
+      size_t first = 0;
+      if (!aligned && count > 0)
       {
-        yaw = newYaw; // Update yaw
-
-        if (yaw > 180)
-        {
-          yaw -= 360; // Wrap around if greater than 180
-        }
-        else if (yaw < -180)
-        {
-          yaw += 360; // Wrap around if less than -180
-        }
-
-        previousYaw = yaw; // Update previousYaw to the new yaw value
+        fusion.align(samples[0].accel[0] * fifo.accelScale() - accelOffsetX,
+                     samples[0].accel[1] * fifo.accelScale() - accelOffsetY,
+                     samples[0].accel[2] * fifo.accelScale() - accelOffsetZ);
+        aligned = true;
+        first = 1;
+      }
+      for (size_t i = first; i < count; i++)
+      {
+        processSample(samples[i]);
       }
-
-      delay(10);
     }
-    else
+    if (stillWindow.samples >= settle && checkDrift())
     {
-      // Failed to take the semaphore
-      // Serial.println("Failed to take semaphore");
-      delay(10);
+      stillWindow = {};
     }
+
+    // The angles are only read at the report rate, converting once per batch is enough
+    imu_euler_t angles = fusion.euler();
+    roll = angles.roll;
+    pitch = angles.pitch;
+    yaw = angles.yaw;
   }
 }
 
@@ -157,12 +442,17 @@ void getAccelerometerData(float &currentRoll, float &currentPitch, float &curren
 void startAccelerometerTask()
 {
   xTaskCreatePinnedToCore(
-      accelerometerTask,    // Task function
-      "Accelerometer Task", // Task name
-      4096,                 // Stack size (in bytes)
-      NULL,                 // Task parameters
-      10,                   // Priority
-      NULL,                 // Task handle
-      1                     // Core to run the task on
+      accelerometerTask,        // Task function
+      "Accelerometer Task",     // Task name
+      4096,                     // Stack size (in bytes)
+      NULL,                     // Task parameters
+      10,                       // Priority
+      &accelerometerTaskHandle, // Task handle
+      1                         // Core to run the task on
   );
+  perfRegisterCommand("calibrate", calibrateCommand);
+#if ACCELEROMETER_INT_PIN >= 0
+  pinMode(ACCELEROMETER_INT_PIN, INPUT_PULLDOWN);
+  attachInterrupt(digitalPinToInterrupt(ACCELEROMETER_INT_PIN), accelerometerInterrupt, RISING);
+#endif
 }
@@ -5,10 +5,15 @@
 #include <Adafruit_MPU6050.h>
 #include <Adafruit_Sensor.h>
 #include <Wire.h>
+#include <mpu6050_fifo.h>
+#include <imu_fusion.h>
+#include <i2c_bus.h>
 #include "globals.h"
 
 void startAccelerometerTask();
 void setupAccelerometer();
 void getAccelerometerData(float &currentRoll, float &currentPitch, float &currentYaw);
 void calibrateAccelerometer();
+bool loadAccelerometerCalibration();
+bool requestAccelerometerCalibration();
 #endif
\ No newline at end of file
@@ -7,18 +7,30 @@
 #define I2S_SCK 26 // Bit clock pin
 
 // FFT parameters
-const uint16_t samples = 2048; // Number of samples for FFT (must be a power of 2)
-double vReal[samples];
-double vImag[samples];
-const double SAMPLE_RATE = 16000.0;
-
-ArduinoFFT<double> FFT = ArduinoFFT<double>(vReal, vImag, samples, SAMPLE_RATE);
+const uint16_t samples = 2048;   // Number of samples per analysis window (must be a power of 2)
+const uint16_t hop = samples / 2; // Samples between two windows, 50 % overlap
+const float SAMPLE_RATE = 16000.0;
+
+#ifdef MICROPHONE_GOERTZEL_BANDS
+// Goertzel mode: levels at a few fixed frequencies instead of the spectrum, e.g. -D MICROPHONE_GOERTZEL_BANDS=500,1000,3150
+const float goertzelFrequencies[] = {MICROPHONE_GOERTZEL_BANDS};
+const uint16_t goertzelBlock = 512; // 32 ms per block, every filter is about 60 Hz wide
+GoertzelBank bank;
+int16_t blockBuffer[goertzelBlock];
+#else
+AudioStream stream;
+#endif
+#ifndef MICROPHONE_OCTAVE_BANDS
+#define MICROPHONE_OCTAVE_BANDS 0 // 1 or 3 adds 1/1 or 1/3 octave band levels of every window, with -D MICROPHONE_A_WEIGHTING A-weighted
+#endif
+#ifdef MICROPHONE_A_WEIGHTING
+const bool aWeighting = true;
+#else
+const bool aWeighting = false;
+#endif
 
 // Variables for storing results
-double averageDb = 0.0;
-double peakFrequency = 0.0; // To store peak frequency
-int zeroCrossings = 0;      // To store the count of zero-crossings
-bool dataReady = false;     // Flag to signal new data is available
+audio_report_t report = {}; // Windows and samples analysed since the last getMicrophoneData()
 
 // Mutex to protect shared data
 portMUX_TYPE dataMutex = portMUX_INITIALIZER_UNLOCKED;
@@ -37,8 +49,8 @@ void setupMicrophone()
       .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
       .communication_format = I2S_COMM_FORMAT_STAND_I2S,
       .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-      .dma_buf_count = 8,
-      .dma_buf_len = 1024,
+      .dma_buf_count = 4, // 128 ms of audio, enough for one analysis while the task never sleeps
+      .dma_buf_len = 512,
       .use_apll = false,
       .tx_desc_auto_clear = false,
       .fixed_mclk = 0};
@@ -53,11 +65,27 @@ void setupMicrophone()
   i2s_set_pin(I2S_NUM, &pin_config);
   i2s_start(I2S_NUM);
 
+#ifdef MICROPHONE_GOERTZEL_BANDS
+  if (!bank.init(goertzelFrequencies, sizeof(goertzelFrequencies) / sizeof(goertzelFrequencies[0]), SAMPLE_RATE, goertzelBlock))
+#else
+  if (!stream.init(samples, hop, SAMPLE_RATE, 20, 4000))
+#endif
+  {
+    Serial.println("Microphone buffers could not be allocated.");
+    return;
+  }
+#ifndef MICROPHONE_GOERTZEL_BANDS
+  if (MICROPHONE_OCTAVE_BANDS != 0 && !stream.initBands(MICROPHONE_OCTAVE_BANDS, aWeighting))
+  {
+    Serial.println("Octave bands could not be set up.");
+  }
+#endif
+
   // Start microphone processing task
   xTaskCreatePinnedToCore(
       microphoneTask,        // Task function
       "MicrophoneTask",      // Task name
-      8192,                  // Stack size
+      4096,                  // Stack size
       NULL,                  // Parameter
       5,                     // Priority
       &microphoneTaskHandle, // Task handle
@@ -65,102 +93,110 @@ void setupMicrophone()
   );
 }
 
-// Microphone processing task
+#ifdef MICROPHONE_GOERTZEL_BANDS
+// Collect the band levels of every block until they are fetched
+static void addBlock(const float *meanSquare, uint8_t bands, void *arg)
+{
+  portENTER_CRITICAL(&dataMutex);
+  audioBandsAdd(&report.bands, meanSquare, bands);
+  portEXIT_CRITICAL(&dataMutex);
+}
+
+// Microphone processing task, every sample passes the filter bank and the time domain kernel once
 void microphoneTask(void *param)
 {
+  audio_time_features_t time = {};
+  int16_t centre = 0; // DC offset of the previous block
   while (true)
   {
-    // Serial.println("Running microphone task");
-    int16_t sampleBuffer[samples];
-    size_t bytesRead;
+    size_t bytesRead = 0;
 
-    // Read data from I2S
-    i2s_read(I2S_NUM, sampleBuffer, samples * sizeof(int16_t), &bytesRead, portMAX_DELAY);
+    i2s_read(I2S_NUM, blockBuffer, sizeof(blockBuffer), &bytesRead, portMAX_DELAY);
+    size_t count = bytesRead / sizeof(int16_t);
+    bank.process(blockBuffer, count, addBlock, NULL);
+    audioTimeFeatures(blockBuffer, count, centre, &time);
 
-    // Prepare data for FFT
-    for (uint16_t i = 0; i < samples; i++)
-    {
-      vReal[i] = (double)sampleBuffer[i]; // Copy real part
-      vImag[i] = 0.0;                     // Imaginary part set to 0
-    }
-
-    // Perform FFT
-    FFT.windowing(FFT_WIN_TYP_HAMMING, FFT_FORWARD);
-    FFT.compute(FFT_FORWARD);
-    FFT.complexToMagnitude();
-
-    // Find the peak frequency in the range of interest (20Hz to 4000Hz)
-    double peakFrequencyLocal = 0.0;
-    double maxMagnitude = 0.0;
-
-    for (uint16_t i = 1; i < (samples / 2); i++)
-    { // Only positive frequencies
-      double frequency = (i * SAMPLE_RATE) / samples;
-      double magnitude = vReal[i];
-
-      // Filter: Only consider frequencies between 20 Hz and 4000 Hz
-      if (frequency >= 20 && frequency <= 4000)
-      {
-        if (magnitude > maxMagnitude)
-        {
-          maxMagnitude = magnitude;
-          peakFrequencyLocal = frequency;
-        }
-      }
-    }
-
-    // Zero-crossing count
-    zeroCrossings = 0;
-    for (uint16_t i = 1; i < samples; i++)
-    {
-      if ((vReal[i - 1] > 0 && vReal[i] < 0) || (vReal[i - 1] < 0 && vReal[i] > 0))
-      {
-        zeroCrossings++;
-      }
-    }
-
-    // Calculate average dB
-    double totalVolume = 0.0;
-    int volumeCount = 0;
-    for (uint16_t i = 1; i < (samples / 2); i++)
-    {
-      totalVolume += vReal[i];
-      volumeCount++;
-    }
-    double averageLinearVolume = totalVolume / volumeCount;
-    double localAverageDb = 20.0 * log10(averageLinearVolume);
-
-    // Update shared data with mutex
     portENTER_CRITICAL(&dataMutex);
-    averageDb = localAverageDb;
-    peakFrequency = peakFrequencyLocal; // Store the peak frequency
-    dataReady = true;                   // Signal new data is ready
+    audioTimeMerge(&report.time, &time);
     portEXIT_CRITICAL(&dataMutex);
+    centre = (int16_t)lroundf(audioTimeDcOffset(&time));
+    audioTimeClear(&time);
+  }
+}
+#else
+// Collect the features of every window until they are fetched
+static void addWindow(const audio_spectrum_features_t *spectrum, const audio_time_features_t *time, const audio_bands_t *bands, void *arg)
+{
+  portENTER_CRITICAL(&dataMutex);
+  audioReportAdd(&report, spectrum, time, bands);
+  portEXIT_CRITICAL(&dataMutex);
+}
 
-    vTaskDelay(200 / portTICK_PERIOD_MS); // Process every second
+// Microphone processing task, reads without pause so no audio is skipped
+void microphoneTask(void *param)
+{
+  while (true)
+  {
+    size_t space = 0;
+    size_t bytesRead = 0;
+
+    // Read a hop straight into the window buffer, blocks until the DMA has filled it (64 ms)
+    int16_t *tail = stream.reserve(&space);
+    i2s_read(I2S_NUM, tail, space * sizeof(int16_t), &bytesRead, portMAX_DELAY);
+    stream.commit(bytesRead / sizeof(int16_t), addWindow, NULL);
   }
 }
+#endif
 
 // Function to get microphone data
-bool getMicrophoneData(double &avgDb, double &peakestFrequency, int &zeroCrossingsCount)
+bool getMicrophoneData(double &avgDb, double &peakestFrequency, int &zeroCrossingsCount, int &peakAmplitude, int &dcOffset, AudioBands &bands)
 {
-  bool ready = false;
-
-  // Access shared data with mutex
+  // Only take the interval under the lock, the microphone task spins on it while the floats below are worked out
+  audio_report_t interval;
   portENTER_CRITICAL(&dataMutex);
-  if (dataReady)
+  interval = report;
+  if (report.time.count > 0)
   {
-    avgDb = averageDb;
+    audioReportClear(&report); // Start the next interval
+  }
+  portEXIT_CRITICAL(&dataMutex);
 
-    // The peak frequency should already be calculated in your microphone task.
-    peakestFrequency = peakFrequency; // `peakFrequency` holds the peak frequency
+  if (interval.time.count == 0)
+  {
+    return false;
+  }
 
-    zeroCrossingsCount = zeroCrossings; // Get the zero-crossing count
+  // RMS of the samples around their DC offset, in dB relative to one LSB (dBFS + 90.3)
+  avgDb = audioTimeLevelDb(&interval.time);
 
-    dataReady = false; // Reset flag
-    ready = true;
+#ifdef MICROPHONE_GOERTZEL_BANDS
+  // Frequency of the loudest band
+  peakestFrequency = 0;
+  float loudest = 0;
+  for (uint8_t i = 0; i < interval.bands.bands; i++)
+  {
+    if (interval.bands.meanSquare[i] > loudest)
+    {
+      loudest = interval.bands.meanSquare[i];
+      peakestFrequency = bank.frequency(i);
+    }
   }
-  portEXIT_CRITICAL(&dataMutex);
+  bands.mode = AUDIO_BANDS_GOERTZEL;
+#else
+  // Peak of the loudest window, a short event would vanish in an average
+  peakestFrequency = interval.peakFrequency;
+  bands.mode = AUDIO_BANDS_NONE;
+  if (stream.bands().bands() > 0)
+  {
+    bands.mode = stream.bands().fraction() == 1 ? AUDIO_BANDS_OCTAVE : AUDIO_BANDS_THIRD_OCTAVE;
+    bands.mode |= stream.bands().aWeighting() ? AUDIO_BANDS_A_WEIGHTED : 0;
+  }
+#endif
+  bands.count = audioBandsQuantise(&interval.bands, bands.level, AUDIO_BANDS_MAX);
+
+  zeroCrossingsCount = lroundf(audioTimeCrossingRate(&interval.time, SAMPLE_RATE)); // Zero crossings per second
+  peakAmplitude = interval.time.peak;
+  dcOffset = lroundf(audioTimeDcOffset(&interval.time));
 
-  return ready;
+  return true;
 }
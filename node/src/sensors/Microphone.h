@@ -2,9 +2,11 @@
 #define MICROPHONE_H
 #include <Arduino.h>
 #include <driver/i2s.h>
-#include <arduinoFFT.h>
+#include <audio_stream.h>
+#include <goertzel_bank.h>
+#include <data_packaging.h>
 
-bool getMicrophoneData(double &avgDb, double &peakestFrequency, int &zeroCrossingsCount);
+bool getMicrophoneData(double &avgDb, double &peakestFrequency, int &zeroCrossingsCount, int &peakAmplitude, int &dcOffset, AudioBands &bands);
 void setupMicrophone();
 void microphoneTask(void *param);
 #endif
\ No newline at end of file
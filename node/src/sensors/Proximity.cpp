@@ -4,32 +4,54 @@
 #define I2C_SDA 21 // Default SDA pin
 #define I2C_SCL 22 // Default SCL pin
 
-#define SLAVE_ADDR 0x08 // Address of the slave ESP32
+#define SLAVE_ADDR 0x08        // Address of the slave ESP32
+#define SLAVE_DATA_SIZE 20     // 2 bytes per device (name + RSSI) × 10 devices = 20 bytes
+#define PROXIMITY_INTERVAL 500 // Milliseconds between two requests, also their deadline
 
 // Structure to hold the BLE data
 
 // Array to store the top 10 devices
 DeviceRSSI devices[10];
 
-// Function to request data from the slave
-void requestDataFromSlave()
-{
-  uint8_t bytesReceived = Wire.requestFrom(SLAVE_ADDR, 20); // 2 bytes per device (name + RSSI) × 10 devices = 20 bytes
+static uint8_t slaveData[SLAVE_DATA_SIZE]; // Filled by the bus task
+static volatile bool requestPending = false;
 
-  int index = 0;
-  while (Wire.available() && index < 10)
+// Runs on the bus task once the slave answered
+static void onSlaveData(esp_err_t result, void *arg)
+{
+  if (result == ESP_OK)
   {
-    // Read device name (1 byte for the last three digits)
-    // uint8_t  = Wire.read();
-    devices[index].deviceName = Wire.read();
+    for (int index = 0; index < 10; index++)
+    {
+      // Read device name (1 byte for the last three digits)
+      devices[index].deviceName = slaveData[2 * index];
 
-    // Read RSSI (1 byte)
-    devices[index].rssi = Wire.read();
+      // Read RSSI (1 byte)
+      devices[index].rssi = slaveData[2 * index + 1];
+    }
+  }
+  requestPending = false;
+}
 
-    // Serial.println("Data requested");
-    // Serial.println(devices[index].deviceName);
-    // Serial.println(devices[index].rssi);
-    index++;
+// Function to request data from the slave
+void requestDataFromSlave()
+{
+  // The previous answer is still outstanding, the buffer belongs to the bus task
+  if (requestPending)
+  {
+    return;
+  }
+  i2c_bus_transaction_t transaction = {
+      .op = I2C_BUS_RECEIVE,
+      .address = SLAVE_ADDR,
+      .length = SLAVE_DATA_SIZE,
+      .data = slaveData,
+      .deadline = xTaskGetTickCount() + pdMS_TO_TICKS(PROXIMITY_INTERVAL),
+      .done = onSlaveData};
+  requestPending = true;
+  if (i2cBus.submit(transaction) != ESP_OK)
+  {
+    requestPending = false;
   }
 }
 
@@ -111,24 +133,10 @@ void ProxmityTask(void *pv)
   while (true)
   {
     // Serial.println("Running proximity task");
-    // Create a semaphore lock
-
-    // Take the semaphore before accessing shared resources
-    if (xSemaphoreTake(xSemaphore, (TickType_t)10) == pdTRUE)
-    {
-      // Critical section
-      requestDataFromSlave();
 
-      // Give the semaphore back
-      xSemaphoreGive(xSemaphore);
-      vTaskDelay(500 / portTICK_PERIOD_MS); // Delay between scans
-    }
-    else
-    {
-      // Failed to take the semaphore
-      // Serial.println("Failed to take semaphore");
-      vTaskDelay(10 / portTICK_PERIOD_MS); // Delay between scans
-    }
+    // The bus task runs the request when the bus is free, the answer arrives in onSlaveData()
+    requestDataFromSlave();
+    vTaskDelay(PROXIMITY_INTERVAL / portTICK_PERIOD_MS); // Delay between scans
   }
 }
 
@@ -6,6 +6,7 @@
 #include "data_packaging.h"
 
 #include <Wire.h>
+#include <i2c_bus.h>
 
 void init_proximity();
 void getTopDevices(DeviceRSSI device[10]);
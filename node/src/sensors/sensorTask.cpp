@@ -7,14 +7,17 @@
 #include <globals.h>
 #include "zh_network.h"
 
-SemaphoreHandle_t xSemaphore = xSemaphoreCreateMutex();
+I2cBus i2cBus;
 
 void sensorSetup()
 {
   // Initialize accelerometer and microphone (and start microphone)
   setupAccelerometer();
-  // Calibrate accelerometer
-  calibrateAccelerometer();
+  // Calibrate accelerometer, unless the offsets stored by an earlier boot still fit
+  if (!loadAccelerometerCalibration())
+  {
+    calibrateAccelerometer();
+  }
 
   setupMicrophone();
 
@@ -28,6 +31,7 @@ void sensorSetup()
 void sensorLoopTask()
 {
   static unsigned long lastRunTime = 0; // Store the last time the loop ran
+  static uint16_t sequence = esp_random(); // Random start, so the root can tell a reboot from a gap
 
   // Check if 1000ms (1 second) has passed since the last execution
   if (millis() - lastRunTime >= 1000)
@@ -44,7 +48,10 @@ void sensorLoopTask()
     double avgDb;
     double peakestFrequency;
     int zeroCrossingsCount;
-    if (getMicrophoneData(avgDb, peakestFrequency, zeroCrossingsCount))
+    int peakAmplitude = 0;
+    int dcOffset = 0;
+    AudioBands audioBands = {0};
+    if (getMicrophoneData(avgDb, peakestFrequency, zeroCrossingsCount, peakAmplitude, dcOffset, audioBands))
     {
 
       // put microphone data in microphone struct
@@ -87,13 +94,29 @@ void sensorLoopTask()
     // make final output data struct
     data.microphoneData = microphonedata;
     data.accelerometerData = accelerometerdata;
+    data.audioBands = audioBands;
 
     // Print MicrophoneData
     Serial.print(data.microphoneData.avgDb);
     Serial.print(", ");
     Serial.print(data.microphoneData.peakFrequency);
     Serial.print(", ");
-    Serial.println(data.microphoneData.zeroCrossingsCount);
+    Serial.print(data.microphoneData.zeroCrossingsCount);
+    Serial.print(", ");
+    Serial.print(peakAmplitude);
+    Serial.print(", ");
+    Serial.println(dcOffset);
+
+    // Print band levels in dB
+    if (data.audioBands.count > 0)
+    {
+      Serial.print("Bands: ");
+      for (uint8_t i = 0; i < data.audioBands.count; i++)
+      {
+        Serial.print(data.audioBands.level[i] / 2.0f, 1);
+        Serial.print(i + 1 < data.audioBands.count ? ", " : "\n");
+      }
+    }
 
     // Print AccelerometerData
     Serial.print(data.accelerometerData.roll, 2);
@@ -124,6 +147,7 @@ void sensorLoopTask()
     send_message.message_header = {
         .type = DATA,
         .id = 0,
+        .seq = sequence++,
         .timestamp = rtc.getEpoch(),
         .timestamp_us = rtc.getMicros()};
     send_message.data = data;
@@ -1,178 +1,527 @@
 #include "serial.h"
 #include "zh_network.h"
 #include "ESP32Time.h"
+#include "spsc_ring.h"
+#include "serial_protocol.h"
+#include "crc16.h"
+#include "flash_spool.h"
+#include "batch_codec.h"
+#include "sequence_tracker.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include <atomic>
 #define MESSAGE_LENGTH sizeof(message_t)
-#define QUEUE_SIZE 20
+#ifndef SERIAL_QUEUE_SIZE
+#define SERIAL_QUEUE_SIZE 128 // Rounded up to a power of two, can be raised to thousands when SERIAL_QUEUE_SPIRAM is set
+#endif
+#ifndef SERIAL_QUEUE_SPIRAM
+#define SERIAL_QUEUE_SPIRAM false
+#endif
+#ifndef SERIAL_SPOOL_PARTITION
+#define SERIAL_SPOOL_PARTITION "spool" // Data partition that takes the overflow of the RAM queue, see huge_app.csv
+#endif
+#ifndef SERIAL_SPOOL_HIGH_WATERMARK
+#define SERIAL_SPOOL_HIGH_WATERMARK 75 // Fill level of the RAM queue (in percent) above which new messages go to flash
+#endif
+#ifndef SERIAL_SPOOL_LOW_WATERMARK
+#define SERIAL_SPOOL_LOW_WATERMARK 25 // Fill level of the RAM queue (in percent) below which new messages go to RAM again
+#endif
+#ifndef SERIAL_SPILL_QUEUE_SIZE
+#define SERIAL_SPILL_QUEUE_SIZE 64 // Spilled messages waiting for serialTask to write them to flash, covers a sector erase
+#endif
 #define BATCH_SIZE 2 // Further reduced batch size for reliability
+#define BATCH_MAX_RESENDS 3
+#ifndef SERIAL_STREAM_BATCH_SIZE
+#define SERIAL_STREAM_BATCH_SIZE 16 // Messages per v2 frame
+#endif
+#ifndef SERIAL_STREAM_WINDOW
+#define SERIAL_STREAM_WINDOW 8 // Unacknowledged v2 frames
+#endif
+#define SERIAL_STREAM_RETRANSMIT_TIMEOUT 500
+#ifndef SERIAL_STAGE_REPORT_INTERVAL
+#define SERIAL_STAGE_REPORT_INTERVAL 30000 // Milliseconds between two zh_network stage latency reports, only with ZH_NETWORK_TRACE
+#endif
+#ifndef SERIAL_SOURCE_REPORT_INTERVAL
+#define SERIAL_SOURCE_REPORT_INTERVAL 10000 // Milliseconds between two reports of new gaps/duplicates (v2 text frames)
+#endif
+#ifndef SERIAL_LINK_REPORT_INTERVAL
+#define SERIAL_LINK_REPORT_INTERVAL 30000 // Milliseconds between two reports of the link load (v2 text frames)
+#endif
 
-// message_t message = {0};
+#define SERIAL_UART UART_NUM_0
+#ifndef SERIAL_BAUD_RATE
+#define SERIAL_BAUD_RATE 115200 // 921600 and up work with short cables and a CP210x/CH34x bridge, the host's baud_rate must match
+#endif
+#define SERIAL_RX_BUFFER_SIZE 1024
+#define SERIAL_STREAM_FRAME_SIZE (SERIAL_FRAME_HEADER_SIZE + SERIAL_STREAM_BATCH_SIZE * MESSAGE_LENGTH + SERIAL_FRAME_TRAILER_SIZE) // Largest v2 frame
+#ifndef SERIAL_TX_BUFFER_SIZE
+#define SERIAL_TX_BUFFER_SIZE ((SERIAL_STREAM_WINDOW * SERIAL_STREAM_FRAME_SIZE + 1023) / 1024 * 1024) // Room for a full v2 window (11 kB by default), so sending one does not wait for the UART ISR. Not measured on hardware
+#endif
+#define SERIAL_EVENT_QUEUE_SIZE 20
+#define SERIAL_STREAM_TICK 5 // Wake-up period while streaming, to push newly queued messages (in milliseconds)
+#define SERIAL_SPILL_TICK 20 // Wake-up period otherwise when there is a spool, to write spilled messages to flash (in milliseconds)
+#define SERIAL_TASK_PRIORITY 6
+#define SERIAL_TASK_STACK_SIZE 4096
 
-message_t messageQueue[QUEUE_SIZE];
-uint8_t queueHead = 0;
-uint8_t queueTail = 0;
+typedef struct // Entry of the RAM queue.
+{
+  uint32_t spilled; // Messages spilled before this one, they go out first.
+  message_t message;
+} serial_queued_t;
+
+// Filled by the zh_network event loop task, drained by serialTask
+SpscRing<serial_queued_t> messageQueue;
+SpscRing<message_t> spillQueue;
+SerialStreamSender streamSender;
+SerialCommandParser commandParser;
+BatchEncoder batchEncoder;
+FlashSpool spool;
+SequenceTracker sourceTracker;
+
+// Once the RAM queue crosses the high-watermark new messages are spilled until it is back at the low-watermark.
+// The event task only pushes them to spillQueue, serialTask writes them to the spool. Every RAM entry carries the
+// number of messages spilled before it, so dequeueMessage() hands out the older spilled ones first and the host
+// always receives messages in arrival order.
+static std::atomic<bool> spilling(false);
+static std::atomic<uint32_t> spilled(0); // Written by the event task only, starts with what a reboot left in the spool.
+static uint32_t spillDelivered = 0;      // Spilled messages dequeued or lost since boot, serialTask only.
+static bool spoolReady = false;
+static uint32_t spoolHighThreshold = 0;
+static uint32_t spoolLowThreshold = 0;
+
+static QueueHandle_t uartQueue = NULL;
+static TaskHandle_t serialTaskHandle = NULL;
 
-bool isQueueFull()
+// Time spent in uart_write_bytes(), to see what the link costs the writing task. The UART ISR that drains the
+// driver's TX ring buffer into the FIFO runs later and is not part of it. No figures from hardware exist yet.
+static uint32_t linkBytes = 0;
+static uint64_t linkWriteTime = 0;
+
+// v1 batch waiting for the host's ack, kept so the next poll can resend it. Prefixed with its 4 byte header.
+#define BATCH_HEADER_SIZE 4
+static uint8_t batch[BATCH_HEADER_SIZE + MESSAGE_LENGTH * BATCH_SIZE];
+static uint16_t batchLength = 0;
+static uint8_t resendCount = 0;
+
+static size_t streamWrite(const uint8_t *data, size_t length)
 {
-  return ((queueHead + 1) % QUEUE_SIZE) == queueTail;
+  int64_t start = esp_timer_get_time();
+  int written = uart_write_bytes(SERIAL_UART, (const char *)data, length);
+  linkWriteTime += esp_timer_get_time() - start;
+  if (written < 0)
+  {
+    return 0;
+  }
+  linkBytes += written;
+  return written;
 }
 
-bool isQueueEmpty()
+static uint32_t streamMillis()
 {
-  return queueHead == queueTail;
+  return millis();
 }
 
-bool enqueueMessage(const message_t &message)
+static bool streamDequeue(uint8_t *message)
 {
-  if (isQueueFull())
+  message_t next;
+  if (!dequeueMessage(next))
   {
     return false;
   }
-  // int test = sizeof(message_header_t)
-  // messageQueue[queueHead] = message;
-  memcpy(&messageQueue[queueHead], &message, sizeof(message_t));
-  queueHead = (queueHead + 1) % QUEUE_SIZE;
+  memcpy(message, &next, MESSAGE_LENGTH);
   return true;
 }
 
-bool dequeueMessage(message_t &message)
+// Compact frames, requested by the host with SERIAL_STREAM_FLAG_COMPACT
+static_assert(DATA == BATCH_CODEC_TYPE_DATA, "batch codec must know which messages carry OutputData");
+static_assert(MESSAGE_LENGTH == BATCH_CODEC_MESSAGE_SIZE && offsetof(message_t, data.accelerometerData) == BATCH_CODEC_OFFSET_ANGLES &&
+                  offsetof(message_t, data.bleData) == BATCH_CODEC_OFFSET_BLE && offsetof(message_t, data.audioBands) == BATCH_CODEC_OFFSET_BANDS,
+              "batchCodecFromMessage() must read the message_t layout");
+static size_t streamEncode(const uint8_t *message, bool first, uint8_t *out, size_t capacity)
 {
-  if (isQueueEmpty())
+  batch_codec_record_t record;
+  batchCodecFromMessage(message, record);
+  if (first)
   {
-    return false;
+    batchEncoder.begin();
   }
-  message = messageQueue[queueTail];
-  queueTail = (queueTail + 1) % QUEUE_SIZE;
-  return true;
+  return batchEncoder.encode(record, out, capacity);
 }
 
-uint16_t checksumCalculator(uint8_t *data, uint16_t length)
+static void serialTask(void *pvParameter);
+
+bool serialSetup()
 {
-  uint16_t crc = 0xFFFF;        // Initial value
-  uint16_t polynomial = 0x1021; // Polynomial used in CRC-16-CCITT
+  serial_stream_config_t config = {
+      .write = streamWrite,
+      .millis = streamMillis,
+      .dequeue = streamDequeue,
+      .message_size = MESSAGE_LENGTH,
+      .batch_size = SERIAL_STREAM_BATCH_SIZE,
+      .window = SERIAL_STREAM_WINDOW,
+      .retransmit_timeout = SERIAL_STREAM_RETRANSMIT_TIMEOUT,
+      .encode = streamEncode,
+      .max_encoded_size = BATCH_CODEC_MAX_RECORD_SIZE};
+  if (!messageQueue.init(SERIAL_QUEUE_SIZE, SERIAL_QUEUE_SPIRAM) || !streamSender.init(config))
+  {
+    return false;
+  }
+  spoolReady = spool.init(SERIAL_SPOOL_PARTITION) == ESP_OK && spillQueue.init(SERIAL_SPILL_QUEUE_SIZE);
+  spoolHighThreshold = messageQueue.capacity() * SERIAL_SPOOL_HIGH_WATERMARK / 100;
+  spoolLowThreshold = messageQueue.capacity() * SERIAL_SPOOL_LOW_WATERMARK / 100;
+  spilled = spoolReady ? spool.pending() : 0; // Left over from before a reboot, goes out first
 
-  for (uint16_t i = 0; i < length; i++)
+  uart_config_t uart_config = {
+      .baud_rate = SERIAL_BAUD_RATE,
+      .data_bits = UART_DATA_8_BITS,
+      .parity = UART_PARITY_DISABLE,
+      .stop_bits = UART_STOP_BITS_1,
+      .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+      .rx_flow_ctrl_thresh = 0,
+      .source_clk = UART_SCLK_APB};
+  if (uart_driver_install(SERIAL_UART, SERIAL_RX_BUFFER_SIZE, SERIAL_TX_BUFFER_SIZE, SERIAL_EVENT_QUEUE_SIZE, &uartQueue, 0) != ESP_OK ||
+      uart_param_config(SERIAL_UART, &uart_config) != ESP_OK ||
+      uart_set_pin(SERIAL_UART, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK)
   {
-    crc ^= (data[i] << 8); // XOR the highest byte with the data byte
+    return false;
+  }
+  uart_flush_input(SERIAL_UART);
+
+  // Send ready byte to indicate ESP32 is ready for communication
+  const uint8_t ready = 0x01;
+  streamWrite(&ready, 1);
 
-    for (uint8_t bit = 0; bit < 8; bit++)
+  return xTaskCreatePinnedToCore(
+             serialTask,             // Function to run
+             "serialTask",           // Name of the task
+             SERIAL_TASK_STACK_SIZE, // Stack size in bytes
+             NULL,                   // Parameter
+             SERIAL_TASK_PRIORITY,   // Priority
+             &serialTaskHandle,      // Task handle
+             0                       // Core to run the task on (0 or 1)
+             ) == pdPASS;
+}
+
+bool enqueueMessage(const message_t &message)
+{
+  if (spoolReady)
+  {
+    // Hysteresis, a queue hovering around one level would otherwise switch between RAM and flash with every message
+    uint32_t size = messageQueue.size();
+    if (!spilling && size >= spoolHighThreshold)
     {
-      if (crc & 0x8000)
-      {
-        crc = (crc << 1) ^ polynomial;
-      }
-      else
+      spilling = true;
+    }
+    else if (spilling && size <= spoolLowThreshold)
+    {
+      spilling = false;
+    }
+    if (spilling)
+    {
+      if (!spillQueue.push(message))
       {
-        crc <<= 1;
+        return false;
       }
+      spilled.fetch_add(1, std::memory_order_relaxed);
+      return true;
     }
   }
-
-  return crc;
+  serial_queued_t entry;
+  entry.spilled = spilled.load(std::memory_order_relaxed);
+  entry.message = message;
+  return messageQueue.push(entry);
 }
 
-void processSerial()
+bool enqueueReceived(const uint8_t *mac_addr, const message_t &message)
 {
-  static uint8_t resendCount = 0;
-  uint8_t messages[MESSAGE_LENGTH * BATCH_SIZE];
-  bool send = false;
-  unsigned long commandStartTime = millis();
+  // A retry whose delivery confirmation got lost carries the same sequence number, keep it off the link
+  uint8_t slot = 0;
+  if (!sourceTracker.accept(mac_addr, message.message_header.seq, &slot))
+  {
+    return true;
+  }
+  // Every node sends id 0, the source's slot tells the host (and the per-node deltas of compact frames) which one it was
+  message_t stamped = message;
+  stamped.message_header.id = slot;
+  return enqueueMessage(stamped);
+}
 
-  // Retry mechanism for receiving the start byte
-  int retryAttempts = 3;
-  while (retryAttempts > 0)
+// Oldest spilled message: whatever is in flash, then what is still waiting in spillQueue
+static bool popSpilled(message_t &message)
+{
+  for (;;)
   {
-    // Wait for the start byte
-    while (millis() - commandStartTime < 1000)
+    uint16_t length = 0;
+    esp_err_t err = spool.pop(&message, MESSAGE_LENGTH, &length);
+    if (err == ESP_OK && length == MESSAGE_LENGTH)
     {
-      if (Serial.available() > 0)
-      {
-        uint8_t command = Serial.read();
-        if (command == 0x25)
-        {
-          send = true;
-          // delay(10);
-          break;
-        }
-        else if (command == 0x11)
-        {
-          // uint64_t currentTime = micros();
-          uint8_t buffer[8];
-          Serial.readBytes(buffer, 8);
-          uint32_t firstValue = *reinterpret_cast<uint32_t *>(buffer);
-          uint32_t secondValue = *reinterpret_cast<uint32_t *>(buffer + 4);
-          rtc.setTime(firstValue, secondValue);
-          timeIsSynced = true;
-          // read rest of the data from serial port
-          //  Serial.write((uint8_t *)&currentTime, 8);
-          Serial.write(0x07);
-          delay(10);
-        }
-      }
+      return true;
     }
-
-    if (send)
+    if (err == ESP_ERR_NOT_FOUND || err == ESP_FAIL)
     {
       break;
     }
-    else
+  }
+  return spillQueue.pop(message);
+}
+
+bool dequeueMessage(message_t &message)
+{
+  const serial_queued_t *next = messageQueue.peek();
+  if (next != NULL && (int32_t)(next->spilled - spillDelivered) <= 0)
+  {
+    message = next->message;
+    messageQueue.release();
+    return true;
+  }
+  if (spoolReady && popSpilled(message))
+  {
+    ++spillDelivered;
+    return true;
+  }
+  if (next == NULL)
+  {
+    return false;
+  }
+  // Spilled messages that never made it (spool full, torn record) must not hold back the RAM queue
+  spillDelivered = next->spilled;
+  message = next->message;
+  messageQueue.release();
+  return true;
+}
+
+// Runs on serialTask, so the event task never waits for a flash write or a sector erase
+static void spillToFlash()
+{
+  message_t message;
+  while (spoolReady && spillQueue.pop(message))
+  {
+    spool.append(&message, MESSAGE_LENGTH); // A full spool counts the message in its dropped stat.
+  }
+}
+
+void getSerialQueueStats(serial_queue_stats_t &stats)
+{
+  stats.capacity = messageQueue.capacity();
+  stats.queued = messageQueue.size();
+  stats.pushed = messageQueue.pushed();
+  stats.dropped = messageQueue.dropped();
+  stats.high_watermark = messageQueue.highWatermark();
+  stats.spilled = spilled;
+  stats.spool_dropped = spoolReady ? spool.stats().dropped + spillQueue.dropped() : 0;
+  stats.spooling = spilling;
+}
+
+uint8_t getSerialSourceStats(sequence_tracker_source_t *stats, uint8_t max)
+{
+  return sourceTracker.sources(stats, max);
+}
+
+void getSerialLinkStats(serial_link_stats_t &stats)
+{
+  stats.baud_rate = SERIAL_BAUD_RATE;
+  stats.bytes_written = linkBytes;
+  stats.write_time_us = linkWriteTime;
+  stats.write_us_per_kb = linkBytes == 0 ? 0 : (uint32_t)(linkWriteTime * 1024 / linkBytes);
+}
+
+static void sendBatch()
+{
+  // A poll while the previous batch is unacknowledged means the host missed it, resend it a limited number of times
+  if (batchLength == 0 || resendCount >= BATCH_MAX_RESENDS)
+  {
+    resendCount = 0;
+    batchLength = 0;
+    uint8_t batchCount = 0;
+    while (batchCount < BATCH_SIZE && streamDequeue(&batch[BATCH_HEADER_SIZE + batchLength]))
+    {
+      batchLength += MESSAGE_LENGTH;
+      batchCount++;
+    }
+  }
+  else
+  {
+    resendCount++;
+  }
+  if (batchLength == 0)
+  {
+    return;
+  }
+
+  uint16_t crc = crc16_ccitt(&batch[BATCH_HEADER_SIZE], batchLength);
+  batch[0] = (uint8_t)batchLength;
+  batch[1] = (uint8_t)(batchLength >> 8);
+  batch[2] = (uint8_t)crc;
+  batch[3] = (uint8_t)(crc >> 8);
+  streamWrite(batch, BATCH_HEADER_SIZE + batchLength);
+}
+
+static void reportSources()
+{
+  // Only sources whose loss or duplicate count changed since the last report, the host logs them as node reports
+  static uint32_t lastReport = 0;
+  static sequence_tracker_source_t reported[SEQUENCE_TRACKER_MAX_SOURCES] = {};
+  if (!streamSender.isActive() || millis() - lastReport < SERIAL_SOURCE_REPORT_INTERVAL)
+  {
+    return;
+  }
+  lastReport = millis();
+  sequence_tracker_source_t sources[SEQUENCE_TRACKER_MAX_SOURCES];
+  uint8_t count = sourceTracker.sources(sources, SEQUENCE_TRACKER_MAX_SOURCES);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    const sequence_tracker_source_t &source = sources[i];
+    sequence_tracker_source_t &last = reported[i];
+    if (memcmp(last.mac_addr, source.mac_addr, sizeof(source.mac_addr)) == 0 && last.lost == source.lost &&
+        last.duplicates == source.duplicates && last.restarts == source.restarts)
     {
-      retryAttempts--;
-      delay(200);
+      continue;
     }
+    last = source;
+    char line[SERIAL_FRAME_MAX_TEXT];
+    snprintf(line, sizeof(line), "source " MACSTR " seq=%u accepted=%u lost=%u duplicates=%u reordered=%u restarts=%u",
+             MAC2STR(source.mac_addr), source.last_seq, source.accepted, source.lost, source.duplicates, source.reordered, source.restarts);
+    streamSender.sendText(line);
   }
+}
 
-  if (!send)
+static void reportLink()
+{
+  // Bytes and write time since the last report, and the share of the line's bit rate they took (8N1: 10 bits per byte)
+  static uint32_t lastReport = 0;
+  static serial_link_stats_t last = {};
+  uint32_t now = millis();
+  if (!streamSender.isActive() || now - lastReport < SERIAL_LINK_REPORT_INTERVAL)
   {
     return;
   }
+  serial_link_stats_t stats;
+  getSerialLinkStats(stats);
+  uint32_t bytes = stats.bytes_written - last.bytes_written;
+  uint32_t writeTime = (uint32_t)(stats.write_time_us - last.write_time_us);
+  uint32_t load = (uint32_t)((uint64_t)bytes * 10 * 1000 * 100 / ((uint64_t)stats.baud_rate * (now - lastReport)));
+  lastReport = now;
+  last = stats;
+  char line[SERIAL_FRAME_MAX_TEXT];
+  snprintf(line, sizeof(line), "link baud=%u bytes=%u load=%u%% write_us=%u write_us_per_kb=%u (uart_write_bytes only, not the TX ISR)",
+           stats.baud_rate, bytes, load, writeTime, bytes == 0 ? 0 : (uint32_t)((uint64_t)writeTime * 1024 / bytes));
+  streamSender.sendText(line);
+}
 
-  // Prepare batch of messages to send
-  uint16_t length = 0;
-  uint8_t batchCount = 0;
-  while (batchCount < BATCH_SIZE && dequeueMessage(*reinterpret_cast<message_t *>(&messages[length])))
+static void reportStages()
+{
+#ifdef ZH_NETWORK_TRACE
+  static uint32_t lastReport = 0;
+  if (!streamSender.isActive() || millis() - lastReport < SERIAL_STAGE_REPORT_INTERVAL)
+  {
+    return;
+  }
+  lastReport = millis();
+  for (uint8_t stage = 0; stage < ZH_NETWORK_STAGE_MAX; stage++)
+  {
+    zh_network_stage_stats_t stats;
+    if (zh_network_get_stage_stats((zh_network_stage_t)stage, &stats) != ESP_OK || stats.count == 0)
+    {
+      continue;
+    }
+    char line[SERIAL_FRAME_MAX_TEXT];
+    snprintf(line, sizeof(line), "stage %s n=%u mean=%u p50=%u p90=%u p99=%u max=%u us", zh_network_stage_name((zh_network_stage_t)stage),
+             stats.count, stats.mean, stats.p50, stats.p90, stats.p99, stats.max);
+    streamSender.sendText(line);
+  }
+#endif
+}
+
+static void handleCommand(const serial_command_t &command)
+{
+  switch (command.type)
   {
-    length += MESSAGE_LENGTH;
-    batchCount++;
+  case SERIAL_COMMAND_POLL:
+    sendBatch();
+    break;
+  case SERIAL_COMMAND_ACK:
+    batchLength = 0;
+    resendCount = 0;
+    break;
+  case SERIAL_COMMAND_TIME_SET:
+  {
+    rtc.setTime(command.seconds, command.microseconds);
+    timeIsSynced = true;
+    const uint8_t ack = SERIAL_CMD_ACK;
+    streamWrite(&ack, 1);
+    break;
   }
+  case SERIAL_COMMAND_STREAM_START:
+    streamSender.start(command.window, command.compact);
+    break;
+  case SERIAL_COMMAND_STREAM_ACK:
+    streamSender.onAck(command.seq);
+    break;
+  case SERIAL_COMMAND_STREAM_NACK:
+    streamSender.onNack(command.seq);
+    break;
+  case SERIAL_COMMAND_STREAM_STOP:
+    streamSender.stop();
+    break;
+  default:
+    break;
+  }
+}
 
-  if (batchCount > 0)
+static void serialTask(void *pvParameter)
+{
+  uart_event_t event;
+  uint8_t buffer[128];
+  while (true)
   {
-    uint16_t crc = checksumCalculator(messages, length);
-    Serial.write((uint8_t)length);
-    Serial.write((uint8_t)length >> 8);
-    Serial.write((uint8_t *)&crc, 2);
-    Serial.write(messages, length);
+    // Only wake up periodically while streaming or to move spilled messages to flash, v1 is driven by host polls alone
+    TickType_t wait = streamSender.isActive() ? pdMS_TO_TICKS(SERIAL_STREAM_TICK) : (spoolReady ? pdMS_TO_TICKS(SERIAL_SPILL_TICK) : portMAX_DELAY);
 
-    // Wait for acknowledgment with a longer timeout and non-blocking delay
-    unsigned long startTime = millis();
-    bool ackReceived = false;
-    while (millis() - startTime < 1000)
+    if (xQueueReceive(uartQueue, &event, wait) == pdTRUE)
     {
-      if (Serial.available() > 0)
+      switch (event.type)
+      {
+      case UART_DATA:
       {
-        uint8_t response = Serial.read();
-        if (response == 0x07)
+        size_t remaining = event.size;
+        while (remaining > 0)
         {
-          ackReceived = true;
-          resendCount = 0;
-          // Serial.write(0x06);
-          delay(10);
-          break;
+          int length = uart_read_bytes(SERIAL_UART, buffer, remaining < sizeof(buffer) ? remaining : sizeof(buffer), 0);
+          if (length <= 0)
+          {
+            break;
+          }
+          remaining -= length;
+          uint32_t now = millis();
+          for (int i = 0; i < length; i++)
+          {
+            serial_command_t command;
+            if (commandParser.feed(buffer[i], now, command))
+            {
+              handleCommand(command);
+            }
+          }
         }
+        break;
       }
-      delay(10);
-    }
-    if (!ackReceived)
-    {
-      resendCount++;
-      if (resendCount >= 3)
+      case UART_FIFO_OVF:
+      case UART_BUFFER_FULL:
       {
-        resendCount = 0;
+        // Input is lost anyway, start over from a clean state
+        uart_flush_input(SERIAL_UART);
+        xQueueReset(uartQueue);
+        commandParser.reset();
+        break;
+      }
+      default:
+        break;
       }
     }
+
+    reportSources();
+    reportLink();
+    reportStages();
+    streamSender.pump();
+    spillToFlash();
   }
-  else
-  {
-    resendCount = 0;
-  }
-}
\ No newline at end of file
+}
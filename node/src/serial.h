@@ -2,6 +2,7 @@
 #define SERIAL_H
 #include <Arduino.h>
 #include "zh_network.h"
+#include "sequence_tracker.h"
 // typedef struct
 // {
 //   uint32_t value1;
@@ -9,11 +10,34 @@
 //   uint32_t value3;
 // } message_type1_t;
 
-bool enqueueMessage(const message_t &message);
+typedef struct
+{
+  uint32_t capacity;       // Number of slots in the queue.
+  uint32_t queued;         // Messages currently waiting to be sent to the host.
+  uint32_t pushed;         // Messages accepted since boot.
+  uint32_t dropped;        // Messages lost because the queue was full.
+  uint32_t high_watermark; // Maximum fill level since boot.
+  uint32_t spilled;        // Messages diverted to the flash spool since boot, including those left from before it.
+  uint32_t spool_dropped;  // Spilled messages lost because the spill queue or the flash spool was full.
+  bool spooling;           // New messages currently go to the flash spool, until the queue is down to the low-watermark.
+} serial_queue_stats_t;
+
+typedef struct
+{
+  uint32_t baud_rate;
+  uint32_t bytes_written;   // Bytes handed to the UART driver since boot.
+  uint64_t write_time_us;   // Time spent in uart_write_bytes() copying them into the TX ring buffer (or waiting for room), not the TX ISR.
+  uint32_t write_us_per_kb; // write_time_us per 1024 bytes, the cost of the link for the writing task.
+} serial_link_stats_t;
 
-uint16_t checksumCalculator(uint8_t *data, uint16_t length);
-void processSerial();
+bool serialSetup(); // Installs the UART driver and starts the serial task that answers the host.
+
+bool enqueueMessage(const message_t &message);
+bool enqueueReceived(const uint8_t *mac_addr, const message_t &message); // Drops duplicates by the source's sequence number, stamps its SequenceTracker slot into header.id, then enqueueMessage().
 
 bool dequeueMessage(message_t &message);
+void getSerialQueueStats(serial_queue_stats_t &stats);
+void getSerialLinkStats(serial_link_stats_t &stats); // Reported to the host as a v2 text frame every SERIAL_LINK_REPORT_INTERVAL.
+uint8_t getSerialSourceStats(sequence_tracker_source_t *stats, uint8_t max); // Returns the number of sources copied.
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef HARNESS_H
+#define HARNESS_H
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct // Byte-for-byte layout of the ESP32 message_t carrying OutputData (4 byte enum and unsigned long).
+{
+  uint32_t type;
+  uint8_t id;
+  uint8_t padding;
+  uint16_t seq;
+  uint32_t timestamp;
+  uint32_t timestamp_us;
+  uint16_t avg_db;
+  uint16_t peak_frequency;
+  uint16_t zero_crossings;
+  uint16_t padding2;
+  float roll;
+  float pitch;
+  float yaw;
+  uint8_t ble[20];
+  uint8_t band_mode;
+  uint8_t band_count;
+  uint8_t bands[22];
+} harness_message_t;
+
+static_assert(sizeof(harness_message_t) == 80, "must match sizeof(message_t) on the ESP32");
+
+#define HARNESS_TYPE_DATA 5
+#define HARNESS_EPOCH 1700000000
+
+// Every generated message carries its running number in the timestamp, so the host peer can check
+// order, loss and duplicates on the decoded message alone.
+static inline void harness_number_to_time(uint64_t number, uint32_t &timestamp, uint32_t &timestamp_us)
+{
+  timestamp = HARNESS_EPOCH + (uint32_t)(number / 1000);
+  timestamp_us = (uint32_t)(number % 1000) * 1000;
+}
+
+static inline uint64_t harness_time_to_number(uint32_t timestamp, uint32_t timestamp_us)
+{
+  return (uint64_t)(timestamp - HARNESS_EPOCH) * 1000 + timestamp_us / 1000;
+}
+
+uint32_t harness_millis();
+uint64_t harness_micros();
+
+#endif
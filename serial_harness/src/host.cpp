@@ -0,0 +1,239 @@
+#include "host.h"
+#include "serial_protocol.h"
+#include "batch_codec.h"
+#include "crc16.h"
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+HostPeer::HostPeer(int fd, ImpairedLink &link, const host_config_t &config)
+    : _fd(fd), _link(link), _config(config)
+{
+}
+
+HostPeer::~HostPeer()
+{
+  stop();
+}
+
+void HostPeer::start()
+{
+  _running = true;
+  _thread = std::thread(&HostPeer::_run, this);
+}
+
+void HostPeer::stop()
+{
+  if (!_running)
+  {
+    return;
+  }
+  _running = false;
+  _thread.join();
+}
+
+host_stats_t HostPeer::stats()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+void HostPeer::_send(uint8_t command, uint16_t seq)
+{
+  const uint8_t bytes[3] = {command, (uint8_t)seq, (uint8_t)(seq >> 8)};
+  _link.write(bytes, sizeof(bytes));
+}
+
+void HostPeer::_startStream()
+{
+  uint8_t argument = _config.window | (_config.compact ? SERIAL_STREAM_FLAG_COMPACT : 0);
+  const uint8_t bytes[2] = {SERIAL_CMD_STREAM_START, argument};
+  _link.write(bytes, sizeof(bytes));
+  _synced = false;
+  _last_frame = harness_millis();
+}
+
+void HostPeer::_nack()
+{
+  uint32_t now = harness_millis();
+  if (now - _last_nack < _config.nack_holdoff)
+  {
+    return;
+  }
+  _last_nack = now;
+  _send(SERIAL_CMD_STREAM_NACK, _expected);
+}
+
+void HostPeer::_run()
+{
+  uint8_t chunk[4096];
+  _startStream();
+  while (_running)
+  {
+    struct pollfd descriptor = {.fd = _fd, .events = POLLIN, .revents = 0};
+    if (poll(&descriptor, 1, 10) > 0 && (descriptor.revents & POLLIN))
+    {
+      ssize_t length = read(_fd, chunk, sizeof(chunk));
+      if (length > 0)
+      {
+        _buffer.insert(_buffer.end(), chunk, chunk + length);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _parse();
+      }
+    }
+    if (harness_millis() - _last_frame > _config.idle_timeout)
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stats.restarts++;
+      _startStream();
+    }
+  }
+}
+
+// The header has no check of its own. One that no root can send is dropped on the spot, otherwise a flipped bit in
+// length would hold the parser for up to 64 kB before the CRC fails
+bool HostPeer::_plausible(const uint8_t *frame) const
+{
+  uint8_t count = frame[3];
+  uint16_t length = frame[6] | (frame[7] << 8);
+  switch (frame[2])
+  {
+  case SERIAL_FRAME_DATA:
+    return count > 0 && count <= _config.batch_size && length == count * sizeof(harness_message_t);
+  case SERIAL_FRAME_DATA_COMPACT:
+    // Compact frames fill the payload of a raw one with as many records as fit, count is not bounded by batch_size
+    return count > 0 && length <= _config.batch_size * sizeof(harness_message_t) &&
+           length >= count * BATCH_CODEC_MIN_RECORD_SIZE;
+  case SERIAL_FRAME_TEXT:
+    return count == 0 && length <= SERIAL_FRAME_MAX_TEXT;
+  default:
+    return false;
+  }
+}
+
+void HostPeer::_parse()
+{
+  size_t offset = 0;
+  while (true)
+  {
+    // Resynchronise on the frame marker, anything in between is dropped
+    while (offset + 1 < _buffer.size() && !(_buffer[offset] == SERIAL_FRAME_SYNC0 && _buffer[offset + 1] == SERIAL_FRAME_SYNC1))
+    {
+      offset++;
+    }
+    if (_buffer.size() - offset < SERIAL_FRAME_HEADER_SIZE)
+    {
+      break;
+    }
+    const uint8_t *frame = _buffer.data() + offset;
+    if (!_plausible(frame))
+    {
+      offset++;
+      continue;
+    }
+    uint16_t length = frame[6] | (frame[7] << 8);
+    size_t size = SERIAL_FRAME_HEADER_SIZE + length + SERIAL_FRAME_TRAILER_SIZE;
+    if (_buffer.size() - offset < size)
+    {
+      break;
+    }
+    uint16_t crc = frame[size - 2] | (frame[size - 1] << 8);
+    if (crc16_ccitt(frame + 2, size - 4) != crc)
+    {
+      // Could also be a false marker inside a frame, skip one byte and look again. The root is still sending, a
+      // restart now would take a frame that was already on its way as the new start of the sequence
+      _stats.crc_errors++;
+      _last_frame = harness_millis();
+      offset++;
+      _nack();
+      continue;
+    }
+    offset += size;
+    _last_frame = harness_millis();
+    if (frame[2] == SERIAL_FRAME_TEXT)
+    {
+      printf("root: %.*s\n", (int)length, (const char *)frame + SERIAL_FRAME_HEADER_SIZE);
+      continue;
+    }
+    uint16_t seq = frame[4] | (frame[5] << 8);
+    if (!_synced)
+    {
+      _expected = seq;
+      _synced = true;
+    }
+    if (seq == _expected)
+    {
+      _deliver(frame + SERIAL_FRAME_HEADER_SIZE, length, frame[2], frame[3]);
+      _stats.frames++;
+      _stats.bytes += size;
+      _expected++;
+      _send(SERIAL_CMD_STREAM_ACK, seq);
+    }
+    else if ((int16_t)(seq - _expected) > 0)
+    {
+      // Gap, everything after it is dropped until the root goes back to the missing frame
+      _stats.gaps++;
+      _nack();
+    }
+    else
+    {
+      // Retransmission of a frame we already have, the ack was probably lost
+      _send(SERIAL_CMD_STREAM_ACK, _expected - 1);
+    }
+  }
+  _buffer.erase(_buffer.begin(), _buffer.begin() + offset);
+}
+
+void HostPeer::_deliver(const uint8_t *payload, uint16_t length, uint8_t type, uint8_t count)
+{
+  if (type == SERIAL_FRAME_DATA)
+  {
+    for (uint8_t i = 0; i < count && (i + 1) * sizeof(harness_message_t) <= length; i++)
+    {
+      harness_message_t message;
+      memcpy(&message, payload + i * sizeof(harness_message_t), sizeof(message));
+      _check(message.timestamp, message.timestamp_us);
+    }
+    return;
+  }
+  if (type == SERIAL_FRAME_DATA_COMPACT)
+  {
+    BatchDecoder decoder;
+    decoder.begin();
+    size_t offset = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+      batch_codec_record_t record;
+      size_t used = decoder.decode(payload + offset, length - offset, record);
+      if (used == 0)
+      {
+        _stats.decode_errors++;
+        return;
+      }
+      offset += used;
+      _check(record.timestamp, record.timestamp_us);
+    }
+  }
+}
+
+void HostPeer::_check(uint32_t timestamp, uint32_t timestamp_us)
+{
+  uint64_t number = harness_time_to_number(timestamp, timestamp_us);
+  _stats.messages++;
+  if (!_numbered)
+  {
+    _stats.lost += number;
+    _numbered = true;
+  }
+  else if (number <= _last_number)
+  {
+    _stats.reordered++;
+    return;
+  }
+  else
+  {
+    _stats.lost += number - _last_number - 1;
+  }
+  _last_number = number;
+}
@@ -0,0 +1,73 @@
+#ifndef HOST_H
+#define HOST_H
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "harness.h"
+#include "link.h"
+
+typedef struct
+{
+  uint8_t window;
+  bool compact;
+  uint8_t batch_size;    // The root's messages per raw frame, bounds the frame headers that are accepted.
+  uint32_t idle_timeout; // Restart the stream when nothing arrives for this long (in milliseconds).
+  uint32_t nack_holdoff; // Minimum time between two NACKs (in milliseconds).
+} host_config_t;
+
+typedef struct
+{
+  uint64_t frames;
+  uint64_t messages;
+  uint64_t bytes;     // Bytes of accepted frames.
+  uint64_t gaps;      // Frames that arrived ahead of the expected one.
+  uint64_t crc_errors;
+  uint64_t restarts;  // Stream restarts after an idle timeout.
+  uint64_t lost;      // Message numbers skipped, matches the root's queue drops once the link is drained.
+  uint64_t reordered; // Message numbers at or below the previous one, must stay 0.
+  uint64_t decode_errors;
+} host_stats_t;
+
+/**
+ * @brief C++ port of the data_ingress v2 receiver (stream.go): resynchronises on the frame marker, checks the
+ * CRC, acks in-order frames cumulatively and NACKs gaps and corrupted frames.
+ */
+class HostPeer
+{
+public:
+  HostPeer(int fd, ImpairedLink &link, const host_config_t &config);
+  ~HostPeer();
+
+  void start();
+  void stop();
+  host_stats_t stats();
+
+private:
+  void _run();
+  void _startStream();
+  void _send(uint8_t command, uint16_t seq);
+  void _nack();
+  bool _plausible(const uint8_t *frame) const;
+  void _parse();
+  void _deliver(const uint8_t *payload, uint16_t length, uint8_t type, uint8_t count);
+  void _check(uint32_t timestamp, uint32_t timestamp_us);
+
+  int _fd;
+  ImpairedLink &_link;
+  host_config_t _config;
+  std::vector<uint8_t> _buffer;
+  uint16_t _expected = 0;
+  bool _synced = false;
+  bool _numbered = false;
+  uint64_t _last_number = 0;
+  uint32_t _last_frame = 0;
+  uint32_t _last_nack = 0;
+  host_stats_t _stats = {};
+  std::mutex _mutex;
+  std::atomic<bool> _running{false};
+  std::thread _thread;
+};
+
+#endif
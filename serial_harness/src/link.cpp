@@ -0,0 +1,100 @@
+#include "link.h"
+#include "harness.h"
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+ImpairedLink::ImpairedLink(int fd, const link_config_t &config)
+    : _fd(fd), _config(config), _random(config.seed)
+{
+  _byte_time_us = config.baud_rate == 0 ? 0.0 : 10.0 * 1000000.0 / config.baud_rate;
+  _thread = std::thread(&ImpairedLink::_run, this);
+}
+
+ImpairedLink::~ImpairedLink()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _running = false;
+  }
+  _wake.notify_all();
+  _space.notify_all();
+  _thread.join();
+}
+
+size_t ImpairedLink::write(const uint8_t *data, size_t length)
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  for (size_t i = 0; i < length; i++)
+  {
+    if (_config.tx_buffer > 0 && _pending.size() >= _config.tx_buffer)
+    {
+      _wake.notify_one();
+      _space.wait(lock, [this] { return _pending.size() < _config.tx_buffer || !_running; });
+    }
+    double now = (double)harness_micros();
+    // The line is busy until the previous byte is out, the latency is on top of that
+    _last_due = std::max(_last_due + _byte_time_us, now);
+    _stats.bytes++;
+    if (_uniform(_random) < _config.drop_rate)
+    {
+      _stats.dropped++;
+      continue;
+    }
+    uint8_t byte = data[i];
+    if (_uniform(_random) < _config.corrupt_rate)
+    {
+      byte ^= 1 << (_random() % 8);
+      _stats.corrupted++;
+    }
+    _pending.push_back({(uint64_t)_last_due + _config.latency_us, byte});
+  }
+  _wake.notify_one();
+  return length;
+}
+
+link_stats_t ImpairedLink::stats()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _stats;
+}
+
+void ImpairedLink::_run()
+{
+  std::vector<uint8_t> out;
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (_running)
+  {
+    if (_pending.empty())
+    {
+      _wake.wait(lock);
+      continue;
+    }
+    uint64_t now = harness_micros();
+    if (_pending.front().due > now)
+    {
+      _wake.wait_for(lock, std::chrono::microseconds(std::min<uint64_t>(_pending.front().due - now, 1000)));
+      continue;
+    }
+    out.clear();
+    while (!_pending.empty() && _pending.front().due <= now)
+    {
+      out.push_back(_pending.front().byte);
+      _pending.pop_front();
+    }
+    _space.notify_all();
+    lock.unlock();
+    size_t written = 0;
+    while (written < out.size() && _running)
+    {
+      ssize_t result = ::write(_fd, out.data() + written, out.size() - written);
+      if (result <= 0)
+      {
+        usleep(100);
+        continue;
+      }
+      written += result;
+    }
+    lock.lock();
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef LINK_H
+#define LINK_H
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+
+typedef struct // Impairments of one direction of the link.
+{
+  uint32_t baud_rate;   // Bytes are paced at 10 bits per byte, 0 for no pacing.
+  uint32_t latency_us;  // Added to every byte on top of the pacing.
+  double corrupt_rate;  // Probability that a byte gets one bit flipped.
+  double drop_rate;     // Probability that a byte is lost.
+  uint32_t seed;
+  uint32_t tx_buffer;   // Bytes that may wait for the line before write() blocks, like the UART driver's TX ring buffer.
+} link_config_t;
+
+typedef struct
+{
+  uint64_t bytes;
+  uint64_t corrupted;
+  uint64_t dropped;
+} link_stats_t;
+
+/**
+ * @brief Writer side of one direction of the pty pair. Bytes are delayed, paced to the baud rate, corrupted
+ * or dropped and then written to the file descriptor by a background thread, like a UART TX buffer.
+ */
+class ImpairedLink
+{
+public:
+  ImpairedLink(int fd, const link_config_t &config);
+  ~ImpairedLink();
+
+  size_t write(const uint8_t *data, size_t length);
+  link_stats_t stats();
+
+private:
+  void _run();
+
+  typedef struct
+  {
+    uint64_t due;
+    uint8_t byte;
+  } _pending_t;
+
+  int _fd;
+  link_config_t _config;
+  double _byte_time_us;
+  double _last_due = 0;
+  link_stats_t _stats = {};
+  std::mt19937 _random;
+  std::uniform_real_distribution<double> _uniform{0.0, 1.0};
+  std::deque<_pending_t> _pending;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _space;
+  std::atomic<bool> _running{true};
+  std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include "root.h"
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+RootSide *RootSide::_instance = NULL;
+
+RootSide::RootSide(int fd, ImpairedLink &link, const root_config_t &config)
+    : _fd(fd), _link(link), _config(config)
+{
+  _instance = this;
+  _messages.init(config.queue_size);
+  serial_stream_config_t stream_config = {
+      .write = _write,
+      .millis = _millis,
+      .dequeue = _dequeue,
+      .message_size = sizeof(harness_message_t),
+      .batch_size = config.batch_size,
+      .window = config.window,
+      .retransmit_timeout = config.retransmit_timeout,
+      .encode = _encode,
+      .max_encoded_size = BATCH_CODEC_MAX_RECORD_SIZE,
+      .acked = _acked};
+  _sender.init(stream_config);
+}
+
+RootSide::~RootSide()
+{
+  stop();
+  _instance = NULL;
+}
+
+void RootSide::start()
+{
+  _running = true;
+  _generating = true;
+  const uint8_t ready = 0x01;
+  _write(&ready, 1);
+  _generator = std::thread(&RootSide::_generate, this);
+  _server = std::thread(&RootSide::_serve, this);
+}
+
+void RootSide::stopGenerator()
+{
+  if (!_generating)
+  {
+    return;
+  }
+  _generating = false;
+  _generator.join();
+}
+
+void RootSide::stop()
+{
+  if (!_running)
+  {
+    return;
+  }
+  stopGenerator();
+  _running = false;
+  _server.join();
+}
+
+uint16_t RootSide::inFlight()
+{
+  std::lock_guard<std::mutex> lock(_stats_mutex);
+  return _in_flight;
+}
+
+serial_stream_stats_t RootSide::senderStats()
+{
+  std::lock_guard<std::mutex> lock(_stats_mutex);
+  return _sender_stats;
+}
+
+LatencyHistogram RootSide::takeAckLatency()
+{
+  std::lock_guard<std::mutex> lock(_stats_mutex);
+  LatencyHistogram latency = _ack_latency;
+  _ack_latency.reset();
+  return latency;
+}
+
+size_t RootSide::_write(const uint8_t *data, size_t length)
+{
+  return _instance->_link.write(data, length);
+}
+
+uint32_t RootSide::_millis()
+{
+  return harness_millis();
+}
+
+bool RootSide::_dequeue(uint8_t *message)
+{
+  harness_message_t next;
+  if (!_instance->_messages.pop(next))
+  {
+    return false;
+  }
+  memcpy(message, &next, sizeof(next));
+  return true;
+}
+
+size_t RootSide::_encode(const uint8_t *message, bool first, uint8_t *out, size_t capacity)
+{
+  batch_codec_record_t record;
+  batchCodecFromMessage(message, record);
+  if (first)
+  {
+    _instance->_encoder.begin();
+  }
+  return _instance->_encoder.encode(record, out, capacity);
+}
+
+void RootSide::_acked(uint8_t count, uint32_t latency)
+{
+  (void)count;
+  std::lock_guard<std::mutex> lock(_instance->_stats_mutex);
+  _instance->_ack_latency.record(latency);
+}
+
+// Offers messages at the configured rate, like zh_network's event task calling enqueueMessage()
+void RootSide::_generate()
+{
+  uint64_t number = 0;
+  uint64_t start = harness_micros();
+  harness_message_t message;
+  memset(&message, 0, sizeof(message));
+  message.type = HARNESS_TYPE_DATA;
+  while (_generating)
+  {
+    uint64_t due = (harness_micros() - start) * _config.rate / 1000000;
+    while (number < due)
+    {
+      message.id = 1 + number % _config.nodes;
+      harness_number_to_time(number, message.timestamp, message.timestamp_us);
+      message.avg_db = 50 + number % 20;
+      message.peak_frequency = 1000 + number % 500;
+      message.zero_crossings = message.peak_frequency / 8;
+      message.roll = (float)(number % 600) / 10.0f - 30.0f;
+      message.pitch = -message.roll / 2;
+      message.yaw = (float)(number % 3600) / 10.0f;
+      message.ble[0] = 100 + message.id;
+      message.ble[1] = 60 + number % 30;
+      // Every other node sends band levels, so compact frames mix both record lengths
+      message.band_mode = message.id % 2;
+      message.band_count = message.band_mode ? 3 + number % 20 : 0;
+      for (uint8_t i = 0; i < message.band_count; i++)
+      {
+        message.bands[i] = 100 + (number + i) % 60;
+      }
+      _messages.push(message);
+      number++;
+      _offered++;
+    }
+    usleep(1000);
+  }
+}
+
+// serialTask: feed received bytes to the parser, then let the sender push frames
+void RootSide::_serve()
+{
+  uint8_t buffer[128];
+  while (_running)
+  {
+    struct pollfd descriptor = {.fd = _fd, .events = POLLIN, .revents = 0};
+    if (poll(&descriptor, 1, 5) > 0 && (descriptor.revents & POLLIN))
+    {
+      ssize_t length = read(_fd, buffer, sizeof(buffer));
+      uint32_t now = harness_millis();
+      for (ssize_t i = 0; i < length; i++)
+      {
+        serial_command_t command;
+        if (_parser.feed(buffer[i], now, command))
+        {
+          _handle(command);
+        }
+      }
+    }
+    _sender.pump(); // Blocks while the link's TX buffer is full, like uart_write_bytes()
+    std::lock_guard<std::mutex> lock(_stats_mutex);
+    _sender_stats = _sender.stats();
+    _in_flight = _sender.inFlight();
+  }
+}
+
+void RootSide::_handle(const serial_command_t &command)
+{
+  switch (command.type)
+  {
+  case SERIAL_COMMAND_TIME_SET:
+  {
+    const uint8_t ack = SERIAL_CMD_ACK;
+    _write(&ack, 1);
+    break;
+  }
+  case SERIAL_COMMAND_STREAM_START:
+    _sender.start(command.window, command.compact);
+    break;
+  case SERIAL_COMMAND_STREAM_ACK:
+    _sender.onAck(command.seq);
+    break;
+  case SERIAL_COMMAND_STREAM_NACK:
+    _sender.onNack(command.seq);
+    break;
+  case SERIAL_COMMAND_STREAM_STOP:
+    _sender.stop();
+    break;
+  default:
+    break; // v1 polling lives in node/src/serial.cpp and is not part of the shared protocol code
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef ROOT_H
+#define ROOT_H
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "harness.h"
+#include "link.h"
+#include "spsc_ring.h"
+#include "serial_protocol.h"
+#include "batch_codec.h"
+#include "latency_histogram.h"
+
+typedef struct
+{
+  uint32_t rate;        // Messages per second offered to the queue.
+  uint8_t nodes;        // Simulated node ids, round robin.
+  uint32_t queue_size;  // Slots of the root queue, SERIAL_QUEUE_SIZE on the node.
+  uint8_t batch_size;   // SERIAL_STREAM_BATCH_SIZE on the node.
+  uint8_t window;       // SERIAL_STREAM_WINDOW on the node.
+  uint16_t retransmit_timeout;
+} root_config_t;
+
+/**
+ * @brief The root node's serial side on Linux: the same queue, sender, parser and codec as node/src/serial.cpp,
+ * fed by a generator thread instead of the mesh and talking to the pty instead of UART0.
+ */
+class RootSide
+{
+public:
+  RootSide(int fd, ImpairedLink &link, const root_config_t &config);
+  ~RootSide();
+
+  void start();
+  void stopGenerator(); // Stop offering new messages, the queue keeps draining.
+  void stop();
+
+  uint64_t offered() const { return _offered; }
+  uint64_t dropped() const { return _messages.dropped(); }
+  uint32_t queued() const { return _messages.size(); }
+  uint16_t inFlight();
+  serial_stream_stats_t senderStats();
+  LatencyHistogram takeAckLatency(); // Since the previous call.
+
+private:
+  void _generate();
+  void _serve();
+  void _handle(const serial_command_t &command);
+
+  static size_t _write(const uint8_t *data, size_t length);
+  static uint32_t _millis();
+  static bool _dequeue(uint8_t *message);
+  static size_t _encode(const uint8_t *message, bool first, uint8_t *out, size_t capacity);
+  static void _acked(uint8_t count, uint32_t latency);
+  static RootSide *_instance; // The sender's callbacks are plain function pointers.
+
+  int _fd;
+  ImpairedLink &_link;
+  root_config_t _config;
+  SpscRing<harness_message_t> _messages;
+  SerialStreamSender _sender;
+  SerialCommandParser _parser;
+  BatchEncoder _encoder;
+  std::mutex _stats_mutex; // Guards the copies below, _sender itself is only touched by the server thread.
+  LatencyHistogram _ack_latency;
+  serial_stream_stats_t _sender_stats = {};
+  uint16_t _in_flight = 0;
+  std::atomic<uint64_t> _offered{0};
+  std::atomic<bool> _running{false};
+  std::atomic<bool> _generating{false};
+  std::thread _generator;
+  std::thread _server;
+};
+
+#endif